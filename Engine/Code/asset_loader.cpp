@@ -0,0 +1,214 @@
+// asset_loader.cpp
+#include "asset_loader.h"
+#include "engine.h"
+#include "gl_error.h"
+#include "gl_extensions.h"
+#include "mesh_cache.h"
+#include "texture_compression.h"
+
+#include <filesystem>
+
+static void PushUpload(App* app, std::function<void(App*)> upload)
+{
+    AssetUpload* node = new AssetUpload();
+    node->upload = std::move(upload);
+    app->assetLoader.uploads.Push(node);
+}
+
+void InitAssetLoader(App* app)
+{
+    // The flip flag of stb_image is global, set it once before any worker decodes
+    stbi_set_flip_vertically_on_load(true);
+
+    u32 hardwareThreads = std::thread::hardware_concurrency();
+    u32 workerCount = glm::clamp<u32>(hardwareThreads > 1 ? hardwareThreads - 1 : 1, 1, ASSET_MAX_WORKERS);
+
+    app->assetLoader.jobs.Init(workerCount);
+    InitTextureStreamer(app->assetLoader.textures);
+    app->assetLoader.initialized = true;
+
+    ILOG("Asset loader started with %u workers", workerCount);
+}
+
+void ShutdownAssetLoader(App* app)
+{
+    AssetLoader& loader = app->assetLoader;
+    if (!loader.initialized) return;
+
+    loader.jobs.Shutdown();
+
+    // Uploads that never ran still own their CPU data
+    while (MPSCNode* node = loader.uploads.Pop()) {
+        delete static_cast<AssetUpload*>(node);
+    }
+    ShutdownTextureStreamer(loader.textures);
+    ShutdownMaterialTextures(app->materialTextures);
+    ShutdownTextureRegistry(app->textureRegistry);
+    loader.initialized = false;
+}
+
+#pragma region Textures
+
+static void DecodeTextureAsync(App* app, std::shared_ptr<Texture> texture)
+{
+    bool compress = app->assetLoader.compressTextures;
+
+    app->assetLoader.pendingAssets++;
+    app->assetLoader.jobs.Submit([app, texture, compress]() {
+        std::shared_ptr<CompressedImage> compressed;
+        std::shared_ptr<DecodedImage> image;
+
+        // Warm start: the block compressed mips are mapped from the cache and the image is not decoded
+        u64 sourceHash = 0;
+        std::string cachePath;
+        if (compress && HashFileContents(texture->path.c_str(), sourceHash)) {
+            cachePath = GetTextureCachePath(texture->path, sourceHash);
+            compressed = std::make_shared<CompressedImage>();
+            if (!ReadTextureCache(cachePath, sourceHash, *compressed)) {
+                compressed.reset();
+            }
+        }
+
+        // A cached BC7 is translucent unless it was only picked for the missing S3TC support
+        bool translucent = compressed && compressed->codec == TextureCodec_BC7 && GLExt.textureCompressionS3TC;
+        if (!compressed) {
+            image = std::make_shared<DecodedImage>();
+            image->pixels = stbi_load(texture->path.c_str(), &image->width, &image->height, &image->components, 0);
+            translucent = image->pixels && HasTranslucentPixels(*image);
+
+            TextureCodec codec = (image->pixels && !cachePath.empty()) ? ChooseTextureCodec(texture->name, *image) : TextureCodec_None;
+            if (codec != TextureCodec_None) {
+                compressed = std::make_shared<CompressedImage>();
+                CompressImage(*image, codec, *compressed, &app->assetLoader.jobs);
+                WriteTextureCache(cachePath, *compressed, sourceHash);
+                image.reset();
+            }
+        }
+
+        PushUpload(app, [texture, image, compressed, translucent](App* app) {
+            texture->translucent = translucent;
+
+            // Still pending until the streamer patches the id in
+            if (compressed) {
+                QueueTextureUpload(app->assetLoader.textures, texture, compressed);
+                return;
+            }
+            if (image->pixels) {
+                QueueTextureUpload(app->assetLoader.textures, texture, image);
+                return;
+            }
+
+            ELOG("Failed to load texture at path: %s", texture->path.c_str());
+            UnregisterTexture(app->textureRegistry, *texture);
+            app->assetLoader.pendingAssets--;
+        });
+    });
+}
+
+std::shared_ptr<Texture> RequestTexture(App* app, const std::string& fullPath)
+{
+    if (std::shared_ptr<Texture> texture = FindTextureByPath(app->textureRegistry, fullPath)) {
+        return texture;
+    }
+
+    std::shared_ptr<Texture> texture = std::make_shared<Texture>();
+    texture->name = std::filesystem::path(fullPath).stem().string();
+    texture->path = fullPath;
+    RegisterTexture(app->textureRegistry, texture);
+
+    DecodeTextureAsync(app, texture);
+    return texture;
+}
+
+void ReloadTexture(App* app, std::shared_ptr<Texture> texture)
+{
+    DecodeTextureAsync(app, texture);
+}
+
+#pragma endregion
+
+#pragma region Models
+
+u32 LoadModelAsync(App* app, const std::string& path, std::function<void(App*, ModelAsset&)> onLoaded, VertexFormat vertexFormat)
+{
+    // Empty until the upload, its instance draws nothing in the meantime
+    std::shared_ptr<ModelAsset> asset = std::make_shared<ModelAsset>();
+    asset->name = std::filesystem::path(path).stem().string();
+    app->assets.push_back(asset);
+
+    u32 slot = AddModelInstance(app, asset);
+
+    app->assetLoader.pendingAssets++;
+    app->assetLoader.jobs.Submit([app, path, asset, onLoaded, vertexFormat]() {
+        std::shared_ptr<ModelImport> import = std::make_shared<ModelImport>();
+        ModelAsset::ImportModel(path, *import, vertexFormat);
+
+        PushUpload(app, [import, asset, onLoaded](App* app) {
+            if (import->valid) {
+                asset->CreateFromImport(app, *import);
+
+                if (onLoaded) {
+                    onLoaded(app, *asset);
+                }
+
+                bool selected = app->selectedModel && app->selectedModel->asset == asset;
+                if (selected && !app->selectedMaterial && !asset->materials.empty()) {
+                    app->selectedMaterial = asset->materials[0];
+                }
+            }
+            else {
+                UnmapFile(import->cacheFile);
+            }
+            app->assetLoader.pendingAssets--;
+        });
+    });
+
+    return slot;
+}
+
+u32 AddModelInstance(App* app, std::shared_ptr<ModelAsset> asset)
+{
+    // The selection is a pointer into the instances, kept across the reallocation
+    i32 selected = app->selectedModel ? (i32)(app->selectedModel - app->models.data()) : -1;
+
+    u32 slot = (u32)app->models.size();
+    app->models.emplace_back();
+    app->models.back().name = asset->name;
+    app->models.back().asset = asset;
+    AddTransform(app->transforms);
+
+    if (selected >= 0) app->selectedModel = &app->models[selected];
+    return slot;
+}
+
+#pragma endregion
+
+void ProcessAssetUploads(App* app, f32 budgetMs)
+{
+    AssetLoader& loader = app->assetLoader;
+    if (!loader.initialized) return;
+
+    f64 start = GetTimeSeconds();
+    while (MPSCNode* node = loader.uploads.Pop()) {
+        AssetUpload* upload = static_cast<AssetUpload*>(node);
+        upload->upload(app);
+        delete upload;
+
+        if ((GetTimeSeconds() - start) * 1000.0 >= budgetMs) break;
+    }
+}
+
+void WaitForAssetLoads(App* app)
+{
+    while (GetPendingAssetCount(app) > 0) {
+        ProcessAssetUploads(app, FLT_MAX);
+        UpdateTextureStreaming(app, FLT_MAX);
+        glFlush();
+        std::this_thread::yield();
+    }
+}
+
+u32 GetPendingAssetCount(const App* app)
+{
+    return app->assetLoader.pendingAssets.load();
+}
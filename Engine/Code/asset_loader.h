@@ -0,0 +1,86 @@
+// asset_loader.h
+#pragma once
+
+#include "platform.h"
+#include "job_system.h"
+#include "texture_streamer.h"
+#include "vertex_format.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+struct App;
+class ModelAsset;
+struct Texture;
+
+#define ASSET_UPLOAD_BUDGET_MS  2.0f    // Main thread time spent on GL uploads per frame
+#define ASSET_MAX_WORKERS       8
+
+/*
+ * Assets load in two stages:
+ *   CPU stage (worker threads): mesh cache read or Assimp import + mesh conversion, texture cache read
+ *                               or image decoding + BCn encoding
+ *   GL stage (main thread):     buffer and texture uploads, drained every frame within a time budget
+ * The workers hand the GL stage over through a lock-free queue. Texture pixels then go through the
+ * streamer's pixel unpack ring, so a big image never stalls a frame on its copy.
+ */
+struct AssetUpload : MPSCNode {
+    std::function<void(App*)> upload;
+};
+
+struct AssetLoader {
+    JobSystem jobs;
+    MPSCQueue uploads;
+    TextureStreamer textures;
+    std::atomic<u32> pendingAssets{ 0 };
+
+    f32 uploadBudgetMs = ASSET_UPLOAD_BUDGET_MS;
+    bool compressTextures = true;   // Encode to BCn (cached as DDS) instead of uploading the decoded pixels
+    bool initialized = false;
+};
+
+void InitAssetLoader(App* app);
+
+/**
+ * Stops the workers, drops the loads still in flight and releases the registered textures.
+ * Must run before the GL context is destroyed.
+ */
+void ShutdownAssetLoader(App* app);
+
+/**
+ * Returns the registered texture for the path, or registers a placeholder (id 0) and decodes the
+ * image on a worker. The texture id is filled once the streamed upload is resident on the GPU.
+ */
+std::shared_ptr<Texture> RequestTexture(App* app, const std::string& fullPath);
+
+/**
+ * Decodes and streams an evicted texture again, into the same Texture object.
+ */
+void ReloadTexture(App* app, std::shared_ptr<Texture> texture);
+
+/**
+ * Adds an asset to app->assets, imported on a worker, and places one instance of it in app->models,
+ * whose slot is returned. onLoaded runs on the main thread right after the upload, e.g. to bind the
+ * material textures. Models use the compact vertex format unless told otherwise.
+ */
+u32 LoadModelAsync(App* app, const std::string& path, std::function<void(App*, ModelAsset&)> onLoaded = nullptr,
+    VertexFormat vertexFormat = VertexFormat_Compact);
+
+/**
+ * Places a new instance of an asset in app->models and returns its slot. The instances may move,
+ * app->selectedModel is updated but other pointers into them are not.
+ */
+u32 AddModelInstance(App* app, std::shared_ptr<ModelAsset> asset);
+
+/**
+ * Runs the pending GL uploads until the budget is spent (at least one per call).
+ */
+void ProcessAssetUploads(App* app, f32 budgetMs);
+
+/**
+ * Blocks until every requested asset is uploaded, e.g. before a benchmark starts measuring.
+ */
+void WaitForAssetLoads(App* app);
+
+u32 GetPendingAssetCount(const App* app);
@@ -0,0 +1,239 @@
+// benchmark.cpp
+#include "benchmark.h"
+#include "engine.h"
+#include "gl_error.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+static void LogBenchmarkUsage()
+{
+    ELOG("Usage: Engine [--headless] [--frames N] [--warmup N] [--scene all|stress|<model name>]\n"
+         "              [--mode deferred|forward] [--width W] [--height H] [--output report.json]\n"
+         "              [--trace trace.json] [--record input.bin] [--replay input.bin]");
+}
+
+static bool ParseU32(const char* str, u32& value)
+{
+    char* end = NULL;
+    unsigned long parsed = strtoul(str, &end, 10);
+    if (end == str || *end != '\0') return false;
+    value = (u32)parsed;
+    return true;
+}
+
+bool ParseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--headless") == 0) {
+            options.headless = true;
+            continue;
+        }
+
+        if (!value) {
+            ELOG("Missing value for argument %s", arg);
+            LogBenchmarkUsage();
+            return false;
+        }
+
+        bool valid = true;
+        if      (strcmp(arg, "--frames") == 0)  valid = ParseU32(value, options.frames) && options.frames > 0;
+        else if (strcmp(arg, "--warmup") == 0)  valid = ParseU32(value, options.warmupFrames);
+        else if (strcmp(arg, "--width") == 0)   valid = ParseU32(value, options.width) && options.width > 0;
+        else if (strcmp(arg, "--height") == 0)  valid = ParseU32(value, options.height) && options.height > 0;
+        else if (strcmp(arg, "--scene") == 0)   options.scene = value;
+        else if (strcmp(arg, "--mode") == 0)    options.mode = value;
+        else if (strcmp(arg, "--output") == 0)  options.output = value;
+        else if (strcmp(arg, "--trace") == 0)   options.trace = value;
+        else if (strcmp(arg, "--record") == 0)  options.record = value;
+        else if (strcmp(arg, "--replay") == 0)  options.replay = value;
+        else {
+            ELOG("Unknown argument %s", arg);
+            LogBenchmarkUsage();
+            return false;
+        }
+
+        if (!valid) {
+            ELOG("Invalid value '%s' for argument %s", value, arg);
+            LogBenchmarkUsage();
+            return false;
+        }
+        ++i;
+    }
+
+    if (options.mode != "deferred" && options.mode != "forward") {
+        ELOG("Invalid render mode '%s'", options.mode.c_str());
+        LogBenchmarkUsage();
+        return false;
+    }
+
+    if (!options.record.empty() && !options.replay.empty()) {
+        ELOG("--record and --replay can not be used together");
+        return false;
+    }
+
+    if (options.headless && !options.record.empty()) {
+        ELOG("--record needs a window, it can not be used with --headless");
+        return false;
+    }
+
+    return true;
+}
+
+FrameTimeStats ComputeFrameTimeStats(std::vector<f32> samples)
+{
+    FrameTimeStats stats = {};
+    if (samples.empty()) return stats;
+
+    std::sort(samples.begin(), samples.end());
+
+    f64 sum = 0.0;
+    for (f32 sample : samples) sum += sample;
+
+    // Nearest-rank percentile
+    auto percentile = [&samples](f32 p) {
+        size_t rank = (size_t)ceil(p / 100.0f * samples.size());
+        return samples[rank > 0 ? rank - 1 : 0];
+    };
+
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.avg = (f32)(sum / samples.size());
+    stats.p50 = percentile(50.0f);
+    stats.p95 = percentile(95.0f);
+    stats.p99 = percentile(99.0f);
+    return stats;
+}
+
+void InitBenchmark(Benchmark& benchmark, const BenchmarkOptions& options)
+{
+    benchmark.options = options;
+    benchmark.currentFrame = 0;
+    benchmark.glCalls = {};
+    benchmark.cpuFrameMs.reserve(options.frames);
+    benchmark.gpuFrameMs.reserve(options.frames);
+
+    GL_CHECK(glGenQueries(BENCHMARK_GPU_QUERY_COUNT * 2, &benchmark.gpuQueries[0][0]));
+    for (u32 i = 0; i < BENCHMARK_GPU_QUERY_COUNT; ++i) {
+        benchmark.gpuQueryFrame[i] = -1;
+    }
+}
+
+static void ResolveGpuQuery(Benchmark& benchmark, u32 slot)
+{
+    if (benchmark.gpuQueryFrame[slot] < 0) return;
+
+    GLuint64 startNs = 0, endNs = 0;
+    GL_CHECK(glGetQueryObjectui64v(benchmark.gpuQueries[slot][0], GL_QUERY_RESULT, &startNs));
+    GL_CHECK(glGetQueryObjectui64v(benchmark.gpuQueries[slot][1], GL_QUERY_RESULT, &endNs));
+    GLuint64 elapsedNs = endNs - startNs;
+
+    if (benchmark.gpuQueryFrame[slot] >= (i64)benchmark.options.warmupFrames) {
+        benchmark.gpuFrameMs.push_back((f32)(elapsedNs / 1.0e6));
+    }
+    benchmark.gpuQueryFrame[slot] = -1;
+}
+
+void BeginBenchmarkFrame(Benchmark& benchmark)
+{
+    u32 slot = benchmark.currentFrame % BENCHMARK_GPU_QUERY_COUNT;
+
+    // The slot was last used BENCHMARK_GPU_QUERY_COUNT frames ago, its result is normally ready
+    ResolveGpuQuery(benchmark, slot);
+
+    GL_CHECK(glQueryCounter(benchmark.gpuQueries[slot][0], GL_TIMESTAMP));
+    benchmark.gpuQueryFrame[slot] = benchmark.currentFrame;
+}
+
+void EndBenchmarkFrame(Benchmark& benchmark, f64 cpuFrameSeconds)
+{
+    u32 slot = benchmark.currentFrame % BENCHMARK_GPU_QUERY_COUNT;
+    GL_CHECK(glQueryCounter(benchmark.gpuQueries[slot][1], GL_TIMESTAMP));
+
+    if (benchmark.currentFrame >= benchmark.options.warmupFrames) {
+        benchmark.cpuFrameMs.push_back((f32)(cpuFrameSeconds * 1000.0));
+
+        const GLStateCounters& frame = GLState::GetFrameCounters();
+        benchmark.glCalls.draws += frame.draws;
+        benchmark.glCalls.programBinds += frame.programBinds;
+        benchmark.glCalls.vertexArrayBinds += frame.vertexArrayBinds;
+        benchmark.glCalls.textureBinds += frame.textureBinds;
+        benchmark.glCalls.bufferBinds += frame.bufferBinds;
+        benchmark.glCalls.framebufferBinds += frame.framebufferBinds;
+        benchmark.glCalls.redundantBinds += frame.redundantBinds;
+    }
+    benchmark.currentFrame++;
+}
+
+void FinishBenchmark(Benchmark& benchmark)
+{
+    // Resolve in submission order so the GPU samples keep the frame order
+    for (u32 i = 0; i < BENCHMARK_GPU_QUERY_COUNT; ++i) {
+        ResolveGpuQuery(benchmark, (benchmark.currentFrame + i) % BENCHMARK_GPU_QUERY_COUNT);
+    }
+
+    GL_CHECK(glDeleteQueries(BENCHMARK_GPU_QUERY_COUNT * 2, &benchmark.gpuQueries[0][0]));
+}
+
+static void WriteStats(FILE* file, const char* name, const FrameTimeStats& stats, bool last)
+{
+    fprintf(file,
+        "  \"%s\": { \"min\": %.4f, \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+        name, stats.min, stats.avg, stats.p50, stats.p95, stats.p99, stats.max, last ? "" : ",");
+}
+
+static std::string EscapeJson(const std::string& str)
+{
+    std::string escaped;
+    for (char c : str) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        if ((unsigned char)c >= 0x20) escaped += c;
+    }
+    return escaped;
+}
+
+bool WriteBenchmarkReport(const Benchmark& benchmark, const App* app)
+{
+    FILE* file = fopen(benchmark.options.output.c_str(), "wb");
+    if (!file) {
+        ELOG("Could not write benchmark report %s", benchmark.options.output.c_str());
+        return false;
+    }
+
+    FrameTimeStats cpuStats = ComputeFrameTimeStats(benchmark.cpuFrameMs);
+    FrameTimeStats gpuStats = ComputeFrameTimeStats(benchmark.gpuFrameMs);
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"scene\": \"%s\",\n", EscapeJson(benchmark.options.scene).c_str());
+    fprintf(file, "  \"mode\": \"%s\",\n", benchmark.options.mode.c_str());
+    fprintf(file, "  \"width\": %u,\n", benchmark.options.width);
+    fprintf(file, "  \"height\": %u,\n", benchmark.options.height);
+    fprintf(file, "  \"frames\": %u,\n", (u32)benchmark.cpuFrameMs.size());
+    fprintf(file, "  \"warmup_frames\": %u,\n", benchmark.options.warmupFrames);
+    fprintf(file, "  \"gl_renderer\": \"%s\",\n", EscapeJson(app->oglInfo.glRenderer).c_str());
+    fprintf(file, "  \"gl_version\": \"%s\",\n", EscapeJson(app->oglInfo.glVersion).c_str());
+    WriteStats(file, "cpu_ms", cpuStats, false);
+    WriteStats(file, "gpu_ms", gpuStats, false);
+
+    // Per frame averages of the calls that reached GL
+    const GLStateCounters& calls = benchmark.glCalls;
+    f32 frames = (f32)std::max((u32)benchmark.cpuFrameMs.size(), 1u);
+    fprintf(file,
+        "  \"gl_calls\": { \"draws\": %.1f, \"program_binds\": %.1f, \"vao_binds\": %.1f, \"texture_binds\": %.1f, "
+        "\"buffer_binds\": %.1f, \"framebuffer_binds\": %.1f, \"redundant_binds\": %.1f }\n",
+        calls.draws / frames, calls.programBinds / frames, calls.vertexArrayBinds / frames, calls.textureBinds / frames,
+        calls.bufferBinds / frames, calls.framebufferBinds / frames, calls.redundantBinds / frames);
+    fprintf(file, "}\n");
+
+    fclose(file);
+
+    ILOG("Benchmark: %u frames, cpu avg %.3f ms p99 %.3f ms, gpu avg %.3f ms p99 %.3f ms -> %s",
+        (u32)benchmark.cpuFrameMs.size(), cpuStats.avg, cpuStats.p99, gpuStats.avg, gpuStats.p99,
+        benchmark.options.output.c_str());
+    return true;
+}
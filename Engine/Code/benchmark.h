@@ -0,0 +1,80 @@
+// benchmark.h
+#pragma once
+
+#include "platform.h"
+#include "gl_state.h"
+#include <glad/glad.h>
+
+#include <vector>
+#include <string>
+
+struct App;
+
+struct BenchmarkOptions {
+    bool headless       = false;
+    u32 frames          = 500;
+    u32 warmupFrames    = 10;
+    u32 width           = 1280;
+    u32 height          = 720;
+    std::string scene   = "all";
+    std::string mode    = "deferred";
+    std::string output  = "benchmark.json";
+    std::string trace   = "";              // Chrome trace of the profiler scopes, not written if empty
+    std::string record  = "";              // Input recording written on exit (windowed only)
+    std::string replay  = "";              // Input recording to replay, overrides --frames in headless mode
+};
+
+/**
+ * Parses the command line of the executable. Returns false if an argument is unknown
+ * or malformed, after logging the expected usage.
+ */
+bool ParseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options);
+
+struct FrameTimeStats {
+    f32 min;
+    f32 avg;
+    f32 p50;
+    f32 p95;
+    f32 p99;
+    f32 max;
+};
+
+/**
+ * Computes min/avg/percentiles/max of a set of frame times (nearest-rank percentiles).
+ */
+FrameTimeStats ComputeFrameTimeStats(std::vector<f32> samples);
+
+// GPU frame times are read back a few frames late so the queries never stall the pipeline. A
+// frame is measured with a pair of timestamps, as the profiler times its passes with
+// GL_TIME_ELAPSED queries, which can not be nested in another one
+#define BENCHMARK_GPU_QUERY_COUNT 4
+
+struct Benchmark {
+    BenchmarkOptions options;
+
+    std::vector<f32> cpuFrameMs;
+    std::vector<f32> gpuFrameMs;
+
+    GLuint gpuQueries[BENCHMARK_GPU_QUERY_COUNT][2];    // Start and end timestamps
+    i64    gpuQueryFrame[BENCHMARK_GPU_QUERY_COUNT];
+
+    GLStateCounters glCalls;        // Summed over the measured frames
+
+    u32 currentFrame;
+};
+
+void InitBenchmark(Benchmark& benchmark, const BenchmarkOptions& options);
+
+void BeginBenchmarkFrame(Benchmark& benchmark);
+
+void EndBenchmarkFrame(Benchmark& benchmark, f64 cpuFrameSeconds);
+
+/**
+ * Reads back the queries still in flight and releases the GL objects.
+ */
+void FinishBenchmark(Benchmark& benchmark);
+
+/**
+ * Writes the frame time report as JSON. Returns false if the file could not be written.
+ */
+bool WriteBenchmarkReport(const Benchmark& benchmark, const App* app);
@@ -0,0 +1,474 @@
+// bvh.cpp
+#include "bvh.h"
+#include "model.h"
+
+struct BvhBin {
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    u32 count;
+};
+
+static f32 SurfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    glm::vec3 size = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static void UpdateNodeBounds(BvhNode& node, const std::vector<u32>& primitives, const glm::vec3* boundsMin, const glm::vec3* boundsMax)
+{
+    node.boundsMin = glm::vec3(FLT_MAX);
+    node.boundsMax = glm::vec3(-FLT_MAX);
+    for (u32 i = 0; i < node.count; ++i) {
+        u32 primitive = primitives[node.leftFirst + i];
+        node.boundsMin = glm::min(node.boundsMin, boundsMin[primitive]);
+        node.boundsMax = glm::max(node.boundsMax, boundsMax[primitive]);
+    }
+}
+
+static inline u32 BinIndex(f32 centroid, f32 centroidMin, f32 scale)
+{
+    return glm::min((u32)((centroid - centroidMin) * scale), (u32)(BVH_SAH_BINS - 1));
+}
+
+void BuildBvh(Bvh& bvh, const glm::vec3* boundsMin, const glm::vec3* boundsMax, u32 count, u32 maxLeafSize)
+{
+    bvh.nodes.clear();
+    bvh.primitives.resize(count);
+    for (u32 i = 0; i < count; ++i) bvh.primitives[i] = i;
+    if (count == 0) return;
+
+    std::vector<glm::vec3> centroids(count);
+    for (u32 i = 0; i < count; ++i) centroids[i] = (boundsMin[i] + boundsMax[i]) * 0.5f;
+
+    // A tree of n primitives has at most 2n - 1 nodes, so the vector never reallocates
+    bvh.nodes.reserve(count * 2);
+    BvhNode root = {};
+    root.count = count;
+    UpdateNodeBounds(root, bvh.primitives, boundsMin, boundsMax);
+    bvh.nodes.push_back(root);
+
+    // Node and depth. The depth is capped so the traversals fit in BVH_STACK_SIZE.
+    std::vector<std::pair<u32, u32>> stack;
+    stack.push_back({ 0, 0 });
+    while (!stack.empty())
+    {
+        u32 nodeIndex = stack.back().first;
+        u32 depth = stack.back().second;
+        stack.pop_back();
+
+        u32 first = bvh.nodes[nodeIndex].leftFirst;
+        u32 nodeCount = bvh.nodes[nodeIndex].count;
+        if (nodeCount <= maxLeafSize || depth >= BVH_STACK_SIZE - 2) continue;
+
+        glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+        for (u32 i = 0; i < nodeCount; ++i) {
+            const glm::vec3& centroid = centroids[bvh.primitives[first + i]];
+            centroidMin = glm::min(centroidMin, centroid);
+            centroidMax = glm::max(centroidMax, centroid);
+        }
+
+        // Every bin boundary of every axis is a candidate, the one with the cheapest children wins
+        f32 bestCost = FLT_MAX;
+        i32 bestAxis = -1;
+        u32 bestSplit = 0;
+        for (i32 axis = 0; axis < 3; ++axis)
+        {
+            f32 extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f) continue;
+
+            BvhBin bins[BVH_SAH_BINS];
+            for (BvhBin& bin : bins) bin = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), 0 };
+
+            f32 scale = BVH_SAH_BINS / extent;
+            for (u32 i = 0; i < nodeCount; ++i) {
+                u32 primitive = bvh.primitives[first + i];
+                BvhBin& bin = bins[BinIndex(centroids[primitive][axis], centroidMin[axis], scale)];
+                bin.boundsMin = glm::min(bin.boundsMin, boundsMin[primitive]);
+                bin.boundsMax = glm::max(bin.boundsMax, boundsMax[primitive]);
+                bin.count++;
+            }
+
+            f32 leftArea[BVH_SAH_BINS - 1];
+            u32 leftCount[BVH_SAH_BINS - 1];
+            glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+            u32 sweepCount = 0;
+            for (u32 i = 0; i < BVH_SAH_BINS - 1; ++i) {
+                sweepMin = glm::min(sweepMin, bins[i].boundsMin);
+                sweepMax = glm::max(sweepMax, bins[i].boundsMax);
+                sweepCount += bins[i].count;
+                leftArea[i] = SurfaceArea(sweepMin, sweepMax);
+                leftCount[i] = sweepCount;
+            }
+
+            sweepMin = glm::vec3(FLT_MAX);
+            sweepMax = glm::vec3(-FLT_MAX);
+            sweepCount = 0;
+            for (u32 i = BVH_SAH_BINS - 1; i > 0; --i) {
+                sweepMin = glm::min(sweepMin, bins[i].boundsMin);
+                sweepMax = glm::max(sweepMax, bins[i].boundsMax);
+                sweepCount += bins[i].count;
+                if (sweepCount == 0 || leftCount[i - 1] == 0) continue;
+
+                f32 cost = leftCount[i - 1] * leftArea[i - 1] + sweepCount * SurfaceArea(sweepMin, sweepMax);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        // All the centroids are in the same spot, nothing can split them
+        if (bestAxis < 0) continue;
+
+        f32 scale = BVH_SAH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        u32 i = first;
+        u32 end = first + nodeCount;
+        while (i < end) {
+            if (BinIndex(centroids[bvh.primitives[i]][bestAxis], centroidMin[bestAxis], scale) < bestSplit) i++;
+            else std::swap(bvh.primitives[i], bvh.primitives[--end]);
+        }
+
+        u32 leftIndex = (u32)bvh.nodes.size();
+        BvhNode left = {};
+        left.leftFirst = first;
+        left.count = i - first;
+        BvhNode right = {};
+        right.leftFirst = i;
+        right.count = nodeCount - left.count;
+        UpdateNodeBounds(left, bvh.primitives, boundsMin, boundsMax);
+        UpdateNodeBounds(right, bvh.primitives, boundsMin, boundsMax);
+        bvh.nodes.push_back(left);
+        bvh.nodes.push_back(right);
+
+        bvh.nodes[nodeIndex].leftFirst = leftIndex;
+        bvh.nodes[nodeIndex].count = 0;
+        stack.push_back({ leftIndex, depth + 1 });
+        stack.push_back({ leftIndex + 1, depth + 1 });
+    }
+}
+
+f32 RefitBvh(Bvh& bvh, const glm::vec3* boundsMin, const glm::vec3* boundsMax)
+{
+    for (size_t i = bvh.nodes.size(); i-- > 0;) {
+        BvhNode& node = bvh.nodes[i];
+        if (node.count > 0) {
+            UpdateNodeBounds(node, bvh.primitives, boundsMin, boundsMax);
+            continue;
+        }
+        const BvhNode& left = bvh.nodes[node.leftFirst];
+        const BvhNode& right = bvh.nodes[node.leftFirst + 1];
+        node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+        node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+    }
+    return BvhCost(bvh);
+}
+
+f32 BvhCost(const Bvh& bvh)
+{
+    if (bvh.nodes.empty()) return 0.0f;
+
+    f32 cost = 0.0f;
+    for (const BvhNode& node : bvh.nodes) {
+        cost += SurfaceArea(node.boundsMin, node.boundsMax) * (node.count > 0 ? node.count : 1);
+    }
+    f32 rootArea = SurfaceArea(bvh.nodes[0].boundsMin, bvh.nodes[0].boundsMax);
+    return rootArea > 0.0f ? cost / rootArea : 0.0f;
+}
+
+Ray MakeRay(const glm::vec3& origin, const glm::vec3& direction)
+{
+    // Axis aligned rays get infinities, which the slab test handles
+    Ray ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.inverseDirection = 1.0f / direction;
+    return ray;
+}
+
+f32 IntersectRayBox(const Ray& ray, const glm::vec3& boundsMin, const glm::vec3& boundsMax, f32 maxT)
+{
+    glm::vec3 t0 = (boundsMin - ray.origin) * ray.inverseDirection;
+    glm::vec3 t1 = (boundsMax - ray.origin) * ray.inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+
+    f32 entry = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+    f32 exit = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+    return entry <= exit && entry < maxT ? entry : FLT_MAX;
+}
+
+static bool IntersectTriangle(const Ray& ray, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, f32& t)
+{
+    glm::vec3 edge1 = p1 - p0;
+    glm::vec3 edge2 = p2 - p0;
+    glm::vec3 h = glm::cross(ray.direction, edge2);
+    f32 determinant = glm::dot(edge1, h);
+    if (determinant == 0.0f) return false;
+
+    f32 inverseDeterminant = 1.0f / determinant;
+    glm::vec3 s = ray.origin - p0;
+    f32 u = glm::dot(s, h) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    glm::vec3 q = glm::cross(s, edge1);
+    f32 v = glm::dot(ray.direction, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    f32 hit = glm::dot(edge2, q) * inverseDeterminant;
+    if (hit <= 0.0f || hit >= t) return false;
+
+    t = hit;
+    return true;
+}
+
+void BuildMeshBvh(MeshBvh& meshBvh, const Vertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount)
+{
+    meshBvh.positions.resize(vertexCount);
+    for (u32 i = 0; i < vertexCount; ++i) meshBvh.positions[i] = vertices[i].Position;
+
+    u32 triangleCount = indexCount / 3;
+    std::vector<glm::vec3> boundsMin(triangleCount), boundsMax(triangleCount);
+    for (u32 t = 0; t < triangleCount; ++t) {
+        const glm::vec3& p0 = meshBvh.positions[indices[t * 3]];
+        const glm::vec3& p1 = meshBvh.positions[indices[t * 3 + 1]];
+        const glm::vec3& p2 = meshBvh.positions[indices[t * 3 + 2]];
+        boundsMin[t] = glm::min(p0, glm::min(p1, p2));
+        boundsMax[t] = glm::max(p0, glm::max(p1, p2));
+    }
+
+    BuildBvh(meshBvh.bvh, boundsMin.data(), boundsMax.data(), triangleCount, BVH_MAX_LEAF_TRIANGLES);
+
+    // The triangles are stored in leaf order, the tree is never refitted so the indirection is dropped
+    meshBvh.triangles.resize(triangleCount * 3);
+    for (u32 i = 0; i < triangleCount; ++i) {
+        u32 t = meshBvh.bvh.primitives[i];
+        for (u32 k = 0; k < 3; ++k) meshBvh.triangles[i * 3 + k] = indices[t * 3 + k];
+    }
+    std::vector<u32>().swap(meshBvh.bvh.primitives);
+}
+
+bool IntersectMeshBvh(const MeshBvh& meshBvh, const Ray& ray, f32& t)
+{
+    const std::vector<BvhNode>& nodes = meshBvh.bvh.nodes;
+    if (nodes.empty()) return false;
+
+    u32 stack[BVH_STACK_SIZE];
+    f32 stackEntry[BVH_STACK_SIZE];
+    u32 stackSize = 0;
+
+    f32 rootEntry = IntersectRayBox(ray, nodes[0].boundsMin, nodes[0].boundsMax, t);
+    if (rootEntry != FLT_MAX) {
+        stack[0] = 0;
+        stackEntry[0] = rootEntry;
+        stackSize = 1;
+    }
+
+    bool hit = false;
+    while (stackSize > 0)
+    {
+        --stackSize;
+        // A closer hit may have been found since the node was pushed
+        if (stackEntry[stackSize] >= t) continue;
+
+        const BvhNode& node = nodes[stack[stackSize]];
+        if (node.count > 0) {
+            for (u32 i = node.leftFirst; i < node.leftFirst + node.count; ++i) {
+                const u32* triangle = &meshBvh.triangles[i * 3];
+                hit |= IntersectTriangle(ray, meshBvh.positions[triangle[0]], meshBvh.positions[triangle[1]], meshBvh.positions[triangle[2]], t);
+            }
+            continue;
+        }
+
+        // The nearest child is pushed last, so it is visited first
+        u32 nearest = node.leftFirst;
+        u32 furthest = node.leftFirst + 1;
+        f32 nearestEntry = IntersectRayBox(ray, nodes[nearest].boundsMin, nodes[nearest].boundsMax, t);
+        f32 furthestEntry = IntersectRayBox(ray, nodes[furthest].boundsMin, nodes[furthest].boundsMax, t);
+        if (furthestEntry < nearestEntry) {
+            std::swap(nearest, furthest);
+            std::swap(nearestEntry, furthestEntry);
+        }
+        if (furthestEntry != FLT_MAX) {
+            stack[stackSize] = furthest;
+            stackEntry[stackSize++] = furthestEntry;
+        }
+        if (nearestEntry != FLT_MAX) {
+            stack[stackSize] = nearest;
+            stackEntry[stackSize++] = nearestEntry;
+        }
+    }
+    return hit;
+}
+
+void UpdateSceneBvh(SceneBvh& sceneBvh, const std::vector<ModelInstance>& models, const std::vector<glm::mat4>& modelMatrices, const SceneBounds& bounds)
+{
+    u32 count = bounds.count;
+    bool rebuild = count != (u32)sceneBvh.instanceModel.size() || modelMatrices.size() != sceneBvh.modelMatrices.size();
+
+    bool moved = rebuild;
+    for (size_t i = 0; i < modelMatrices.size() && !moved; ++i) {
+        moved = memcmp(&modelMatrices[i], &sceneBvh.modelMatrices[i], sizeof(glm::mat4)) != 0;
+    }
+    if (!moved) return;
+
+    sceneBvh.modelMatrices = modelMatrices;
+    sceneBvh.boundsMin.resize(count);
+    sceneBvh.boundsMax.resize(count);
+    for (u32 i = 0; i < count; ++i) {
+        glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+        glm::vec3 extent(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+        sceneBvh.boundsMin[i] = center - extent;
+        sceneBvh.boundsMax[i] = center + extent;
+    }
+
+    if (rebuild) {
+        sceneBvh.instanceModel.clear();
+        sceneBvh.instanceMesh.clear();
+        for (size_t m = 0; m < models.size(); ++m) {
+            for (u32 i = 0; i < models[m].GetMeshCount(); ++i) {
+                sceneBvh.instanceModel.push_back((u32)m);
+                sceneBvh.instanceMesh.push_back(i);
+            }
+        }
+    }
+    else {
+        // Moving instances make the refitted nodes overlap, the tree is rebuilt once that costs too much
+        sceneBvh.cost = RefitBvh(sceneBvh.bvh, sceneBvh.boundsMin.data(), sceneBvh.boundsMax.data());
+        sceneBvh.refitCount++;
+        if (sceneBvh.cost <= sceneBvh.builtCost * BVH_REBUILD_COST_RATIO) return;
+    }
+
+    BuildBvh(sceneBvh.bvh, sceneBvh.boundsMin.data(), sceneBvh.boundsMax.data(), count, BVH_MAX_LEAF_INSTANCES);
+    sceneBvh.builtCost = sceneBvh.cost = BvhCost(sceneBvh.bvh);
+    sceneBvh.rebuildCount++;
+}
+
+u32 CullSceneBvh(const SceneBvh& sceneBvh, const Frustum& frustum, SceneBounds& bounds)
+{
+    std::fill(bounds.visible.begin(), bounds.visible.end(), (u8)0);
+
+    const std::vector<BvhNode>& nodes = sceneBvh.bvh.nodes;
+    if (nodes.empty()) return 0;
+
+    // Each node carries the planes its parent was not fully inside of
+    u32 stack[BVH_STACK_SIZE];
+    u8 stackPlanes[BVH_STACK_SIZE];
+    u32 stackSize = 1;
+    stack[0] = 0;
+    stackPlanes[0] = 0x3F;
+
+    u32 visibleCount = 0;
+    while (stackSize > 0)
+    {
+        --stackSize;
+        const BvhNode& node = nodes[stack[stackSize]];
+        u8 planes = stackPlanes[stackSize];
+
+        glm::vec3 center = (node.boundsMin + node.boundsMax) * 0.5f;
+        glm::vec3 extent = (node.boundsMax - node.boundsMin) * 0.5f;
+        bool outside = false;
+        for (u32 p = 0; p < 6 && !outside; ++p) {
+            if (!(planes & (1 << p))) continue;
+
+            const glm::vec4& plane = frustum.planes[p];
+            f32 distance = glm::dot(glm::vec3(plane), center) + plane.w;
+            f32 reach = glm::dot(glm::abs(glm::vec3(plane)), extent);
+            outside = distance + reach <= 0.0f;
+            if (distance - reach > 0.0f) planes &= ~(1 << p);
+        }
+        if (outside) continue;
+
+        if (node.count == 0) {
+            stack[stackSize] = node.leftFirst;
+            stackPlanes[stackSize++] = planes;
+            stack[stackSize] = node.leftFirst + 1;
+            stackPlanes[stackSize++] = planes;
+            continue;
+        }
+
+        // Same test as CullSceneBounds, on the planes left
+        for (u32 i = node.leftFirst; i < node.leftFirst + node.count; ++i) {
+            u32 instance = sceneBvh.bvh.primitives[i];
+            glm::vec3 instanceCenter(bounds.centerX[instance], bounds.centerY[instance], bounds.centerZ[instance]);
+            glm::vec3 instanceExtent(bounds.extentX[instance], bounds.extentY[instance], bounds.extentZ[instance]);
+
+            bool inside = true;
+            for (u32 p = 0; p < 6 && inside; ++p) {
+                if (!(planes & (1 << p))) continue;
+
+                const glm::vec4& plane = frustum.planes[p];
+                f32 distance = glm::dot(glm::vec3(plane), instanceCenter) + plane.w;
+                f32 reach = glm::min(glm::dot(glm::abs(glm::vec3(plane)), instanceExtent), bounds.radius[instance]);
+                inside = distance + reach > 0.0f;
+            }
+            bounds.visible[instance] = inside;
+            visibleCount += inside;
+        }
+    }
+    return visibleCount;
+}
+
+bool PickSceneBvh(const SceneBvh& sceneBvh, const std::vector<ModelInstance>& models, const Ray& ray, u32& modelIndex, u32& meshIndex, f32& t)
+{
+    const std::vector<BvhNode>& nodes = sceneBvh.bvh.nodes;
+    if (nodes.empty()) return false;
+
+    u32 stack[BVH_STACK_SIZE];
+    f32 stackEntry[BVH_STACK_SIZE];
+    u32 stackSize = 0;
+
+    f32 rootEntry = IntersectRayBox(ray, nodes[0].boundsMin, nodes[0].boundsMax, t);
+    if (rootEntry != FLT_MAX) {
+        stack[0] = 0;
+        stackEntry[0] = rootEntry;
+        stackSize = 1;
+    }
+
+    bool hit = false;
+    while (stackSize > 0)
+    {
+        --stackSize;
+        if (stackEntry[stackSize] >= t) continue;
+
+        const BvhNode& node = nodes[stack[stackSize]];
+        if (node.count > 0) {
+            for (u32 i = node.leftFirst; i < node.leftFirst + node.count; ++i) {
+                u32 instance = sceneBvh.bvh.primitives[i];
+                if (IntersectRayBox(ray, sceneBvh.boundsMin[instance], sceneBvh.boundsMax[instance], t) == FLT_MAX) continue;
+
+                u32 model = sceneBvh.instanceModel[instance];
+                u32 mesh = sceneBvh.instanceMesh[instance];
+                if (model >= models.size() || mesh >= models[model].GetMeshCount()) continue;
+
+                // The ray goes to model space unnormalized, so the hit distances stay comparable
+                glm::mat4 inverse = glm::inverse(sceneBvh.modelMatrices[model]);
+                Ray localRay = MakeRay(glm::vec3(inverse * glm::vec4(ray.origin, 1.0f)), glm::mat3(inverse) * ray.direction);
+                if (IntersectMeshBvh(models[model].asset->meshes[mesh].pickingBvh, localRay, t)) {
+                    modelIndex = model;
+                    meshIndex = mesh;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        u32 nearest = node.leftFirst;
+        u32 furthest = node.leftFirst + 1;
+        f32 nearestEntry = IntersectRayBox(ray, nodes[nearest].boundsMin, nodes[nearest].boundsMax, t);
+        f32 furthestEntry = IntersectRayBox(ray, nodes[furthest].boundsMin, nodes[furthest].boundsMax, t);
+        if (furthestEntry < nearestEntry) {
+            std::swap(nearest, furthest);
+            std::swap(nearestEntry, furthestEntry);
+        }
+        if (furthestEntry != FLT_MAX) {
+            stack[stackSize] = furthest;
+            stackEntry[stackSize++] = furthestEntry;
+        }
+        if (nearestEntry != FLT_MAX) {
+            stack[stackSize] = nearest;
+            stackEntry[stackSize++] = nearestEntry;
+        }
+    }
+    return hit;
+}
@@ -0,0 +1,110 @@
+// bvh.h
+#pragma once
+
+#include "platform.h"
+#include "frustum_culling.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Vertex;
+struct ModelInstance;
+
+#define BVH_SAH_BINS                12      // Split candidates per axis
+#define BVH_MAX_LEAF_TRIANGLES      4
+#define BVH_MAX_LEAF_INSTANCES      2
+#define BVH_REBUILD_COST_RATIO      1.5f    // The scene BVH is rebuilt once refits grow its SAH cost past this ratio
+#define BVH_STACK_SIZE              64
+
+/*
+ * 32 bytes. The two children of an inner node are next to each other and after their parent,
+ * so walking the nodes backwards visits children first.
+ */
+struct BvhNode {
+    glm::vec3 boundsMin;
+    u32 leftFirst;          // First primitive of a leaf, left child of an inner node
+    glm::vec3 boundsMax;
+    u32 count;              // Primitives of a leaf, 0 for inner nodes
+};
+
+struct Bvh {
+    std::vector<BvhNode> nodes;
+    std::vector<u32> primitives;    // Primitive indices, every leaf is a range of it
+};
+
+/**
+ * Top-down build with the surface area heuristic, binned over the primitive centroids.
+ * Nodes with more than maxLeafSize primitives are always split.
+ */
+void BuildBvh(Bvh& bvh, const glm::vec3* boundsMin, const glm::vec3* boundsMax, u32 count, u32 maxLeafSize);
+
+/**
+ * Recomputes the node bounds from the primitive bounds, keeping the tree.
+ * Returns the SAH cost relative to the root, see BvhCost.
+ */
+f32 RefitBvh(Bvh& bvh, const glm::vec3* boundsMin, const glm::vec3* boundsMax);
+
+/**
+ * Surface area of the inner nodes plus the one of the leaves times their primitives, over the root one.
+ */
+f32 BvhCost(const Bvh& bvh);
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;        // Not normalized, hits are at origin + t * direction
+    glm::vec3 inverseDirection;
+};
+
+Ray MakeRay(const glm::vec3& origin, const glm::vec3& direction);
+
+/**
+ * Entry distance of the ray into the box (slab test), FLT_MAX when it misses it or the entry is past maxT.
+ */
+f32 IntersectRayBox(const Ray& ray, const glm::vec3& boundsMin, const glm::vec3& boundsMax, f32 maxT);
+
+/*
+ * Triangles of LOD0 for picking, in model space. The copy is needed as the GPU buffers can be
+ * compact and the mesh cache file is unmapped after the upload.
+ */
+struct MeshBvh {
+    Bvh bvh;
+    std::vector<glm::vec3> positions;
+    std::vector<u32> triangles;     // Three indices per triangle, in leaf order
+};
+
+void BuildMeshBvh(MeshBvh& meshBvh, const Vertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount);
+
+/**
+ * Closest triangle hit (Moller-Trumbore, both sides) nearer than t, which is updated on a hit.
+ */
+bool IntersectMeshBvh(const MeshBvh& meshBvh, const Ray& ray, f32& t);
+
+/*
+ * BVH over the world boxes of every mesh of the scene, in the order of SceneBounds. Refitted when
+ * a model moves, rebuilt when meshes are added or the refits have made it too loose.
+ */
+struct SceneBvh {
+    Bvh bvh;
+    std::vector<glm::vec3> boundsMin, boundsMax;
+    std::vector<u32> instanceModel;         // Model and mesh of every instance
+    std::vector<u32> instanceMesh;
+    std::vector<glm::mat4> modelMatrices;   // Of the last update, to find the models that moved
+    f32 builtCost = 0.0f;
+    f32 cost = 0.0f;
+    u32 rebuildCount = 0;
+    u32 refitCount = 0;
+};
+
+void UpdateSceneBvh(SceneBvh& sceneBvh, const std::vector<ModelInstance>& models, const std::vector<glm::mat4>& modelMatrices, const SceneBounds& bounds);
+
+/**
+ * Same results as CullSceneBounds, walking the tree. Planes a node is fully inside are not tested
+ * again below it, and subtrees fully inside the frustum are accepted without tests.
+ */
+u32 CullSceneBvh(const SceneBvh& sceneBvh, const Frustum& frustum, SceneBounds& bounds);
+
+/**
+ * Closest mesh hit by the world space ray, tested against the triangles of the meshes whose boxes
+ * it crosses, nearest box first. Returns false when nothing is hit.
+ */
+bool PickSceneBvh(const SceneBvh& sceneBvh, const std::vector<ModelInstance>& models, const Ray& ray, u32& modelIndex, u32& meshIndex, f32& t);
@@ -0,0 +1,223 @@
+// draw_batches.cpp
+#include "draw_batches.h"
+#include "model.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+void InitDrawBatches(DrawBatches& batches)
+{
+    glGenBuffers(1, &batches.drawDataBuffer);
+    glGenBuffers(1, &batches.materialsBuffer);
+}
+
+void ShutdownDrawBatches(DrawBatches& batches)
+{
+    GLState::DeleteBuffers(1, &batches.drawDataBuffer);
+    GLState::DeleteBuffers(1, &batches.materialsBuffer);
+    batches = DrawBatches();
+}
+
+// Bit per property, in the order of GpuMaterial, set when its texture can be sampled: resident, and
+// with its reference when the textures are not bound
+static u32 GetResidentTextureMask(const Material& material, const MaterialTextures& textures)
+{
+    const Mat_Property* properties[] = { &material.diffuse, &material.metallic, &material.roughness,
+        &material.normal, &material.height, &material.alphaMask };
+
+    u32 mask = 0;
+    for (u32 i = 0; i < ARRAY_COUNT(properties); ++i) {
+        const Mat_Property& property = *properties[i];
+        if (!property.tex_enabled || !property.texture || property.texture->id == 0) continue;
+
+        u32 reference[2];
+        if (textures.mode == MaterialTextures_Bind || GetMaterialTextureReference(textures, *property.texture, reference)) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+static GpuMaterialProperty PackMaterialProperty(const Mat_Property& property, const MaterialTextures& textures, u32 textureMask, u32 bit)
+{
+    GpuMaterialProperty packed = {};
+    packed.color = property.color;
+    packed.useTexture = (textureMask >> bit) & 1u;
+    packed.propEnabled = property.prop_enabled ? 1 : 0;
+    if (packed.useTexture && textures.mode != MaterialTextures_Bind) {
+        GetMaterialTextureReference(textures, *property.texture, packed.texture);
+    }
+    return packed;
+}
+
+static GpuMaterial PackMaterial(const Material& material, const MaterialTextures& textures, u32 textureMask)
+{
+    GpuMaterial packed;
+    packed.diffuse = PackMaterialProperty(material.diffuse, textures, textureMask, 0);
+    packed.metallic = PackMaterialProperty(material.metallic, textures, textureMask, 1);
+    packed.roughness = PackMaterialProperty(material.roughness, textures, textureMask, 2);
+    packed.normal = PackMaterialProperty(material.normal, textures, textureMask, 3);
+    packed.height = PackMaterialProperty(material.height, textures, textureMask, 4);
+    packed.alphaMask = PackMaterialProperty(material.alphaMask, textures, textureMask, 5);
+    return packed;
+}
+
+// Touches the texture like BindMaterialTextures would, and gives it its reference once resident
+static bool AcquireMaterialProperty(const Mat_Property& property, MaterialTextures& textures, bool onlyIfEnabled)
+{
+    if (onlyIfEnabled && !property.prop_enabled) return false;
+    if (!property.AcquireTexture()) return false;
+    return AcquireMaterialTexture(textures, *property.texture);
+}
+
+// True when a reference changed
+static bool AcquireMaterialTextures(const Material& material, MaterialTextures& textures)
+{
+    bool changed = AcquireMaterialProperty(material.diffuse, textures, false);
+    changed |= AcquireMaterialProperty(material.metallic, textures, false);
+    changed |= AcquireMaterialProperty(material.normal, textures, true);
+    changed |= AcquireMaterialProperty(material.height, textures, true);
+    changed |= AcquireMaterialProperty(material.roughness, textures, true);
+    changed |= AcquireMaterialProperty(material.alphaMask, textures, true);
+    return changed;
+}
+
+void UpdateDrawBatches(DrawBatches& batches, const std::vector<ModelInstance>& models, GeometryArenas& arenas,
+    const MaterialTextures& textures)
+{
+    u32 meshCount = 0;
+    for (const ModelInstance& model : models) meshCount += model.GetMeshCount();
+    if (meshCount == batches.meshCount && models.size() == batches.modelFirstDraw.size() && textures.mode == batches.textureMode &&
+        arenas.allocationCount == batches.arenaAllocations) return;
+
+    batches.batches.clear();
+    batches.meshes.clear();
+    batches.materials.clear();
+    batches.materialTextureMasks.clear();
+    batches.drawData.clear();
+    batches.modelFirstDraw.clear();
+    batches.meshCount = meshCount;
+    batches.textureMode = textures.mode;
+    batches.arenaAllocations = arenas.allocationCount;
+    batches.version++;
+    bool splitByMaterial = textures.mode == MaterialTextures_Bind;
+
+    struct SortedMesh {
+        u32 arena;
+        u32 material;
+        u32 assetMesh;
+        DrawBatchMesh mesh;
+    };
+    std::vector<SortedMesh> sorted;
+    sorted.reserve(meshCount);
+
+    std::unordered_map<Material*, u32> materialIndices;
+    std::unordered_map<const Mesh*, u32> assetMeshIndices;
+    for (u32 m = 0; m < (u32)models.size(); ++m) {
+        batches.modelFirstDraw.push_back((u32)batches.drawData.size());
+
+        for (u32 i = 0; i < models[m].GetMeshCount(); ++i) {
+            const Mesh& mesh = models[m].asset->meshes[i];
+
+            auto inserted = materialIndices.emplace(mesh.material.get(), (u32)batches.materials.size());
+            if (inserted.second) batches.materials.push_back(mesh.material.get());
+
+            // The instances of a mesh share this index, so they end up next to each other
+            u32 assetMesh = assetMeshIndices.emplace(&mesh, (u32)assetMeshIndices.size()).first->second;
+
+            DrawData data;
+            data.positionOffset = mesh.positionOffset;
+            data.transformIndex = m;
+            data.positionScale = mesh.positionScale;
+            data.materialIndex = inserted.first->second;
+            batches.drawData.push_back(data);
+
+            sorted.push_back({ (u32)mesh.arena, data.materialIndex, assetMesh, { m, i } });
+        }
+    }
+
+    // Stable, so the instances of a mesh keep the scene order. Still by material when the batches
+    // are not split, so the draws of a material stay together
+    std::stable_sort(sorted.begin(), sorted.end(), [](const SortedMesh& a, const SortedMesh& b) {
+        if (a.arena != b.arena) return a.arena < b.arena;
+        return a.material != b.material ? a.material < b.material : a.assetMesh < b.assetMesh;
+    });
+
+    for (const SortedMesh& entry : sorted) {
+        DrawBatch* batch = batches.batches.empty() ? NULL : &batches.batches.back();
+        if (!batch || (u32)batch->arena != entry.arena ||
+            (splitByMaterial && batch->material.get() != batches.materials[entry.material])) {
+            DrawBatch newBatch;
+            newBatch.arena = (GeometryArenaType)entry.arena;
+            newBatch.material = models[entry.mesh.model].asset->meshes[entry.mesh.mesh].material;
+            newBatch.firstMesh = (u32)batches.meshes.size();
+            newBatch.meshCount = 0;
+            batches.batches.push_back(newBatch);
+            batch = &batches.batches.back();
+        }
+        batches.meshes.push_back(entry.mesh);
+        batch->meshCount++;
+    }
+
+    ReserveDrawIds(arenas, meshCount);
+
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, batches.drawDataBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, batches.drawData.size() * sizeof(DrawData), batches.drawData.data(), GL_STATIC_DRAW);
+
+    // Every material again, the indices have changed
+    std::vector<GpuMaterial> gpuMaterials;
+    gpuMaterials.reserve(batches.materials.size());
+    for (Material* material : batches.materials) {
+        u32 textureMask = GetResidentTextureMask(*material, textures);
+        gpuMaterials.push_back(PackMaterial(*material, textures, textureMask));
+        batches.materialTextureMasks.push_back(textureMask);
+        material->dirty = false;
+    }
+    batches.materialUseFrames.assign(batches.materials.size(), 0);
+    batches.textureReleases = textures.releases;
+    batches.textureMoves = textures.moves;
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, batches.materialsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gpuMaterials.size() * sizeof(GpuMaterial), gpuMaterials.data(), GL_DYNAMIC_DRAW);
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Uploads the material when it was edited or its resident textures changed
+static void UpdateDrawBatchMaterial(DrawBatches& batches, const MaterialTextures& textures, u32 index)
+{
+    Material& material = *batches.materials[index];
+    u32 textureMask = GetResidentTextureMask(material, textures);
+    if (!material.dirty && textureMask == batches.materialTextureMasks[index]) return;
+
+    GpuMaterial packed = PackMaterial(material, textures, textureMask);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, (GLintptr)index * sizeof(GpuMaterial), sizeof(GpuMaterial), &packed);
+    batches.materialTextureMasks[index] = textureMask;
+    material.dirty = false;
+}
+
+void UpdateDrawBatchMaterials(DrawBatches& batches, MaterialTextures& textures, const std::vector<u32>& usedMaterials)
+{
+    batches.materialFrame++;
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, batches.materialsBuffer);
+    for (u32 index : usedMaterials) {
+        if (index >= (u32)batches.materials.size() || batches.materialUseFrames[index] == batches.materialFrame) continue;
+        batches.materialUseFrames[index] = batches.materialFrame;
+
+        Material& material = *batches.materials[index];
+        if (textures.mode != MaterialTextures_Bind && AcquireMaterialTextures(material, textures)) material.dirty = true;
+        UpdateDrawBatchMaterial(batches, textures, index);
+    }
+
+    // A released bindless handle or array layer must not stay in the materials that were not drawn
+    // either, and a compacted array moved layers without changing any mask. Evictions are rare, so
+    // they are the only frames that go over every material.
+    if (textures.releases != batches.textureReleases || textures.moves != batches.textureMoves) {
+        bool moved = textures.moves != batches.textureMoves;
+        batches.textureReleases = textures.releases;
+        batches.textureMoves = textures.moves;
+        for (u32 i = 0; i < (u32)batches.materials.size(); ++i) {
+            if (moved) batches.materials[i]->dirty = true;
+            UpdateDrawBatchMaterial(batches, textures, i);
+        }
+    }
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
@@ -0,0 +1,105 @@
+// draw_batches.h
+#pragma once
+
+#include "platform.h"
+#include "geometry_arena.h"
+#include "material_textures.h"
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+struct ModelInstance;
+class Material;
+
+/*
+ * Per draw data, indexed by the draw id (the base instance of the command). 32 bytes, matches
+ * DrawData in the mesh shaders (std430).
+ */
+struct DrawData {
+    glm::vec3 positionOffset;   // Dequantization of compact positions
+    u32 transformIndex;         // Model and normal matrices in the transforms buffer
+    glm::vec3 positionScale;
+    u32 materialIndex;          // In DrawBatches::materials
+};
+
+// One Mat_Property as read by the mesh shaders, 32 bytes (std430)
+struct GpuMaterialProperty {
+    glm::vec4 color;
+    u32 useTexture;             // Enabled and resident, with its reference when the textures are not bound
+    u32 propEnabled;
+    u32 texture[2];             // Bindless handle, or texture array and layer (see MaterialTextureMode)
+};
+
+/*
+ * Material as read by the mesh shaders, indexed by the material index of the draw data. 192 bytes,
+ * matches Material in forward.glsl and geometry_pass.glsl (std430), in the same property order.
+ */
+struct GpuMaterial {
+    GpuMaterialProperty diffuse;
+    GpuMaterialProperty metallic;
+    GpuMaterialProperty roughness;
+    GpuMaterialProperty normal;
+    GpuMaterialProperty height;
+    GpuMaterialProperty alphaMask;
+};
+
+struct DrawBatchMesh {
+    u32 model;
+    u32 mesh;
+};
+
+/*
+ * Meshes sharing an arena, and a material when the textures are bound per batch, drawn with a
+ * single multi draw. Their commands are contiguous, one mesh after the other. The instances of an
+ * asset mesh are next to each other, so they can be merged into instanced commands.
+ */
+struct DrawBatch {
+    GeometryArenaType arena;
+    std::shared_ptr<Material> material;     // Of the first mesh, the only one in bind mode
+    u32 firstMesh;              // In DrawBatches::meshes
+    u32 meshCount;
+    u32 firstCommand = 0;       // Filled by the culling every frame
+    u32 commandCount = 0;
+};
+
+struct DrawBatches {
+    std::vector<DrawBatch> batches;
+    std::vector<DrawBatchMesh> meshes;      // Grouped by batch
+    std::vector<Material*> materials;       // Every material of the scene, in order of first use
+    std::vector<u32> materialTextureMasks;  // Resident textures of every material when it was uploaded
+    std::vector<u32> materialUseFrames;     // materialFrame of the last update that used the material
+    u32 materialFrame = 0;
+    u32 textureReleases = 0;                // MaterialTextures::releases when the references were last checked
+    u32 textureMoves = 0;                   // MaterialTextures::moves, likewise
+    GLuint materialsBuffer = 0;
+    std::vector<DrawData> drawData;         // Per mesh, in the order of SceneBounds
+    std::vector<u32> modelFirstDraw;        // Draw id of the first mesh of every model
+    GLuint drawDataBuffer = 0;
+    u32 meshCount = 0;
+    MaterialTextureMode textureMode = MaterialTextures_Bind;    // Of the last regrouping
+    u32 arenaAllocations = 0;               // GeometryArenas::allocationCount of the last regrouping
+    u32 version = 0;                        // Incremented by every regrouping, for what is built from the batches
+};
+
+void InitDrawBatches(DrawBatches& batches);
+
+void ShutdownDrawBatches(DrawBatches& batches);
+
+/**
+ * Regroups the meshes in batches and uploads their draw data when the meshes of the scene, their
+ * geometry (a mesh was uploaded to the arenas) or the texture mode have changed. Only bind mode
+ * splits the batches by material. The draw id of a mesh is its index in the scene, modelFirstDraw
+ * plus its index in the asset.
+ */
+void UpdateDrawBatches(DrawBatches& batches, const std::vector<ModelInstance>& models, GeometryArenas& arenas,
+    const MaterialTextures& textures);
+
+/**
+ * Uploads the used materials (indices in batches.materials, repeats allowed) that were edited
+ * (Material::dirty) or whose textures were streamed in, evicted or given a new reference. Without
+ * bind mode their textures are acquired here, so the others can be evicted. The materials that are
+ * not used stay as they are in batches.materialsBuffer, until a reference is released.
+ */
+void UpdateDrawBatchMaterials(DrawBatches& batches, MaterialTextures& textures, const std::vector<u32>& usedMaterials);
@@ -1,6 +1,8 @@
 //engine.cpp
 #include "engine.h"
 #include "gl_error.h"
+#include "mesh_optimizer.h"
+#include "gl_extensions.h"
 
 #include <imgui.h>
 #include <imgui_internal.h>
@@ -30,9 +32,9 @@ Buffer CreateBuffer(u32 size, GLenum type, GLenum usage)
 	buffer.type = type;
 
 	GL_CHECK(glGenBuffers(1, &buffer.handle));
-	GL_CHECK(glBindBuffer(type, buffer.handle));
+	GL_CHECK(GLState::BindBuffer(type, buffer.handle));
 	GL_CHECK(glBufferData(type, buffer.size, NULL, usage));
-	GL_CHECK(glBindBuffer(type, 0));
+	GL_CHECK(GLState::BindBuffer(type, 0));
 
 	return buffer;
 }
@@ -41,14 +43,18 @@ Buffer CreateBuffer(u32 size, GLenum type, GLenum usage)
 #define CreateStaticVertexBuffer(size) CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
 
+#define DRAW_COMMANDS_INITIAL_COUNT 4096
+#define STRESS_SCENE_INSTANCES      10000   // Backpacks of the "stress" benchmark scene
+#define STRESS_INSTANCE_SPACING     0.6f
+
 void BindBuffer(const Buffer& buffer)
 {
-	GL_CHECK(glBindBuffer(buffer.type, buffer.handle));
+	GL_CHECK(GLState::BindBuffer(buffer.type, buffer.handle));
 }
 
 void MapBuffer(Buffer& buffer, GLenum access)
 {
-	GL_CHECK(glBindBuffer(buffer.type, buffer.handle));
+	GL_CHECK(GLState::BindBuffer(buffer.type, buffer.handle));
 	void* ptr = glMapBuffer(buffer.type, access);
 	buffer.data = (u8*)ptr;
 
@@ -57,9 +63,9 @@ void MapBuffer(Buffer& buffer, GLenum access)
 
 void UnmapBuffer(Buffer& buffer)
 {
-	GL_CHECK(glBindBuffer(buffer.type, buffer.handle));
+	GL_CHECK(GLState::BindBuffer(buffer.type, buffer.handle));
 	GL_CHECK(glUnmapBuffer(buffer.type));
-	GL_CHECK(glBindBuffer(buffer.type, 0));
+	GL_CHECK(GLState::BindBuffer(buffer.type, 0));
 }
 
 void AlignHead(Buffer& buffer, u32 alignment)
@@ -87,16 +93,10 @@ void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
 
 void InitUBOs(App* app) {
 	// UBOs
-	// Transform UBO
-	GL_CHECK(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,
-		reinterpret_cast<GLint*>(&app->transformsUBO.alignment)));
-
-	app->transformsUBO.blockSize = (2 * sizeof(glm::mat4));
-	app->transformsUBO.blockSize = Align(app->transformsUBO.blockSize, app->transformsUBO.alignment);
-
-	app->transformsUBO.buffer = CreateBuffer(
-		app->transformsUBO.blockSize * app->models.size(),
-		GL_UNIFORM_BUFFER,
+	// Transforms: the model and normal matrices of every model
+	app->transformsBuffer = CreateBuffer(
+		glm::max((u32)app->models.size(), 1u) * sizeof(GpuTransform),
+		GL_SHADER_STORAGE_BUFFER,
 		GL_DYNAMIC_DRAW
 	);
 
@@ -104,10 +104,11 @@ void InitUBOs(App* app) {
 	GL_CHECK(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,
 		reinterpret_cast<GLint*>(&app->globalParamsUBO.alignment)));
 
+	size_t viewProjectionSize = sizeof(glm::mat4);
 	size_t cameraPosSize = sizeof(glm::vec4);
 	size_t lightCountSize = sizeof(glm::uvec4);
 	size_t lightSize = 4 * sizeof(glm::vec4);
-	app->globalParamsUBO.blockSize = cameraPosSize + lightCountSize + app->lights.size() * lightSize;
+	app->globalParamsUBO.blockSize = viewProjectionSize + cameraPosSize + lightCountSize + app->lights.size() * lightSize;
 	app->globalParamsUBO.blockSize = Align(app->globalParamsUBO.blockSize, app->globalParamsUBO.alignment);
 
 	app->globalParamsUBO.buffer = CreateBuffer(
@@ -115,9 +116,315 @@ void InitUBOs(App* app) {
 		GL_UNIFORM_BUFFER,
 		GL_STREAM_DRAW
 	);
+
+	// Indirect commands, grown when a frame needs more
+	app->drawCommandsBuffer = CreateBuffer(
+		DRAW_COMMANDS_INITIAL_COUNT * sizeof(DrawElementsIndirectCommand),
+		GL_DRAW_INDIRECT_BUFFER,
+		GL_STREAM_DRAW
+	);
+}
+
+void UploadDrawCommands(App* app) {
+	Buffer& buffer = app->drawCommandsBuffer;
+	u32 size = (u32)(app->drawCommands.size() * sizeof(DrawElementsIndirectCommand));
+	if (size > buffer.size) {
+		GL_CHECK(GLState::DeleteBuffers(1, &buffer.handle));
+		buffer = CreateBuffer(size * 2, GL_DRAW_INDIRECT_BUFFER, GL_STREAM_DRAW);
+	}
+	if (size == 0) return;
+
+	// Orphaned, so the driver does not wait for the draws of the last frame
+	BindBuffer(buffer);
+	GL_CHECK(glBufferData(GL_DRAW_INDIRECT_BUFFER, buffer.size, NULL, GL_STREAM_DRAW));
+	GL_CHECK(glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, app->drawCommands.data()));
+	GL_CHECK(GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+}
+
+// Every meshlet culled by the compute shader, which also selects the levels and reads the transforms buffer.
+// The instances stay on the GPU, so the CPU work does not grow with the scene
+static void CullSceneGpu(App* app, const glm::mat4& viewProjection, const glm::mat4& projection) {
+	GpuCuller& culler = app->gpuCuller;
+	UpdateGpuCuller(culler, app->drawBatches, app->models);
+
+	// Hi-Z against the pyramid the deferred pass built last frame
+	Frustum frustum = ExtractFrustum(viewProjection);
+	const OcclusionCuller& occlusion = app->occlusionCuller;
+	bool occlusionCulling = app->occlusionCulling && app->mode == Mode_Deferred && occlusion.pyramidValid;
+
+	GpuCullParams params;
+	params.frustum = app->frustumCulling ? &frustum : NULL;
+	params.occlusion = occlusionCulling ? &occlusion : NULL;
+	params.cameraPosition = app->camera.Position;
+	params.projectionScale = projection[1][1];
+	params.lodBias = app->lodBias;
+	params.forcedLod = app->forcedLod;
+	params.backface = app->meshletCulling && app->meshletConeCulling;
+	params.onlyModel = app->renderAll || !app->selectedModel ? -1 : (i32)(app->selectedModel - app->models.data());
+	DispatchGpuCull(culler, app->shaders[app->gpuCullShaderIdx], app->transformsBuffer.handle, params);
+
+	// The materials visible in the dispatch that was read back, the draws of this frame see them a few frames late
+	UpdateDrawBatchMaterials(app->drawBatches, app->materialTextures, culler.visibleMaterials);
+
+	app->drawCommands.clear();
+	app->occlusionCuller.instances.clear();
+	app->instancedCommands = 0;
+	app->instancedMeshes = 0;
+
+	// Read back GPU_CULL_STATS_LATENCY frames late. The shader does not tell the occluded meshes
+	// from the ones outside the frustum, so there is no occluded count
+	const GpuCullStats& stats = culler.stats;
+	app->meshletStats = {};
+	app->meshletStats.tested = stats.testedMeshlets;
+	app->meshletStats.visible = stats.visibleMeshlets;
+	app->meshletStats.drawCommands = stats.visibleMeshlets;
+	app->visibleMeshCount = stats.visibleMeshes;
+	app->profiler.SetCounter("Visible meshes", stats.visibleMeshes);
+	app->profiler.SetCounter("Culled meshes", stats.meshes - stats.visibleMeshes);
+	app->profiler.SetCounter("Visible meshlets", stats.visibleMeshlets);
+}
+
+// Key of a draw whose box is centered there
+static u64 MakeDrawKey(App* app, u32 arena, u32 material, const glm::vec3& center) {
+	// Only the forward pass blends, the geometry pass draws everything front to back
+	const Material& drawMaterial = *app->drawBatches.materials[material];
+	bool transparent = app->mode == Mode_Forward && drawMaterial.IsTransparent();
+
+	// The material only sorts when it is bound, otherwise the depth goes right after the arena
+	if (app->materialTextures.mode != MaterialTextures_Bind) material = 0;
+
+	f32 depth = glm::dot(center - app->camera.Position, app->camera.Front) / app->camera.z_far;
+	return MakeRenderKey(transparent ? RenderLayer_Transparent : RenderLayer_Opaque, arena, material, depth);
+}
+
+// The visible instances of an asset mesh (batch entries [first, end)) drawn with one instanced command
+// per level of detail. Their draw ids go to the instance lists, each level is a packet with their combined box.
+static void BuildInstancedCommands(App* app, const Mesh& mesh, u32 first, u32 end) {
+	const DrawBatches& batches = app->drawBatches;
+	RenderQueue& queue = app->renderQueue;
+	const SceneBounds& bounds = app->sceneBounds;
+	u32 lodCount = (u32)mesh.lods.size();
+
+	for (u32 lod = 0; lod < lodCount; ++lod) {
+		u32 listStart = (u32)app->instanceDrawIds.size();
+		u32 firstDrawId = 0;
+		glm::vec3 boxMin = glm::vec3(FLT_MAX);
+		glm::vec3 boxMax = glm::vec3(-FLT_MAX);
+
+		for (u32 b = first; b < end; ++b) {
+			const DrawBatchMesh& entry = batches.meshes[b];
+			u32 drawId = batches.modelFirstDraw[entry.model] + entry.mesh;
+			if (!bounds.visible[drawId]) continue;
+			if (glm::min(app->models[entry.model].GetMeshLod(entry.mesh), lodCount - 1) != lod) continue;
+
+			if (app->instanceDrawIds.size() == listStart) firstDrawId = drawId;
+			app->instanceDrawIds.push_back(drawId);
+			glm::vec3 center(bounds.centerX[drawId], bounds.centerY[drawId], bounds.centerZ[drawId]);
+			glm::vec3 extent(bounds.extentX[drawId], bounds.extentY[drawId], bounds.extentZ[drawId]);
+			boxMin = glm::min(boxMin, center - extent);
+			boxMax = glm::max(boxMax, center + extent);
+		}
+
+		u32 instanceCount = (u32)app->instanceDrawIds.size() - listStart;
+		if (instanceCount == 0) continue;
+
+		// The base instance points into the instance lists, which follow the scene draw ids
+		const MeshLod& level = mesh.lods[lod];
+		u32 baseInstance = app->geometryArenas.sceneDrawIdCount + listStart;
+
+		RenderPacket packet;
+		packet.center = (boxMin + boxMax) * 0.5f;
+		packet.firstCommand = (u32)queue.commands.size();
+		packet.extent = (boxMax - boxMin) * 0.5f;
+		packet.commandCount = 1;
+		packet.mesh = &mesh;
+		packet.arena = (u32)mesh.arena;
+		packet.material = batches.drawData[firstDrawId].materialIndex;
+		packet.drawId = firstDrawId;
+		queue.commands.push_back({ level.indexCount, instanceCount, mesh.indexOffset + level.indexOffset, mesh.vertexOffset, baseInstance });
+		PushRenderPacket(queue, MakeDrawKey(app, packet.arena, packet.material, packet.center), packet);
+
+		app->instancedCommands++;
+		app->instancedMeshes += instanceCount;
+	}
+}
+
+// World bounds of every mesh and the BVH over them. Every frame on the CPU path, only for the picking on the GPU path
+static void UpdateSceneBounds(App* app, const std::vector<glm::mat4>& modelMatrices) {
+	SceneBounds& bounds = app->sceneBounds;
+	ResizeSceneBounds(bounds, app->drawBatches.meshCount);
+
+	u32 index = 0;
+	for (size_t i = 0; i < app->models.size(); ++i) {
+		for (u32 m = 0; m < app->models[i].GetMeshCount(); ++m) {
+			const Mesh& mesh = app->models[i].asset->meshes[m];
+			SetSceneBounds(bounds, index++, modelMatrices[i], mesh.boundsMin, mesh.boundsMax, mesh.boundsRadius);
+		}
+	}
+
+	UpdateSceneBvh(app->sceneBvh, app->models, modelMatrices, bounds);
+}
+
+void CullScene(App* app, const glm::mat4& viewProjection, const glm::mat4& projection, const std::vector<glm::mat4>& modelMatrices) {
+	PROFILE_SCOPE(app, "Culling");
+
+	UpdateDrawBatches(app->drawBatches, app->models, app->geometryArenas, app->materialTextures);
+
+	u32 meshCount = app->drawBatches.meshCount;
+	app->sceneMeshCount = meshCount;
+	if (app->gpuCulling) {
+		CullSceneGpu(app, viewProjection, projection);
+		return;
+	}
+
+	// Whole meshes against the frustum first, then the meshlets of the visible ones
+	UpdateSceneBounds(app, modelMatrices);
+	SceneBounds& bounds = app->sceneBounds;
+
+	u32 visibleMeshes = meshCount;
+	if (app->frustumCulling) {
+		Frustum frustum = ExtractFrustum(viewProjection);
+		visibleMeshes = app->bvhCulling ? CullSceneBvh(app->sceneBvh, frustum, bounds) : CullSceneBounds(bounds, frustum);
+	}
+	else {
+		std::fill(bounds.visible.begin(), bounds.visible.end(), (u8)1);
+	}
+
+	app->drawCommands.clear();
+	app->meshletStats = {};
+	app->instanceDrawIds.clear();
+	app->instancedCommands = 0;
+	app->instancedMeshes = 0;
+	RenderQueue& queue = app->renderQueue;
+	ClearRenderQueue(queue);
+
+	std::vector<MeshletCullParams> cullParams(app->models.size());
+	for (size_t i = 0; i < app->models.size(); ++i) {
+		cullParams[i] = MakeMeshletCullParams(viewProjection * modelMatrices[i], modelMatrices[i], app->camera.Position,
+			app->meshletConeCulling);
+	}
+
+	// Every visible draw becomes a packet, the batches only group the instances of an asset mesh
+	const ModelInstance* onlyModel = app->renderAll ? NULL : app->selectedModel;
+	DrawBatches& batches = app->drawBatches;
+	for (const DrawBatch& batch : batches.batches) {
+		u32 batchEnd = batch.firstMesh + batch.meshCount;
+		for (u32 b = batch.firstMesh; b < batchEnd; ) {
+			// The instances of an asset mesh are next to each other in the batch
+			const Mesh& mesh = app->models[batches.meshes[b].model].asset->meshes[batches.meshes[b].mesh];
+			u32 end = b + 1;
+			while (end < batchEnd && &app->models[batches.meshes[end].model].asset->meshes[batches.meshes[end].mesh] == &mesh) ++end;
+
+			// Instanced commands skip the meshlet culling, which differs for every instance
+			if (app->instancing && !onlyModel && end - b > 1) {
+				BuildInstancedCommands(app, mesh, b, end);
+				b = end;
+				continue;
+			}
+
+			for (; b < end; ++b) {
+				const DrawBatchMesh& entry = batches.meshes[b];
+				const ModelInstance& model = app->models[entry.model];
+				u32 drawId = batches.modelFirstDraw[entry.model] + entry.mesh;
+				if (!bounds.visible[drawId] || (onlyModel && onlyModel != &model)) continue;
+
+				const MeshletCullParams& cull = cullParams[entry.model];
+				RenderPacket packet;
+				packet.center = glm::vec3(bounds.centerX[drawId], bounds.centerY[drawId], bounds.centerZ[drawId]);
+				packet.firstCommand = (u32)queue.commands.size();
+				packet.extent = glm::vec3(bounds.extentX[drawId], bounds.extentY[drawId], bounds.extentZ[drawId]);
+				packet.commandCount = mesh.BuildDrawCommands(model.GetMeshLod(entry.mesh), drawId,
+					app->meshletCulling ? &cull : NULL, queue.commands, app->meshletStats);
+				packet.mesh = &mesh;
+				packet.arena = (u32)mesh.arena;
+				packet.material = batches.drawData[drawId].materialIndex;
+				packet.drawId = drawId;
+				if (packet.commandCount > 0) {
+					PushRenderPacket(queue, MakeDrawKey(app, packet.arena, packet.material, packet.center), packet);
+				}
+			}
+		}
+	}
+
+	// Packets with commands are left to the occlusion culling, which runs on the GPU
+	app->occlusionCuller.instances.clear();
+	bool splitByMaterial = app->materialTextures.mode == MaterialTextures_Bind;
+	{
+		PROFILE_SCOPE(app, "SortDraws");
+		FlushRenderQueue(queue, app->sortDraws, splitByMaterial, app->drawCommands, app->occlusionCuller.instances);
+	}
+	CountSceneStateChanges(queue, splitByMaterial);
+
+	// Only the materials drawn this frame keep their textures
+	app->usedMaterials.clear();
+	for (const RenderPacket& packet : queue.packets) app->usedMaterials.push_back(packet.material);
+	UpdateDrawBatchMaterials(batches, app->materialTextures, app->usedMaterials);
+
+	app->meshletStats.drawCommands = (u32)app->drawCommands.size();
+	UploadDrawCommands(app);
+	UploadInstanceDrawIds(app->geometryArenas, app->instanceDrawIds);
+
+	app->visibleMeshCount = visibleMeshes;
+	app->profiler.SetCounter("Visible meshes", visibleMeshes);
+	app->profiler.SetCounter("Culled meshes", meshCount - visibleMeshes);
+	app->profiler.SetCounter("Visible meshlets", app->meshletStats.visible);
+	app->profiler.SetCounter("Occluded meshes", app->occlusionCuller.stats.occluded);
+	app->profiler.SetCounter("State changes unsorted", queue.stateChangesUnsorted);
+	app->profiler.SetCounter("State changes sorted", queue.stateChangesSorted);
+}
+
+void PickModel(App* app, const glm::vec2& mousePosition) {
+	PROFILE_SCOPE(app, "Picking");
+
+	// Unprojected from the near to the far plane, the hit distance is the fraction of that segment
+	glm::vec2 ndc = mousePosition / glm::vec2(app->displaySize) * 2.0f - 1.0f;
+	ndc.y = -ndc.y;
+	glm::mat4 inverseViewProjection = glm::inverse(app->viewProjection);
+	glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	Ray ray = MakeRay(origin, glm::vec3(farPoint) / farPoint.w - origin);
+
+	// The GPU culling does not keep the BVH up to date
+	if (app->gpuCulling) UpdateSceneBounds(app, app->transforms.modelMatrices);
+
+	u32 modelIndex, meshIndex;
+	f32 t = 1.0f;
+	if (PickSceneBvh(app->sceneBvh, app->models, ray, modelIndex, meshIndex, t)) {
+		app->selectedModel = &app->models[modelIndex];
+		app->selectedMaterial = app->selectedModel->asset->meshes[meshIndex].material;
+	}
+}
+
+// Composes the transforms that changed since the last frame and uploads them, in runs of neighbours
+static void UpdateTransformsBuffer(App* app) {
+	TransformStorage& transforms = app->transforms;
+	u32 transformsSize = (u32)(transforms.gpuTransforms.size() * sizeof(GpuTransform));
+	if (transformsSize > app->transformsBuffer.size) {
+		GL_CHECK(GLState::DeleteBuffers(1, &app->transformsBuffer.handle));
+		app->transformsBuffer = CreateBuffer(transformsSize * 2, GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+		MarkAllTransformsDirty(transforms);
+	}
+
+	u32 updated = UpdateTransforms(transforms);
+	app->profiler.SetCounter("Dirty transforms", (f32)updated);
+	if (updated == 0) return;
+
+	BindBuffer(app->transformsBuffer);
+	for (u32 i = 0; i < updated;) {
+		u32 first = transforms.updated[i];
+		u32 count = 1;
+		while (i + count < updated && transforms.updated[i + count] == first + count) count++;
+
+		GL_CHECK(glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(GpuTransform), count * sizeof(GpuTransform),
+			&transforms.gpuTransforms[first]));
+		i += count;
+	}
+	GL_CHECK(GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
 }
 
 void UpdateUBOs(App* app) {
+	PROFILE_SCOPE(app, "UpdateUBOs");
 
 	// Transform UBO
 	// Calculate matrices
@@ -127,37 +434,23 @@ void UpdateUBOs(App* app) {
 		app->camera.z_near, app->camera.z_far
 	);
 
-	MapBuffer(app->transformsUBO.buffer, GL_WRITE_ONLY);
-	app->transformsUBO.currentOffset = 0;
-
-	for (auto& model : app->models) {
-		size_t blockStart = app->transformsUBO.currentOffset;
+	glm::mat4 vp = projection * view;
+	app->viewProjection = vp;
 
-		glm::mat4 modelMat = glm::mat4(1.0f);
-		modelMat = glm::translate(modelMat, model.position);
-		modelMat = glm::rotate(modelMat, glm::radians(model.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		modelMat = glm::rotate(modelMat, glm::radians(model.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		modelMat = glm::rotate(modelMat, glm::radians(model.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		modelMat = glm::scale(modelMat, model.scale);
+	UpdateTransformsBuffer(app);
 
-		glm::mat4 vp = projection * view;
-
-		PushMat4(app->transformsUBO.buffer, modelMat);
-		PushMat4(app->transformsUBO.buffer, vp);
-
-		AlignHead(app->transformsUBO.buffer, app->transformsUBO.blockSize);
-
-		model.bufferOffset = blockStart;
-		model.bufferSize = app->transformsUBO.blockSize;
-
-		app->transformsUBO.currentOffset += app->transformsUBO.blockSize;
+	// Once per frame, every pass draws the same levels. The GPU culling selects them in the shader
+	const std::vector<glm::mat4>& modelMatrices = app->transforms.modelMatrices;
+	for (size_t i = 0; i < app->models.size() && !app->gpuCulling; ++i) {
+		app->models[i].SelectLods(modelMatrices[i], app->camera.Position, projection[1][1], app->lodBias, app->forcedLod);
 	}
 
-	UnmapBuffer(app->transformsUBO.buffer);
+	CullScene(app, vp, projection, modelMatrices);
 
-	// Global UBO
+	// Global UBO, the per frame data of every pass
 	MapBuffer(app->globalParamsUBO.buffer, GL_WRITE_ONLY);
 
+	PushMat4(app->globalParamsUBO.buffer, vp);
 	PushVec3(app->globalParamsUBO.buffer, app->camera.Position);
 	PushUInt(app->globalParamsUBO.buffer, static_cast<u32>(app->lights.size()));
 
@@ -182,180 +475,171 @@ void UpdateUBOs(App* app) {
 #pragma region ModelLoaders
 
 std::shared_ptr<Texture> GetTexture(App* app, std::string name) {
-	for (const auto& texture : app->textures_loaded) {
-		if (texture && texture->name == name) {
-			return texture;
-		}
-	}
-	return nullptr;
+	return FindTextureByName(app->textureRegistry, name);
 }
 
 void LoadRifleModel(App* app) {
-	Model model("Rifle/Rifle.fbx", app);
-	model.scale = glm::vec3(0.1f);
-
 	// Textures
-	Model::LoadTexture(app, "Rifle/");
+	ModelAsset::LoadTexture(app, "Rifle/");
 
+	u32 slot = LoadModelAsync(app, "Rifle/Rifle.fbx", [](App* app, ModelAsset& model) {
 #pragma region Mat1
 
-	model.materials[0]->diffuse.texture = GetTexture(app, "low_Upper_BaseColor");
-	model.materials[0]->diffuse.prop_enabled = true;
-	model.materials[0]->diffuse.tex_enabled = true;
+		model.materials[0]->diffuse.texture = GetTexture(app, "low_Upper_BaseColor");
+		model.materials[0]->diffuse.prop_enabled = true;
+		model.materials[0]->diffuse.tex_enabled = true;
 
-	model.materials[0]->metallic.texture = GetTexture(app, "low_Upper_Metallic");
-	model.materials[0]->metallic.prop_enabled = true;
-	model.materials[0]->metallic.tex_enabled = true;
+		model.materials[0]->metallic.texture = GetTexture(app, "low_Upper_Metallic");
+		model.materials[0]->metallic.prop_enabled = true;
+		model.materials[0]->metallic.tex_enabled = true;
 
-	model.materials[0]->roughness.texture = GetTexture(app, "low_Upper_Roughness");
-	model.materials[0]->roughness.prop_enabled = true;
-	model.materials[0]->roughness.tex_enabled = true;
+		model.materials[0]->roughness.texture = GetTexture(app, "low_Upper_Roughness");
+		model.materials[0]->roughness.prop_enabled = true;
+		model.materials[0]->roughness.tex_enabled = true;
 
-	model.materials[0]->normal.texture = GetTexture(app, "low_Upper_Normal");
-	model.materials[0]->normal.prop_enabled = true;
-	model.materials[0]->normal.tex_enabled = true;
+		model.materials[0]->normal.texture = GetTexture(app, "low_Upper_Normal");
+		model.materials[0]->normal.prop_enabled = true;
+		model.materials[0]->normal.tex_enabled = true;
 
 #pragma endregion
 
 #pragma region Mat2
 
-	model.materials[1]->diffuse.texture = GetTexture(app, "low_Lower_BaseColor");
-	model.materials[1]->diffuse.prop_enabled = true;
-	model.materials[1]->diffuse.tex_enabled = true;
+		model.materials[1]->diffuse.texture = GetTexture(app, "low_Lower_BaseColor");
+		model.materials[1]->diffuse.prop_enabled = true;
+		model.materials[1]->diffuse.tex_enabled = true;
 
-	model.materials[1]->metallic.texture = GetTexture(app, "low_Lower_Metallic");
-	model.materials[1]->metallic.prop_enabled = true;
-	model.materials[1]->metallic.tex_enabled = true;
+		model.materials[1]->metallic.texture = GetTexture(app, "low_Lower_Metallic");
+		model.materials[1]->metallic.prop_enabled = true;
+		model.materials[1]->metallic.tex_enabled = true;
 
-	model.materials[1]->roughness.texture = GetTexture(app, "low_Lower_Roughness");
-	model.materials[1]->roughness.prop_enabled = true;
-	model.materials[1]->roughness.tex_enabled = true;
+		model.materials[1]->roughness.texture = GetTexture(app, "low_Lower_Roughness");
+		model.materials[1]->roughness.prop_enabled = true;
+		model.materials[1]->roughness.tex_enabled = true;
 
-	model.materials[1]->normal.texture = GetTexture(app, "low_Lower_Normal");
-	model.materials[1]->normal.prop_enabled = true;
-	model.materials[1]->normal.tex_enabled = true;
+		model.materials[1]->normal.texture = GetTexture(app, "low_Lower_Normal");
+		model.materials[1]->normal.prop_enabled = true;
+		model.materials[1]->normal.tex_enabled = true;
 
 #pragma endregion
 
 #pragma region Mat3
 
-	model.materials[2]->diffuse.texture = GetTexture(app, "low_Bcg_BaseColor");
-	model.materials[2]->diffuse.prop_enabled = true;
-	model.materials[2]->diffuse.tex_enabled = true;
+		model.materials[2]->diffuse.texture = GetTexture(app, "low_Bcg_BaseColor");
+		model.materials[2]->diffuse.prop_enabled = true;
+		model.materials[2]->diffuse.tex_enabled = true;
 
-	model.materials[2]->metallic.texture = GetTexture(app, "low_Bcg_Metallic");
-	model.materials[2]->metallic.prop_enabled = true;
-	model.materials[2]->metallic.tex_enabled = true;
+		model.materials[2]->metallic.texture = GetTexture(app, "low_Bcg_Metallic");
+		model.materials[2]->metallic.prop_enabled = true;
+		model.materials[2]->metallic.tex_enabled = true;
 
-	model.materials[2]->roughness.texture = GetTexture(app, "low_Bcg_Roughness");
-	model.materials[2]->roughness.prop_enabled = true;
-	model.materials[2]->roughness.tex_enabled = true;
+		model.materials[2]->roughness.texture = GetTexture(app, "low_Bcg_Roughness");
+		model.materials[2]->roughness.prop_enabled = true;
+		model.materials[2]->roughness.tex_enabled = true;
 
-	model.materials[2]->normal.texture = GetTexture(app, "low_Bcg_Normal");
-	model.materials[2]->normal.prop_enabled = true;
-	model.materials[2]->normal.tex_enabled = true;
+		model.materials[2]->normal.texture = GetTexture(app, "low_Bcg_Normal");
+		model.materials[2]->normal.prop_enabled = true;
+		model.materials[2]->normal.tex_enabled = true;
 
 #pragma endregion
 
 #pragma region Mat4
 
-	model.materials[3]->diffuse.texture = GetTexture(app, "low_Mag_BaseColor");
-	model.materials[3]->diffuse.prop_enabled = true;
-	model.materials[3]->diffuse.tex_enabled = true;
+		model.materials[3]->diffuse.texture = GetTexture(app, "low_Mag_BaseColor");
+		model.materials[3]->diffuse.prop_enabled = true;
+		model.materials[3]->diffuse.tex_enabled = true;
 
-	model.materials[3]->metallic.texture = GetTexture(app, "low_Mag_Metallic");
-	model.materials[3]->metallic.prop_enabled = true;
-	model.materials[3]->metallic.tex_enabled = true;
+		model.materials[3]->metallic.texture = GetTexture(app, "low_Mag_Metallic");
+		model.materials[3]->metallic.prop_enabled = true;
+		model.materials[3]->metallic.tex_enabled = true;
 
-	model.materials[3]->roughness.texture = GetTexture(app, "low_Mag_Roughness");
-	model.materials[3]->roughness.prop_enabled = true;
-	model.materials[3]->roughness.tex_enabled = true;
+		model.materials[3]->roughness.texture = GetTexture(app, "low_Mag_Roughness");
+		model.materials[3]->roughness.prop_enabled = true;
+		model.materials[3]->roughness.tex_enabled = true;
 
-	model.materials[3]->normal.texture = GetTexture(app, "low_Mag_Normal");
-	model.materials[3]->normal.prop_enabled = true;
-	model.materials[3]->normal.tex_enabled = true;
+		model.materials[3]->normal.texture = GetTexture(app, "low_Mag_Normal");
+		model.materials[3]->normal.prop_enabled = true;
+		model.materials[3]->normal.tex_enabled = true;
 
 #pragma endregion
 
 #pragma region Mat5
 
-	model.materials[4]->diffuse.texture = GetTexture(app, "low_Silencer_BaseColor");
-	model.materials[4]->diffuse.prop_enabled = true;
-	model.materials[4]->diffuse.tex_enabled = true;
+		model.materials[4]->diffuse.texture = GetTexture(app, "low_Silencer_BaseColor");
+		model.materials[4]->diffuse.prop_enabled = true;
+		model.materials[4]->diffuse.tex_enabled = true;
 
-	model.materials[4]->metallic.texture = GetTexture(app, "low_Silencer_Metallic");
-	model.materials[4]->metallic.prop_enabled = true;
-	model.materials[4]->metallic.tex_enabled = true;
+		model.materials[4]->metallic.texture = GetTexture(app, "low_Silencer_Metallic");
+		model.materials[4]->metallic.prop_enabled = true;
+		model.materials[4]->metallic.tex_enabled = true;
 
-	model.materials[4]->roughness.texture = GetTexture(app, "low_Silencer_Roughness");
-	model.materials[4]->roughness.prop_enabled = true;
-	model.materials[4]->roughness.tex_enabled = true;
+		model.materials[4]->roughness.texture = GetTexture(app, "low_Silencer_Roughness");
+		model.materials[4]->roughness.prop_enabled = true;
+		model.materials[4]->roughness.tex_enabled = true;
 
-	model.materials[4]->normal.texture = GetTexture(app, "low_Silencer_Normal");
-	model.materials[4]->normal.prop_enabled = true;
-	model.materials[4]->normal.tex_enabled = true;
+		model.materials[4]->normal.texture = GetTexture(app, "low_Silencer_Normal");
+		model.materials[4]->normal.prop_enabled = true;
+		model.materials[4]->normal.tex_enabled = true;
 
 #pragma endregion
 
 #pragma region Mat6
 
-	model.materials[5]->diffuse.texture = GetTexture(app, "low_Scope_BaseColor");
-	model.materials[5]->diffuse.prop_enabled = true;
-	model.materials[5]->diffuse.tex_enabled = true;
+		model.materials[5]->diffuse.texture = GetTexture(app, "low_Scope_BaseColor");
+		model.materials[5]->diffuse.prop_enabled = true;
+		model.materials[5]->diffuse.tex_enabled = true;
 
-	model.materials[5]->metallic.texture = GetTexture(app, "low_Scope_Metallic");
-	model.materials[5]->metallic.prop_enabled = true;
-	model.materials[5]->metallic.tex_enabled = true;
+		model.materials[5]->metallic.texture = GetTexture(app, "low_Scope_Metallic");
+		model.materials[5]->metallic.prop_enabled = true;
+		model.materials[5]->metallic.tex_enabled = true;
 
-	model.materials[5]->roughness.texture = GetTexture(app, "low_Scope_Roughness");
-	model.materials[5]->roughness.prop_enabled = true;
-	model.materials[5]->roughness.tex_enabled = true;
+		model.materials[5]->roughness.texture = GetTexture(app, "low_Scope_Roughness");
+		model.materials[5]->roughness.prop_enabled = true;
+		model.materials[5]->roughness.tex_enabled = true;
 
-	model.materials[5]->normal.texture = GetTexture(app, "low_Scope_Normal");
-	model.materials[5]->normal.prop_enabled = true;
-	model.materials[5]->normal.tex_enabled = true;
+		model.materials[5]->normal.texture = GetTexture(app, "low_Scope_Normal");
+		model.materials[5]->normal.prop_enabled = true;
+		model.materials[5]->normal.tex_enabled = true;
 
 #pragma endregion
-
-	app->models.push_back(model);
+	});
+	SetTransformScale(app->transforms, slot, glm::vec3(0.1f));
 }
 
 void LoadBackPackModel(App* app) {
-	Model model("Backpack/Survival_BackPack_2.fbx", app);
-	model.scale = glm::vec3(0.01f);
-
 	// Textures
-	Model::LoadTexture(app, "Backpack/");
-	model.materials[0]->diffuse.texture = GetTexture(app, "1001_albedo");
-	model.materials[0]->diffuse.prop_enabled = true;
-	model.materials[0]->diffuse.tex_enabled = true;
-
-	model.materials[0]->metallic.texture = GetTexture(app, "1001_metallic");
-	model.materials[0]->metallic.prop_enabled = true;
-	model.materials[0]->metallic.tex_enabled = true;
-
-	model.materials[0]->roughness.texture = GetTexture(app, "1001_roughness");
-	model.materials[0]->roughness.prop_enabled = true;
-	model.materials[0]->roughness.tex_enabled = true;
-
-	model.materials[0]->normal.texture = GetTexture(app, "1001_normal");
-	model.materials[0]->normal.prop_enabled = true;
-	model.materials[0]->normal.tex_enabled = true;
-
-	app->models.push_back(model);
+	ModelAsset::LoadTexture(app, "Backpack/");
+
+	u32 slot = LoadModelAsync(app, "Backpack/Survival_BackPack_2.fbx", [](App* app, ModelAsset& model) {
+		model.materials[0]->diffuse.texture = GetTexture(app, "1001_albedo");
+		model.materials[0]->diffuse.prop_enabled = true;
+		model.materials[0]->diffuse.tex_enabled = true;
+
+		model.materials[0]->metallic.texture = GetTexture(app, "1001_metallic");
+		model.materials[0]->metallic.prop_enabled = true;
+		model.materials[0]->metallic.tex_enabled = true;
+
+		model.materials[0]->roughness.texture = GetTexture(app, "1001_roughness");
+		model.materials[0]->roughness.prop_enabled = true;
+		model.materials[0]->roughness.tex_enabled = true;
+
+		model.materials[0]->normal.texture = GetTexture(app, "1001_normal");
+		model.materials[0]->normal.prop_enabled = true;
+		model.materials[0]->normal.tex_enabled = true;
+	});
+	SetTransformScale(app->transforms, slot, glm::vec3(0.01f));
 }
 
 void LoadPatrickModel(App* app) {
-	Model model("Patrick/Patrick.obj", app);
-
 	// Textures
-	Model::LoadTexture(app, "Backpack/");
+	ModelAsset::LoadTexture(app, "Backpack/");
 
-	app->models.push_back(model);
+	LoadModelAsync(app, "Patrick/Patrick.obj");
 }
 
 void GeneratePlaneModel(App* app, float size, int subdivisions) {
-	Model model;
+	std::shared_ptr<ModelAsset> asset = std::make_shared<ModelAsset>();
+	ModelAsset& model = *asset;
 	model.name = "Plane";
 
 	Mesh planeMesh;
@@ -407,18 +691,27 @@ void GeneratePlaneModel(App* app, float size, int subdivisions) {
 
 	planeMesh.material = model.materials.back();
 
-	planeMesh.SetupMesh();
+	MeshOptimizerStats stats = OptimizeMesh(planeMesh.vertices, planeMesh.indices);
+	ILOG("Plane (%u tris): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", (u32)planeMesh.indices.size() / 3,
+		stats.acmrBefore, stats.acmrAfter, stats.atvrBefore, stats.atvrAfter);
+
+	ComputeBounds(planeMesh.vertices.data(), (u32)planeMesh.vertices.size(),
+		planeMesh.boundsMin, planeMesh.boundsMax, planeMesh.boundsCenter, planeMesh.boundsRadius);
+	BuildMeshBvh(planeMesh.pickingBvh, planeMesh.vertices.data(), (u32)planeMesh.vertices.size(),
+		planeMesh.indices.data(), (u32)planeMesh.indices.size());
+	planeMesh.SetupMesh(app->geometryArenas);
 
 	model.meshes.push_back(planeMesh);
-	app->models.push_back(model);
+	app->assets.push_back(asset);
+	AddModelInstance(app, asset);
 }
 
 void LoadBrickPlane(App* app) {
 	GeneratePlaneModel(app, 5, 1);
 
 	// Textures
-	Model::LoadTexture(app, "Bricks/");
-	Model& last = app->models.back();
+	ModelAsset::LoadTexture(app, "Bricks/");
+	ModelAsset& last = *app->assets.back();
 
 	last.materials[0]->diffuse.texture = GetTexture(app, "bricks2");
 	last.materials[0]->diffuse.prop_enabled = true;
@@ -457,26 +750,26 @@ void InitTexturedQuad(App* app) {
 	// - element/index buffers
 	//Geometry
 	GL_CHECK(glGenBuffers(1, &app->embeddedVertices));
-	GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, app->embeddedVertices));
+	GL_CHECK(GLState::BindBuffer(GL_ARRAY_BUFFER, app->embeddedVertices));
 	GL_CHECK(glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW));
-	GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
+	GL_CHECK(GLState::BindBuffer(GL_ARRAY_BUFFER, 0));
 
 	GL_CHECK(glGenBuffers(1, &app->embeddedElements));
-	GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements));
+	GL_CHECK(GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements));
 	GL_CHECK(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW));
-	GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+	GL_CHECK(GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
 
 	// - vaos
 	//Attribute state
 	GL_CHECK(glGenVertexArrays(1, &app->vao));
-	GL_CHECK(glBindVertexArray(app->vao));
-	GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, app->embeddedVertices));
+	GL_CHECK(GLState::BindVertexArray(app->vao));
+	GL_CHECK(GLState::BindBuffer(GL_ARRAY_BUFFER, app->embeddedVertices));
 	GL_CHECK(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexV3V2), (void*)0));
 	GL_CHECK(glEnableVertexAttribArray(0));
 	GL_CHECK(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexV3V2), (void*)12));
 	GL_CHECK(glEnableVertexAttribArray(1));
-	GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements));
-	GL_CHECK(glBindVertexArray(0));
+	GL_CHECK(GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements));
+	GL_CHECK(GLState::BindVertexArray(0));
 
 	if (app->enableDebugGroups) {
 		glObjectLabel(GL_VERTEX_ARRAY, app->vao, -1, "MainVAO");
@@ -491,11 +784,11 @@ void InitFBOs(App* app) {
 
 	// Create FBO
 	glGenFramebuffers(1, &app->geometryFboHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, app->geometryFboHandle);
+	GLState::BindFramebuffer(GL_FRAMEBUFFER, app->geometryFboHandle);
 
 	// Albedo
 	glGenTextures(1, &app->albedoTexture);
-	glBindTexture(GL_TEXTURE_2D, app->albedoTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->albedoTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -503,7 +796,7 @@ void InitFBOs(App* app) {
 
 	// Normal
 	glGenTextures(1, &app->normalTexture);
-	glBindTexture(GL_TEXTURE_2D, app->normalTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->normalTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, app->displaySize.x, app->displaySize.y, 0, GL_RGB, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -511,7 +804,7 @@ void InitFBOs(App* app) {
 
 	// Position
 	glGenTextures(1, &app->positionTexture);
-	glBindTexture(GL_TEXTURE_2D, app->positionTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->positionTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, app->displaySize.x, app->displaySize.y, 0, GL_RGB, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -519,7 +812,7 @@ void InitFBOs(App* app) {
 
 	// Depth
 	glGenTextures(1, &app->depthTexture);
-	glBindTexture(GL_TEXTURE_2D, app->depthTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->depthTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -527,7 +820,7 @@ void InitFBOs(App* app) {
 
 	// MaterialProps (Metallic, Roughness, Height, Ambient Oclusion?)
 	glGenTextures(1, &app->materialPropsTexture);
-	glBindTexture(GL_TEXTURE_2D, app->materialPropsTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->materialPropsTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -546,18 +839,18 @@ void InitFBOs(App* app) {
 		ELOG("Geometry FBO initialization failed!");
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
 
 #pragma endregion
 
 #pragma region SceneFBO
 	// Create FBO
 	glGenFramebuffers(1, &app->sceneFboHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, app->sceneFboHandle);
+	GLState::BindFramebuffer(GL_FRAMEBUFFER, app->sceneFboHandle);
 
 	// Scene
 	glGenTextures(1, &app->sceneTexture);
-	glBindTexture(GL_TEXTURE_2D, app->sceneTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->sceneTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -565,7 +858,7 @@ void InitFBOs(App* app) {
 
 	// Brightness
 	glGenTextures(1, &app->brightnessTexture);
-	glBindTexture(GL_TEXTURE_2D, app->brightnessTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->brightnessTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -581,7 +874,7 @@ void InitFBOs(App* app) {
 		ELOG("Scene FBO initialization failed!");
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
 #pragma endregion
 
 }
@@ -593,8 +886,8 @@ void InitPingPongBlurFBO(App* app) {
 	glGenTextures(2, app->pingPongTextures);
 	for (unsigned int i = 0; i < 2; i++)
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, app->pingPongFboHandle[i]);
-		glBindTexture(GL_TEXTURE_2D, app->pingPongTextures[i]);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, app->pingPongFboHandle[i]);
+		GLState::BindTexture(GL_TEXTURE_2D, app->pingPongTextures[i]);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -607,13 +900,20 @@ void InitPingPongBlurFBO(App* app) {
 		}
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void Init(App* app)
 {
+	GLState::Invalidate();
+
 	GLUtils::InitDebugging(app);
 
+	app->profiler.debugGroups = app->enableDebugGroups;
+	app->profiler.Init();
+
+	InitAssetLoader(app);
+
 	InitGUI(app);
 
 	app->mode = Mode_Deferred;
@@ -627,6 +927,11 @@ void Init(App* app)
 
 	InitFBOs(app);
 	InitPingPongBlurFBO(app);
+	InitOcclusionCuller(app->occlusionCuller, app->displaySize);
+	InitGpuCuller(app->gpuCuller);
+	InitGeometryArenas(app->geometryArenas, app->enableDebugGroups);
+	InitDrawBatches(app->drawBatches);
+	InitMaterialTextures(app->materialTextures, GetDefaultMaterialTextureMode());
 	InitTexturedQuad(app);
 
 #pragma region Shaders
@@ -634,10 +939,12 @@ void Init(App* app)
 	app->shaders.emplace_back("Shaders/debug_textures.glsl", "DEBUG_TEXTURES");
 	app->debugTexturesShaderIdx = app->shaders.size() - 1;
 
-	app->shaders.emplace_back("Shaders/forward.glsl", "FORWARD");
+	// The mesh shaders are compiled for the material texture mode
+	const char* materialTextureDefines = GetMaterialTextureDefines(app->materialTextures.mode);
+	app->shaders.emplace_back("Shaders/forward.glsl", "FORWARD", false, materialTextureDefines);
 	app->forwardShaderIdx = app->shaders.size() - 1;
 
-	app->shaders.emplace_back("Shaders/geometry_pass.glsl", "GEOMETRY_PASS");
+	app->shaders.emplace_back("Shaders/geometry_pass.glsl", "GEOMETRY_PASS", false, materialTextureDefines);
 	app->geometryPassShaderIdx = app->shaders.size() - 1;
 
 	app->shaders.emplace_back("Shaders/deferred_lighting.glsl", "DEFERRED_LIGHTING");
@@ -649,18 +956,33 @@ void Init(App* app)
 	app->shaders.emplace_back("Shaders/composition.glsl", "COMPOSITION");
 	app->compositionShaderIdx = app->shaders.size() - 1;
 
+	app->shaders.emplace_back("Shaders/culling.glsl", "HIZ_DOWNSAMPLE", true);
+	app->hizDownsampleShaderIdx = app->shaders.size() - 1;
+
+	app->shaders.emplace_back("Shaders/culling.glsl", "HIZ_CULL", true);
+	app->hizCullShaderIdx = app->shaders.size() - 1;
+
+	app->shaders.emplace_back("Shaders/culling.glsl", "GPU_CULL", true);
+	app->gpuCullShaderIdx = app->shaders.size() - 1;
+
+	// Set every frame or for every draw batch, resolved once
+	app->forwardUniforms = GetMeshShaderUniforms(app->shaders[app->forwardShaderIdx]);
+	app->geometryPassUniforms = GetMeshShaderUniforms(app->shaders[app->geometryPassShaderIdx]);
+	app->occlusionCuller.uniforms = GetOcclusionUniforms(app->shaders[app->hizCullShaderIdx], app->shaders[app->hizDownsampleShaderIdx]);
+	app->gpuCuller.uniforms = GetGpuCullUniforms(app->shaders[app->gpuCullShaderIdx]);
+
 #pragma endregion
 
 #pragma region Models
 
-	
+	// The imports run on the worker threads, the models stream in during the first frames
 	LoadBackPackModel(app);
 	LoadBrickPlane(app);
 	LoadPatrickModel(app);
 	LoadRifleModel(app);
 
 	app->selectedModel = &app->models[0];
-	app->selectedMaterial = app->selectedModel->materials[0];
+	app->selectedMaterial = app->selectedModel->asset->materials.empty() ? nullptr : app->selectedModel->asset->materials[0];
 
 	app->camera.SetMode(CAMERA_ORBIT);
 
@@ -692,64 +1014,144 @@ void Init(App* app)
 #pragma endregion
 
 	InitUBOs(app);
+}
 
-	// Enable debug options
-	if (app->enableDebugGroups) {
-		for (Model model : app->models) {
-			for (Mesh mesh : model.meshes) {
-				glObjectLabel(GL_VERTEX_ARRAY, mesh.VAO, -1, "ModelVAO");
-				glObjectLabel(GL_BUFFER, mesh.VBO, -1, "ModelVBO");
-				glObjectLabel(GL_BUFFER, mesh.EBO, -1, "ModelEBO");
-			}
+#pragma endregion
 
-			for (const auto& texture : app->textures_loaded) {
-				glObjectLabel(GL_TEXTURE, texture->id, -1, texture->path.c_str());
-			}
+bool SetupBenchmarkScene(App* app, const std::string& scene, Mode mode)
+{
+	app->mode = mode;
+
+	if (scene == "all") {
+		app->renderAll = true;
+		return true;
+	}
+
+	if (scene == "stress") {
+		app->renderAll = true;
+		SpawnStressInstances(app, STRESS_SCENE_INSTANCES);
+		return true;
+	}
+
+	// Match the model name case-insensitively, so "backpack" finds "Survival_BackPack_2"
+	auto toLower = [](std::string str) {
+		for (char& c : str) c = (char)tolower((unsigned char)c);
+		return str;
+	};
+
+	std::string sceneLower = toLower(scene);
+	for (ModelInstance& model : app->models) {
+		if (toLower(model.name).find(sceneLower) != std::string::npos) {
+			app->renderAll = false;
+			app->selectedModel = &model;
+			app->selectedMaterial = model.asset->materials.empty() ? nullptr : model.asset->materials[0];
+			return true;
 		}
 	}
+
+	ELOG("Unknown benchmark scene '%s'. Available scenes:", scene.c_str());
+	ELOG("  all");
+	ELOG("  stress");
+	for (const ModelInstance& model : app->models) {
+		ELOG("  %s", model.name.c_str());
+	}
+	return false;
 }
 
-#pragma endregion
+void SpawnStressInstances(App* app, u32 count)
+{
+	// The stress instances are always the last ones
+	app->models.resize(app->models.size() - app->stressInstanceCount);
+	TruncateTransforms(app->transforms, (u32)app->models.size());
+	app->stressInstanceCount = 0;
+	if (app->selectedModel && app->selectedModel >= app->models.data() + app->models.size()) {
+		app->selectedModel = app->models.empty() ? NULL : &app->models[0];
+	}
+	if (count == 0) return;
+
+	std::shared_ptr<ModelAsset> backpack;
+	for (const std::shared_ptr<ModelAsset>& asset : app->assets) {
+		if (asset->name == "Survival_BackPack_2") backpack = asset;
+	}
+	if (!backpack) {
+		ELOG("The stress test needs the backpack asset");
+		return;
+	}
+
+	// Square grid on the ground, centered on the origin
+	u32 side = (u32)ceilf(sqrtf((f32)count));
+	f32 offset = (side - 1) * STRESS_INSTANCE_SPACING * 0.5f;
+	for (u32 i = 0; i < count; ++i) {
+		u32 slot = AddModelInstance(app, backpack);
+		ModelInstance& instance = app->models[slot];
+		instance.name = backpack->name + "_" + std::to_string(i);
+		SetTransformPosition(app->transforms, slot,
+			glm::vec3((i % side) * STRESS_INSTANCE_SPACING - offset, 0.0f, (i / side) * STRESS_INSTANCE_SPACING - offset));
+		SetTransformRotation(app->transforms, slot, glm::vec3(0.0f, (f32)((i * 37) % 360), 0.0f));
+		SetTransformScale(app->transforms, slot, glm::vec3(0.01f));
+	}
+	app->stressInstanceCount = count;
+	ILOG("Stress test: %u instances of %s", count, backpack->name.c_str());
+}
+
+void ChangeMaterialTextureMode(App* app, MaterialTextureMode mode)
+{
+	MaterialTextureMode previous = app->materialTextures.mode;
+	if (mode == previous || !IsMaterialTextureModeSupported(mode)) return;
+
+	// Every reference is dropped, the batches regroup and upload the materials again on the next frame
+	Shader& forward = app->shaders[app->forwardShaderIdx];
+	Shader& geometryPass = app->shaders[app->geometryPassShaderIdx];
+	SetMaterialTextureMode(app->materialTextures, mode);
+	if (!forward.SetDefines(GetMaterialTextureDefines(mode)) || !geometryPass.SetDefines(GetMaterialTextureDefines(mode))) {
+		ELOG("Material textures: the mesh shaders do not compile for %s", GetMaterialTextureModeName(mode));
+		SetMaterialTextureMode(app->materialTextures, previous);
+		forward.SetDefines(GetMaterialTextureDefines(previous));
+		geometryPass.SetDefines(GetMaterialTextureDefines(previous));
+		return;
+	}
+	ILOG("Material textures: %s", GetMaterialTextureModeName(mode));
+}
 
 void ResizeFBO(App* app) {
 	// Albedo
-	glBindTexture(GL_TEXTURE_2D, app->albedoTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->albedoTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
 		app->displaySize.x, app->displaySize.y,
 		0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 
 	// Normal
-	glBindTexture(GL_TEXTURE_2D, app->normalTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->normalTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F,
 		app->displaySize.x, app->displaySize.y,
 		0, GL_RGB, GL_FLOAT, NULL);
 
 	// Position
-	glBindTexture(GL_TEXTURE_2D, app->positionTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->positionTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F,
 		app->displaySize.x, app->displaySize.y,
 		0, GL_RGB, GL_FLOAT, NULL);
 
 	// Depth
-	glBindTexture(GL_TEXTURE_2D, app->depthTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->depthTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24,
 		app->displaySize.x, app->displaySize.y,
 		0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 
 	// Material Properties
-	glBindTexture(GL_TEXTURE_2D, app->materialPropsTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->materialPropsTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F,
 		app->displaySize.x, app->displaySize.y,
 		0, GL_RGBA, GL_FLOAT, NULL);
 
 	// Scene
-	glBindTexture(GL_TEXTURE_2D, app->sceneTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->sceneTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F,
 		app->displaySize.x, app->displaySize.y,
 		0, GL_RGBA, GL_FLOAT, NULL);
 	
 	// Brightness
-	glBindTexture(GL_TEXTURE_2D, app->brightnessTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->brightnessTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F,
 		app->displaySize.x, app->displaySize.y,
 		0, GL_RGBA, GL_FLOAT, NULL);
@@ -757,24 +1159,27 @@ void ResizeFBO(App* app) {
 	// Blur Ping Pong
 	for (unsigned int i = 0; i < 2; i++)
 	{
-		glBindTexture(GL_TEXTURE_2D, app->pingPongTextures[i]);
+		GLState::BindTexture(GL_TEXTURE_2D, app->pingPongTextures[i]);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F,
 			app->displaySize.x, app->displaySize.y,
 			0, GL_RGBA, GL_FLOAT, NULL);
 	}
 
 	// Composite
-	glBindTexture(GL_TEXTURE_2D, app->compositeTexture);
+	GLState::BindTexture(GL_TEXTURE_2D, app->compositeTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F,
 		app->displaySize.x, app->displaySize.y,
 		0, GL_RGBA, GL_FLOAT, NULL);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLState::BindTexture(GL_TEXTURE_2D, 0);
 
+	ResizeOcclusionCuller(app->occlusionCuller, app->displaySize);
 }
 
 void Gui(App* app)
 {
+	PROFILE_SCOPE(app, "Gui");
+
 	ImGuiDockNodeFlags dock_flags = 0;
 	dock_flags |= ImGuiDockNodeFlags_PassthruCentralNode;
 	ImGui::DockSpaceOverViewport(0, dock_flags);
@@ -787,6 +1192,23 @@ void Gui(App* app)
 
 void Update(App* app)
 {
+	PROFILE_SCOPE(app, "Update");
+
+	{
+		PROFILE_SCOPE(app, "AssetUploads");
+		ProcessAssetUploads(app, app->assetLoader.uploadBudgetMs);
+	}
+
+	{
+		PROFILE_SCOPE(app, "TextureRegistry");
+		UpdateTextureRegistry(app);
+	}
+
+	{
+		PROFILE_SCOPE(app, "TextureStreaming");
+		UpdateTextureStreaming(app, app->assetLoader.textures.budgetMB);
+	}
+
 	//TODO_K: optimize this to not run every frame?
 	for (Shader& shader : app->shaders)
 	{
@@ -805,7 +1227,9 @@ void Update(App* app)
 
 		for (size_t i = 0; i < app->models.size(); ++i)
 		{
-			app->models[i].rotation.y = fmod(app->models[i].rotation.y + (app->rotate_speed), 360.0f);
+			glm::vec3 rotation = GetTransformRotation(app->transforms, (u32)i);
+			rotation.y = fmod(rotation.y + (app->rotate_speed), 360.0f);
+			SetTransformRotation(app->transforms, (u32)i, rotation);
 		}
 	}
 
@@ -839,7 +1263,7 @@ void Update(App* app)
 		}
 	}
 
-	app->camera.SetOrbitTarget(app->selectedModel->position);
+	app->camera.SetOrbitTarget(GetTransformPosition(app->transforms, (u32)(app->selectedModel - app->models.data())));
 
 	if (app->input.keys[Key::K_F] == BUTTON_RELEASE) {
 		if (app->camera.Mode == CAMERA_FREE) {
@@ -864,6 +1288,12 @@ void Update(App* app)
 	if (app->input.keys[Key::K_CTRL] == BUTTON_PRESSED)
 		app->camera.ProcessKeyboard(M_DOWN, app->deltaTime);
 
+	// ImGui keeps the clicks on its windows, see platform.cpp
+	if (app->input.mouseButtons[MouseButton::LEFT] == BUTTON_PRESS)
+	{
+		PickModel(app, app->input.mousePos);
+	}
+
 	if (app->input.mouseButtons[MouseButton::RIGHT] == BUTTON_PRESSED)
 	{
 		float xoffset = app->input.mouseDelta.x;
@@ -881,149 +1311,212 @@ void Update(App* app)
 	app->time += app->deltaTime;
 }
 
+// Indirect commands of the frame, from the CPU or the GPU culling
+static GLuint SceneCommandsBuffer(App* app) {
+	return app->gpuCulling ? app->gpuCuller.commandsBuffer : app->drawCommandsBuffer.handle;
+}
+
+// Every batch with commands in the given buffer, one multi draw each (the culling leaves out the
+// models that are not drawn)
+void DrawModels(App* app, Shader& shader, const MeshShaderUniforms& uniforms, GLuint commandsBuffer) {
+	GL_CHECK(GLState::BindBuffer(GL_DRAW_INDIRECT_BUFFER, commandsBuffer));
+
+	// Draw counts of the GPU culled commands, one per batch
+	bool drawCounts = app->gpuCulling && GLExt.drawIndirectCount;
+	if (drawCounts) {
+		GL_CHECK(GLState::BindBuffer(GL_PARAMETER_BUFFER, app->gpuCuller.drawCountsBuffer));
+	}
+
+	// Read with the draw id, the base instance of every command. The CPU culling draws the sorted
+	// batches of the render queue, the GPU culling the static ones it has command ranges for
+	DrawBatches& batches = app->drawBatches;
+	const std::vector<DrawBatch>& drawBatches = app->gpuCulling ? batches.batches : app->renderQueue.batches;
+	GL_CHECK(GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, app->transformsBuffer.handle));
+	GL_CHECK(GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, batches.drawDataBuffer));
+	GL_CHECK(GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, batches.materialsBuffer));
+	SetMaterialTextureUnits(shader, uniforms);
+
+	// Without bind mode the materials buffer references the textures, nothing is bound per batch
+	bool bindTextures = app->materialTextures.mode == MaterialTextures_Bind;
+	if (app->materialTextures.mode == MaterialTextures_Arrays) {
+		BindMaterialTextureArrays(app->materialTextures);
+	}
+
+	i32 boundArena = -1;
+	for (size_t b = 0; b < drawBatches.size(); ++b) {
+		const DrawBatch& batch = drawBatches[b];
+		if (batch.commandCount == 0) continue;
+
+		const GeometryArena& arena = app->geometryArenas.arenas[batch.arena];
+		if (boundArena != (i32)batch.arena) {
+			GLState::BindVertexArray(arena.vao);
+			shader.Set(uniforms.compactVertex, arena.format == VertexFormat_Compact);
+			boundArena = (i32)batch.arena;
+		}
+		if (bindTextures) BindMaterialTextures(*batch.material);
+
+		const void* commands = (void*)((size_t)batch.firstCommand * sizeof(DrawElementsIndirectCommand));
+		if (drawCounts) {
+			GLState::MultiDrawElementsIndirectCount(GL_TRIANGLES, arena.indexType, commands, (GLintptr)b * sizeof(u32), batch.commandCount, 0);
+		}
+		else {
+			GLState::MultiDrawElementsIndirect(GL_TRIANGLES, arena.indexType, commands, batch.commandCount, 0);
+		}
+	}
+}
+
 void ForwardRendering(App* app) {
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
 
-	if (app->enableDebugGroups) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 2, -1, "Forward");
+	PROFILE_GPU_SCOPE(app, "Forward");
 	Shader& currentShader = app->shaders[app->forwardShaderIdx];
 	currentShader.Use();
 
-	GL_CHECK(glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->globalParamsUBO.buffer.handle, 0, app->globalParamsUBO.blockSize));
-
-	if (app->renderAll) {
-		for (Model& model : app->models) {
-			glBindBufferRange(GL_UNIFORM_BUFFER, 1,
-				app->transformsUBO.buffer.handle,
-				model.bufferOffset,
-				app->transformsUBO.blockSize);
-			model.Draw(currentShader);
-		}
-	}
-	else {
-		glBindBufferRange(GL_UNIFORM_BUFFER, 1,
-			app->transformsUBO.buffer.handle,
-			app->selectedModel->bufferOffset,
-			app->transformsUBO.blockSize);
-		app->selectedModel->Draw(currentShader);
-	}
+	GL_CHECK(GLState::BindBufferRange(GL_UNIFORM_BUFFER, 0, app->globalParamsUBO.buffer.handle, 0, app->globalParamsUBO.blockSize));
+	DrawModels(app, currentShader, app->forwardUniforms, SceneCommandsBuffer(app));
 
 	glDisable(GL_BLEND);
-
-	if (app->enableDebugGroups) glPopDebugGroup();
 }
 
 void DeferredRendering(App* app) {
-	if (app->enableDebugGroups) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 4, -1, "Deferred");
+	PROFILE_GL_SCOPE(app, "Deferred");
 
 	// --- Geometry Pass ---
-	glBindFramebuffer(GL_FRAMEBUFFER, app->geometryFboHandle);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
 	Shader& geoShader = app->shaders[app->geometryPassShaderIdx];
-	geoShader.Use();
-	geoShader.SetFloat("parallaxScale", app->parallax_scale);
-	geoShader.SetFloat("numLayers", app->parallax_layers);
-
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->globalParamsUBO.buffer.handle, 0, app->globalParamsUBO.blockSize);
-	if (app->renderAll) {
-		for (Model& model : app->models) {
-			glBindBufferRange(GL_UNIFORM_BUFFER, 1,
-				app->transformsUBO.buffer.handle,
-				model.bufferOffset,
-				app->transformsUBO.blockSize);
-			model.Draw(geoShader);
-		}
+	Shader& hizCullShader = app->shaders[app->hizCullShaderIdx];
+	OcclusionCuller& occlusion = app->occlusionCuller;
+	bool occlusionCulling = app->occlusionCulling && !app->gpuCulling && !app->drawCommands.empty();
+
+	if (occlusionCulling) {
+		PROFILE_GPU_SCOPE(app, "OcclusionEarly");
+		CullOcclusionEarly(occlusion, hizCullShader, app->drawCommandsBuffer.handle, (u32)app->drawCommands.size());
 	}
-	else {
-		glBindBufferRange(GL_UNIFORM_BUFFER, 1,
-			app->transformsUBO.buffer.handle,
-			app->selectedModel->bufferOffset,
-			app->transformsUBO.blockSize);
-		app->selectedModel->Draw(geoShader);
+
+	{
+		PROFILE_GPU_SCOPE(app, "Geometry");
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, app->geometryFboHandle);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		geoShader.Use();
+		geoShader.Set(app->geometryPassUniforms.parallaxScale, app->parallax_scale);
+		geoShader.Set(app->geometryPassUniforms.parallaxLayers, app->parallax_layers);
+
+		GLState::BindBufferRange(GL_UNIFORM_BUFFER, 0, app->globalParamsUBO.buffer.handle, 0, app->globalParamsUBO.blockSize);
+		DrawModels(app, geoShader, app->geometryPassUniforms, SceneCommandsBuffer(app));
+	}
+
+	if (app->occlusionCulling && app->gpuCulling) {
+		PROFILE_GPU_SCOPE(app, "OcclusionLate");
+
+		// Single phase, the GPU culling of the next frame tests against this depth
+		BuildDepthPyramid(occlusion, app->shaders[app->hizDownsampleShaderIdx], app->depthTexture, app->viewProjection);
+	}
+
+	if (occlusionCulling) {
+		PROFILE_GPU_SCOPE(app, "OcclusionLate");
+		Shader& downsampleShader = app->shaders[app->hizDownsampleShaderIdx];
+
+		// Meshes hidden last frame, against the depth of the ones drawn so far
+		BuildDepthPyramid(occlusion, downsampleShader, app->depthTexture, app->viewProjection);
+		CullOcclusionLate(occlusion, hizCullShader, app->drawCommandsBuffer.handle);
+
+		geoShader.Use();
+		geoShader.Set(app->geometryPassUniforms.parallaxScale, app->parallax_scale);
+		geoShader.Set(app->geometryPassUniforms.parallaxLayers, app->parallax_layers);
+		DrawModels(app, geoShader, app->geometryPassUniforms, occlusion.lateCommandsBuffer);
+
+		// With the full depth, for the early phase of the next frame
+		BuildDepthPyramid(occlusion, downsampleShader, app->depthTexture, app->viewProjection);
 	}
 
 	// --- Lighting Pass ---
-	glBindFramebuffer(GL_FRAMEBUFFER, app->sceneFboHandle);
-	glDisable(GL_DEPTH_TEST);
-	glClear(GL_COLOR_BUFFER_BIT);
+	{
+		PROFILE_GPU_SCOPE(app, "Lighting");
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, app->sceneFboHandle);
+		glDisable(GL_DEPTH_TEST);
+		glClear(GL_COLOR_BUFFER_BIT);
 
-	Shader& lightShader = app->shaders[app->deferredLightingShaderIdx];
-	lightShader.Use();
+		Shader& lightShader = app->shaders[app->deferredLightingShaderIdx];
+		lightShader.Use();
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, app->albedoTexture);
-	lightShader.SetInt("gAlbedo", 0);
+		GLState::ActiveTexture(GL_TEXTURE0);
+		GLState::BindTexture(GL_TEXTURE_2D, app->albedoTexture);
+		lightShader.SetInt("gAlbedo", 0);
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, app->normalTexture);
-	lightShader.SetInt("gNormal", 1);
+		GLState::ActiveTexture(GL_TEXTURE1);
+		GLState::BindTexture(GL_TEXTURE_2D, app->normalTexture);
+		lightShader.SetInt("gNormal", 1);
 
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, app->positionTexture);
-	lightShader.SetInt("gPosition", 2);
+		GLState::ActiveTexture(GL_TEXTURE2);
+		GLState::BindTexture(GL_TEXTURE_2D, app->positionTexture);
+		lightShader.SetInt("gPosition", 2);
 
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, app->materialPropsTexture);
-	lightShader.SetInt("gMatProps", 3);
+		GLState::ActiveTexture(GL_TEXTURE3);
+		GLState::BindTexture(GL_TEXTURE_2D, app->materialPropsTexture);
+		lightShader.SetInt("gMatProps", 3);
 
-	glBindVertexArray(app->vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+		GLState::BindVertexArray(app->vao);
+		GLState::DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	}
 
 	// --- Bloom Pass ---
-	Shader& bloomShader = app->shaders[app->bloomPassShaderIdx];
-	bloomShader.Use();
-
-	bool horizontal = true, first_iteration = true;
-	for (unsigned int i = 0; i < app->bloomAmount; i++)
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, app->pingPongFboHandle[horizontal]);
-		bloomShader.SetBool("horizontal", horizontal);
+		PROFILE_GPU_SCOPE(app, "Bloom");
+		Shader& bloomShader = app->shaders[app->bloomPassShaderIdx];
+		bloomShader.Use();
+		GLState::BindVertexArray(app->vao);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, first_iteration ? app->brightnessTexture : app->pingPongTextures[!horizontal]);
+		bool horizontal = true, first_iteration = true;
+		for (unsigned int i = 0; i < app->bloomAmount; i++)
+		{
+			GLState::BindFramebuffer(GL_FRAMEBUFFER, app->pingPongFboHandle[horizontal]);
+			bloomShader.SetBool("horizontal", horizontal);
 
-		glBindVertexArray(app->vao);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+			GLState::ActiveTexture(GL_TEXTURE0);
+			GLState::BindTexture(GL_TEXTURE_2D, first_iteration ? app->brightnessTexture : app->pingPongTextures[!horizontal]);
+			GLState::DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 
-		horizontal = !horizontal;
-		if (first_iteration)
-			first_iteration = false;
+			horizontal = !horizontal;
+			if (first_iteration)
+				first_iteration = false;
+		}
+		app->bloomTexture = app->pingPongTextures[!horizontal];
 	}
-	app->bloomTexture = app->pingPongTextures[!horizontal];
 
 	// --- Final Composition ---
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	Shader& compositionShader = app->shaders[app->compositionShaderIdx];
-	compositionShader.Use();
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, app->sceneTexture);
-	compositionShader.SetInt("tScene", 0);
+	{
+		PROFILE_GPU_SCOPE(app, "Composition");
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
+		Shader& compositionShader = app->shaders[app->compositionShaderIdx];
+		compositionShader.Use();
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, app->bloomTexture);
-	compositionShader.SetInt("tBloom", 1);
+		GLState::ActiveTexture(GL_TEXTURE0);
+		GLState::BindTexture(GL_TEXTURE_2D, app->sceneTexture);
+		compositionShader.SetInt("tScene", 0);
 
-	compositionShader.SetBool("bloom_enable", app->bloomEnable);
-	compositionShader.SetFloat("bloom_exposure", app->bloomExposure);
-	compositionShader.SetFloat("bloom_gamma", app->bloomGamma);
+		GLState::ActiveTexture(GL_TEXTURE1);
+		GLState::BindTexture(GL_TEXTURE_2D, app->bloomTexture);
+		compositionShader.SetInt("tBloom", 1);
 
-	glBindVertexArray(app->vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+		compositionShader.SetBool("bloom_enable", app->bloomEnable);
+		compositionShader.SetFloat("bloom_exposure", app->bloomExposure);
+		compositionShader.SetFloat("bloom_gamma", app->bloomGamma);
 
-	glEnable(GL_DEPTH_TEST);
+		GLState::BindVertexArray(app->vao);
+		GLState::DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 
-	if (app->enableDebugGroups) glPopDebugGroup();
+		glEnable(GL_DEPTH_TEST);
+	}
 }
 
 void DebugRendering(App* app) {
-	if (app->enableDebugGroups) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 3, -1, "DebugFBO");
+	PROFILE_GPU_SCOPE(app, "DebugFBO");
 
 	// --- Display Pass ---
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
 	glDisable(GL_DEPTH_TEST);
 	glClear(GL_COLOR_BUFFER_BIT);
 
@@ -1031,47 +1524,45 @@ void DebugRendering(App* app) {
 	displayShader.Use();
 	displayShader.SetInt("uDisplayMode", app->displayMode);
 
-	glActiveTexture(GL_TEXTURE0);
+	GLState::ActiveTexture(GL_TEXTURE0);
 	switch (app->displayMode) {
 	case Display_Albedo:
-		glBindTexture(GL_TEXTURE_2D, app->albedoTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, app->albedoTexture);
 		break;
 	case Display_Normals:
-		glBindTexture(GL_TEXTURE_2D, app->normalTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, app->normalTexture);
 		break;
 	case Display_Positions:
-		glBindTexture(GL_TEXTURE_2D, app->positionTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, app->positionTexture);
 		break;
 	case Display_Depth:
-		glBindTexture(GL_TEXTURE_2D, app->depthTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, app->depthTexture);
 		glTexParameteri(GL_TEXTURE_2D, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_DEPTH_COMPONENT);
 		break;
 	case Display_MatProps:
-		glBindTexture(GL_TEXTURE_2D, app->materialPropsTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, app->materialPropsTexture);
 		break;
 	case Display_LightPass:
-		glBindTexture(GL_TEXTURE_2D, app->sceneTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, app->sceneTexture);
 		break;
 	case Display_Brightness:
-		glBindTexture(GL_TEXTURE_2D, app->brightnessTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, app->brightnessTexture);
 		break;
 	case Display_Blurr:
-		glBindTexture(GL_TEXTURE_2D, app->bloomTexture);
+		GLState::BindTexture(GL_TEXTURE_2D, app->bloomTexture);
 		break;
 	}
 
-	glBindVertexArray(app->vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	GLState::BindVertexArray(app->vao);
+	GLState::DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 	glEnable(GL_DEPTH_TEST);
-
-	if (app->enableDebugGroups) glPopDebugGroup();
 }
 
 void Render(App* app)
 {
 	GLUtils::ErrorGuard renderGuard("MainRender");
 
-	if (app->enableDebugGroups) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, "MainRenderPass");
+	PROFILE_GL_SCOPE(app, "MainRenderPass");
 
 	GL_CHECK(glViewport(0, 0, app->displaySize.x, app->displaySize.y));
 	GL_CHECK(glClearColor(app->bg_color.r, app->bg_color.g, app->bg_color.b, app->bg_color.a));
@@ -1095,5 +1586,12 @@ void Render(App* app)
 		break;
 	}
 
-	if (app->enableDebugGroups) glPopDebugGroup();
+	// Calls of the engine that reached GL, ImGui draws after and binds its state without the cache
+	const GLStateCounters& glCalls = GLState::GetFrameCounters();
+	app->profiler.SetCounter("Draw calls", glCalls.draws);
+	app->profiler.SetCounter("Program binds", glCalls.programBinds);
+	app->profiler.SetCounter("VAO binds", glCalls.vertexArrayBinds);
+	app->profiler.SetCounter("Texture binds", glCalls.textureBinds);
+	app->profiler.SetCounter("Buffer binds", glCalls.bufferBinds);
+	app->profiler.SetCounter("Redundant binds", glCalls.redundantBinds);
 }
\ No newline at end of file
@@ -6,6 +6,15 @@
 #include "shader.h"
 #include "camera.h"
 #include "panels.h"
+#include "profiler.h"
+#include "input_recorder.h"
+#include "asset_loader.h"
+#include "occlusion_culling.h"
+#include "gpu_culling.h"
+#include "geometry_arena.h"
+#include "draw_batches.h"
+#include "render_queue.h"
+#include "transforms.h"
 #include <glad/glad.h>
 
 typedef glm::vec2  vec2;
@@ -86,6 +95,7 @@ struct App
     ivec2 displaySize;
 
     Input input;
+    InputRecorder inputRecorder;
 
     // Graphics Details
     char gpuName[64];
@@ -94,14 +104,20 @@ struct App
 
     bool enableDebugGroups = true;
 
+    Profiler profiler;
+    AssetLoader assetLoader;
+
     // Engine
-    std::vector<Model>                          models;
+    std::vector<std::shared_ptr<ModelAsset>>    assets;
+    std::vector<ModelInstance>                  models;     // Instances of the assets
+    TransformStorage                            transforms; // Of the instances, indexed like models
     std::vector<Shader>                         shaders;
     std::vector<Light>                          lights;
-    std::vector<std::shared_ptr<Texture>>       textures_loaded;
+    TextureRegistry                             textureRegistry;
 
     Camera      camera;
-    Model*      selectedModel;
+    glm::mat4   viewProjection = glm::mat4(1.0f);   // Of the current frame, set by UpdateUBOs
+    ModelInstance* selectedModel = NULL;
     Light*      selectedLight;
 
     std::shared_ptr<Material> selectedMaterial;
@@ -114,6 +130,9 @@ struct App
     float parallax_scale = 0.1;
     float parallax_layers = 20.0;
 
+    float lodBias       = 1.0f;     // Scales the LOD screen size thresholds, higher keeps the detail further away
+    int forcedLod       = -1;       // -1 selects the LODs by screen size
+
     bool bloomEnable          = true;
     int bloomAmount     = 5;
     float bloomExposure = 1.0f;
@@ -130,11 +149,65 @@ struct App
     u32 geometryPassShaderIdx;
     u32 bloomPassShaderIdx;
     u32 compositionShaderIdx;
+    u32 hizDownsampleShaderIdx;
+    u32 hizCullShaderIdx;
+    u32 gpuCullShaderIdx;
+
+    // Per batch uniforms of the mesh shaders
+    MeshShaderUniforms forwardUniforms;
+    MeshShaderUniforms geometryPassUniforms;
 
     //UBOs
-    UniformBuffer transformsUBO;
     UniformBuffer globalParamsUBO;
 
+    // Model and normal matrices (SSBO), indexed by the transform index of the draw data. Only the
+    // transforms that changed are uploaded
+    Buffer transformsBuffer;
+
+    // Every static mesh lives in the arena of its vertex layout, drawn in batches
+    GeometryArenas geometryArenas;
+    DrawBatches drawBatches;
+
+    // How the mesh shaders reach the material textures, bindless or texture arrays when available
+    MaterialTextures materialTextures;
+
+    // Indirect draws, rebuilt every frame from the meshlets that pass the culling
+    Buffer drawCommandsBuffer;
+    std::vector<DrawElementsIndirectCommand> drawCommands;
+
+    // The visible draws of the CPU culling, sorted by state and depth before their commands are written
+    RenderQueue renderQueue;
+    bool sortDraws = true;
+    bool meshletCulling = true;
+    bool meshletConeCulling = false;    // The mesh passes draw both faces, back facing clusters are visible
+    MeshletCullStats meshletStats;
+
+    // Instances of an asset mesh merged into instanced commands, see CullScene
+    bool instancing = true;
+    std::vector<u32> instanceDrawIds;   // Instance lists of the frame, see UploadInstanceDrawIds
+    std::vector<u32> usedMaterials;     // Of the packets of the frame, see UpdateDrawBatchMaterials
+    u32 instancedCommands = 0;
+    u32 instancedMeshes = 0;
+
+    // Grid of backpack instances appended to the scene, see SpawnStressInstances
+    u32 stressInstanceCount = 0;
+
+    // Frustum culling of whole meshes, in world space
+    SceneBounds sceneBounds;
+    SceneBvh sceneBvh;          // Over the same meshes, also used for the mouse picking
+    bool frustumCulling = true;
+    bool bvhCulling = true;     // Walk the BVH instead of testing every mesh
+    u32 sceneMeshCount = 0;
+    u32 visibleMeshCount = 0;
+
+    // Hi-Z occlusion culling of the deferred geometry pass, see occlusion_culling.h
+    OcclusionCuller occlusionCuller;
+    bool occlusionCulling = true;
+
+    // Meshlets culled by a compute shader into the indirect commands, see gpu_culling.h
+    GpuCuller gpuCuller;
+    bool gpuCulling = false;
+
     // Framebuffer resources
     GLuint geometryFboHandle;
     GLuint albedoTexture;
@@ -172,4 +245,19 @@ void Update(App* app);
 
 void Render(App* app);
 
-void ResizeFBO(App* app);
\ No newline at end of file
+void ResizeFBO(App* app);
+
+// Selects what the headless benchmark renders: "all" models, the "stress" grid of instances or the first model whose name contains the scene string
+bool SetupBenchmarkScene(App* app, const std::string& scene, Mode mode);
+
+/**
+ * Replaces the stress test instances with a grid of count backpacks, sharing the loaded asset.
+ * A count of 0 removes them.
+ */
+void SpawnStressInstances(App* app, u32 count);
+
+/**
+ * Switches the material texture mode and compiles the mesh shaders for it. On a compile error the
+ * previous mode is restored.
+ */
+void ChangeMaterialTextureMode(App* app, MaterialTextureMode mode);
\ No newline at end of file
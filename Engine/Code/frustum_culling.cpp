@@ -0,0 +1,153 @@
+// frustum_culling.cpp
+#include "frustum_culling.h"
+#include "model.h"
+
+#if CULLING_SIMD_WIDTH == 8
+#include <immintrin.h>
+
+typedef __m256 SimdFloat;
+static inline SimdFloat SimdLoad(const f32* p) { return _mm256_loadu_ps(p); }
+static inline SimdFloat SimdSet(f32 value) { return _mm256_set1_ps(value); }
+static inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a, b); }
+static inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a, b); }
+static inline SimdFloat SimdMin(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a, b); }
+static inline SimdFloat SimdAnd(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a, b); }
+static inline SimdFloat SimdGreater(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline SimdFloat SimdTrue() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+static inline int SimdMask(SimdFloat a) { return _mm256_movemask_ps(a); }
+#else
+#include <xmmintrin.h>
+
+typedef __m128 SimdFloat;
+static inline SimdFloat SimdLoad(const f32* p) { return _mm_loadu_ps(p); }
+static inline SimdFloat SimdSet(f32 value) { return _mm_set1_ps(value); }
+static inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm_add_ps(a, b); }
+static inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a, b); }
+static inline SimdFloat SimdMin(SimdFloat a, SimdFloat b) { return _mm_min_ps(a, b); }
+static inline SimdFloat SimdAnd(SimdFloat a, SimdFloat b) { return _mm_and_ps(a, b); }
+static inline SimdFloat SimdGreater(SimdFloat a, SimdFloat b) { return _mm_cmpgt_ps(a, b); }
+static inline SimdFloat SimdTrue() { return _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps()); }
+static inline int SimdMask(SimdFloat a) { return _mm_movemask_ps(a); }
+#endif
+
+void ComputeBounds(const Vertex* vertices, u32 vertexCount, glm::vec3& boundsMin, glm::vec3& boundsMax, glm::vec3& center, f32& radius)
+{
+    boundsMin = boundsMax = center = glm::vec3(0.0f);
+    radius = 0.0f;
+    if (vertexCount == 0) return;
+
+    boundsMin = glm::vec3(FLT_MAX);
+    boundsMax = glm::vec3(-FLT_MAX);
+    for (u32 i = 0; i < vertexCount; ++i) {
+        boundsMin = glm::min(boundsMin, vertices[i].Position);
+        boundsMax = glm::max(boundsMax, vertices[i].Position);
+    }
+    center = (boundsMin + boundsMax) * 0.5f;
+
+    f32 radiusSquared = 0.0f;
+    for (u32 i = 0; i < vertexCount; ++i) {
+        glm::vec3 offset = vertices[i].Position - center;
+        radiusSquared = glm::max(radiusSquared, glm::dot(offset, offset));
+    }
+    radius = sqrtf(radiusSquared);
+}
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection)
+{
+    // The clip space planes are sums of the matrix rows
+    const glm::mat4& m = viewProjection;
+    glm::vec4 rowX(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 rowY(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 rowZ(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 rowW(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = rowW + rowX;
+    frustum.planes[1] = rowW - rowX;
+    frustum.planes[2] = rowW + rowY;
+    frustum.planes[3] = rowW - rowY;
+    frustum.planes[4] = rowW + rowZ;
+    frustum.planes[5] = rowW - rowZ;
+    for (glm::vec4& plane : frustum.planes) {
+        f32 length = glm::length(glm::vec3(plane));
+        if (length > 0.0f) plane /= length;
+    }
+    return frustum;
+}
+
+void ResizeSceneBounds(SceneBounds& bounds, u32 count)
+{
+    // Padded with empty bounds at the origin, their results are never read
+    size_t size = (count + CULLING_SIMD_WIDTH - 1) / CULLING_SIMD_WIDTH * CULLING_SIMD_WIDTH;
+    for (std::vector<f32>* array : { &bounds.centerX, &bounds.centerY, &bounds.centerZ,
+        &bounds.extentX, &bounds.extentY, &bounds.extentZ, &bounds.radius }) {
+        array->resize(size, 0.0f);
+    }
+    bounds.visible.resize(count);
+    bounds.count = count;
+}
+
+void SetSceneBounds(SceneBounds& bounds, u32 index, const glm::mat4& modelMat, const glm::vec3& boundsMin, const glm::vec3& boundsMax, f32 radius)
+{
+    glm::vec3 localCenter = (boundsMin + boundsMax) * 0.5f;
+    glm::vec3 localExtent = (boundsMax - boundsMin) * 0.5f;
+
+    glm::vec3 center = glm::vec3(modelMat * glm::vec4(localCenter, 1.0f));
+    glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(modelMat[0])), glm::abs(glm::vec3(modelMat[1])), glm::abs(glm::vec3(modelMat[2])));
+    glm::vec3 extent = absolute * localExtent;
+    f32 maxScale = glm::max(glm::length(glm::vec3(modelMat[0])), glm::max(glm::length(glm::vec3(modelMat[1])), glm::length(glm::vec3(modelMat[2]))));
+
+    bounds.centerX[index] = center.x;
+    bounds.centerY[index] = center.y;
+    bounds.centerZ[index] = center.z;
+    bounds.extentX[index] = extent.x;
+    bounds.extentY[index] = extent.y;
+    bounds.extentZ[index] = extent.z;
+    bounds.radius[index] = radius * maxScale;
+}
+
+u32 CullSceneBounds(SceneBounds& bounds, const Frustum& frustum)
+{
+    SimdFloat planeX[6], planeY[6], planeZ[6], planeW[6];
+    SimdFloat absPlaneX[6], absPlaneY[6], absPlaneZ[6];
+    for (u32 p = 0; p < 6; ++p) {
+        const glm::vec4& plane = frustum.planes[p];
+        planeX[p] = SimdSet(plane.x);
+        planeY[p] = SimdSet(plane.y);
+        planeZ[p] = SimdSet(plane.z);
+        planeW[p] = SimdSet(plane.w);
+        absPlaneX[p] = SimdSet(fabsf(plane.x));
+        absPlaneY[p] = SimdSet(fabsf(plane.y));
+        absPlaneZ[p] = SimdSet(fabsf(plane.z));
+    }
+    SimdFloat zero = SimdSet(0.0f);
+
+    u32 visibleCount = 0;
+    for (u32 i = 0; i < bounds.count; i += CULLING_SIMD_WIDTH) {
+        SimdFloat cx = SimdLoad(&bounds.centerX[i]);
+        SimdFloat cy = SimdLoad(&bounds.centerY[i]);
+        SimdFloat cz = SimdLoad(&bounds.centerZ[i]);
+        SimdFloat ex = SimdLoad(&bounds.extentX[i]);
+        SimdFloat ey = SimdLoad(&bounds.extentY[i]);
+        SimdFloat ez = SimdLoad(&bounds.extentZ[i]);
+        SimdFloat radius = SimdLoad(&bounds.radius[i]);
+
+        SimdFloat inside = SimdTrue();
+        for (u32 p = 0; p < 6; ++p) {
+            SimdFloat distance = SimdAdd(SimdAdd(SimdMul(planeX[p], cx), SimdMul(planeY[p], cy)),
+                SimdAdd(SimdMul(planeZ[p], cz), planeW[p]));
+            // Reach of the box towards the plane normal, the sphere wins when it is smaller
+            SimdFloat boxReach = SimdAdd(SimdAdd(SimdMul(absPlaneX[p], ex), SimdMul(absPlaneY[p], ey)), SimdMul(absPlaneZ[p], ez));
+            SimdFloat reach = SimdMin(boxReach, radius);
+            inside = SimdAnd(inside, SimdGreater(SimdAdd(distance, reach), zero));
+        }
+
+        int mask = SimdMask(inside);
+        u32 lanes = glm::min(bounds.count - i, (u32)CULLING_SIMD_WIDTH);
+        for (u32 lane = 0; lane < lanes; ++lane) {
+            bounds.visible[i + lane] = (mask >> lane) & 1;
+            visibleCount += bounds.visible[i + lane];
+        }
+    }
+    return visibleCount;
+}
@@ -0,0 +1,56 @@
+// frustum_culling.h
+#pragma once
+
+#include "platform.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Vertex;
+
+// Bounds tested per instruction: AVX2 when the build targets it (/arch:AVX2), SSE otherwise
+#if defined(__AVX2__)
+#define CULLING_SIMD_WIDTH 8
+#else
+#define CULLING_SIMD_WIDTH 4
+#endif
+
+/**
+ * Bounding box of the vertices and the bounding sphere centered on it.
+ */
+void ComputeBounds(const Vertex* vertices, u32 vertexCount, glm::vec3& boundsMin, glm::vec3& boundsMax, glm::vec3& center, f32& radius);
+
+struct Frustum {
+    glm::vec4 planes[6];    // Left, right, bottom, top, near, far. Normalized, the inside is positive.
+};
+
+/**
+ * Planes of the clip volume of the matrix (Gribb-Hartmann). With a model-view-projection matrix they are in model space.
+ */
+Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+/*
+ * World space bounds of every mesh of the scene, SoA and padded to the SIMD width. The box and the
+ * sphere share the center, as ComputeBounds centers the sphere on the box.
+ */
+struct SceneBounds {
+    std::vector<f32> centerX, centerY, centerZ;
+    std::vector<f32> extentX, extentY, extentZ;     // Half size of the box, along the world axes
+    std::vector<f32> radius;
+    std::vector<u8> visible;                        // Filled by CullSceneBounds
+    u32 count = 0;
+};
+
+void ResizeSceneBounds(SceneBounds& bounds, u32 count);
+
+/**
+ * Transforms the model space box of a mesh to a world space box (Arvo) and scales its sphere
+ * by the largest axis of the transform.
+ */
+void SetSceneBounds(SceneBounds& bounds, u32 index, const glm::mat4& modelMat, const glm::vec3& boundsMin, const glm::vec3& boundsMax, f32 radius);
+
+/**
+ * Tests every bound against the frustum, CULLING_SIMD_WIDTH at a time. A bound is culled when its box
+ * or its sphere is fully outside a plane, whichever is tighter. Returns the visible count.
+ */
+u32 CullSceneBounds(SceneBounds& bounds, const Frustum& frustum);
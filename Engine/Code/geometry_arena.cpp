@@ -0,0 +1,207 @@
+// geometry_arena.cpp
+#include "geometry_arena.h"
+#include "model.h"
+
+#include <vector>
+
+static const char* ArenaNames[GeometryArena_Count] = { "GeometryFloat", "GeometryCompact16", "GeometryCompact32" };
+
+// Vertex attributes of the arena layout, the same locations for both formats
+static void SetupArenaVertexArray(GeometryArenas& arenas, GeometryArena& arena)
+{
+    GLState::BindVertexArray(arena.vao);
+    GLState::BindBuffer(GL_ARRAY_BUFFER, arena.vertexBuffer);
+    GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.indexBuffer);
+
+    if (arena.format == VertexFormat_Compact) {
+        // Decoded by the shaders when compactVertex is set, see vertex_format.h
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, position));
+
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, normal));
+
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, texCoords));
+
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, tangent));
+
+        // The bitangent is rebuilt from the normal, the tangent and its sign
+        glDisableVertexAttribArray(4);
+    }
+    else {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    }
+
+    // One draw id per instance, offset by the base instance of the command
+    GLState::BindBuffer(GL_ARRAY_BUFFER, arenas.drawIdBuffer);
+    glEnableVertexAttribArray(GEOMETRY_DRAW_ID_LOCATION);
+    glVertexAttribIPointer(GEOMETRY_DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+    glVertexAttribDivisor(GEOMETRY_DRAW_ID_LOCATION, 1);
+
+    GLState::BindVertexArray(0);
+    GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void LabelArena(GeometryArenas& arenas, GeometryArena& arena, GeometryArenaType type)
+{
+    if (!arenas.labels) return;
+
+    std::string name = ArenaNames[type];
+    glObjectLabel(GL_VERTEX_ARRAY, arena.vao, -1, (name + "VAO").c_str());
+    glObjectLabel(GL_BUFFER, arena.vertexBuffer, -1, (name + "Vertices").c_str());
+    glObjectLabel(GL_BUFFER, arena.indexBuffer, -1, (name + "Indices").c_str());
+}
+
+// New buffer of the given size with the used part of the old one, which is deleted
+static GLuint GrowBuffer(GLuint buffer, u32 usedSize, u32 newSize)
+{
+    GLuint newBuffer;
+    glGenBuffers(1, &newBuffer);
+    GLState::BindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+
+    if (usedSize > 0) {
+        GLState::BindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedSize);
+        GLState::BindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    GLState::BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    GLState::DeleteBuffers(1, &buffer);
+    return newBuffer;
+}
+
+// Grows the draw id buffer to hold capacity ids, and writes the ids of the scene draws again, as the
+// instance lists overwrite what follows them
+static void WriteDrawIds(GeometryArenas& arenas, u32 capacity)
+{
+    GLState::BindBuffer(GL_ARRAY_BUFFER, arenas.drawIdBuffer);
+    if (capacity > arenas.drawIdCapacity) {
+        arenas.drawIdCapacity = glm::max(capacity, arenas.drawIdCapacity * 2);
+        glBufferData(GL_ARRAY_BUFFER, arenas.drawIdCapacity * sizeof(u32), NULL, GL_DYNAMIC_DRAW);
+    }
+
+    std::vector<u32> drawIds(arenas.sceneDrawIdCount);
+    for (u32 i = 0; i < arenas.sceneDrawIdCount; ++i) drawIds[i] = i;
+    if (!drawIds.empty()) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, drawIds.size() * sizeof(u32), drawIds.data());
+    }
+    GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InitGeometryArenas(GeometryArenas& arenas, bool labels)
+{
+    arenas.labels = labels;
+
+    // Every arena VAO points to it, so it is only grown in place
+    arenas.drawIdCapacity = 0;
+    arenas.sceneDrawIdCount = 0;
+    glGenBuffers(1, &arenas.drawIdBuffer);
+    WriteDrawIds(arenas, 1024);
+
+    for (u32 type = 0; type < GeometryArena_Count; ++type) {
+        GeometryArena& arena = arenas.arenas[type];
+        arena.format = type == GeometryArena_Float ? VertexFormat_Float : VertexFormat_Compact;
+        arena.indexType = type == GeometryArena_Compact16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        arena.vertexSize = arena.format == VertexFormat_Compact ? sizeof(CompactVertex) : sizeof(Vertex);
+        arena.indexSize = arena.indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+
+        // Allocated on the first mesh, most scenes use a single layout
+        glGenVertexArrays(1, &arena.vao);
+        glGenBuffers(1, &arena.vertexBuffer);
+        glGenBuffers(1, &arena.indexBuffer);
+        SetupArenaVertexArray(arenas, arena);
+        LabelArena(arenas, arena, (GeometryArenaType)type);
+    }
+}
+
+void ShutdownGeometryArenas(GeometryArenas& arenas)
+{
+    for (GeometryArena& arena : arenas.arenas) {
+        GLState::DeleteVertexArrays(1, &arena.vao);
+        GLState::DeleteBuffers(1, &arena.vertexBuffer);
+        GLState::DeleteBuffers(1, &arena.indexBuffer);
+    }
+    GLState::DeleteBuffers(1, &arenas.drawIdBuffer);
+    arenas = GeometryArenas();
+}
+
+GeometryArenaType GetGeometryArenaType(VertexFormat format, GLenum indexType)
+{
+    if (format == VertexFormat_Float) return GeometryArena_Float;
+    return indexType == GL_UNSIGNED_SHORT ? GeometryArena_Compact16 : GeometryArena_Compact32;
+}
+
+void AllocateGeometry(GeometryArenas& arenas, GeometryArenaType type, const void* vertices, u32 vertexCount,
+    const void* indices, u32 indexCount, u32& vertexOffset, u32& indexOffset)
+{
+    GeometryArena& arena = arenas.arenas[type];
+
+    bool grown = false;
+    if (arena.vertexCount + vertexCount > arena.vertexCapacity) {
+        u32 capacity = glm::max(arena.vertexCapacity * 2, (u32)GEOMETRY_ARENA_INITIAL_VERTICES);
+        capacity = glm::max(capacity, arena.vertexCount + vertexCount);
+        arena.vertexBuffer = GrowBuffer(arena.vertexBuffer, arena.vertexCount * arena.vertexSize, capacity * arena.vertexSize);
+        arena.vertexCapacity = capacity;
+        grown = true;
+    }
+    if (arena.indexCount + indexCount > arena.indexCapacity) {
+        u32 capacity = glm::max(arena.indexCapacity * 2, (u32)GEOMETRY_ARENA_INITIAL_INDICES);
+        capacity = glm::max(capacity, arena.indexCount + indexCount);
+        arena.indexBuffer = GrowBuffer(arena.indexBuffer, arena.indexCount * arena.indexSize, capacity * arena.indexSize);
+        arena.indexCapacity = capacity;
+        grown = true;
+    }
+    if (grown) {
+        SetupArenaVertexArray(arenas, arena);
+        LabelArena(arenas, arena, type);
+    }
+
+    vertexOffset = arena.vertexCount;
+    indexOffset = arena.indexCount;
+
+    GLState::BindBuffer(GL_COPY_WRITE_BUFFER, arena.vertexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)vertexOffset * arena.vertexSize, (GLsizeiptr)vertexCount * arena.vertexSize, vertices);
+    GLState::BindBuffer(GL_COPY_WRITE_BUFFER, arena.indexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)indexOffset * arena.indexSize, (GLsizeiptr)indexCount * arena.indexSize, indices);
+    GLState::BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    arena.vertexCount += vertexCount;
+    arena.indexCount += indexCount;
+    arenas.allocationCount++;
+}
+
+void ReserveDrawIds(GeometryArenas& arenas, u32 count)
+{
+    arenas.sceneDrawIdCount = count;
+    WriteDrawIds(arenas, count);
+}
+
+u32 UploadInstanceDrawIds(GeometryArenas& arenas, const std::vector<u32>& drawIds)
+{
+    u32 first = arenas.sceneDrawIdCount;
+    if (drawIds.empty()) return first;
+
+    u32 count = first + (u32)drawIds.size();
+    if (count > arenas.drawIdCapacity) WriteDrawIds(arenas, count);
+
+    GLState::BindBuffer(GL_ARRAY_BUFFER, arenas.drawIdBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)first * sizeof(u32), (GLsizeiptr)drawIds.size() * sizeof(u32), drawIds.data());
+    GLState::BindBuffer(GL_ARRAY_BUFFER, 0);
+    return first;
+}
@@ -0,0 +1,80 @@
+// geometry_arena.h
+#pragma once
+
+#include "platform.h"
+#include "vertex_format.h"
+#include <glad/glad.h>
+
+#include <vector>
+
+#define GEOMETRY_ARENA_INITIAL_VERTICES     (1 << 18)
+#define GEOMETRY_ARENA_INITIAL_INDICES      (1 << 20)
+#define GEOMETRY_DRAW_ID_LOCATION           5           // Matches aDrawId in the mesh shaders
+
+// One arena per vertex layout and index type, as a multi draw shares both
+enum GeometryArenaType
+{
+    GeometryArena_Float,        // Vertex, 32 bit indices
+    GeometryArena_Compact16,    // CompactVertex, 16 bit indices
+    GeometryArena_Compact32,    // CompactVertex, 32 bit indices
+    GeometryArena_Count
+};
+
+/*
+ * Vertex and index buffer shared by every static mesh of a layout, with its VAO. Meshes are
+ * appended and never freed; they keep their first vertex (the base vertex of their draws, so the
+ * indices stay mesh relative) and first index. The buffers double when full, copied on the GPU.
+ */
+struct GeometryArena {
+    GLuint vao = 0;
+    GLuint vertexBuffer = 0;
+    GLuint indexBuffer = 0;
+    VertexFormat format = VertexFormat_Float;
+    GLenum indexType = GL_UNSIGNED_INT;
+    u32 vertexSize = 0;
+    u32 indexSize = 0;
+
+    u32 vertexCapacity = 0;
+    u32 vertexCount = 0;
+    u32 indexCapacity = 0;
+    u32 indexCount = 0;
+};
+
+/*
+ * The arenas and the draw ids: 0, 1, 2... read as a per instance attribute of every arena VAO,
+ * so the base instance of an indirect command picks the per draw data of the shaders. After the
+ * ids of the scene draws come the instance lists of the frame: an instanced command starts at
+ * one of them, each of its instances reading the draw id of a different mesh instance.
+ */
+struct GeometryArenas {
+    GeometryArena arenas[GeometryArena_Count];
+    GLuint drawIdBuffer = 0;
+    u32 drawIdCapacity = 0;
+    u32 sceneDrawIdCount = 0;
+    u32 allocationCount = 0;    // Meshes appended so far, changes whenever one is uploaded
+    bool labels = false;        // GL object labels for the debuggers
+};
+
+void InitGeometryArenas(GeometryArenas& arenas, bool labels);
+
+void ShutdownGeometryArenas(GeometryArenas& arenas);
+
+GeometryArenaType GetGeometryArenaType(VertexFormat format, GLenum indexType);
+
+/**
+ * Appends the vertices and indices of a mesh to its arena, growing it if needed. vertexOffset and
+ * indexOffset get where they were placed.
+ */
+void AllocateGeometry(GeometryArenas& arenas, GeometryArenaType type, const void* vertices, u32 vertexCount,
+    const void* indices, u32 indexCount, u32& vertexOffset, u32& indexOffset);
+
+/**
+ * Writes the draw ids [0, count) of the scene draws.
+ */
+void ReserveDrawIds(GeometryArenas& arenas, u32 count);
+
+/**
+ * Uploads the instance lists of the frame after the scene draw ids. Returns where they start, the
+ * base instance of an instanced command being that plus the offset of its list.
+ */
+u32 UploadInstanceDrawIds(GeometryArenas& arenas, const std::vector<u32>& drawIds);
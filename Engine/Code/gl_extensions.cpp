@@ -0,0 +1,52 @@
+// gl_extensions.cpp
+#include "gl_extensions.h"
+
+#include <string.h>
+
+GLExtensions GLExt;
+
+static bool IsVersionAtLeast(int major, int minor)
+{
+    return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+bool GLUtils::HasExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, name) == 0) return true;
+    }
+    return false;
+}
+
+void GLUtils::LoadExtensions(GLADloadproc load)
+{
+    GLExt = GLExtensions();
+
+    if (IsVersionAtLeast(4, 4) || HasExtension("GL_ARB_buffer_storage")) {
+        GLExt.BufferStorage = (PFNGLBUFFERSTORAGEPROC_EXT)load("glBufferStorage");
+        GLExt.bufferStorage = GLExt.BufferStorage != NULL;
+    }
+
+    if (IsVersionAtLeast(4, 6)) {
+        GLExt.MultiDrawElementsIndirectCount = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC_EXT)load("glMultiDrawElementsIndirectCount");
+    }
+    else if (HasExtension("GL_ARB_indirect_parameters")) {
+        GLExt.MultiDrawElementsIndirectCount = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC_EXT)load("glMultiDrawElementsIndirectCountARB");
+    }
+    GLExt.drawIndirectCount = GLExt.MultiDrawElementsIndirectCount != NULL;
+
+    GLExt.textureCompressionS3TC = HasExtension("GL_EXT_texture_compression_s3tc");
+
+    if (HasExtension("GL_ARB_bindless_texture")) {
+        GLExt.GetTextureHandle = (PFNGLGETTEXTUREHANDLEPROC_EXT)load("glGetTextureHandleARB");
+        GLExt.MakeTextureHandleResident = (PFNGLMAKETEXTUREHANDLERESIDENTPROC_EXT)load("glMakeTextureHandleResidentARB");
+        GLExt.MakeTextureHandleNonResident = (PFNGLMAKETEXTUREHANDLENONRESIDENTPROC_EXT)load("glMakeTextureHandleNonResidentARB");
+        GLExt.bindlessTexture = GLExt.GetTextureHandle && GLExt.MakeTextureHandleResident && GLExt.MakeTextureHandleNonResident;
+    }
+
+    ILOG("GL extensions: buffer storage %s, indirect count %s, S3TC %s, bindless textures %s", GLExt.bufferStorage ? "yes" : "no",
+        GLExt.drawIndirectCount ? "yes" : "no", GLExt.textureCompressionS3TC ? "yes" : "no", GLExt.bindlessTexture ? "yes" : "no");
+}
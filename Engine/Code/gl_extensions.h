@@ -0,0 +1,66 @@
+// gl_extensions.h
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+// glad is generated for the GL 4.3 core profile. Newer entry points are loaded here at runtime,
+// and every feature has a flag so the renderer can fall back when the driver does not expose it.
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT   0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT     0x0080
+#endif
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_DYNAMIC_STORAGE_BIT  0x0100
+#endif
+#ifndef GL_CLIENT_STORAGE_BIT
+#define GL_CLIENT_STORAGE_BIT   0x0200
+#endif
+#ifndef GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT
+#define GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT 0x00004000
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_PARAMETER_BUFFER
+#define GL_PARAMETER_BUFFER     0x80EE
+#endif
+
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC_EXT)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC_EXT)(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+typedef GLuint64 (APIENTRYP PFNGLGETTEXTUREHANDLEPROC_EXT)(GLuint texture);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTPROC_EXT)(GLuint64 handle);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLENONRESIDENTPROC_EXT)(GLuint64 handle);
+
+struct GLExtensions {
+    // GL 4.4 or ARB_buffer_storage: immutable buffers that can stay mapped while the GPU reads them
+    bool bufferStorage = false;
+    PFNGLBUFFERSTORAGEPROC_EXT BufferStorage = NULL;
+
+    // GL 4.6 or ARB_indirect_parameters: multi draw indirect with the draw count in GL_PARAMETER_BUFFER
+    bool drawIndirectCount = false;
+    PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC_EXT MultiDrawElementsIndirectCount = NULL;
+
+    // EXT_texture_compression_s3tc: BC1 (BC4/BC5 and BC7 are core since GL 3.0 and 4.2)
+    bool textureCompressionS3TC = false;
+
+    // ARB_bindless_texture: 64 bit texture handles the shaders sample without binding
+    bool bindlessTexture = false;
+    PFNGLGETTEXTUREHANDLEPROC_EXT GetTextureHandle = NULL;
+    PFNGLMAKETEXTUREHANDLERESIDENTPROC_EXT MakeTextureHandleResident = NULL;
+    PFNGLMAKETEXTUREHANDLENONRESIDENTPROC_EXT MakeTextureHandleNonResident = NULL;
+};
+
+extern GLExtensions GLExt;
+
+namespace GLUtils {
+    bool HasExtension(const char* name);
+
+    /**
+     * Loads the entry points above GL 4.3. Call it right after gladLoadGLLoader, with the same loader.
+     */
+    void LoadExtensions(GLADloadproc load);
+}
@@ -0,0 +1,259 @@
+// gl_state.cpp
+#include "gl_state.h"
+#include "gl_extensions.h"
+
+#include <string.h>
+
+GLStateCache GLStateShadow;
+
+static i32 GetTextureTarget(GLenum target)
+{
+    switch (target) {
+    case GL_TEXTURE_2D: return GLStateTexture_2D;
+    case GL_TEXTURE_2D_ARRAY: return GLStateTexture_2DArray;
+    case GL_TEXTURE_CUBE_MAP: return GLStateTexture_CubeMap;
+    default: return -1;
+    }
+}
+
+static i32 GetBufferTarget(GLenum target)
+{
+    switch (target) {
+    case GL_ARRAY_BUFFER: return GLStateBuffer_Array;
+    case GL_ELEMENT_ARRAY_BUFFER: return GLStateBuffer_ElementArray;
+    case GL_COPY_READ_BUFFER: return GLStateBuffer_CopyRead;
+    case GL_COPY_WRITE_BUFFER: return GLStateBuffer_CopyWrite;
+    case GL_PIXEL_PACK_BUFFER: return GLStateBuffer_PixelPack;
+    case GL_PIXEL_UNPACK_BUFFER: return GLStateBuffer_PixelUnpack;
+    case GL_DRAW_INDIRECT_BUFFER: return GLStateBuffer_DrawIndirect;
+    case GL_DISPATCH_INDIRECT_BUFFER: return GLStateBuffer_DispatchIndirect;
+    case GL_PARAMETER_BUFFER: return GLStateBuffer_Parameter;
+    case GL_SHADER_STORAGE_BUFFER: return GLStateBuffer_ShaderStorage;
+    case GL_UNIFORM_BUFFER: return GLStateBuffer_Uniform;
+    case GL_ATOMIC_COUNTER_BUFFER: return GLStateBuffer_AtomicCounter;
+    default: return -1;
+    }
+}
+
+// Shadowed indexed bindings of the target, NULL for the others
+static GLIndexedBuffer* GetIndexedBuffer(GLenum target, GLuint index)
+{
+    if (index >= GL_STATE_BUFFER_INDICES) return NULL;
+    if (target == GL_SHADER_STORAGE_BUFFER) return &GLStateShadow.shaderStorageBuffers[index];
+    if (target == GL_UNIFORM_BUFFER) return &GLStateShadow.uniformBuffers[index];
+    return NULL;
+}
+
+void GLState::Invalidate()
+{
+    GLStateCache& state = GLStateShadow;
+    state.program = GL_STATE_UNKNOWN;
+    state.vertexArray = GL_STATE_UNKNOWN;
+    state.activeUnit = GL_STATE_UNKNOWN;
+    memset(state.textures, 0xFF, sizeof(state.textures));
+    memset(state.buffers, 0xFF, sizeof(state.buffers));
+    for (u32 i = 0; i < GL_STATE_BUFFER_INDICES; ++i) {
+        state.shaderStorageBuffers[i] = { GL_STATE_UNKNOWN, 0, 0 };
+        state.uniformBuffers[i] = { GL_STATE_UNKNOWN, 0, 0 };
+    }
+    state.drawFramebuffer = GL_STATE_UNKNOWN;
+    state.readFramebuffer = GL_STATE_UNKNOWN;
+}
+
+void GLState::BeginFrame()
+{
+    GLStateShadow.frame = {};
+    Invalidate();
+}
+
+const GLStateCounters& GLState::GetFrameCounters()
+{
+    return GLStateShadow.frame;
+}
+
+void GLState::UseProgram(GLuint program)
+{
+    GLStateCache& state = GLStateShadow;
+    if (state.program == program) {
+        state.frame.redundantBinds++;
+        return;
+    }
+    glUseProgram(program);
+    state.program = program;
+    state.frame.programBinds++;
+}
+
+void GLState::BindVertexArray(GLuint vertexArray)
+{
+    GLStateCache& state = GLStateShadow;
+    if (state.vertexArray == vertexArray) {
+        state.frame.redundantBinds++;
+        return;
+    }
+    glBindVertexArray(vertexArray);
+    state.vertexArray = vertexArray;
+    state.buffers[GLStateBuffer_ElementArray] = GL_STATE_UNKNOWN;
+    state.frame.vertexArrayBinds++;
+}
+
+void GLState::ActiveTexture(GLenum unit)
+{
+    GLStateCache& state = GLStateShadow;
+    u32 index = unit - GL_TEXTURE0;
+    if (state.activeUnit == index) return;
+    glActiveTexture(unit);
+    state.activeUnit = index;
+}
+
+void GLState::BindTexture(GLenum target, GLuint texture)
+{
+    GLStateCache& state = GLStateShadow;
+    i32 slot = GetTextureTarget(target);
+    bool shadowed = slot >= 0 && state.activeUnit < GL_STATE_TEXTURE_UNITS;
+    if (shadowed && state.textures[state.activeUnit][slot] == texture) {
+        state.frame.redundantBinds++;
+        return;
+    }
+    glBindTexture(target, texture);
+    if (shadowed) state.textures[state.activeUnit][slot] = texture;
+    state.frame.textureBinds++;
+}
+
+void GLState::BindBuffer(GLenum target, GLuint buffer)
+{
+    GLStateCache& state = GLStateShadow;
+    i32 slot = GetBufferTarget(target);
+    if (slot >= 0 && state.buffers[slot] == buffer) {
+        state.frame.redundantBinds++;
+        return;
+    }
+    glBindBuffer(target, buffer);
+    if (slot >= 0) state.buffers[slot] = buffer;
+    state.frame.bufferBinds++;
+}
+
+void GLState::BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    GLStateCache& state = GLStateShadow;
+    GLIndexedBuffer* indexed = GetIndexedBuffer(target, index);
+    if (indexed && indexed->buffer == buffer && indexed->size == -1) {
+        state.frame.redundantBinds++;
+        return;
+    }
+    glBindBufferBase(target, index, buffer);
+    if (indexed) *indexed = { buffer, 0, -1 };
+
+    // Also binds the generic binding point of the target
+    i32 slot = GetBufferTarget(target);
+    if (slot >= 0) state.buffers[slot] = buffer;
+    state.frame.bufferBinds++;
+}
+
+void GLState::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    GLStateCache& state = GLStateShadow;
+    GLIndexedBuffer* indexed = GetIndexedBuffer(target, index);
+    if (indexed && indexed->buffer == buffer && indexed->offset == offset && indexed->size == size) {
+        state.frame.redundantBinds++;
+        return;
+    }
+    glBindBufferRange(target, index, buffer, offset, size);
+    if (indexed) *indexed = { buffer, offset, size };
+
+    i32 slot = GetBufferTarget(target);
+    if (slot >= 0) state.buffers[slot] = buffer;
+    state.frame.bufferBinds++;
+}
+
+void GLState::BindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    GLStateCache& state = GLStateShadow;
+    bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+    bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+    if ((!draw || state.drawFramebuffer == framebuffer) && (!read || state.readFramebuffer == framebuffer)) {
+        state.frame.redundantBinds++;
+        return;
+    }
+    glBindFramebuffer(target, framebuffer);
+    if (draw) state.drawFramebuffer = framebuffer;
+    if (read) state.readFramebuffer = framebuffer;
+    state.frame.framebufferBinds++;
+}
+
+void GLState::DeleteProgram(GLuint program)
+{
+    // Stays in use until another program is, but is no longer the one to compare with
+    if (GLStateShadow.program == program) GLStateShadow.program = GL_STATE_UNKNOWN;
+    glDeleteProgram(program);
+}
+
+void GLState::DeleteVertexArrays(GLsizei count, const GLuint* vertexArrays)
+{
+    GLStateCache& state = GLStateShadow;
+    for (GLsizei i = 0; i < count; ++i) {
+        if (vertexArrays[i] != 0 && state.vertexArray == vertexArrays[i]) {
+            state.vertexArray = 0;
+            state.buffers[GLStateBuffer_ElementArray] = GL_STATE_UNKNOWN;
+        }
+    }
+    glDeleteVertexArrays(count, vertexArrays);
+}
+
+void GLState::DeleteTextures(GLsizei count, const GLuint* textures)
+{
+    GLStateCache& state = GLStateShadow;
+    for (GLsizei i = 0; i < count; ++i) {
+        if (textures[i] == 0) continue;
+        for (u32 unit = 0; unit < GL_STATE_TEXTURE_UNITS; ++unit) {
+            for (u32 target = 0; target < GLStateTexture_Count; ++target) {
+                if (state.textures[unit][target] == textures[i]) state.textures[unit][target] = 0;
+            }
+        }
+    }
+    glDeleteTextures(count, textures);
+}
+
+void GLState::DeleteBuffers(GLsizei count, const GLuint* buffers)
+{
+    GLStateCache& state = GLStateShadow;
+    for (GLsizei i = 0; i < count; ++i) {
+        if (buffers[i] == 0) continue;
+        for (u32 target = 0; target < GLStateBuffer_Count; ++target) {
+            if (state.buffers[target] == buffers[i]) state.buffers[target] = 0;
+        }
+        for (u32 index = 0; index < GL_STATE_BUFFER_INDICES; ++index) {
+            if (state.shaderStorageBuffers[index].buffer == buffers[i]) state.shaderStorageBuffers[index] = { 0, 0, -1 };
+            if (state.uniformBuffers[index].buffer == buffers[i]) state.uniformBuffers[index] = { 0, 0, -1 };
+        }
+    }
+    glDeleteBuffers(count, buffers);
+}
+
+void GLState::DeleteFramebuffers(GLsizei count, const GLuint* framebuffers)
+{
+    GLStateCache& state = GLStateShadow;
+    for (GLsizei i = 0; i < count; ++i) {
+        if (framebuffers[i] == 0) continue;
+        if (state.drawFramebuffer == framebuffers[i]) state.drawFramebuffer = 0;
+        if (state.readFramebuffer == framebuffers[i]) state.readFramebuffer = 0;
+    }
+    glDeleteFramebuffers(count, framebuffers);
+}
+
+void GLState::DrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+    glDrawElements(mode, count, type, indices);
+    GLStateShadow.frame.draws++;
+}
+
+void GLState::MultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride)
+{
+    glMultiDrawElementsIndirect(mode, type, indirect, drawCount, stride);
+    GLStateShadow.frame.draws++;
+}
+
+void GLState::MultiDrawElementsIndirectCount(GLenum mode, GLenum type, const void* indirect, GLintptr drawCount, GLsizei maxDrawCount, GLsizei stride)
+{
+    GLExt.MultiDrawElementsIndirectCount(mode, type, indirect, drawCount, maxDrawCount, stride);
+    GLStateShadow.frame.draws++;
+}
@@ -0,0 +1,106 @@
+// gl_state.h
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+#define GL_STATE_TEXTURE_UNITS      32      // Units shadowed, binds to the others always reach GL
+#define GL_STATE_BUFFER_INDICES     16      // Indexed shader storage and uniform bindings shadowed
+#define GL_STATE_UNKNOWN            0xFFFFFFFF  // Never matches, so the next bind reaches GL
+
+enum GLStateTextureTarget
+{
+    GLStateTexture_2D,
+    GLStateTexture_2DArray,
+    GLStateTexture_CubeMap,
+    GLStateTexture_Count
+};
+
+enum GLStateBufferTarget
+{
+    GLStateBuffer_Array,
+    GLStateBuffer_ElementArray,     // Part of the VAO, forgotten when it changes
+    GLStateBuffer_CopyRead,
+    GLStateBuffer_CopyWrite,
+    GLStateBuffer_PixelPack,
+    GLStateBuffer_PixelUnpack,
+    GLStateBuffer_DrawIndirect,
+    GLStateBuffer_DispatchIndirect,
+    GLStateBuffer_Parameter,
+    GLStateBuffer_ShaderStorage,
+    GLStateBuffer_Uniform,
+    GLStateBuffer_AtomicCounter,
+    GLStateBuffer_Count
+};
+
+// Calls of a frame that reached GL, and the binds skipped because nothing would change
+struct GLStateCounters {
+    u32 draws;
+    u32 programBinds;
+    u32 vertexArrayBinds;
+    u32 textureBinds;
+    u32 bufferBinds;
+    u32 framebufferBinds;
+    u32 redundantBinds;
+};
+
+struct GLIndexedBuffer {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;            // -1 for glBindBufferBase, the whole buffer
+};
+
+/*
+ * Shadow of the bindings of the context. Every program, VAO, texture, buffer and framebuffer bind
+ * of the engine goes through GLState, which skips those that would not change anything, and so do
+ * the deletions, as GL unbinds deleted objects and reuses their names. ImGui binds state of its own
+ * (restored when it is done), so the shadow is forgotten at the start of every frame.
+ */
+struct GLStateCache {
+    GLuint program = GL_STATE_UNKNOWN;
+    GLuint vertexArray = GL_STATE_UNKNOWN;
+    u32 activeUnit = GL_STATE_UNKNOWN;
+    GLuint textures[GL_STATE_TEXTURE_UNITS][GLStateTexture_Count];
+    GLuint buffers[GLStateBuffer_Count];
+    GLIndexedBuffer shaderStorageBuffers[GL_STATE_BUFFER_INDICES];
+    GLIndexedBuffer uniformBuffers[GL_STATE_BUFFER_INDICES];
+    GLuint drawFramebuffer = GL_STATE_UNKNOWN;
+    GLuint readFramebuffer = GL_STATE_UNKNOWN;
+
+    GLStateCounters frame = {};
+};
+
+extern GLStateCache GLStateShadow;
+
+namespace GLState {
+
+    // Forgets every binding, the next bind of each reaches GL
+    void Invalidate();
+
+    // Resets the counters and forgets the bindings
+    void BeginFrame();
+
+    // Counted since BeginFrame
+    const GLStateCounters& GetFrameCounters();
+
+    void UseProgram(GLuint program);
+    void BindVertexArray(GLuint vertexArray);
+    void ActiveTexture(GLenum unit);
+    void BindTexture(GLenum target, GLuint texture);
+    void BindBuffer(GLenum target, GLuint buffer);
+    void BindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void BindFramebuffer(GLenum target, GLuint framebuffer);
+
+    void DeleteProgram(GLuint program);
+    void DeleteVertexArrays(GLsizei count, const GLuint* vertexArrays);
+    void DeleteTextures(GLsizei count, const GLuint* textures);
+    void DeleteBuffers(GLsizei count, const GLuint* buffers);
+    void DeleteFramebuffers(GLsizei count, const GLuint* framebuffers);
+
+    // Counted draws
+    void DrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices);
+    void MultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride);
+    void MultiDrawElementsIndirectCount(GLenum mode, GLenum type, const void* indirect, GLintptr drawCount, GLsizei maxDrawCount, GLsizei stride);
+
+} // namespace GLState
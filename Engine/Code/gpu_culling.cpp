@@ -0,0 +1,331 @@
+// gpu_culling.cpp
+#include "gpu_culling.h"
+#include "occlusion_culling.h"
+#include "gl_extensions.h"
+#include "draw_batches.h"
+#include "model.h"
+
+#include <cstddef>
+#include <unordered_map>
+
+static void ReserveBuffer(GLuint& buffer, u32& capacity, u32 size)
+{
+    if (size <= capacity) return;
+
+    capacity = glm::max(size, capacity * 2);
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+static u32 GetStatsSize(u32 materialCount)
+{
+    return sizeof(GpuCullStats) + materialCount * 2 * sizeof(u32);
+}
+
+// The ring of counters, with the visible flag and the visible list of every material. Pending reads are dropped.
+static void CreateStatsBuffers(GpuCuller& culler, u32 materialCount)
+{
+    for (GLsync& fence : culler.statsFences) {
+        if (fence) glDeleteSync(fence);
+        fence = NULL;
+    }
+    GLState::DeleteBuffers(GPU_CULL_STATS_LATENCY, culler.statsBuffers);
+    culler.statsMaterialCapacity = materialCount;
+
+    u32 size = GetStatsSize(materialCount);
+    std::vector<u8> zero(size, 0);
+    glGenBuffers(GPU_CULL_STATS_LATENCY, culler.statsBuffers);
+    for (u32 i = 0; i < GPU_CULL_STATS_LATENCY; ++i) {
+        GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.statsBuffers[i]);
+
+        // Mapped once, only read after the fence of the slot signals
+        if (GLExt.bufferStorage) {
+            GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            GLExt.BufferStorage(GL_SHADER_STORAGE_BUFFER, size, zero.data(), flags);
+            culler.mappedStats[i] = (const GpuCullStats*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, flags);
+        }
+        else {
+            glBufferData(GL_SHADER_STORAGE_BUFFER, size, zero.data(), GL_DYNAMIC_READ);
+        }
+    }
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void InitGpuCuller(GpuCuller& culler)
+{
+    glGenBuffers(1, &culler.meshletsBuffer);
+    glGenBuffers(1, &culler.lodRangesBuffer);
+    glGenBuffers(1, &culler.instancesBuffer);
+    glGenBuffers(2, culler.lodStateBuffers);
+    glGenBuffers(1, &culler.commandsBuffer);
+    glGenBuffers(1, &culler.drawCountsBuffer);
+    glGenBuffers(1, &culler.meshVisibleBuffer);
+    CreateStatsBuffers(culler, 0);
+}
+
+void ShutdownGpuCuller(GpuCuller& culler)
+{
+    GLState::DeleteBuffers(1, &culler.meshletsBuffer);
+    GLState::DeleteBuffers(1, &culler.lodRangesBuffer);
+    GLState::DeleteBuffers(1, &culler.instancesBuffer);
+    GLState::DeleteBuffers(2, culler.lodStateBuffers);
+    GLState::DeleteBuffers(1, &culler.commandsBuffer);
+    GLState::DeleteBuffers(1, &culler.drawCountsBuffer);
+    GLState::DeleteBuffers(1, &culler.meshVisibleBuffer);
+    for (GLsync fence : culler.statsFences) {
+        if (fence) glDeleteSync(fence);
+    }
+    GLState::DeleteBuffers(GPU_CULL_STATS_LATENCY, culler.statsBuffers);
+    culler = GpuCuller();
+}
+
+GpuCullUniforms GetGpuCullUniforms(Shader& cullShader)
+{
+    GpuCullUniforms uniforms;
+    uniforms.frustum = cullShader.GetUniform<glm::vec4>("uFrustum");
+    uniforms.instanceCount = cullShader.GetUniform<int>("uInstanceCount");
+    uniforms.threadCount = cullShader.GetUniform<u32>("uThreadCount");
+    uniforms.occlusion = cullShader.GetUniform<bool>("uOcclusion");
+    uniforms.cameraPosition = cullShader.GetUniform<glm::vec3>("uCameraPosition");
+    uniforms.backface = cullShader.GetUniform<bool>("uBackface");
+    uniforms.onlyTransform = cullShader.GetUniform<int>("uOnlyTransform");
+    uniforms.projectionScale = cullShader.GetUniform<float>("uProjectionScale");
+    uniforms.lodThreshold = cullShader.GetUniform<float>("uLodThreshold");
+    uniforms.lodHysteresis = cullShader.GetUniform<float>("uLodHysteresis");
+    uniforms.forcedLod = cullShader.GetUniform<int>("uForcedLod");
+    uniforms.materialCount = cullShader.GetUniform<u32>("uMaterialCount");
+    uniforms.hiz = GetHiZUniforms(cullShader);
+    return uniforms;
+}
+
+// Meshlets of every LOD of every asset mesh, shared by its instances
+static void BuildGpuCullerMeshlets(GpuCuller& culler, const std::vector<ModelInstance>& models)
+{
+    culler.meshlets.clear();
+    culler.lodRanges.clear();
+    culler.meshFirstLod.clear();
+
+    std::unordered_map<const Mesh*, u32> assetMeshFirstLod;
+    for (const ModelInstance& model : models) {
+        for (u32 m = 0; m < model.GetMeshCount(); ++m) {
+            const Mesh& mesh = model.asset->meshes[m];
+            auto inserted = assetMeshFirstLod.emplace(&mesh, (u32)culler.lodRanges.size());
+            culler.meshFirstLod.push_back(inserted.first->second);
+            if (!inserted.second) continue;
+
+            for (const MeshLod& lod : mesh.lods) {
+                culler.lodRanges.push_back({ (u32)culler.meshlets.size(), glm::max(lod.meshletCount, 1u) });
+
+                // The whole level as one meshlet, never backface culled
+                if (lod.meshletCount == 0) {
+                    GpuMeshlet gpuMeshlet = {};
+                    gpuMeshlet.sphere = glm::vec4(mesh.boundsCenter, mesh.boundsRadius);
+                    gpuMeshlet.cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+                    gpuMeshlet.indexOffset = mesh.indexOffset + lod.indexOffset;
+                    gpuMeshlet.indexCount = lod.indexCount;
+                    culler.meshlets.push_back(gpuMeshlet);
+                    continue;
+                }
+
+                for (u32 i = 0; i < lod.meshletCount; ++i) {
+                    const Meshlet& meshlet = mesh.meshlets[lod.meshletOffset + i];
+                    GpuMeshlet gpuMeshlet = {};
+                    gpuMeshlet.sphere = glm::vec4(meshlet.center, meshlet.radius);
+                    gpuMeshlet.cone = glm::vec4(meshlet.coneAxis, meshlet.coneCutoff);
+                    gpuMeshlet.indexOffset = mesh.indexOffset + meshlet.indexOffset;
+                    gpuMeshlet.indexCount = meshlet.triangleCount * 3;
+                    culler.meshlets.push_back(gpuMeshlet);
+                }
+            }
+        }
+    }
+}
+
+// One instance per mesh, batch after batch, with threads and command slots for its largest level
+static void BuildGpuCullInstances(GpuCuller& culler, DrawBatches& batches, const std::vector<ModelInstance>& models)
+{
+    culler.instances.clear();
+    culler.threadCount = 0;
+    culler.commandCount = 0;
+    culler.batchCount = (u32)batches.batches.size();
+
+    for (u32 b = 0; b < culler.batchCount; ++b) {
+        DrawBatch& batch = batches.batches[b];
+        batch.firstCommand = culler.commandCount;
+
+        for (u32 m = batch.firstMesh; m < batch.firstMesh + batch.meshCount; ++m) {
+            u32 modelIndex = batches.meshes[m].model;
+            u32 meshIndex = batches.meshes[m].mesh;
+            const Mesh& mesh = models[modelIndex].asset->meshes[meshIndex];
+            u32 drawId = batches.modelFirstDraw[modelIndex] + meshIndex;
+
+            GpuCullInstance instance = {};
+            instance.boundsSphere = glm::vec4(mesh.boundsCenter, mesh.boundsRadius);
+            instance.firstThread = culler.threadCount;
+            instance.firstLod = culler.meshFirstLod[drawId];
+            instance.lodCount = (u32)mesh.lods.size();
+            for (u32 l = 0; l < instance.lodCount; ++l) {
+                instance.threadCount = glm::max(instance.threadCount, culler.lodRanges[instance.firstLod + l].count);
+            }
+            instance.commandOffset = batch.firstCommand;
+            instance.drawCountIndex = b;
+            instance.baseVertex = mesh.vertexOffset;
+            instance.drawId = drawId;
+            instance.transformIndex = modelIndex;
+            instance.materialIndex = batches.drawData[drawId].materialIndex;
+
+            culler.instances.push_back(instance);
+            culler.threadCount += instance.threadCount;
+            culler.commandCount += instance.threadCount;
+        }
+        batch.commandCount = culler.commandCount - batch.firstCommand;
+    }
+}
+
+static void UploadStaticBuffer(GLuint buffer, u32 size, const void* data)
+{
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STATIC_DRAW);
+}
+
+void UpdateGpuCuller(GpuCuller& culler, DrawBatches& batches, const std::vector<ModelInstance>& models)
+{
+    if (batches.version == culler.batchesVersion && !culler.meshlets.empty()) return;
+    culler.batchesVersion = batches.version;
+
+    BuildGpuCullerMeshlets(culler, models);
+    BuildGpuCullInstances(culler, batches, models);
+
+    u32 instanceCount = (u32)culler.instances.size();
+    UploadStaticBuffer(culler.meshletsBuffer, (u32)(culler.meshlets.size() * sizeof(GpuMeshlet)), culler.meshlets.data());
+    UploadStaticBuffer(culler.lodRangesBuffer, (u32)(culler.lodRanges.size() * sizeof(GpuLodRange)), culler.lodRanges.data());
+    UploadStaticBuffer(culler.instancesBuffer, instanceCount * sizeof(GpuCullInstance), culler.instances.data());
+
+    // Every instance starts at LOD0
+    std::vector<u32> lods(instanceCount, 0);
+    for (GLuint buffer : culler.lodStateBuffers) {
+        GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, instanceCount * sizeof(u32), lods.data(), GL_DYNAMIC_COPY);
+    }
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    ReserveBuffer(culler.commandsBuffer, culler.commandsCapacity, culler.commandCount * sizeof(DrawElementsIndirectCommand));
+    ReserveBuffer(culler.drawCountsBuffer, culler.drawCountsCapacity, culler.batchCount * sizeof(u32));
+    ReserveBuffer(culler.meshVisibleBuffer, culler.meshVisibleCapacity, instanceCount * sizeof(u32));
+
+    // The material indices have changed, so the reads of the older dispatches are dropped either way
+    culler.materialCount = (u32)batches.materials.size();
+    culler.visibleMaterials.clear();
+    if (culler.materialCount > culler.statsMaterialCapacity) {
+        CreateStatsBuffers(culler, glm::max(culler.materialCount, culler.statsMaterialCapacity * 2));
+    }
+    else {
+        for (GLsync& fence : culler.statsFences) {
+            if (fence) glDeleteSync(fence);
+            fence = NULL;
+        }
+    }
+}
+
+// Counters of the last dispatch that used the slot, kept from an older one while its fence has not signaled.
+// The slot is reused either way, the GPU orders the reset after that dispatch
+static void ReadGpuCullStats(GpuCuller& culler, u32 slot)
+{
+    GLsync& fence = culler.statsFences[slot];
+    if (!fence) return;
+
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    glDeleteSync(fence);
+    fence = NULL;
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+
+    // The list of visible materials follows their flags
+    GLintptr listOffset = GetStatsSize(culler.materialCount) - culler.materialCount * sizeof(u32);
+    if (culler.mappedStats[slot]) {
+        culler.stats = *culler.mappedStats[slot];
+        const u32* list = (const u32*)((const u8*)culler.mappedStats[slot] + listOffset);
+        culler.visibleMaterials.assign(list, list + culler.stats.visibleMaterials);
+    }
+    else {
+        GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.statsBuffers[slot]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GpuCullStats), &culler.stats);
+        culler.visibleMaterials.resize(culler.stats.visibleMaterials);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, listOffset, culler.stats.visibleMaterials * sizeof(u32), culler.visibleMaterials.data());
+    }
+}
+
+void DispatchGpuCull(GpuCuller& culler, const Shader& cullShader, GLuint transformsBuffer, const GpuCullParams& params)
+{
+    culler.frame++;
+    u32 slot = culler.frame % GPU_CULL_STATS_LATENCY;
+    GLuint statsBuffer = culler.statsBuffers[slot];
+    ReadGpuCullStats(culler, slot);
+
+    // Reset on the GPU, after the dispatch that last used the slot
+    u32 instanceCount = (u32)culler.instances.size();
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(GpuCullStats) + culler.materialCount * sizeof(u32),
+        GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, offsetof(GpuCullStats, meshes), sizeof(u32), GL_RED_INTEGER, GL_UNSIGNED_INT, &instanceCount);
+    if (instanceCount == 0) {
+        GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        culler.statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        return;
+    }
+
+    // Every batch starts with no commands. Without the count draws, the unwritten commands are zeroes.
+    u32 commandsSize = culler.commandCount * sizeof(DrawElementsIndirectCommand);
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.drawCountsBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, culler.batchCount * sizeof(u32), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.meshVisibleBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, instanceCount * sizeof(u32), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    if (!GLExt.drawIndirectCount) {
+        GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.commandsBuffer);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, commandsSize, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    }
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Without frustum culling the planes pass everything
+    glm::vec4 planes[6];
+    for (u32 p = 0; p < 6; ++p) {
+        planes[p] = params.frustum ? params.frustum->planes[p] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    const OcclusionCuller* occlusion = params.occlusion;
+    const GpuCullUniforms& uniforms = culler.uniforms;
+    cullShader.Use();
+    cullShader.Set(uniforms.frustum, planes, 6);
+    cullShader.Set(uniforms.instanceCount, (int)instanceCount);
+    cullShader.Set(uniforms.threadCount, culler.threadCount);
+    cullShader.Set(uniforms.occlusion, occlusion != NULL);
+    cullShader.Set(uniforms.cameraPosition, params.cameraPosition);
+    cullShader.Set(uniforms.backface, params.backface);
+    cullShader.Set(uniforms.onlyTransform, (int)params.onlyModel);
+    cullShader.Set(uniforms.projectionScale, params.projectionScale);
+    cullShader.Set(uniforms.lodThreshold, MESH_LOD_SCREEN_SIZE * params.lodBias);
+    cullShader.Set(uniforms.lodHysteresis, MESH_LOD_HYSTERESIS);
+    cullShader.Set(uniforms.forcedLod, (int)params.forcedLod);
+    cullShader.Set(uniforms.materialCount, culler.materialCount);
+    if (occlusion) SetHiZUniforms(cullShader, uniforms.hiz, *occlusion, occlusion->pyramidViewProjection);
+
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culler.meshletsBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culler.instancesBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culler.commandsBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culler.drawCountsBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, statsBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, culler.meshVisibleBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, transformsBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, culler.lodRangesBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, culler.lodStateBuffers[culler.frame & 1]);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, culler.lodStateBuffers[(culler.frame + 1) & 1]);
+
+    u32 groups = (culler.threadCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE;
+    u32 groupsX = glm::min(groups, (u32)GPU_CULL_MAX_GROUPS_X);
+    glDispatchCompute(groupsX, (groups + groupsX - 1) / groupsX, 1);
+
+    // The commands and the counts are read by the draws, the stats through the mapping or glGetBufferSubData
+    GLbitfield statsBarrier = culler.mappedStats[slot] ? GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT : GL_BUFFER_UPDATE_BARRIER_BIT;
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | statsBarrier);
+    culler.statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
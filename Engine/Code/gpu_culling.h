@@ -0,0 +1,155 @@
+// gpu_culling.h
+#pragma once
+
+#include "platform.h"
+#include "frustum_culling.h"
+#include "occlusion_culling.h"
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct ModelInstance;
+struct DrawBatches;
+
+#define GPU_CULL_GROUP_SIZE         64      // Matches local_size in culling.glsl
+#define GPU_CULL_MAX_GROUPS_X       65535   // Minimum of GL_MAX_COMPUTE_WORK_GROUP_COUNT, larger dispatches wrap to y
+#define GPU_CULL_STATS_LATENCY      3       // Slots of the counters ring, each read back once its fence signals, so the read never waits
+
+/*
+ * Meshlet as read by the culling shader. 48 bytes, matches GpuMeshlet in culling.glsl (std430).
+ */
+struct GpuMeshlet {
+    glm::vec4 sphere;       // Model space center and radius
+    glm::vec4 cone;         // Axis and cutoff, see Meshlet
+    u32 indexOffset;        // In the geometry arena
+    u32 indexCount;
+    u32 pad[2];
+};
+
+/*
+ * A mesh of the scene, with the meshlets of every level. 64 bytes, matches GpuCullInstance in culling.glsl.
+ * The shader selects the level and reads the model matrix from the transforms buffer, so the instances
+ * only change when the batches are regrouped. Every meshlet of the largest level gets a thread,
+ * firstThread being the one of the first meshlet.
+ */
+struct GpuCullInstance {
+    glm::vec4 boundsSphere;     // Model space center and radius of the mesh, for the LOD selection
+    u32 firstThread;
+    u32 threadCount;
+    u32 firstLod;               // In GpuCuller::lodRanges
+    u32 lodCount;
+    u32 commandOffset;          // First command of the batch of the mesh
+    u32 drawCountIndex;         // Batch of the mesh
+    u32 baseVertex;
+    u32 drawId;
+    u32 transformIndex;         // Model and normal matrices in the transforms buffer
+    u32 materialIndex;          // In DrawBatches::materials
+    u32 pad[2];
+};
+
+// Counters of a dispatch, matches Stats in culling.glsl (std430)
+struct GpuCullStats {
+    u32 visibleMeshlets;
+    u32 visibleMeshes;          // With at least one visible meshlet
+    u32 meshes;                 // Instances dispatched, written by the CPU
+    u32 testedMeshlets;         // Of the selected levels
+    u32 visibleMaterials;       // Listed after their flags, see GpuCuller::visibleMaterials
+};
+
+// Meshlets of one LOD of a mesh in GpuCuller::meshlets, matches the uvec2 of LodRanges in culling.glsl
+struct GpuLodRange {
+    u32 offset;
+    u32 count;
+};
+
+// Of the GPU_CULL program, resolved once
+struct GpuCullUniforms {
+    UniformHandle<glm::vec4> frustum;
+    UniformHandle<int> instanceCount;
+    UniformHandle<u32> threadCount;
+    UniformHandle<bool> occlusion;
+    UniformHandle<glm::vec3> cameraPosition;
+    UniformHandle<bool> backface;
+    UniformHandle<int> onlyTransform;
+    UniformHandle<float> projectionScale;
+    UniformHandle<float> lodThreshold;
+    UniformHandle<float> lodHysteresis;
+    UniformHandle<int> forcedLod;
+    UniformHandle<u32> materialCount;
+    HiZUniforms hiz;
+};
+
+// Per frame inputs of the dispatch
+struct GpuCullParams {
+    const Frustum* frustum;         // NULL passes everything
+    const OcclusionCuller* occlusion;
+    glm::vec3 cameraPosition;
+    f32 projectionScale;            // Projection [1][1], see ModelInstance::SelectLods
+    f32 lodBias;
+    i32 forcedLod;                  // -1 selects by screen size
+    bool backface;
+    i32 onlyModel;                  // Index of the only model culled in, -1 for all of them
+};
+
+/*
+ * LOD selection, frustum, backface and Hi-Z culling of every meshlet on the GPU. The shader appends one indirect
+ * command per visible meshlet to the range of its draw batch, and counts them in drawCounts, so a
+ * batch is drawn with glMultiDrawElementsIndirectCount and the CPU never reads the results.
+ * Without the count entry point the commands buffer is cleared every frame and each batch draws its
+ * whole range, the commands left empty being no-ops.
+ */
+struct GpuCuller {
+    GLuint meshletsBuffer = 0;
+    GLuint lodRangesBuffer = 0;
+    GLuint instancesBuffer = 0;
+    GLuint lodStateBuffers[2] = {};         // Level of every instance, read from one and written to the other each frame
+    GLuint commandsBuffer = 0;
+    u32 commandsCapacity = 0;
+    GLuint drawCountsBuffer = 0;
+    u32 drawCountsCapacity = 0;
+    GLuint meshVisibleBuffer = 0;           // One flag per instance, set by its first visible meshlet
+    u32 meshVisibleCapacity = 0;
+    GLuint statsBuffers[GPU_CULL_STATS_LATENCY] = {};
+    GLsync statsFences[GPU_CULL_STATS_LATENCY] = {};       // After the dispatch that wrote the slot
+    const GpuCullStats* mappedStats[GPU_CULL_STATS_LATENCY] = {};  // Persistent mappings, NULL without buffer storage
+    u32 statsMaterialCapacity = 0;
+    u32 frame = 0;
+
+    // Meshlets of every LOD of every mesh of the scene, rebuilt when the meshes change
+    std::vector<GpuMeshlet> meshlets;
+    std::vector<GpuLodRange> lodRanges;
+    std::vector<u32> meshFirstLod;          // Per mesh, in the order of SceneBounds. Instances share the ranges
+    u32 batchesVersion = 0;                 // DrawBatches::version the meshlets were built for
+
+    std::vector<GpuCullInstance> instances; // Built with the meshlets
+    u32 threadCount = 0;
+    u32 commandCount = 0;
+    u32 batchCount = 0;
+
+    GpuCullUniforms uniforms;               // See GetGpuCullUniforms
+    GpuCullStats stats = {};                // Of the latest signaled slot, usually GPU_CULL_STATS_LATENCY frames ago
+    u32 materialCount = 0;
+    std::vector<u32> visibleMaterials;      // With a visible meshlet in the dispatch of stats, for the texture residency
+};
+
+void InitGpuCuller(GpuCuller& culler);
+
+void ShutdownGpuCuller(GpuCuller& culler);
+
+GpuCullUniforms GetGpuCullUniforms(Shader& cullShader);
+
+/**
+ * When the draw batches were regrouped, i.e. the meshes of the scene or their geometry changed:
+ * uploads the meshlets of every mesh, LODs without meshlets getting one covering the whole level, and
+ * the instances, batch after batch, giving every batch its range of culler.commandsBuffer with room
+ * for all the meshlets of its meshes. Nothing is done on the other frames.
+ */
+void UpdateGpuCuller(GpuCuller& culler, DrawBatches& batches, const std::vector<ModelInstance>& models);
+
+/**
+ * Culls the meshlets of the instances into the commands. The transforms buffer has the model
+ * matrices of this frame. The pyramid of the occlusion culler is of the last frame, so with it a
+ * mesh that shows up can be missing for one frame.
+ */
+void DispatchGpuCull(GpuCuller& culler, const Shader& cullShader, GLuint transformsBuffer, const GpuCullParams& params);
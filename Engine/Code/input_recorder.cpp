@@ -0,0 +1,172 @@
+// input_recorder.cpp
+#include "input_recorder.h"
+#include "engine.h"
+
+static void PackButtons(const Input& input, u8* packed)
+{
+    memset(packed, 0, INPUT_PACKED_BUTTON_BYTES);
+    for (u32 i = 0; i < MOUSE_BUTTON_COUNT + KEY_COUNT; ++i)
+    {
+        u32 state = i < MOUSE_BUTTON_COUNT ? input.mouseButtons[i] : input.keys[i - MOUSE_BUTTON_COUNT];
+        packed[i / 4] |= (u8)((state & 0x3) << ((i % 4) * 2));
+    }
+}
+
+static void UnpackButtons(const u8* packed, Input& input)
+{
+    for (u32 i = 0; i < MOUSE_BUTTON_COUNT + KEY_COUNT; ++i)
+    {
+        ButtonState state = (ButtonState)((packed[i / 4] >> ((i % 4) * 2)) & 0x3);
+        if (i < MOUSE_BUTTON_COUNT) input.mouseButtons[i] = state;
+        else                        input.keys[i - MOUSE_BUTTON_COUNT] = state;
+    }
+}
+
+void StartInputRecording(InputRecorder& recorder, const App* app, const std::string& path)
+{
+    InputRecordingStart& start = recorder.start;
+    start.cameraPosition = app->camera.Position;
+    start.cameraYaw      = app->camera.Yaw;
+    start.cameraPitch    = app->camera.Pitch;
+    start.cameraZoom     = app->camera.Zoom;
+    start.orbitDistance  = app->camera.OrbitDistance;
+    start.orbitAngleX    = app->camera.OrbitAngleX;
+    start.orbitAngleY    = app->camera.OrbitAngleY;
+    start.cameraMode     = app->camera.Mode;
+    start.renderMode     = app->mode;
+    start.displayMode    = app->displayMode;
+    start.selectedModel  = app->selectedModel ? (i32)(app->selectedModel - app->models.data()) : -1;
+    start.time           = app->time;
+
+    recorder.frames.clear();
+    recorder.path  = path;
+    recorder.state = InputRecorder_Recording;
+
+    ILOG("Input recording started");
+}
+
+void RecordInputFrame(InputRecorder& recorder, const Input& input, f32 deltaTime)
+{
+    if (recorder.state != InputRecorder_Recording) return;
+
+    InputFrame frame;
+    frame.deltaTime   = deltaTime;
+    frame.mousePos    = input.mousePos;
+    frame.mouseDelta  = input.mouseDelta;
+    frame.scrollDelta = input.scrollDelta;
+    PackButtons(input, frame.buttons);
+
+    recorder.frames.push_back(frame);
+}
+
+bool StopInputRecording(InputRecorder& recorder)
+{
+    if (recorder.state != InputRecorder_Recording) return false;
+    recorder.state = InputRecorder_Idle;
+
+    FILE* file = fopen(recorder.path.c_str(), "wb");
+    if (!file) {
+        ELOG("Could not write input recording %s", recorder.path.c_str());
+        return false;
+    }
+
+    InputRecordingHeader header = {};
+    header.magic            = INPUT_RECORDING_MAGIC;
+    header.version          = INPUT_RECORDING_VERSION;
+    header.frameCount       = (u32)recorder.frames.size();
+    header.mouseButtonCount = MOUSE_BUTTON_COUNT;
+    header.keyCount         = KEY_COUNT;
+    header.start            = recorder.start;
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(recorder.frames.data(), sizeof(InputFrame), recorder.frames.size(), file);
+    fclose(file);
+
+    ILOG("Input recording with %u frames written to %s", header.frameCount, recorder.path.c_str());
+    return true;
+}
+
+bool StartInputReplay(InputRecorder& recorder, App* app, const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        ELOG("Could not open input recording %s", path.c_str());
+        return false;
+    }
+
+    InputRecordingHeader header = {};
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == INPUT_RECORDING_MAGIC &&
+        header.version == INPUT_RECORDING_VERSION &&
+        header.mouseButtonCount == MOUSE_BUTTON_COUNT &&
+        header.keyCount == KEY_COUNT;
+
+    if (valid) {
+        recorder.frames.resize(header.frameCount);
+        valid = fread(recorder.frames.data(), sizeof(InputFrame), header.frameCount, file) == header.frameCount;
+    }
+    fclose(file);
+
+    if (!valid || header.frameCount == 0) {
+        ELOG("Invalid or empty input recording %s", path.c_str());
+        recorder.frames.clear();
+        return false;
+    }
+
+    // Restore the state of the first recorded frame
+    const InputRecordingStart& start = header.start;
+    app->camera.Position      = start.cameraPosition;
+    app->camera.Yaw           = start.cameraYaw;
+    app->camera.Pitch         = start.cameraPitch;
+    app->camera.Zoom          = start.cameraZoom;
+    app->camera.OrbitDistance = start.orbitDistance;
+    app->camera.OrbitAngleX   = start.orbitAngleX;
+    app->camera.OrbitAngleY   = start.orbitAngleY;
+    app->camera.Mode          = (CameraMode)start.cameraMode;
+    app->camera.UpdateVectors();
+
+    app->mode        = (Mode)start.renderMode;
+    app->displayMode = (DisplayMode)start.displayMode;
+    app->time        = start.time;
+    if (start.selectedModel >= 0 && start.selectedModel < (i32)app->models.size()) {
+        app->selectedModel = &app->models[start.selectedModel];
+    }
+
+    recorder.start       = start;
+    recorder.path        = path;
+    recorder.replayFrame = 0;
+    recorder.state       = InputRecorder_Replaying;
+
+    ILOG("Replaying %u input frames from %s", header.frameCount, path.c_str());
+    return true;
+}
+
+bool ReplayInputFrame(InputRecorder& recorder, Input& input, f32& deltaTime)
+{
+    if (recorder.state != InputRecorder_Replaying) return false;
+
+    if (recorder.replayFrame >= recorder.frames.size()) {
+        StopInputReplay(recorder, input);
+        return false;
+    }
+
+    const InputFrame& frame = recorder.frames[recorder.replayFrame++];
+    deltaTime         = frame.deltaTime;
+    input.mousePos    = frame.mousePos;
+    input.mouseDelta  = frame.mouseDelta;
+    input.scrollDelta = frame.scrollDelta;
+    UnpackButtons(frame.buttons, input);
+    return true;
+}
+
+void StopInputReplay(InputRecorder& recorder, Input& input)
+{
+    if (recorder.state != InputRecorder_Replaying) return;
+
+    Input idle = {};
+    idle.mousePos = input.mousePos;
+    input = idle;
+
+    ILOG("Input replay finished after %u frames", recorder.replayFrame);
+    recorder.state = InputRecorder_Idle;
+}
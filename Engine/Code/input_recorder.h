@@ -0,0 +1,92 @@
+// input_recorder.h
+#pragma once
+
+#include "platform.h"
+
+#include <vector>
+#include <string>
+
+struct App;
+
+#define INPUT_RECORDING_MAGIC   0x43524e49  // "INRC"
+#define INPUT_RECORDING_VERSION 1
+
+// Button states fit in 2 bits, 4 buttons per byte
+#define INPUT_PACKED_BUTTON_BYTES ((MOUSE_BUTTON_COUNT + KEY_COUNT + 3) / 4)
+
+enum InputRecorderState {
+    InputRecorder_Idle,
+    InputRecorder_Recording,
+    InputRecorder_Replaying
+};
+
+// Engine state at the first recorded frame, restored before replaying so the camera path is identical
+struct InputRecordingStart {
+    glm::vec3 cameraPosition;
+    f32 cameraYaw;
+    f32 cameraPitch;
+    f32 cameraZoom;
+    f32 orbitDistance;
+    f32 orbitAngleX;
+    f32 orbitAngleY;
+    u32 cameraMode;
+    u32 renderMode;
+    u32 displayMode;
+    i32 selectedModel;
+    f32 time;
+};
+
+struct InputRecordingHeader {
+    u32 magic;
+    u32 version;
+    u32 frameCount;
+    u16 mouseButtonCount;
+    u16 keyCount;
+    InputRecordingStart start;
+};
+
+struct InputFrame {
+    f32 deltaTime;
+    glm::vec2 mousePos;
+    glm::vec2 mouseDelta;
+    glm::vec2 scrollDelta;
+    u8 buttons[INPUT_PACKED_BUTTON_BYTES];
+};
+
+struct InputRecorder {
+    InputRecorderState state = InputRecorder_Idle;
+    std::string path;
+
+    InputRecordingStart start;
+    std::vector<InputFrame> frames;
+    u32 replayFrame = 0;
+};
+
+/**
+ * Starts capturing the input consumed by Update(). The file is written by StopInputRecording.
+ */
+void StartInputRecording(InputRecorder& recorder, const App* app, const std::string& path);
+
+void RecordInputFrame(InputRecorder& recorder, const Input& input, f32 deltaTime);
+
+/**
+ * Writes the captured frames to disk. Returns false if the file could not be written.
+ */
+bool StopInputRecording(InputRecorder& recorder);
+
+/**
+ * Loads a recording and restores the engine state of its first frame.
+ */
+bool StartInputReplay(InputRecorder& recorder, App* app, const std::string& path);
+
+/**
+ * Overwrites the input and the delta time with the next recorded frame. The recorded
+ * delta time is used as is, so the simulation does not depend on the speed of the build.
+ * Returns false when not replaying, the replay is stopped after its last frame.
+ */
+bool ReplayInputFrame(InputRecorder& recorder, Input& input, f32& deltaTime);
+
+/**
+ * Ends the replay and releases the buttons that were held in the last replayed frame.
+ */
+void StopInputReplay(InputRecorder& recorder, Input& input);
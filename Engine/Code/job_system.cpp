@@ -0,0 +1,81 @@
+// job_system.cpp
+#include "job_system.h"
+
+void JobSystem::Init(u32 workerCount)
+{
+    stopping = false;
+    for (u32 i = 0; i < workerCount; ++i) {
+        workers.emplace_back(&JobSystem::WorkerLoop, this);
+    }
+}
+
+void JobSystem::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        jobs.clear();
+    }
+    wakeUp.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void JobSystem::Submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    wakeUp.notify_one();
+}
+
+void JobSystem::WorkerLoop()
+{
+    for (;;)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeUp.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping) return;
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+MPSCNode* MPSCQueue::Pop()
+{
+    MPSCNode* first = tail;
+    MPSCNode* next = first->next.load(std::memory_order_acquire);
+
+    // Skip the stub, it is only there so the queue is never really empty
+    if (first == &stub) {
+        if (!next) return NULL;
+        tail = next;
+        first = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        tail = next;
+        return first;
+    }
+
+    // first is the last node: it can only be popped after re-inserting the stub behind it
+    if (first != head.load(std::memory_order_acquire)) return NULL;   // A producer is linking a new node
+
+    Push(&stub);
+    next = first->next.load(std::memory_order_acquire);
+    if (next) {
+        tail = next;
+        return first;
+    }
+    return NULL;
+}
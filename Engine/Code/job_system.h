@@ -0,0 +1,62 @@
+// job_system.h
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * Fixed pool of worker threads running CPU-only jobs (no GL calls, the context lives on the main thread).
+ */
+class JobSystem {
+public:
+    void Init(u32 workerCount);
+
+    // Waits for the running jobs and drops the queued ones
+    void Shutdown();
+
+    void Submit(std::function<void()> job);
+
+    u32 GetWorkerCount() const { return (u32)workers.size(); }
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopping = false;
+};
+
+struct MPSCNode {
+    std::atomic<MPSCNode*> next;
+};
+
+/**
+ * Intrusive lock-free multi-producer single-consumer queue (Vyukov). Any thread can Push,
+ * only one thread may Pop. Pop can return NULL while a Push is halfway through, the node
+ * shows up on a later Pop.
+ */
+class MPSCQueue {
+public:
+    MPSCQueue() : head(&stub), tail(&stub) { stub.next.store(NULL, std::memory_order_relaxed); }
+
+    void Push(MPSCNode* node) {
+        node->next.store(NULL, std::memory_order_relaxed);
+        MPSCNode* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    MPSCNode* Pop();
+
+private:
+    std::atomic<MPSCNode*> head;    // Last pushed node, written by the producers
+    MPSCNode* tail;                 // Next node to pop, only touched by the consumer
+    MPSCNode stub;
+};
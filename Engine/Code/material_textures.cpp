@@ -0,0 +1,270 @@
+// material_textures.cpp
+#include "material_textures.h"
+#include "gl_extensions.h"
+#include "model.h"
+
+#include <glm/glm.hpp>
+
+static const char* ModeNames[MaterialTextures_Count] = { "Bind per batch", "Bindless", "Texture arrays" };
+
+void InitMaterialTextures(MaterialTextures& textures, MaterialTextureMode mode)
+{
+    textures = MaterialTextures();
+    textures.mode = IsMaterialTextureModeSupported(mode) ? mode : MaterialTextures_Arrays;
+    ILOG("Material textures: %s", ModeNames[textures.mode]);
+}
+
+void ShutdownMaterialTextures(MaterialTextures& textures)
+{
+    SetMaterialTextureMode(textures, MaterialTextures_Bind);
+}
+
+MaterialTextureMode GetDefaultMaterialTextureMode()
+{
+    return GLExt.bindlessTexture ? MaterialTextures_Bindless : MaterialTextures_Arrays;
+}
+
+bool IsMaterialTextureModeSupported(MaterialTextureMode mode)
+{
+    return mode != MaterialTextures_Bindless || GLExt.bindlessTexture;
+}
+
+const char* GetMaterialTextureModeName(MaterialTextureMode mode)
+{
+    return ModeNames[mode];
+}
+
+const char* GetMaterialTextureDefines(MaterialTextureMode mode)
+{
+    switch (mode) {
+    case MaterialTextures_Bindless: return "#extension GL_ARB_bindless_texture : require\n#define BINDLESS_TEXTURES\n";
+    case MaterialTextures_Arrays: return "#define TEXTURE_ARRAYS\n";
+    default: return "";
+    }
+}
+
+void SetMaterialTextureMode(MaterialTextures& textures, MaterialTextureMode mode)
+{
+    while (!textures.referenced.empty()) {
+        ReleaseMaterialTexture(textures, **textures.referenced.begin());
+    }
+    for (MaterialTextureArray& array : textures.arrays) {
+        GLState::DeleteTextures(1, &array.id);
+    }
+    textures.arrays.clear();
+    textures.arrayBytes = 0;
+    textures.arraysFull = false;
+    textures.mode = mode;
+}
+
+// New storage of that many layers with the used ones of the old, packed at the start, so the textures
+// of the moved layers get their new one. No storage at all for 0 layers.
+static void ResizeTextureArray(MaterialTextures& textures, MaterialTextureArray& array, u32 capacity)
+{
+    GLuint id = 0;
+    if (capacity > 0) {
+        glGenTextures(1, &id);
+        GLState::BindTexture(GL_TEXTURE_2D_ARRAY, id);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.levels, array.internalFormat, array.width, array.height, capacity);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        GLState::BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    u32 usedCount = 0;
+    for (u32 layer = 0; layer < array.layerCount; ++layer) {
+        Texture* texture = array.layerTextures[layer];
+        if (!texture) continue;
+
+        for (u32 level = 0; level < array.levels; ++level) {
+            u32 width = glm::max(array.width >> level, 1u);
+            u32 height = glm::max(array.height >> level, 1u);
+            glCopyImageSubData(array.id, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, id, GL_TEXTURE_2D_ARRAY, level, 0, 0, usedCount,
+                width, height, 1);
+        }
+        if (layer != usedCount) textures.moves++;
+        texture->arrayLayer = usedCount;
+        array.layerTextures[usedCount++] = texture;
+    }
+    if (array.id) GLState::DeleteTextures(1, &array.id);
+
+    textures.arrayBytes = textures.arrayBytes - array.layerCapacity * array.layerBytes + capacity * array.layerBytes;
+    array.id = id;
+    array.layerCapacity = capacity;
+    array.layerCount = usedCount;
+    array.layerTextures.resize(usedCount);
+    array.freeLayers.clear();
+    if (capacity == 0) array = MaterialTextureArray();
+}
+
+// Twice the layers, false past the layer limit of the context
+static bool GrowTextureArray(MaterialTextures& textures, MaterialTextureArray& array)
+{
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    u32 capacity = array.layerCapacity ? array.layerCapacity * 2 : MATERIAL_TEXTURE_ARRAY_LAYERS;
+    capacity = glm::min(capacity, (u32)maxLayers);
+    if (capacity <= array.layerCapacity) return false;
+
+    ResizeTextureArray(textures, array, capacity);
+    return true;
+}
+
+// Half the layers once a quarter is used, none once they are all free
+static void TrimTextureArray(MaterialTextures& textures, MaterialTextureArray& array)
+{
+    u32 usedCount = array.layerCount - (u32)array.freeLayers.size();
+    if (usedCount == 0) {
+        ResizeTextureArray(textures, array, 0);
+    }
+    else if (usedCount <= array.layerCapacity / 4 && array.layerCapacity > MATERIAL_TEXTURE_ARRAY_LAYERS) {
+        ResizeTextureArray(textures, array, glm::max(array.layerCapacity / 2, (u32)MATERIAL_TEXTURE_ARRAY_LAYERS));
+    }
+}
+
+// Copies every level of the texture to a free layer of the array of its size, format and mip count
+static bool CopyToTextureArray(MaterialTextures& textures, Texture& texture)
+{
+    GLint width = 0, height = 0, internalFormat = 0, levels = 0;
+    GLState::BindTexture(GL_TEXTURE_2D, texture.id);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_LEVELS, &levels);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+    if (levels == 0) levels = 1;    // Not allocated with glTexStorage2D, e.g. the solid colors
+
+    u32 arrayIndex = INVALID_TEXTURE_ARRAY_INDEX;
+    u32 emptyIndex = INVALID_TEXTURE_ARRAY_INDEX;
+    for (u32 i = 0; i < (u32)textures.arrays.size(); ++i) {
+        const MaterialTextureArray& array = textures.arrays[i];
+        if (array.width == (u32)width && array.height == (u32)height && array.internalFormat == (GLenum)internalFormat &&
+            array.levels == (u32)levels) {
+            arrayIndex = i;
+            break;
+        }
+        if (array.layerCapacity == 0 && emptyIndex == INVALID_TEXTURE_ARRAY_INDEX) emptyIndex = i;
+    }
+
+    if (arrayIndex == INVALID_TEXTURE_ARRAY_INDEX) {
+        if (emptyIndex == INVALID_TEXTURE_ARRAY_INDEX && textures.arrays.size() < MATERIAL_TEXTURE_ARRAY_COUNT) {
+            emptyIndex = (u32)textures.arrays.size();
+            textures.arrays.emplace_back();
+        }
+        if (emptyIndex != INVALID_TEXTURE_ARRAY_INDEX) {
+            MaterialTextureArray& array = textures.arrays[emptyIndex];
+            array.width = width;
+            array.height = height;
+            array.internalFormat = internalFormat;
+            array.levels = levels;
+            array.layerBytes = texture.bytes;
+            arrayIndex = emptyIndex;
+        }
+    }
+
+    MaterialTextureArray* array = arrayIndex != INVALID_TEXTURE_ARRAY_INDEX ? &textures.arrays[arrayIndex] : NULL;
+    if (array && array->freeLayers.empty() && array->layerCount == array->layerCapacity && !GrowTextureArray(textures, *array)) {
+        array = NULL;
+    }
+    if (!array) {
+        if (!textures.arraysFull) {
+            ELOG("Material texture arrays full, %s (%dx%d) is drawn without its texture", texture.name.c_str(), width, height);
+            textures.arraysFull = true;
+        }
+        return false;
+    }
+
+    u32 layer;
+    if (!array->freeLayers.empty()) {
+        layer = array->freeLayers.back();
+        array->freeLayers.pop_back();
+    }
+    else {
+        layer = array->layerCount++;
+        array->layerTextures.push_back(NULL);
+    }
+    array->layerTextures[layer] = &texture;
+
+    for (u32 level = 0; level < array->levels; ++level) {
+        u32 levelWidth = glm::max(array->width >> level, 1u);
+        u32 levelHeight = glm::max(array->height >> level, 1u);
+        glCopyImageSubData(texture.id, GL_TEXTURE_2D, level, 0, 0, 0, array->id, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+            levelWidth, levelHeight, 1);
+    }
+
+    texture.arrayIndex = arrayIndex;
+    texture.arrayLayer = layer;
+    return true;
+}
+
+bool AcquireMaterialTexture(MaterialTextures& textures, Texture& texture)
+{
+    if (textures.mode == MaterialTextures_Bind || texture.id == 0) return false;
+    if (texture.materialTextures == &textures && texture.referenceId == texture.id) return false;
+
+    // Of a GL texture replaced without going through the eviction
+    ReleaseMaterialTexture(textures, texture);
+
+    if (textures.mode == MaterialTextures_Bindless) {
+        texture.bindlessHandle = GLExt.GetTextureHandle(texture.id);
+        GLExt.MakeTextureHandleResident(texture.bindlessHandle);
+    }
+    else if (!CopyToTextureArray(textures, texture)) {
+        // Left without a reference and copied again on the next frame, once layers may have been freed
+        textures.failedCopies++;
+        return false;
+    }
+
+    texture.materialTextures = &textures;
+    texture.referenceId = texture.id;
+    textures.referenced.insert(&texture);
+    return true;
+}
+
+bool GetMaterialTextureReference(const MaterialTextures& textures, const Texture& texture, u32 reference[2])
+{
+    if (texture.materialTextures != &textures || texture.id == 0 || texture.referenceId != texture.id) return false;
+
+    if (textures.mode == MaterialTextures_Bindless) {
+        reference[0] = (u32)(texture.bindlessHandle & 0xFFFFFFFF);
+        reference[1] = (u32)(texture.bindlessHandle >> 32);
+        return texture.bindlessHandle != 0;
+    }
+
+    reference[0] = texture.arrayIndex;
+    reference[1] = texture.arrayLayer;
+    return texture.arrayIndex != INVALID_TEXTURE_ARRAY_INDEX;
+}
+
+void ReleaseMaterialTexture(MaterialTextures& textures, Texture& texture)
+{
+    if (texture.materialTextures != &textures) return;
+
+    if (texture.bindlessHandle != 0) {
+        GLExt.MakeTextureHandleNonResident(texture.bindlessHandle);
+        texture.bindlessHandle = 0;
+    }
+    if (texture.arrayIndex != INVALID_TEXTURE_ARRAY_INDEX) {
+        MaterialTextureArray& array = textures.arrays[texture.arrayIndex];
+        array.layerTextures[texture.arrayLayer] = NULL;
+        array.freeLayers.push_back(texture.arrayLayer);
+        texture.arrayIndex = INVALID_TEXTURE_ARRAY_INDEX;
+        TrimTextureArray(textures, array);
+    }
+
+    texture.materialTextures = NULL;
+    texture.referenceId = 0;
+    textures.referenced.erase(&texture);
+    textures.releases++;
+}
+
+void BindMaterialTextureArrays(const MaterialTextures& textures)
+{
+    for (u32 i = 0; i < (u32)textures.arrays.size(); ++i) {
+        GLState::ActiveTexture(GL_TEXTURE0 + i);
+        GLState::BindTexture(GL_TEXTURE_2D_ARRAY, textures.arrays[i].id);
+    }
+    GLState::ActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,104 @@
+// material_textures.h
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+#include <unordered_set>
+#include <vector>
+
+struct Texture;
+
+#define MATERIAL_TEXTURE_ARRAY_COUNT        8       // Matches uTextureArrays in the mesh shaders, one unit each
+#define MATERIAL_TEXTURE_ARRAY_LAYERS       4       // Of a new array, doubled when full and halved when a quarter is used
+#define INVALID_TEXTURE_ARRAY_INDEX         0xFFFFFFFF
+
+// How the mesh shaders get the textures of a material
+enum MaterialTextureMode
+{
+    MaterialTextures_Bind,          // Bound to units 0 to 5 for every draw batch, so batches split by material
+    MaterialTextures_Bindless,      // ARB_bindless_texture handles in the materials buffer
+    MaterialTextures_Arrays,        // Copied to a layer of a texture array, whose index and layer are in the materials buffer
+    MaterialTextures_Count
+};
+
+/*
+ * Layers of textures of one size, format and mip count, in a GL_TEXTURE_2D_ARRAY. An array whose
+ * layers are all released frees its storage, and the slot is reused by the next size or format.
+ */
+struct MaterialTextureArray {
+    GLuint id = 0;
+    GLenum internalFormat = 0;
+    u32 width = 0;
+    u32 height = 0;
+    u32 levels = 0;
+    u64 layerBytes = 0;             // Every level of one layer
+    u32 layerCapacity = 0;
+    u32 layerCount = 0;             // Used and free layers
+    std::vector<u32> freeLayers;
+    std::vector<Texture*> layerTextures;    // Per layer, NULL when free
+};
+
+/*
+ * Without bind mode, the materials buffer references the textures itself and a whole pass draws
+ * without binding any: with bindless handles, or with the texture arrays, bound once per pass.
+ * A texture gets its reference (see Texture) when it is resident and used by a material, and
+ * loses it before its GL texture is deleted.
+ */
+struct MaterialTextures {
+    MaterialTextureMode mode = MaterialTextures_Bind;
+    std::vector<MaterialTextureArray> arrays;
+    std::unordered_set<Texture*> referenced;
+    bool arraysFull = false;        // Logged once, textures that do not fit are drawn with their color
+    u32 releases = 0;               // Incremented by ReleaseMaterialTexture, for the materials holding references
+    u32 moves = 0;                  // Incremented when an array is compacted and its textures get new layers
+    u64 arrayBytes = 0;             // Storage of every array, counted in the texture VRAM budget
+    u32 failedCopies = 0;           // Copies to an array that found no layer, retried every frame
+};
+
+void InitMaterialTextures(MaterialTextures& textures, MaterialTextureMode mode);
+
+void ShutdownMaterialTextures(MaterialTextures& textures);
+
+/**
+ * Best mode of the context: bindless when supported, the texture arrays otherwise.
+ */
+MaterialTextureMode GetDefaultMaterialTextureMode();
+
+bool IsMaterialTextureModeSupported(MaterialTextureMode mode);
+
+const char* GetMaterialTextureModeName(MaterialTextureMode mode);
+
+// Defines of the mesh shaders for the mode
+const char* GetMaterialTextureDefines(MaterialTextureMode mode);
+
+/**
+ * Drops the references of every texture and the arrays. The mesh shaders have to be compiled again
+ * with the defines of the new mode, and every material uploaded again.
+ */
+void SetMaterialTextureMode(MaterialTextures& textures, MaterialTextureMode mode);
+
+/**
+ * Gives a resident texture its reference: makes its bindless handle resident, or copies it to a
+ * layer of the array of its size and format. Returns true when the reference changed, so the
+ * materials using it have to be uploaded again. A texture that does not fit in the arrays stays
+ * without a reference and is tried again on the next call.
+ */
+bool AcquireMaterialTexture(MaterialTextures& textures, Texture& texture);
+
+/**
+ * The two words of GpuMaterialProperty::texture: the bindless handle, or the array and its layer.
+ * False when the texture has no valid reference.
+ */
+bool GetMaterialTextureReference(const MaterialTextures& textures, const Texture& texture, u32 reference[2]);
+
+/**
+ * Makes the handle non resident, or frees the layer. Called before the GL texture is deleted. An
+ * array down to a quarter of its layers is compacted to half, an empty one is deleted.
+ */
+void ReleaseMaterialTexture(MaterialTextures& textures, Texture& texture);
+
+/**
+ * Binds the texture arrays to units 0 to MATERIAL_TEXTURE_ARRAY_COUNT - 1, once per pass.
+ */
+void BindMaterialTextureArrays(const MaterialTextures& textures);
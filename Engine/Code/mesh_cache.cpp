@@ -0,0 +1,304 @@
+// mesh_cache.cpp
+#include "mesh_cache.h"
+#include "model.h"
+
+#include <filesystem>
+
+u64 HashBytes(u64 hash, const void* data, size_t size)
+{
+    const u8* bytes = (const u8*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+bool HashFileContents(const char* filepath, u64& hash)
+{
+    FILE* file = fopen(filepath, "rb");
+    if (!file) return false;
+
+    hash = FNV_OFFSET_BASIS;
+    u8 buffer[KB(64)];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        hash = HashBytes(hash, buffer, read);
+    }
+    fclose(file);
+    return true;
+}
+
+std::string GetMeshCachePath(const std::string& sourcePath, u64 sourceHash, u32 importFlags, VertexFormat vertexFormat)
+{
+    u32 version = MESH_CACHE_VERSION;
+    u32 format = vertexFormat;
+    u64 key = HashBytes(sourceHash, &importFlags, sizeof(importFlags));
+    key = HashBytes(key, &format, sizeof(format));
+    key = HashBytes(key, &version, sizeof(version));
+
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s_%016llx.meshcache",
+        std::filesystem::path(sourcePath).stem().string().c_str(), (unsigned long long)key);
+
+    return (std::filesystem::path(MESH_CACHE_DIRECTORY) / filename).string();
+}
+
+static u64 AlignOffset(u64 offset)
+{
+    return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(u64)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static u32 GetVertexStride(VertexFormat format)
+{
+    return format == VertexFormat_Compact ? (u32)sizeof(CompactVertex) : (u32)sizeof(Vertex);
+}
+
+// The MeshletBounds arrays are padded by 3 (see BuildMeshletBounds), each one starts aligned
+static u64 GetMeshletBoundsStride(u32 meshletCount)
+{
+    return AlignOffset((u64)(meshletCount + 3) * sizeof(f32));
+}
+
+#define MESHLET_BOUNDS_ARRAY_COUNT 8
+
+// In file order
+static std::vector<f32> MeshletBounds::* const MeshletBoundsArrays[MESHLET_BOUNDS_ARRAY_COUNT] = {
+    &MeshletBounds::centerX, &MeshletBounds::centerY, &MeshletBounds::centerZ, &MeshletBounds::radius,
+    &MeshletBounds::axisX, &MeshletBounds::axisY, &MeshletBounds::axisZ, &MeshletBounds::cutoff
+};
+
+bool ReadMeshCache(const std::string& cachePath, u64 sourceHash, u32 importFlags, VertexFormat vertexFormat, ModelImport& import)
+{
+    MappedFile file;
+    if (!MapFile(cachePath.c_str(), file)) {
+        return false;
+    }
+
+    const MeshCacheHeader* header = (const MeshCacheHeader*)file.data;
+    bool valid = file.size >= sizeof(MeshCacheHeader) &&
+        header->magic == MESH_CACHE_MAGIC &&
+        header->version == MESH_CACHE_VERSION &&
+        header->fileSize == file.size &&
+        header->sourceHash == sourceHash &&
+        header->importFlags == importFlags &&
+        header->vertexFormat == (u32)vertexFormat &&
+        header->vertexStride == GetVertexStride(vertexFormat) &&
+        sizeof(MeshCacheHeader) + (u64)header->meshCount * sizeof(MeshCacheEntry) <= file.size &&
+        (u64)header->stringTableOffset + header->stringTableSize <= file.size &&
+        header->stringTableSize > 0 && file.data[header->stringTableOffset + header->stringTableSize - 1] == '\0';
+
+    auto inFile = [&file](u64 offset, u64 size) {
+        return offset <= file.size && size <= file.size - offset;
+    };
+
+    const MeshCacheEntry* entries = (const MeshCacheEntry*)(file.data + sizeof(MeshCacheHeader));
+    for (u32 i = 0; valid && i < header->meshCount; ++i) {
+        const MeshCacheEntry& entry = entries[i];
+        valid = inFile(entry.vertexDataOffset, (u64)entry.vertexCount * header->vertexStride) &&
+            (entry.indexSize == 4 || (entry.indexSize == 2 && vertexFormat == VertexFormat_Compact)) &&
+            inFile(entry.indexDataOffset, (u64)entry.indexCount * entry.indexSize) &&
+            entry.materialNameOffset < header->stringTableSize &&
+            entry.diffusePathOffset < header->stringTableSize &&
+            inFile(entry.meshletDataOffset, (u64)entry.meshletCount * sizeof(Meshlet)) &&
+            inFile(entry.meshletBoundsOffset, GetMeshletBoundsStride(entry.meshletCount) * (MESHLET_BOUNDS_ARRAY_COUNT - 1) +
+                (u64)(entry.meshletCount + 3) * sizeof(f32)) &&
+            inFile(entry.bvhNodeOffset, (u64)entry.bvhNodeCount * sizeof(BvhNode)) &&
+            inFile(entry.bvhPositionOffset, (u64)entry.vertexCount * sizeof(glm::vec3)) &&
+            inFile(entry.bvhTriangleOffset, (u64)entry.bvhTriangleCount * 3 * sizeof(u32)) &&
+            entry.lodCount > 0 && entry.lodCount <= MESH_LOD_MAX_COUNT;
+        for (u32 l = 0; valid && l < entry.lodCount; ++l) {
+            const MeshLod& lod = entry.lods[l];
+            valid = (u64)lod.indexOffset + lod.indexCount <= entry.indexCount &&
+                (u64)lod.meshletOffset + lod.meshletCount <= entry.meshletCount;
+        }
+
+        const Meshlet* meshlets = valid ? (const Meshlet*)(file.data + entry.meshletDataOffset) : NULL;
+        for (u32 m = 0; valid && m < entry.meshletCount; ++m) {
+            valid = (u64)meshlets[m].indexOffset + meshlets[m].triangleCount * 3 <= entry.indexCount;
+        }
+    }
+
+    if (!valid) {
+        ELOG("Ignoring invalid mesh cache %s", cachePath.c_str());
+        UnmapFile(file);
+        return false;
+    }
+
+    const char* strings = (const char*)(file.data + header->stringTableOffset);
+    import.meshes.resize(header->meshCount);
+    for (u32 i = 0; i < header->meshCount; ++i) {
+        const MeshCacheEntry& entry = entries[i];
+        MeshImport& mesh = import.meshes[i];
+
+        // Geometry stays in the mapped file, uploaded from there
+        mesh.format = vertexFormat;
+        mesh.vertexCount = entry.vertexCount;
+        mesh.indexCount = entry.indexCount;
+        const u8* vertexData = file.data + entry.vertexDataOffset;
+        const u8* indexData = file.data + entry.indexDataOffset;
+        if (vertexFormat == VertexFormat_Compact) {
+            mesh.compactVertexData = (const CompactVertex*)vertexData;
+        }
+        else {
+            mesh.vertexData = (const Vertex*)vertexData;
+        }
+        if (entry.indexSize == 2) {
+            mesh.indexData16 = (const u16*)indexData;
+        }
+        else {
+            mesh.indexData = (const u32*)indexData;
+        }
+
+        mesh.lods.assign(entry.lods, entry.lods + entry.lodCount);
+        mesh.boundsMin = entry.boundsMin;
+        mesh.boundsMax = entry.boundsMax;
+        mesh.boundsCenter = entry.boundsCenter;
+        mesh.boundsRadius = entry.boundsRadius;
+
+        const Meshlet* meshlets = (const Meshlet*)(file.data + entry.meshletDataOffset);
+        mesh.meshlets.assign(meshlets, meshlets + entry.meshletCount);
+        u64 boundsStride = GetMeshletBoundsStride(entry.meshletCount);
+        for (u32 a = 0; a < MESHLET_BOUNDS_ARRAY_COUNT; ++a) {
+            const f32* array = (const f32*)(file.data + entry.meshletBoundsOffset + a * boundsStride);
+            (mesh.meshletBounds.*MeshletBoundsArrays[a]).assign(array, array + entry.meshletCount + 3);
+        }
+
+        const BvhNode* nodes = (const BvhNode*)(file.data + entry.bvhNodeOffset);
+        const glm::vec3* positions = (const glm::vec3*)(file.data + entry.bvhPositionOffset);
+        const u32* triangles = (const u32*)(file.data + entry.bvhTriangleOffset);
+        mesh.pickingBvh.bvh.nodes.assign(nodes, nodes + entry.bvhNodeCount);
+        mesh.pickingBvh.positions.assign(positions, positions + entry.vertexCount);
+        mesh.pickingBvh.triangles.assign(triangles, triangles + (size_t)entry.bvhTriangleCount * 3);
+
+        mesh.materialName = strings + entry.materialNameOffset;
+        mesh.diffusePath = strings + entry.diffusePathOffset;
+    }
+    import.cacheFile = file;
+
+    ILOG("Loaded %s from mesh cache %s", import.path.c_str(), cachePath.c_str());
+    return true;
+}
+
+bool WriteMeshCache(const std::string& cachePath, const ModelImport& import, u64 sourceHash, u32 importFlags)
+{
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(cachePath).parent_path(), error);
+
+    VertexFormat vertexFormat = import.meshes.empty() ? VertexFormat_Float : import.meshes[0].format;
+
+    // String table, offset 0 is the empty string
+    std::string strings(1, '\0');
+    auto pushString = [&strings](const std::string& str) {
+        u32 offset = (u32)strings.size();
+        strings.append(str.c_str(), str.size() + 1);
+        return offset;
+    };
+
+    std::vector<MeshCacheEntry> entries(import.meshes.size(), MeshCacheEntry{});
+    for (size_t i = 0; i < import.meshes.size(); ++i) {
+        const MeshImport& mesh = import.meshes[i];
+        MeshCacheEntry& entry = entries[i];
+        entry.vertexCount = mesh.vertexCount;
+        entry.indexCount = mesh.indexCount;
+        entry.indexSize = mesh.indexData16 ? sizeof(u16) : sizeof(u32);
+        entry.meshletCount = (u32)mesh.meshlets.size();
+        entry.bvhNodeCount = (u32)mesh.pickingBvh.bvh.nodes.size();
+        entry.bvhTriangleCount = (u32)mesh.pickingBvh.triangles.size() / 3;
+        entry.boundsMin = mesh.boundsMin;
+        entry.boundsMax = mesh.boundsMax;
+        entry.boundsCenter = mesh.boundsCenter;
+        entry.boundsRadius = mesh.boundsRadius;
+        if (mesh.lods.empty()) {
+            entry.lodCount = 1;
+            entry.lods[0] = { 0, mesh.indexCount, 0.0f, 0, 0 };
+        }
+        else {
+            entry.lodCount = (u32)glm::min(mesh.lods.size(), (size_t)MESH_LOD_MAX_COUNT);
+            memcpy(entry.lods, mesh.lods.data(), entry.lodCount * sizeof(MeshLod));
+        }
+        entry.materialNameOffset = mesh.materialName.empty() ? 0 : pushString(mesh.materialName);
+        entry.diffusePathOffset = mesh.diffusePath.empty() ? 0 : pushString(mesh.diffusePath);
+    }
+
+    MeshCacheHeader header = {};
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.importFlags = importFlags;
+    header.vertexStride = GetVertexStride(vertexFormat);
+    header.vertexFormat = vertexFormat;
+    header.meshCount = (u32)entries.size();
+    header.stringTableOffset = (u32)(sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry));
+    header.stringTableSize = (u32)strings.size();
+
+    // Every blob in file order, the entries get the offsets of the ones they reference
+    struct Blob {
+        u64* offset;
+        const void* data;
+        u64 size;
+    };
+    std::vector<Blob> blobs;
+    for (size_t i = 0; i < import.meshes.size(); ++i) {
+        const MeshImport& mesh = import.meshes[i];
+        MeshCacheEntry& entry = entries[i];
+
+        const void* vertexData = vertexFormat == VertexFormat_Compact ? (const void*)mesh.compactVertexData : (const void*)mesh.vertexData;
+        const void* indexData = mesh.indexData16 ? (const void*)mesh.indexData16 : (const void*)mesh.indexData;
+        blobs.push_back({ &entry.vertexDataOffset, vertexData, (u64)mesh.vertexCount * header.vertexStride });
+        blobs.push_back({ &entry.indexDataOffset, indexData, (u64)mesh.indexCount * entry.indexSize });
+        blobs.push_back({ &entry.meshletDataOffset, mesh.meshlets.data(), (u64)mesh.meshlets.size() * sizeof(Meshlet) });
+        for (u32 a = 0; a < MESHLET_BOUNDS_ARRAY_COUNT; ++a) {
+            const std::vector<f32>& array = mesh.meshletBounds.*MeshletBoundsArrays[a];
+            blobs.push_back({ a == 0 ? &entry.meshletBoundsOffset : NULL, array.data(), (u64)array.size() * sizeof(f32) });
+        }
+        blobs.push_back({ &entry.bvhNodeOffset, mesh.pickingBvh.bvh.nodes.data(), (u64)entry.bvhNodeCount * sizeof(BvhNode) });
+        blobs.push_back({ &entry.bvhPositionOffset, mesh.pickingBvh.positions.data(), (u64)mesh.pickingBvh.positions.size() * sizeof(glm::vec3) });
+        blobs.push_back({ &entry.bvhTriangleOffset, mesh.pickingBvh.triangles.data(), (u64)mesh.pickingBvh.triangles.size() * sizeof(u32) });
+    }
+
+    u64 offset = header.stringTableOffset + header.stringTableSize;
+    std::vector<u64> blobOffsets(blobs.size());
+    for (size_t b = 0; b < blobs.size(); ++b) {
+        blobOffsets[b] = AlignOffset(offset);
+        if (blobs[b].offset) *blobs[b].offset = blobOffsets[b];
+        offset = blobOffsets[b] + blobs[b].size;
+    }
+    header.fileSize = offset;
+
+    // Written next to the cache and renamed over it, a process killed halfway leaves no truncated cache
+    std::string tempPath = cachePath + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        ELOG("Could not write mesh cache %s", cachePath.c_str());
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(entries.data(), sizeof(MeshCacheEntry), entries.size(), file);
+    fwrite(strings.data(), 1, strings.size(), file);
+
+    const u8 zeros[MESH_CACHE_ALIGNMENT] = {};
+    u64 written = header.stringTableOffset + header.stringTableSize;
+    for (size_t b = 0; b < blobs.size(); ++b) {
+        fwrite(zeros, 1, (size_t)(blobOffsets[b] - written), file);
+        if (blobs[b].size > 0) fwrite(blobs[b].data, 1, (size_t)blobs[b].size, file);
+        written = blobOffsets[b] + blobs[b].size;
+    }
+
+    bool ok = ferror(file) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (ok) {
+        std::filesystem::rename(tempPath, cachePath, error);
+        ok = !error;
+    }
+
+    if (!ok) {
+        ELOG("Error writing mesh cache %s", cachePath.c_str());
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+
+    ILOG("Mesh cache written to %s", cachePath.c_str());
+    return true;
+}
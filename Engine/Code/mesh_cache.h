@@ -0,0 +1,90 @@
+// mesh_cache.h
+#pragma once
+
+#include "platform.h"
+#include "mesh_lod.h"
+#include "meshlet.h"
+#include "vertex_format.h"
+
+#include <string>
+
+struct ModelImport;
+
+#define MESH_CACHE_DIRECTORY    "Cache"
+#define MESH_CACHE_MAGIC        0x4853454d  // "MESH"
+#define MESH_CACHE_VERSION      6           // Bump when Vertex or the import post-processing changes
+#define MESH_CACHE_ALIGNMENT    16
+
+/*
+ * File layout:
+ *   MeshCacheHeader
+ *   MeshCacheEntry[meshCount]
+ *   String table (null terminated strings, referenced by offset)
+ *   Blobs of every mesh, each aligned to MESH_CACHE_ALIGNMENT: vertices and indices in the exact GPU layout
+ *   of the vertex format (the index blob has the LODs after LOD0), meshlets, the 8 MeshletBounds arrays
+ *   and the picking BVH nodes, positions and triangles
+ */
+struct MeshCacheHeader {
+    u32 magic;
+    u32 version;
+    u64 sourceHash;
+    u32 importFlags;
+    u32 vertexStride;
+    u32 meshCount;
+    u32 stringTableOffset;
+    u32 stringTableSize;
+    u32 vertexFormat;           // VertexFormat of every mesh
+    u64 fileSize;               // Of the whole file, a truncated file is ignored
+};
+
+struct MeshCacheEntry {
+    u64 vertexDataOffset;
+    u64 indexDataOffset;
+    u64 meshletDataOffset;
+    u64 meshletBoundsOffset;    // First array, the others follow every GetMeshletBoundsStride bytes
+    u64 bvhNodeOffset;
+    u64 bvhPositionOffset;      // vertexCount positions
+    u64 bvhTriangleOffset;      // Three indices per triangle
+    u32 vertexCount;
+    u32 indexCount;
+    u32 indexSize;              // 2 or 4 bytes, 2 only for the compact format
+    u32 materialNameOffset;     // Offsets in the string table
+    u32 diffusePathOffset;
+    u32 meshletCount;
+    u32 bvhNodeCount;
+    u32 bvhTriangleCount;
+    glm::vec3 boundsMin;
+    f32 boundsRadius;
+    glm::vec3 boundsMax;
+    u32 lodCount;
+    glm::vec3 boundsCenter;
+    u32 padding;
+    MeshLod lods[MESH_LOD_MAX_COUNT];   // Ranges of the index blob, which holds every level
+};
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME        0x100000001b3ull
+
+// FNV-1a, continues from hash (start with FNV_OFFSET_BASIS)
+u64 HashBytes(u64 hash, const void* data, size_t size);
+
+/**
+ * FNV-1a hash of the contents of a file. Returns false if the file can not be read.
+ */
+bool HashFileContents(const char* filepath, u64& hash);
+
+/**
+ * The cache file name combines the source name with its hash, the import flags, the vertex format and
+ * the cache version, so any change of those misses the cache instead of loading stale data.
+ */
+std::string GetMeshCachePath(const std::string& sourcePath, u64 sourceHash, u32 importFlags, VertexFormat vertexFormat);
+
+/**
+ * Maps the cache file and points the imported meshes to its vertex/index blobs, which are then
+ * uploaded straight to the GPU. Bounds, meshlets and picking BVHs are copied out as they are stored,
+ * nothing is recomputed. The file stays mapped in import.cacheFile until the upload.
+ * Returns false on a cache miss or an invalid file. Thread safe.
+ */
+bool ReadMeshCache(const std::string& cachePath, u64 sourceHash, u32 importFlags, VertexFormat vertexFormat, ModelImport& import);
+
+bool WriteMeshCache(const std::string& cachePath, const ModelImport& import, u64 sourceHash, u32 importFlags);
@@ -0,0 +1,340 @@
+// mesh_lod.cpp
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
+#include "frustum_culling.h"
+#include "model.h"
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+
+#pragma region Simplification
+
+// Symmetric 4x4 matrix, weighted sum of the squared distances to a set of planes, and the sum of the weights
+struct Quadric {
+    f64 a00, a01, a02, a03;
+    f64      a11, a12, a13;
+    f64           a22, a23;
+    f64                a33;
+    f64 weight;
+};
+
+static void AddPlane(Quadric& q, const glm::dvec3& n, f64 d, f64 weight)
+{
+    q.a00 += weight * n.x * n.x; q.a01 += weight * n.x * n.y; q.a02 += weight * n.x * n.z; q.a03 += weight * n.x * d;
+    q.a11 += weight * n.y * n.y; q.a12 += weight * n.y * n.z; q.a13 += weight * n.y * d;
+    q.a22 += weight * n.z * n.z; q.a23 += weight * n.z * d;
+    q.a33 += weight * d * d;
+    q.weight += weight;
+}
+
+static void AddQuadric(Quadric& q, const Quadric& other)
+{
+    q.a00 += other.a00; q.a01 += other.a01; q.a02 += other.a02; q.a03 += other.a03;
+    q.a11 += other.a11; q.a12 += other.a12; q.a13 += other.a13;
+    q.a22 += other.a22; q.a23 += other.a23;
+    q.a33 += other.a33;
+    q.weight += other.weight;
+}
+
+// Weighted mean of the squared distances, a squared distance whatever the area behind the quadric
+static f64 EvaluateQuadric(const Quadric& q, const glm::dvec3& p)
+{
+    if (q.weight <= 0.0) return 0.0;
+    return (q.a00 * p.x * p.x + 2.0 * (q.a01 * p.x * p.y + q.a02 * p.x * p.z + q.a03 * p.x) +
+        q.a11 * p.y * p.y + 2.0 * (q.a12 * p.y * p.z + q.a13 * p.y) +
+        q.a22 * p.z * p.z + 2.0 * q.a23 * p.z +
+        q.a33) / q.weight;
+}
+
+struct Collapse {
+    f64 cost;
+    u32 from;
+    u32 to;
+    u32 version;    // Of the from vertex, any change around it makes the collapse stale
+
+    bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+struct Simplifier {
+    std::vector<glm::dvec3> positions;              // Relative to the bounding sphere
+    std::vector<u32> triangles;
+    std::vector<bool> triangleRemoved;
+    std::vector<std::vector<u32>> vertexTriangles;  // Live triangles of every vertex
+    std::vector<Quadric> quadrics;
+    std::vector<bool> locked;
+    std::vector<u32> versions;
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+};
+
+static void GatherNeighbours(const Simplifier& s, u32 v, std::vector<u32>& neighbours)
+{
+    neighbours.clear();
+    for (u32 t : s.vertexTriangles[v]) {
+        for (u32 k = 0; k < 3; ++k) {
+            u32 n = s.triangles[t * 3 + k];
+            if (n != v && std::find(neighbours.begin(), neighbours.end(), n) == neighbours.end()) neighbours.push_back(n);
+        }
+    }
+}
+
+static bool TriangleHasVertex(const u32* triangle, u32 v)
+{
+    return triangle[0] == v || triangle[1] == v || triangle[2] == v;
+}
+
+static bool IsCollapseValid(const Simplifier& s, u32 from, u32 to, const std::vector<u32>& fromNeighbours, std::vector<u32>& scratch)
+{
+    // Link condition: the edge is shared by two triangles and its ends have no other common neighbour,
+    // otherwise the collapse pinches the surface into a non manifold edge
+    u32 sharedTriangles = 0;
+    for (u32 t : s.vertexTriangles[from]) {
+        if (TriangleHasVertex(&s.triangles[t * 3], to)) sharedTriangles++;
+    }
+    if (sharedTriangles != 2) return false;
+
+    GatherNeighbours(s, to, scratch);
+    u32 commonNeighbours = 0;
+    for (u32 n : fromNeighbours) {
+        if (std::find(scratch.begin(), scratch.end(), n) != scratch.end()) commonNeighbours++;
+    }
+    if (commonNeighbours != 2) return false;
+
+    // No triangle may flip or turn too far when its corner moves
+    for (u32 t : s.vertexTriangles[from]) {
+        const u32* triangle = &s.triangles[t * 3];
+        if (TriangleHasVertex(triangle, to)) continue;
+
+        glm::dvec3 p[3], q[3];
+        for (u32 k = 0; k < 3; ++k) {
+            p[k] = s.positions[triangle[k]];
+            q[k] = triangle[k] == from ? s.positions[to] : p[k];
+        }
+        glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <= 0.25 * glm::length(before) * glm::length(after)) return false;
+    }
+    return true;
+}
+
+static void PushBestCollapse(Simplifier& s, u32 v, std::vector<u32>& neighbours, std::vector<u32>& scratch)
+{
+    if (s.locked[v] || s.vertexTriangles[v].empty()) return;
+
+    GatherNeighbours(s, v, neighbours);
+
+    Collapse best = { DBL_MAX, v, v, s.versions[v] };
+    for (u32 n : neighbours) {
+        Quadric q = s.quadrics[v];
+        AddQuadric(q, s.quadrics[n]);
+        f64 cost = EvaluateQuadric(q, s.positions[n]);
+        if (cost < best.cost && IsCollapseValid(s, v, n, neighbours, scratch)) {
+            best.cost = cost;
+            best.to = n;
+        }
+    }
+
+    if (best.to != v) s.queue.push(best);
+}
+
+f32 SimplifyMesh(const Vertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount,
+    u32 targetIndexCount, f32 targetError, std::vector<u32>& result)
+{
+    result.clear();
+
+    Simplifier s;
+    glm::vec3 boundsMin, boundsMax, center;
+    f32 radius;
+    ComputeBounds(vertices, vertexCount, boundsMin, boundsMax, center, radius);
+    f64 scale = radius > 0.0f ? 1.0 / radius : 1.0;
+
+    s.positions.resize(vertexCount);
+    for (u32 i = 0; i < vertexCount; ++i) s.positions[i] = glm::dvec3(vertices[i].Position - center) * scale;
+
+    u32 triangleCount = indexCount / 3;
+    s.triangles.assign(indices, indices + triangleCount * 3);
+    s.triangleRemoved.assign(triangleCount, false);
+    s.vertexTriangles.resize(vertexCount);
+    s.quadrics.assign(vertexCount, Quadric{});
+    s.versions.assign(vertexCount, 0);
+
+    u32 liveIndexCount = 0;
+    for (u32 t = 0; t < triangleCount; ++t) {
+        const u32* triangle = &s.triangles[t * 3];
+        if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[0] == triangle[2]) {
+            s.triangleRemoved[t] = true;
+            continue;
+        }
+        for (u32 k = 0; k < 3; ++k) s.vertexTriangles[triangle[k]].push_back(t);
+        liveIndexCount += 3;
+
+        // Area weighted planes, so slivers barely constrain the collapses
+        glm::dvec3 n = glm::cross(s.positions[triangle[1]] - s.positions[triangle[0]], s.positions[triangle[2]] - s.positions[triangle[0]]);
+        f64 area = glm::length(n);
+        if (area == 0.0) continue;
+        n /= area;
+        f64 d = -glm::dot(n, s.positions[triangle[0]]);
+        for (u32 k = 0; k < 3; ++k) AddPlane(s.quadrics[triangle[k]], n, d, area * 0.5);
+    }
+
+    // Vertices sharing a position are attribute seams, which are found by sorting the positions
+    std::vector<u32> order(vertexCount);
+    std::iota(order.begin(), order.end(), 0);
+    auto positionLess = [vertices](u32 a, u32 b) {
+        const glm::vec3& pa = vertices[a].Position;
+        const glm::vec3& pb = vertices[b].Position;
+        return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+    };
+    std::sort(order.begin(), order.end(), positionLess);
+
+    std::vector<u32> positionId(vertexCount);
+    s.locked.assign(vertexCount, false);
+    u32 positionCount = 0;
+    for (u32 i = 0; i < vertexCount; ++i) {
+        if (i > 0 && vertices[order[i]].Position == vertices[order[i - 1]].Position) {
+            positionId[order[i]] = positionCount - 1;
+            s.locked[order[i]] = s.locked[order[i - 1]] = true;
+        }
+        else {
+            positionId[order[i]] = positionCount++;
+        }
+    }
+
+    // Edges not shared by exactly two triangles (open borders and non manifold edges) lock their ends.
+    // Counted by position, so the seams do not look like borders.
+    std::vector<u64> edges;
+    edges.reserve(liveIndexCount);
+    for (u32 t = 0; t < triangleCount; ++t) {
+        if (s.triangleRemoved[t]) continue;
+        for (u32 k = 0; k < 3; ++k) {
+            u32 a = positionId[s.triangles[t * 3 + k]];
+            u32 b = positionId[s.triangles[t * 3 + (k + 1) % 3]];
+            edges.push_back(((u64)glm::min(a, b) << 32) | glm::max(a, b));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<bool> lockedPosition(positionCount, false);
+    for (size_t i = 0; i < edges.size();) {
+        size_t end = i + 1;
+        while (end < edges.size() && edges[end] == edges[i]) end++;
+        if (end - i != 2) {
+            lockedPosition[(u32)(edges[i] >> 32)] = true;
+            lockedPosition[(u32)edges[i]] = true;
+        }
+        i = end;
+    }
+    for (u32 v = 0; v < vertexCount; ++v) {
+        if (lockedPosition[positionId[v]]) s.locked[v] = true;
+    }
+
+    std::vector<u32> neighbours, scratch, affected;
+    for (u32 v = 0; v < vertexCount; ++v) PushBestCollapse(s, v, neighbours, scratch);
+
+    f64 maxErrorSquared = (f64)targetError * targetError;
+    f64 reachedErrorSquared = 0.0;
+
+    while (liveIndexCount > targetIndexCount && !s.queue.empty())
+    {
+        Collapse collapse = s.queue.top();
+        s.queue.pop();
+        if (collapse.version != s.versions[collapse.from]) continue;
+        if (collapse.cost > maxErrorSquared) break;
+
+        u32 from = collapse.from;
+        u32 to = collapse.to;
+        GatherNeighbours(s, from, affected);
+
+        // A collapse onto a neighbour of an earlier one was queued with the old quadric and fan of that
+        // neighbour. It is checked again, and queued again with what it costs now.
+        Quadric merged = s.quadrics[from];
+        AddQuadric(merged, s.quadrics[to]);
+        if (EvaluateQuadric(merged, s.positions[to]) != collapse.cost || !IsCollapseValid(s, from, to, affected, scratch)) {
+            PushBestCollapse(s, from, neighbours, scratch);
+            continue;
+        }
+
+        for (u32 t : s.vertexTriangles[from]) {
+            u32* triangle = &s.triangles[t * 3];
+            if (TriangleHasVertex(triangle, to)) {
+                s.triangleRemoved[t] = true;
+                liveIndexCount -= 3;
+                for (u32 k = 0; k < 3; ++k) {
+                    if (triangle[k] == from) continue;
+                    std::vector<u32>& list = s.vertexTriangles[triangle[k]];
+                    list.erase(std::find(list.begin(), list.end(), t));
+                }
+            }
+            else {
+                for (u32 k = 0; k < 3; ++k) {
+                    if (triangle[k] == from) triangle[k] = to;
+                }
+                s.vertexTriangles[to].push_back(t);
+            }
+        }
+        s.vertexTriangles[from].clear();
+        AddQuadric(s.quadrics[to], s.quadrics[from]);
+        reachedErrorSquared = glm::max(reachedErrorSquared, collapse.cost);
+
+        // Everything around the collapsed edge has a new neighbourhood or quadric
+        s.versions[from]++;
+        affected.push_back(to);
+        for (u32 v : affected) {
+            s.versions[v]++;
+            PushBestCollapse(s, v, neighbours, scratch);
+        }
+    }
+
+    result.reserve(liveIndexCount);
+    for (u32 t = 0; t < triangleCount; ++t) {
+        if (!s.triangleRemoved[t]) result.insert(result.end(), &s.triangles[t * 3], &s.triangles[t * 3] + 3);
+    }
+
+    return (f32)sqrt(glm::max(reachedErrorSquared, 0.0));
+}
+
+#pragma endregion
+
+void GenerateMeshLods(const std::vector<Vertex>& vertices, std::vector<u32>& indices, std::vector<MeshLod>& lods)
+{
+    u32 sourceCount = (u32)indices.size();
+    lods.clear();
+    lods.push_back({ 0, sourceCount, 0.0f, 0, 0 });
+
+    // Every level starts from LOD0, errors do not add up along the chain
+    std::vector<u32> lod;
+    f32 reduction = 1.0f;
+    for (u32 level = 1; level < MESH_LOD_MAX_COUNT; ++level) {
+        reduction *= MESH_LOD_REDUCTION;
+        u32 targetIndexCount = (u32)(sourceCount / 3 * reduction) * 3;
+        if (targetIndexCount / 3 < MESH_LOD_MIN_TRIANGLES) break;
+
+        f32 error = SimplifyMesh(vertices.data(), (u32)vertices.size(), indices.data(), sourceCount,
+            targetIndexCount, MESH_LOD_MAX_ERROR, lod);
+        if (lod.empty() || lod.size() > lods.back().indexCount * MESH_LOD_MIN_PROGRESS) break;
+
+        OptimizeVertexCache(lod, (u32)vertices.size());
+        lods.push_back({ (u32)indices.size(), (u32)lod.size(), error, 0, 0 });
+        indices.insert(indices.end(), lod.begin(), lod.end());
+    }
+}
+
+u32 SelectMeshLod(u32 currentLod, u32 lodCount, f32 screenSize, f32 bias)
+{
+    if (lodCount <= 1) return 0;
+
+    auto lodForSize = [lodCount, bias](f32 size) {
+        u32 lod = 0;
+        f32 threshold = MESH_LOD_SCREEN_SIZE * bias;
+        while (lod + 1 < lodCount && size < threshold) {
+            lod++;
+            threshold *= 0.5f;
+        }
+        return lod;
+    };
+
+    // Coarser only once the size is clearly below the threshold, finer once it is clearly above
+    u32 finest = lodForSize(screenSize * (1.0f + MESH_LOD_HYSTERESIS));
+    u32 coarsest = lodForSize(screenSize * (1.0f - MESH_LOD_HYSTERESIS));
+    return glm::clamp(currentLod, finest, coarsest);
+}
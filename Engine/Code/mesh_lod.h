@@ -0,0 +1,50 @@
+// mesh_lod.h
+#pragma once
+
+#include "platform.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Vertex;
+
+#define MESH_LOD_MAX_COUNT      5       // LOD0 (the source mesh) and up to 4 simplified levels
+#define MESH_LOD_REDUCTION      0.5f    // Triangles kept from one level to the next
+#define MESH_LOD_MIN_TRIANGLES  64      // No levels are generated below this
+#define MESH_LOD_MIN_PROGRESS   0.85f   // A level with more than this ratio of the previous one is dropped, and the chain ends
+#define MESH_LOD_MAX_ERROR      0.05f   // Max simplification error, relative to the bounding sphere radius
+#define MESH_LOD_SCREEN_SIZE    0.25f   // LOD1 is used below this projected size (sphere diameter / screen height), halved per level
+#define MESH_LOD_HYSTERESIS     0.15f   // Size margin around each threshold, so meshes do not flicker between levels
+
+/*
+ * A level is a range of the mesh index buffer, all of them share the vertex buffer.
+ */
+struct MeshLod {
+    u32 indexOffset;
+    u32 indexCount;
+    f32 error;          // Relative to the bounding sphere radius
+    u32 meshletOffset;  // Meshlets splitting the range, see meshlet.h
+    u32 meshletCount;
+};
+
+/**
+ * Quadric error edge collapse (Garland-Heckbert). Vertices are only collapsed onto one of their
+ * neighbours, so the result indexes the same vertex buffer. Open borders and attribute seams are
+ * locked. Stops at targetIndexCount, at targetError (relative to the bounding sphere) or when no
+ * collapse is left that keeps the surface from folding.
+ * Returns the error reached.
+ */
+f32 SimplifyMesh(const Vertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount,
+    u32 targetIndexCount, f32 targetError, std::vector<u32>& result);
+
+/**
+ * Appends the simplified levels to indices, each simplified from LOD0 and cache optimized.
+ * lods[0] is the range of the original indices.
+ */
+void GenerateMeshLods(const std::vector<Vertex>& vertices, std::vector<u32>& indices, std::vector<MeshLod>& lods);
+
+/**
+ * Level for the projected size of the mesh (bounding sphere diameter / screen height). The current
+ * level only changes once the size is past a threshold by the hysteresis margin.
+ */
+u32 SelectMeshLod(u32 currentLod, u32 lodCount, f32 screenSize, f32 bias);
@@ -0,0 +1,293 @@
+// mesh_optimizer.cpp
+#include "mesh_optimizer.h"
+#include "model.h"
+
+#include <algorithm>
+#include <math.h>
+
+void AnalyzeVertexCache(const u32* indices, u32 indexCount, u32 vertexCount, u32 cacheSize, f32& acmr, f32& atvr)
+{
+    // FIFO cache: a vertex stays cached until cacheSize misses happened after its own
+    std::vector<u32> timestamps(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    u32 time = cacheSize + 1;
+    u32 misses = 0;
+    u32 uniqueVertices = 0;
+
+    for (u32 i = 0; i < indexCount; ++i) {
+        u32 v = indices[i];
+        if (time - timestamps[v] > cacheSize) {
+            timestamps[v] = time++;
+            misses++;
+        }
+        if (!referenced[v]) {
+            referenced[v] = true;
+            uniqueVertices++;
+        }
+    }
+
+    acmr = indexCount ? (f32)misses / (indexCount / 3) : 0.0f;
+    atvr = uniqueVertices ? (f32)misses / uniqueVertices : 0.0f;
+}
+
+#pragma region Vertex cache
+
+static f32 ForsythVertexScore(i32 cachePosition, u32 remainingTriangles)
+{
+    if (remainingTriangles == 0) return -1.0f;
+
+    f32 score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // The vertices of the last triangle get a fixed score, so it does not matter how it was ordered
+            score = 0.75f;
+        }
+        else {
+            f32 scale = 1.0f / (MESH_OPT_CACHE_SIZE - 3);
+            score = powf(1.0f - (cachePosition - 3) * scale, 1.5f);
+        }
+    }
+
+    // Boost the vertices with few triangles left, so lone triangles do not get left behind
+    score += 2.0f * powf((f32)remainingTriangles, -0.5f);
+    return score;
+}
+
+void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount)
+{
+    u32 triangleCount = (u32)indices.size() / 3;
+    if (triangleCount == 0) return;
+
+    // Triangles of every vertex. The live ones are kept at the front of each range.
+    std::vector<u32> liveTriangles(vertexCount, 0);
+    for (u32 index : indices) liveTriangles[index]++;
+
+    std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+    for (u32 v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+    std::vector<u32> adjacency(indices.size());
+    std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (u32 t = 0; t < triangleCount; ++t) {
+        for (u32 k = 0; k < 3; ++k) adjacency[fill[indices[t * 3 + k]]++] = t;
+    }
+
+    std::vector<i32> cachePosition(vertexCount, -1);
+    std::vector<f32> vertexScore(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v) vertexScore[v] = ForsythVertexScore(-1, liveTriangles[v]);
+
+    std::vector<f32> triangleScore(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (u32 t = 0; t < triangleCount; ++t) {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    u32 cache[MESH_OPT_CACHE_SIZE + 3];
+    u32 cacheCount = 0;
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+
+    i32 best = (i32)(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+    u32 scanPosition = 0;
+
+    while (result.size() < indices.size())
+    {
+        if (best < 0) {
+            // Nothing adjacent to the cache is left, continue with the next triangle in input order
+            while (emitted[scanPosition]) scanPosition++;
+            best = (i32)scanPosition;
+        }
+
+        const u32* triangle = &indices[best * 3];
+        emitted[best] = true;
+        result.insert(result.end(), triangle, triangle + 3);
+
+        for (u32 k = 0; k < 3; ++k) {
+            u32 v = triangle[k];
+            u32* begin = &adjacency[adjacencyOffsets[v]];
+            u32* end = begin + liveTriangles[v];
+            u32* it = std::find(begin, end, (u32)best);
+            std::swap(*it, *(end - 1));
+            liveTriangles[v]--;
+        }
+
+        // LRU: the triangle vertices move to the front, the rest shift back
+        u32 newCache[MESH_OPT_CACHE_SIZE + 3];
+        u32 newCount = 0;
+        for (u32 k = 0; k < 3; ++k) {
+            if (std::find(newCache, newCache + newCount, triangle[k]) == newCache + newCount) newCache[newCount++] = triangle[k];
+        }
+        for (u32 i = 0; i < cacheCount; ++i) {
+            u32 v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) newCache[newCount++] = v;
+        }
+
+        for (u32 i = 0; i < newCount; ++i) {
+            cachePosition[newCache[i]] = i < MESH_OPT_CACHE_SIZE ? (i32)i : -1;
+        }
+
+        best = -1;
+        f32 bestScore = -1.0f;
+        for (u32 i = 0; i < newCount; ++i) {
+            u32 v = newCache[i];
+            vertexScore[v] = ForsythVertexScore(cachePosition[v], liveTriangles[v]);
+        }
+        for (u32 i = 0; i < newCount; ++i) {
+            u32 v = newCache[i];
+            const u32* adjacent = &adjacency[adjacencyOffsets[v]];
+            for (u32 a = 0; a < liveTriangles[v]; ++a) {
+                u32 t = adjacent[a];
+                triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = (i32)t;
+                }
+            }
+        }
+
+        cacheCount = glm::min(newCount, (u32)MESH_OPT_CACHE_SIZE);
+        memcpy(cache, newCache, cacheCount * sizeof(u32));
+    }
+
+    indices.swap(result);
+}
+
+#pragma endregion
+
+#pragma region Overdraw
+
+struct TriangleCluster {
+    u32 begin;      // In triangles
+    u32 end;
+    f32 sortKey;
+};
+
+// Misses of a FIFO cache, used to find where the triangle list can be split without hurting it
+static u32 SimulateCacheMiss(const u32* triangle, std::vector<u32>& timestamps, u32& time)
+{
+    u32 misses = 0;
+    for (u32 k = 0; k < 3; ++k) {
+        u32 v = triangle[k];
+        if (time - timestamps[v] > MESH_OPT_ANALYZE_CACHE_SIZE) {
+            timestamps[v] = time++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+static void BuildClusters(const std::vector<u32>& indices, u32 vertexCount, f32 threshold, std::vector<TriangleCluster>& clusters)
+{
+    u32 triangleCount = (u32)indices.size() / 3;
+
+    // Hard boundaries: triangles missing all their vertices, the cache starts over there anyway
+    std::vector<u32> hardBoundaries(1, 0);
+    std::vector<u32> timestamps(vertexCount, 0);
+    u32 time = MESH_OPT_ANALYZE_CACHE_SIZE + 1;
+    for (u32 t = 0; t < triangleCount; ++t) {
+        if (SimulateCacheMiss(&indices[t * 3], timestamps, time) == 3 && t > 0) hardBoundaries.push_back(t);
+    }
+    hardBoundaries.push_back(triangleCount);
+
+    // Soft boundaries: inside each hard cluster, split as soon as the running ACMR is within the threshold
+    for (size_t h = 0; h + 1 < hardBoundaries.size(); ++h) {
+        u32 begin = hardBoundaries[h];
+        u32 end = hardBoundaries[h + 1];
+
+        // Moving the time past the cache size flushes it
+        time += MESH_OPT_ANALYZE_CACHE_SIZE + 1;
+        u32 clusterMisses = 0;
+        for (u32 t = begin; t < end; ++t) clusterMisses += SimulateCacheMiss(&indices[t * 3], timestamps, time);
+        f32 clusterThreshold = threshold * (f32)clusterMisses / (end - begin);
+
+        time += MESH_OPT_ANALYZE_CACHE_SIZE + 1;
+        u32 start = begin;
+        u32 misses = 0;
+        for (u32 t = begin; t < end; ++t) {
+            misses += SimulateCacheMiss(&indices[t * 3], timestamps, time);
+            if (t + 1 == end || (f32)misses / (t - start + 1) <= clusterThreshold) {
+                clusters.push_back({ start, t + 1, 0.0f });
+                start = t + 1;
+                misses = 0;
+                time += MESH_OPT_ANALYZE_CACHE_SIZE + 1;
+            }
+        }
+    }
+}
+
+void OptimizeOverdraw(std::vector<u32>& indices, const std::vector<Vertex>& vertices, f32 threshold)
+{
+    u32 triangleCount = (u32)indices.size() / 3;
+    if (triangleCount == 0) return;
+
+    std::vector<TriangleCluster> clusters;
+    BuildClusters(indices, (u32)vertices.size(), threshold, clusters);
+
+    glm::vec3 meshCentroid(0.0f);
+    for (u32 index : indices) meshCentroid += vertices[index].Position;
+    meshCentroid /= (f32)indices.size();
+
+    for (TriangleCluster& cluster : clusters) {
+        // Area weighted, as the cross products are
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        f32 area = 0.0f;
+        for (u32 t = cluster.begin; t < cluster.end; ++t) {
+            const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            f32 triangleArea = glm::length(n);
+
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+
+        if (area > 0.0f) centroid /= area;
+        f32 normalLength = glm::length(normal);
+        cluster.sortKey = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(),
+        [](const TriangleCluster& a, const TriangleCluster& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+    for (const TriangleCluster& cluster : clusters) {
+        result.insert(result.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+    }
+    indices.swap(result);
+}
+
+#pragma endregion
+
+void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<u32>& indices)
+{
+    const u32 unused = 0xFFFFFFFF;
+    std::vector<u32> remap(vertices.size(), unused);
+    std::vector<Vertex> result;
+    result.reserve(vertices.size());
+
+    for (u32& index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = (u32)result.size();
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(result);
+}
+
+MeshOptimizerStats OptimizeMesh(std::vector<Vertex>& vertices, std::vector<u32>& indices)
+{
+    MeshOptimizerStats stats = {};
+    u32 vertexCount = (u32)vertices.size();
+    AnalyzeVertexCache(indices.data(), (u32)indices.size(), vertexCount, MESH_OPT_ANALYZE_CACHE_SIZE, stats.acmrBefore, stats.atvrBefore);
+
+    OptimizeVertexCache(indices, vertexCount);
+    OptimizeOverdraw(indices, vertices, MESH_OPT_OVERDRAW_THRESHOLD);
+    OptimizeVertexFetch(vertices, indices);
+
+    AnalyzeVertexCache(indices.data(), (u32)indices.size(), (u32)vertices.size(), MESH_OPT_ANALYZE_CACHE_SIZE, stats.acmrAfter, stats.atvrAfter);
+    return stats;
+}
@@ -0,0 +1,46 @@
+// mesh_optimizer.h
+#pragma once
+
+#include "platform.h"
+
+#include <vector>
+
+struct Vertex;
+
+#define MESH_OPT_CACHE_SIZE         32      // Cache the Forsyth scores target
+#define MESH_OPT_ANALYZE_CACHE_SIZE 16      // FIFO cache used to report ACMR/ATVR, as in most GPUs' post-transform cache
+#define MESH_OPT_OVERDRAW_THRESHOLD 1.05f   // Max ACMR growth accepted to split clusters for overdraw sorting
+
+/*
+ * ACMR: vertex shader invocations per triangle (0.5 is the ideal for big regular grids, 3 the worst)
+ * ATVR: vertex shader invocations per vertex (1 is the ideal)
+ */
+struct MeshOptimizerStats {
+    f32 acmrBefore;
+    f32 acmrAfter;
+    f32 atvrBefore;
+    f32 atvrAfter;
+};
+
+void AnalyzeVertexCache(const u32* indices, u32 indexCount, u32 vertexCount, u32 cacheSize, f32& acmr, f32& atvr);
+
+// Forsyth's linear-speed vertex cache optimization
+void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount);
+
+/**
+ * View independent overdraw ordering (Sander et al.): splits the cache optimized triangle list in
+ * clusters where it barely costs cache misses, then draws first the clusters facing away from
+ * the mesh center, as they are the most likely to occlude the rest.
+ */
+void OptimizeOverdraw(std::vector<u32>& indices, const std::vector<Vertex>& vertices, f32 threshold);
+
+/**
+ * Reorders the vertices in the order the indices first use them, so the vertex fetch walks the
+ * buffer linearly. Unreferenced vertices are dropped.
+ */
+void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<u32>& indices);
+
+/**
+ * Runs the three stages above, in that order, and measures the cache before and after.
+ */
+MeshOptimizerStats OptimizeMesh(std::vector<Vertex>& vertices, std::vector<u32>& indices);
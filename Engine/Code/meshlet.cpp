@@ -0,0 +1,260 @@
+// meshlet.cpp
+#include "meshlet.h"
+#include "model.h"
+#include "frustum_culling.h"
+#include "mesh_optimizer.h"
+
+#include <xmmintrin.h>
+
+#define MESHLET_NONE 0xFFFFFFFF
+
+static void ComputeMeshletBounds(const std::vector<Vertex>& vertices, const u32* indices, const std::vector<glm::vec3>& normals,
+    u32 firstTriangle, Meshlet& meshlet)
+{
+    glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    for (u32 i = 0; i < meshlet.triangleCount * 3; ++i) {
+        const glm::vec3& p = vertices[indices[i]].Position;
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+    meshlet.center = (boundsMin + boundsMax) * 0.5f;
+
+    f32 radiusSquared = 0.0f;
+    glm::vec3 normalSum(0.0f);
+    for (u32 i = 0; i < meshlet.triangleCount * 3; ++i) {
+        glm::vec3 offset = vertices[indices[i]].Position - meshlet.center;
+        radiusSquared = glm::max(radiusSquared, glm::dot(offset, offset));
+    }
+    meshlet.radius = sqrtf(radiusSquared);
+
+    for (u32 t = 0; t < meshlet.triangleCount; ++t) normalSum += normals[firstTriangle + t];
+
+    // The cone holds every triangle normal, degenerate triangles have none and do not count
+    meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = 1.0f;
+    f32 axisLength = glm::length(normalSum);
+    if (axisLength == 0.0f) return;
+
+    glm::vec3 axis = normalSum / axisLength;
+    f32 minDot = 1.0f;
+    for (u32 t = 0; t < meshlet.triangleCount; ++t) {
+        const glm::vec3& n = normals[firstTriangle + t];
+        if (n != glm::vec3(0.0f)) minDot = glm::min(minDot, glm::dot(n, axis));
+    }
+
+    meshlet.coneAxis = axis;
+    if (minDot >= MESHLET_MIN_CONE_DOT) meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+// Growing through the adjacency loses the cache optimized order, it is restored within the meshlet on its
+// own vertices (at most MESHLET_MAX_VERTICES), so the cost does not depend on the mesh size
+static void OptimizeMeshletVertexCache(u32* indices, u32 triangleCount, const std::vector<u32>& localVertex,
+    const u32* meshletVertices, u32 meshletVertexCount, std::vector<u32>& scratch)
+{
+    scratch.resize(triangleCount * 3);
+    for (u32 i = 0; i < triangleCount * 3; ++i) scratch[i] = localVertex[indices[i]];
+    OptimizeVertexCache(scratch, meshletVertexCount);
+    for (u32 i = 0; i < triangleCount * 3; ++i) indices[i] = meshletVertices[scratch[i]];
+}
+
+void BuildMeshlets(const std::vector<Vertex>& vertices, std::vector<u32>& indices, u32 indexOffset, u32 indexCount,
+    std::vector<Meshlet>& meshlets)
+{
+    u32 triangleCount = indexCount / 3;
+    if (triangleCount == 0) return;
+
+    const u32* source = &indices[indexOffset];
+    u32 vertexCount = (u32)vertices.size();
+
+    std::vector<glm::vec3> normals(triangleCount);
+    for (u32 t = 0; t < triangleCount; ++t) {
+        const glm::vec3& p0 = vertices[source[t * 3]].Position;
+        glm::vec3 n = glm::cross(vertices[source[t * 3 + 1]].Position - p0, vertices[source[t * 3 + 2]].Position - p0);
+        f32 length = glm::length(n);
+        normals[t] = length > 0.0f ? n / length : glm::vec3(0.0f);
+    }
+
+    // Triangles of every vertex
+    std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+    for (u32 i = 0; i < triangleCount * 3; ++i) adjacencyOffsets[source[i] + 1]++;
+    for (u32 v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+    std::vector<u32> adjacency(triangleCount * 3);
+    std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (u32 t = 0; t < triangleCount; ++t) {
+        for (u32 k = 0; k < 3; ++k) adjacency[fill[source[t * 3 + k]]++] = t;
+    }
+
+    // Membership is stamped with the meshlet number, so nothing is cleared between meshlets
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<u32> vertexMeshlet(vertexCount, MESHLET_NONE);
+    std::vector<u32> localVertex(vertexCount);
+    u32 meshletVertices[MESHLET_MAX_VERTICES];
+    std::vector<u32> scratch;
+    std::vector<u32> candidateMeshlet(triangleCount, MESHLET_NONE);
+    std::vector<u32> candidates;
+    std::vector<u32> result;
+    std::vector<glm::vec3> resultNormals;
+    result.reserve(triangleCount * 3);
+    resultNormals.reserve(triangleCount);
+
+    u32 meshletId = 0;
+    u32 seed = 0;
+    while (true)
+    {
+        // Each meshlet starts at the first triangle left, so they keep the order of the optimized list
+        while (seed < triangleCount && emitted[seed]) seed++;
+        if (seed == triangleCount) break;
+
+        Meshlet meshlet = {};
+        meshlet.indexOffset = indexOffset + (u32)result.size();
+        u32 firstTriangle = (u32)resultNormals.size();
+        u32 meshletVertexCount = 0;
+        glm::vec3 normalSum(0.0f);
+        candidates.clear();
+
+        u32 next = seed;
+        while (next != MESHLET_NONE)
+        {
+            emitted[next] = true;
+            for (u32 k = 0; k < 3; ++k) {
+                u32 v = source[next * 3 + k];
+                result.push_back(v);
+                if (vertexMeshlet[v] == meshletId) continue;
+
+                vertexMeshlet[v] = meshletId;
+                localVertex[v] = meshletVertexCount;
+                meshletVertices[meshletVertexCount++] = v;
+                for (u32 a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; ++a) {
+                    u32 t = adjacency[a];
+                    if (!emitted[t] && candidateMeshlet[t] != meshletId) {
+                        candidateMeshlet[t] = meshletId;
+                        candidates.push_back(t);
+                    }
+                }
+            }
+            resultNormals.push_back(normals[next]);
+            normalSum += normals[next];
+            meshlet.triangleCount++;
+            if (meshlet.triangleCount == MESHLET_MAX_TRIANGLES) break;
+
+            // Grow through the adjacent triangle that adds the fewest vertices, then the one facing the same way
+            next = MESHLET_NONE;
+            u32 bestNewVertices = 4;
+            f32 bestDot = -FLT_MAX;
+            u32 live = 0;
+            for (u32 c : candidates) {
+                if (emitted[c]) continue;
+                candidates[live++] = c;
+
+                u32 newVertices = 0;
+                for (u32 k = 0; k < 3; ++k) newVertices += vertexMeshlet[source[c * 3 + k]] != meshletId;
+                if (meshletVertexCount + newVertices > MESHLET_MAX_VERTICES) continue;
+
+                f32 dot = glm::dot(normals[c], normalSum);
+                if (newVertices < bestNewVertices || (newVertices == bestNewVertices && dot > bestDot)) {
+                    next = c;
+                    bestNewVertices = newVertices;
+                    bestDot = dot;
+                }
+            }
+            candidates.resize(live);
+        }
+
+        u32* meshletIndices = &result[meshlet.indexOffset - indexOffset];
+        ComputeMeshletBounds(vertices, meshletIndices, resultNormals, firstTriangle, meshlet);
+        OptimizeMeshletVertexCache(meshletIndices, meshlet.triangleCount, localVertex, meshletVertices, meshletVertexCount, scratch);
+        meshlets.push_back(meshlet);
+        meshletId++;
+    }
+
+    std::copy(result.begin(), result.end(), indices.begin() + indexOffset);
+}
+
+void BuildMeshletBounds(const std::vector<Meshlet>& meshlets, MeshletBounds& bounds)
+{
+    size_t size = meshlets.size() + 3;
+    for (std::vector<f32>* array : { &bounds.centerX, &bounds.centerY, &bounds.centerZ, &bounds.radius,
+        &bounds.axisX, &bounds.axisY, &bounds.axisZ, &bounds.cutoff }) {
+        array->assign(size, 0.0f);
+    }
+
+    for (size_t i = 0; i < meshlets.size(); ++i) {
+        const Meshlet& meshlet = meshlets[i];
+        bounds.centerX[i] = meshlet.center.x;
+        bounds.centerY[i] = meshlet.center.y;
+        bounds.centerZ[i] = meshlet.center.z;
+        bounds.radius[i] = meshlet.radius;
+        bounds.axisX[i] = meshlet.coneAxis.x;
+        bounds.axisY[i] = meshlet.coneAxis.y;
+        bounds.axisZ[i] = meshlet.coneAxis.z;
+        bounds.cutoff[i] = meshlet.coneCutoff;
+    }
+}
+
+u32 CullMeshlets(const MeshletBounds& bounds, u32 first, u32 count, const MeshletCullParams& params, std::vector<u8>& visible)
+{
+    visible.resize(count);
+
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for (u32 p = 0; p < 6; ++p) {
+        planeX[p] = _mm_set1_ps(params.planes[p].x);
+        planeY[p] = _mm_set1_ps(params.planes[p].y);
+        planeZ[p] = _mm_set1_ps(params.planes[p].z);
+        planeW[p] = _mm_set1_ps(params.planes[p].w);
+    }
+    __m128 cameraX = _mm_set1_ps(params.cameraPosition.x);
+    __m128 cameraY = _mm_set1_ps(params.cameraPosition.y);
+    __m128 cameraZ = _mm_set1_ps(params.cameraPosition.z);
+    __m128 zero = _mm_setzero_ps();
+
+    u32 visibleCount = 0;
+    for (u32 i = 0; i < count; i += 4) {
+        u32 base = first + i;
+        __m128 cx = _mm_loadu_ps(&bounds.centerX[base]);
+        __m128 cy = _mm_loadu_ps(&bounds.centerY[base]);
+        __m128 cz = _mm_loadu_ps(&bounds.centerZ[base]);
+        __m128 radius = _mm_loadu_ps(&bounds.radius[base]);
+        __m128 negativeRadius = _mm_sub_ps(zero, radius);
+
+        // Outside if the sphere is fully behind any plane
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (u32 p = 0; p < 6; ++p) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)),
+                _mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negativeRadius));
+        }
+
+        if (params.backface) {
+            __m128 dx = _mm_sub_ps(cx, cameraX);
+            __m128 dy = _mm_sub_ps(cy, cameraY);
+            __m128 dz = _mm_sub_ps(cz, cameraZ);
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&bounds.axisX[base])), _mm_mul_ps(dy, _mm_loadu_ps(&bounds.axisY[base]))),
+                _mm_mul_ps(dz, _mm_loadu_ps(&bounds.axisZ[base])));
+            __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&bounds.cutoff[base]), length), radius);
+            inside = _mm_andnot_ps(_mm_cmpge_ps(dot, limit), inside);
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        u32 lanes = glm::min(count - i, 4u);
+        for (u32 lane = 0; lane < lanes; ++lane) {
+            visible[i + lane] = (mask >> lane) & 1;
+            visibleCount += visible[i + lane];
+        }
+    }
+    return visibleCount;
+}
+
+MeshletCullParams MakeMeshletCullParams(const glm::mat4& modelViewProjection, const glm::mat4& modelMat, const glm::vec3& cameraPosition,
+    bool backface)
+{
+    MeshletCullParams params = {};
+
+    Frustum frustum = ExtractFrustum(modelViewProjection);
+    memcpy(params.planes, frustum.planes, sizeof(params.planes));
+
+    params.cameraPosition = glm::vec3(glm::inverse(modelMat) * glm::vec4(cameraPosition, 1.0f));
+    params.backface = backface && glm::determinant(glm::mat3(modelMat)) > 0.0f;
+    return params;
+}
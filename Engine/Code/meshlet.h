@@ -0,0 +1,81 @@
+// meshlet.h
+#pragma once
+
+#include "platform.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Vertex;
+
+#define MESHLET_MAX_VERTICES    64
+#define MESHLET_MAX_TRIANGLES   124
+#define MESHLET_MIN_CONE_DOT    0.1f    // Clusters with normals spread wider than this get no backface cone
+
+/*
+ * Cluster of triangles, a contiguous range of the mesh index buffer. The bounds are in model space.
+ * Backfacing test (the whole cluster faces away from the camera):
+ *   dot(center - camera, coneAxis) >= coneCutoff * length(center - camera) + radius
+ * A coneCutoff of 1 never passes it.
+ */
+struct Meshlet {
+    u32 indexOffset;
+    u32 triangleCount;
+    glm::vec3 center;
+    f32 radius;
+    glm::vec3 coneAxis;
+    f32 coneCutoff;     // Sine of the cone angle
+};
+
+/*
+ * The meshlet bounds as SoA for the SSE culling, padded so the last group of 4 can be loaded whole.
+ */
+struct MeshletBounds {
+    std::vector<f32> centerX, centerY, centerZ, radius;
+    std::vector<f32> axisX, axisY, axisZ, cutoff;
+};
+
+// Same layout as the GL indirect command
+struct DrawElementsIndirectCommand {
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    u32 baseVertex;
+    u32 baseInstance;
+};
+
+struct MeshletCullParams {
+    glm::vec4 planes[6];        // Frustum planes in model space, normalized, inside is positive
+    glm::vec3 cameraPosition;   // In model space
+    bool backface;              // Off for mirrored transforms, they flip the winding
+};
+
+struct MeshletCullStats {
+    u32 tested;
+    u32 visible;
+    u32 drawCommands;
+};
+
+/**
+ * Splits the triangles in [indexOffset, indexOffset + indexCount) in meshlets of at most
+ * MESHLET_MAX_VERTICES / MESHLET_MAX_TRIANGLES, growing each one through the triangles adjacent to
+ * it. The range is reordered in place, meshlet after meshlet with the triangles of each one in vertex
+ * cache order, and the meshlets appended.
+ */
+void BuildMeshlets(const std::vector<Vertex>& vertices, std::vector<u32>& indices, u32 indexOffset, u32 indexCount,
+    std::vector<Meshlet>& meshlets);
+
+void BuildMeshletBounds(const std::vector<Meshlet>& meshlets, MeshletBounds& bounds);
+
+/**
+ * Frustum and backface cone test of meshlets [first, first + count), 4 at a time.
+ * visible gets one byte per meshlet. Returns the number of visible meshlets.
+ */
+u32 CullMeshlets(const MeshletBounds& bounds, u32 first, u32 count, const MeshletCullParams& params, std::vector<u8>& visible);
+
+/**
+ * Model space culling parameters from the model-view-projection matrix. The backface cone test is
+ * only for one sided geometry, the engine does not enable GL_CULL_FACE.
+ */
+MeshletCullParams MakeMeshletCullParams(const glm::mat4& modelViewProjection, const glm::mat4& modelMat, const glm::vec3& cameraPosition,
+    bool backface);
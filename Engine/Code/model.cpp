@@ -1,9 +1,13 @@
 // model.cpp
 #include "engine.h"
 #include "model.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "asset_loader.h"
+#include "gl_extensions.h"
 
 Material::Material() {
-    diffuse.color       = glm::vec4(glm::vec3(Model::RandomColorRGB(), Model::RandomColorRGB(), Model::RandomColorRGB()), 1.0f);
+    diffuse.color       = glm::vec4(glm::vec3(ModelAsset::RandomColorRGB(), ModelAsset::RandomColorRGB(), ModelAsset::RandomColorRGB()), 1.0f);
     metallic.color       = glm::vec4(glm::vec3(0.5f), 1.0f);
     normal.color        = glm::vec4(glm::vec3(0.5f, 0.5f, 1.0f), 1.0f);
     height.color        = glm::vec4(glm::vec3(0.0f), 1.0f);
@@ -14,134 +18,270 @@ Material::Material() {
     metallic.prop_enabled = true;
 }
 
-void Mesh::Draw(const Shader& shader) const {
-    glBindVertexArray(VAO);
+void Mesh::SetupCompactMesh(GeometryArenas& arenas, const CompactVertex* vertexData, u32 numVertices, const void* indexData, GLenum type, u32 numIndices,
+    const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    vertexCount = numVertices;
+    indexCount = numIndices;
+    if (lods.empty()) lods.push_back({ 0, numIndices, 0.0f, 0, 0 });
+    vertexFormat = VertexFormat_Compact;
+    indexType = type;
+    positionOffset = boundsMin;
+    positionScale = glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+
+    arena = GetGeometryArenaType(VertexFormat_Compact, type);
+    AllocateGeometry(arenas, arena, vertexData, numVertices, indexData, numIndices, vertexOffset, indexOffset);
+}
 
-    shader.SetInt("mat_textures.diffuse", 0);
-    shader.SetVec4("material.diffuse.color", material->diffuse.color);
-    shader.SetBool("material.diffuse.prop_enabled", material->diffuse.prop_enabled);
-    if (material->diffuse.tex_enabled) {
-        shader.SetBool("material.diffuse.use_text", true);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, material->diffuse.texture->id);
+// Units of BindMaterialTextures, in the order of the texture units
+static const char* MaterialTextureNames[MATERIAL_TEXTURE_COUNT] = {
+    "mat_textures.diffuse", "mat_textures.metallic", "mat_textures.normal",
+    "mat_textures.height", "mat_textures.roughness", "mat_textures.alphaMask"
+};
+
+MeshShaderUniforms GetMeshShaderUniforms(Shader& shader) {
+    MeshShaderUniforms uniforms;
+    uniforms.compactVertex = shader.GetUniform<bool>("compactVertex");
+    for (u32 i = 0; i < MATERIAL_TEXTURE_COUNT; ++i) {
+        uniforms.textureUnits[i] = shader.GetUniform<int>(MaterialTextureNames[i]);
     }
-    else {
-        shader.SetBool("material.diffuse.use_text", false);
+    for (u32 i = 0; i < MATERIAL_TEXTURE_ARRAY_COUNT; ++i) {
+        uniforms.textureArrays[i] = shader.GetUniform<int>("uTextureArrays[" + std::to_string(i) + "]");
     }
+    uniforms.parallaxScale = shader.GetUniform<float>("parallaxScale");
+    uniforms.parallaxLayers = shader.GetUniform<float>("numLayers");
+    return uniforms;
+}
 
-    shader.SetInt("mat_textures.metallic", 1);
-    shader.SetVec4("material.metallic.color", material->metallic.color);
-    shader.SetBool("material.metallic.prop_enabled", material->metallic.prop_enabled);
-    if (material->metallic.tex_enabled) {
-        shader.SetBool("material.metallic.use_text", true);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, material->metallic.texture->id);
+void SetMaterialTextureUnits(const Shader& shader, const MeshShaderUniforms& uniforms) {
+    for (u32 i = 0; i < MATERIAL_TEXTURE_COUNT; ++i) {
+        shader.Set(uniforms.textureUnits[i], (int)i);
     }
-    else {
-        shader.SetBool("material.metallic.use_text", false);
+    for (u32 i = 0; i < MATERIAL_TEXTURE_ARRAY_COUNT; ++i) {
+        shader.Set(uniforms.textureArrays[i], (int)i);
     }
+}
 
-    shader.SetInt("mat_textures.normal", 2);
-    shader.SetVec4("material.normal.color", material->normal.color);
-    shader.SetBool("material.normal.prop_enabled", material->normal.prop_enabled);
-    if (material->normal.prop_enabled) {
-        if (material->normal.tex_enabled) {
-            shader.SetBool("material.normal.use_text", true);
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, material->normal.texture->id);
-        }
-        else {
-            shader.SetBool("material.normal.use_text", false);
-        }
+// Textures of the properties that are not always used are only acquired when enabled, so they can be evicted
+static void BindMaterialTexture(const Mat_Property& property, u32 unit, bool onlyIfEnabled) {
+    if (onlyIfEnabled && !property.prop_enabled) return;
+    if (property.AcquireTexture()) {
+        GLState::ActiveTexture(GL_TEXTURE0 + unit);
+        GLState::BindTexture(GL_TEXTURE_2D, property.texture->id);
     }
+}
+
+void BindMaterialTextures(const Material& material) {
+    BindMaterialTexture(material.diffuse, 0, false);
+    BindMaterialTexture(material.metallic, 1, false);
+    BindMaterialTexture(material.normal, 2, true);
+    BindMaterialTexture(material.height, 3, true);
+    BindMaterialTexture(material.roughness, 4, true);
+    BindMaterialTexture(material.alphaMask, 5, true);
+}
+
+bool ModelAsset::ImportMeshes(std::string const& path, ModelImport& import) {
+    const aiScene* scene = aiImportFile(path.c_str(), MODEL_IMPORT_FLAGS);
 
-    shader.SetInt("mat_textures.height", 3);
-    shader.SetVec4("material.height.color", material->height.color);
-    shader.SetBool("material.height.prop_enabled", material->height.prop_enabled);
-    if (material->height.prop_enabled) {
-        if (material->height.tex_enabled) {
-            shader.SetBool("material.height.use_text", true);
-            glActiveTexture(GL_TEXTURE3);
-            glBindTexture(GL_TEXTURE_2D, material->height.texture->id);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        ELOG("Error loading mesh %s: %s", path.c_str(), aiGetErrorString());
+        if (scene) aiReleaseImport(scene);
+        return false;
+    }
+
+    ProcessNode(scene->mRootNode, scene, import);
+    aiReleaseImport(scene);
+
+    for (size_t i = 0; i < import.meshes.size(); ++i) {
+        MeshImport& mesh = import.meshes[i];
+        MeshOptimizerStats stats = OptimizeMesh(mesh.vertices, mesh.indices);
+        u32 triangleCount = (u32)mesh.indices.size() / 3;
+
+        // After the optimization, the levels share its vertex order
+        GenerateMeshLods(mesh.vertices, mesh.indices, mesh.lods);
+        for (size_t l = 1; l < mesh.lods.size(); ++l) {
+            ILOG("%s mesh %u LOD%u: %u tris, error %.4f", path.c_str(), (u32)i, (u32)l, mesh.lods[l].indexCount / 3, mesh.lods[l].error);
         }
-        else {
-            shader.SetBool("material.height.use_text", false);
+
+        for (MeshLod& lod : mesh.lods) {
+            lod.meshletOffset = (u32)mesh.meshlets.size();
+            BuildMeshlets(mesh.vertices, mesh.indices, lod.indexOffset, lod.indexCount, mesh.meshlets);
+            lod.meshletCount = (u32)mesh.meshlets.size() - lod.meshletOffset;
         }
+
+        // Measured on LOD0 as it is uploaded, after the meshlets regrouped it
+        AnalyzeVertexCache(mesh.indices.data(), mesh.lods[0].indexCount, (u32)mesh.vertices.size(), MESH_OPT_ANALYZE_CACHE_SIZE,
+            stats.acmrAfter, stats.atvrAfter);
+        ILOG("%s mesh %u (%u tris): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %u meshlets at LOD0", path.c_str(), (u32)i, triangleCount,
+            stats.acmrBefore, stats.acmrAfter, stats.atvrBefore, stats.atvrAfter, mesh.lods[0].meshletCount);
     }
 
-    shader.SetInt("mat_textures.roughness", 4);
-    shader.SetVec4("material.roughness.color", material->roughness.color);
-    shader.SetBool("material.roughness.prop_enabled", material->roughness.prop_enabled);
-    if (material->roughness.prop_enabled) {
-        if (material->roughness.tex_enabled) {
-            shader.SetBool("material.roughness.use_text", true);
-            glActiveTexture(GL_TEXTURE4);
-            glBindTexture(GL_TEXTURE_2D, material->roughness.texture->id);
+    for (MeshImport& mesh : import.meshes) {
+        mesh.vertexData = mesh.vertices.data();
+        mesh.vertexCount = (u32)mesh.vertices.size();
+        mesh.indexData = mesh.indices.data();
+        mesh.indexCount = (u32)mesh.indices.size();
+    }
+    return true;
+}
+
+bool ModelAsset::ImportModel(std::string const& path, ModelImport& import, VertexFormat vertexFormat) {
+    import.path = path;
+
+    // Warm start: the meshes are mapped from the cache as they are uploaded, Assimp and the processing are skipped
+    u64 sourceHash = 0;
+    std::string cachePath;
+    if (HashFileContents(path.c_str(), sourceHash)) {
+        cachePath = GetMeshCachePath(path, sourceHash, MODEL_IMPORT_FLAGS, vertexFormat);
+        if (ReadMeshCache(cachePath, sourceHash, MODEL_IMPORT_FLAGS, vertexFormat, import)) {
+            import.valid = true;
+            return true;
         }
-        else {
-            shader.SetBool("material.roughness.use_text", false);
+    }
+
+    if (!ImportMeshes(path, import)) {
+        return false;
+    }
+
+    for (MeshImport& mesh : import.meshes) {
+        ComputeBounds(mesh.vertexData, mesh.vertexCount, mesh.boundsMin, mesh.boundsMax, mesh.boundsCenter, mesh.boundsRadius);
+        BuildMeshletBounds(mesh.meshlets, mesh.meshletBounds);
+        BuildMeshBvh(mesh.pickingBvh, mesh.vertexData, mesh.vertexCount, mesh.indexData,
+            mesh.lods.empty() ? mesh.indexCount : mesh.lods[0].indexCount);
+
+        if (vertexFormat == VertexFormat_Compact) {
+            CompactMeshImport(mesh);
         }
     }
 
-    shader.SetInt("mat_textures.alphaMask", 5);
-    shader.SetVec4("material.alphaMask.color", material->alphaMask.color);
-    shader.SetBool("material.alphaMask.prop_enabled", material->alphaMask.prop_enabled);
-    if (material->alphaMask.prop_enabled) {
-        if (material->alphaMask.tex_enabled) {
-            shader.SetBool("material.alphaMask.use_text", true);
-            glActiveTexture(GL_TEXTURE5);
-            glBindTexture(GL_TEXTURE_2D, material->alphaMask.texture->id);
+    // Written in the final format, warm starts upload it with no conversion
+    if (!cachePath.empty()) {
+        WriteMeshCache(cachePath, import, sourceHash, MODEL_IMPORT_FLAGS);
+    }
+
+    import.valid = true;
+    return true;
+}
+
+void ModelAsset::CreateFromImport(App* app, ModelImport& import) {
+    GLUtils::ErrorGuard guard("ModelUpload");
+
+    this->name = std::filesystem::path(import.path).stem().string();
+    directory = import.path.substr(0, import.path.find_last_of('/'));
+
+    for (MeshImport& meshImport : import.meshes) {
+        Mesh mesh;
+
+        // One material per mesh, in the order of the source file
+        materials.push_back(std::make_shared<Material>());
+        mesh.material = materials.back();
+        mesh.material->name = meshImport.materialName.empty() ? "unnamed_material" : meshImport.materialName;
+        mesh.material->sourceDiffusePath = meshImport.diffusePath;
+        if (!meshImport.diffusePath.empty()) {
+            mesh.material->diffuse.tex_enabled = LoadTextureToMat(app, mesh.material->diffuse.texture, meshImport.diffusePath);
+        }
+
+        mesh.lods = meshImport.lods;
+        mesh.boundsMin = meshImport.boundsMin;
+        mesh.boundsMax = meshImport.boundsMax;
+        mesh.boundsCenter = meshImport.boundsCenter;
+        mesh.boundsRadius = meshImport.boundsRadius;
+        mesh.meshlets = std::move(meshImport.meshlets);
+        mesh.meshletBounds = std::move(meshImport.meshletBounds);
+        mesh.pickingBvh = std::move(meshImport.pickingBvh);
+
+        if (meshImport.format == VertexFormat_Compact) {
+            bool shortIndices = meshImport.indexData16 != NULL;
+            mesh.SetupCompactMesh(app->geometryArenas, meshImport.compactVertexData, meshImport.vertexCount,
+                shortIndices ? (const void*)meshImport.indexData16 : (const void*)meshImport.indexData,
+                shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, meshImport.indexCount,
+                meshImport.boundsMin, meshImport.boundsMax);
         }
         else {
-            shader.SetBool("material.alphaMask.use_text", false);
+            mesh.SetupMesh(app->geometryArenas, meshImport.vertexData, meshImport.vertexCount, meshImport.indexData, meshImport.indexCount);
         }
+
+        // Meshes from the cache keep no CPU copy of the geometry
+        mesh.vertices = std::move(meshImport.vertices);
+        mesh.indices = std::move(meshImport.indices);
+        meshes.push_back(std::move(mesh));
     }
 
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-    glActiveTexture(GL_TEXTURE0);
+    UnmapFile(import.cacheFile);
+    import.meshes.clear();
 }
 
-void Model::LoadModel(std::string const& path, App* app) {
-    GLUtils::ErrorGuard guard("AssimpLoad");
+void ModelInstance::SelectLods(const glm::mat4& modelMat, const glm::vec3& cameraPosition, f32 projectionScale, f32 bias, i32 forcedLod) {
+    if (!asset) return;
+    const std::vector<Mesh>& meshes = asset->meshes;
+    meshLods.resize(meshes.size(), 0);
 
-    const aiScene* scene = aiImportFile(path.c_str(),
-        aiProcess_Triangulate |
-        aiProcess_GenSmoothNormals |
-        aiProcess_CalcTangentSpace |
-        aiProcess_JoinIdenticalVertices |
-        aiProcess_PreTransformVertices |
-        aiProcess_ImproveCacheLocality |
-        aiProcess_OptimizeMeshes |
-        aiProcess_SortByPType);
+    // Spheres are scaled by the largest axis, so they still contain the mesh
+    f32 maxScale = glm::max(glm::length(glm::vec3(modelMat[0])), glm::max(glm::length(glm::vec3(modelMat[1])), glm::length(glm::vec3(modelMat[2]))));
 
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-        ELOG("Error loading mesh %s: %s", path.c_str(), aiGetErrorString());
-        return;
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        const Mesh& mesh = meshes[i];
+        u32 lodCount = (u32)mesh.lods.size();
+        if (forcedLod >= 0) {
+            meshLods[i] = glm::min((u32)forcedLod, lodCount - 1);
+            continue;
+        }
+
+        glm::vec3 center = glm::vec3(modelMat * glm::vec4(mesh.boundsCenter, 1.0f));
+        f32 radius = mesh.boundsRadius * maxScale;
+        f32 distance = glm::length(center - cameraPosition);
+
+        // Diameter over the screen height, the camera inside the sphere always gets LOD0
+        f32 screenSize = distance > radius ? radius * projectionScale / distance : FLT_MAX;
+        meshLods[i] = SelectMeshLod(meshLods[i], lodCount, screenSize, bias);
     }
+}
 
-    this->name = std::filesystem::path(path).stem().string();
+u32 Mesh::BuildDrawCommands(u32 lodIndex, u32 drawId, const MeshletCullParams* cull, std::vector<DrawElementsIndirectCommand>& commands, MeshletCullStats& stats) const {
+    u32 firstCommand = (u32)commands.size();
+
+    // Indices are relative to the mesh, the base vertex places them in the arena
+    const MeshLod& lod = lods[glm::min(lodIndex, (u32)lods.size() - 1)];
+    if (!cull || lod.meshletCount == 0) {
+        commands.push_back({ lod.indexCount, 1, indexOffset + lod.indexOffset, vertexOffset, drawId });
+        return 1;
+    }
 
-    directory = path.substr(0, path.find_last_of('/'));
-    ProcessNode(scene->mRootNode, scene, app);
+    static std::vector<u8> visible;     // Scratch, the culling runs on the main thread
+    stats.tested += lod.meshletCount;
+    stats.visible += CullMeshlets(meshletBounds, lod.meshletOffset, lod.meshletCount, *cull, visible);
+
+    for (u32 i = 0; i < lod.meshletCount; ++i) {
+        if (!visible[i]) continue;
+
+        const Meshlet& meshlet = meshlets[lod.meshletOffset + i];
+        u32 meshletFirstIndex = indexOffset + meshlet.indexOffset;
+        bool contiguous = commands.size() > firstCommand &&
+            commands.back().firstIndex + commands.back().count == meshletFirstIndex;
+        if (contiguous) {
+            commands.back().count += meshlet.triangleCount * 3;
+        }
+        else {
+            commands.push_back({ meshlet.triangleCount * 3, 1, meshletFirstIndex, vertexOffset, drawId });
+        }
+    }
+    return (u32)commands.size() - firstCommand;
 }
 
-void Model::ProcessNode(aiNode* node, const aiScene* scene, App* app) {
+void ModelAsset::ProcessNode(aiNode* node, const aiScene* scene, ModelImport& import) {
     for (u32 i = 0; i < node->mNumMeshes; i++) {
         aiMesh* ai_mesh = scene->mMeshes[node->mMeshes[i]];
-        Mesh mesh;
-        ProcessMesh(app, ai_mesh, scene, mesh);
-        mesh.SetupMesh();
-        meshes.push_back(mesh);
+        import.meshes.emplace_back();
+        ProcessMesh(ai_mesh, scene, import.meshes.back());
     }
 
     for (u32 i = 0; i < node->mNumChildren; i++) {
-        ProcessNode(node->mChildren[i], scene, app);
+        ProcessNode(node->mChildren[i], scene, import);
     }
 }
 
-void Model::ProcessMesh(App* app, aiMesh* mesh, const aiScene* scene, Mesh& new_mesh) {
+void ModelAsset::ProcessMesh(aiMesh* mesh, const aiScene* scene, MeshImport& new_mesh) {
     // Vertices
+    new_mesh.vertices.reserve(mesh->mNumVertices);
     for (u32 i = 0; i < mesh->mNumVertices; i++) {
         Vertex vertex;
         vertex.Position = { mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z };
@@ -163,6 +303,7 @@ void Model::ProcessMesh(App* app, aiMesh* mesh, const aiScene* scene, Mesh& new_
     }
 
     // Indices
+    new_mesh.indices.reserve(mesh->mNumFaces * 3);
     for (u32 i = 0; i < mesh->mNumFaces; i++) {
         aiFace face = mesh->mFaces[i];
         for (u32 j = 0; j < face.mNumIndices; j++) {
@@ -173,89 +314,36 @@ void Model::ProcessMesh(App* app, aiMesh* mesh, const aiScene* scene, Mesh& new_
     // Material
     if (mesh->mMaterialIndex >= 0) {
         aiMaterial* mat = scene->mMaterials[mesh->mMaterialIndex];
-        materials.push_back(std::make_shared<Material>());
-        new_mesh.material = materials.back();
 
         aiString matName;
         if (mat->Get(AI_MATKEY_NAME, matName) == AI_SUCCESS) {
-            new_mesh.material->name = matName.C_Str();
+            new_mesh.materialName = matName.C_Str();
         }
-        else {
-            new_mesh.material->name = "unnamed_material";
-        }
-
-        LoadMaterialTextures(app, mat, *new_mesh.material);
-    }
-}
-
-void Model::LoadMaterialTextures(App* app, aiMaterial* mat, Material& material) {
 
-    if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
-        aiString path;
-        mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
-        material.diffuse.tex_enabled = LoadTextureToMat(app, material.diffuse.texture, path.C_Str());
+        if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
+            aiString path;
+            mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
+            new_mesh.diffusePath = path.C_Str();
+        }
     }
 }
 
-bool Model::LoadTextureToMat(App* app, std::shared_ptr<Texture>& texture, std::string path) {
+bool ModelAsset::LoadTextureToMat(App* app, std::shared_ptr<Texture>& texture, std::string path) {
 
     std::filesystem::path fsPath(path);
-    std::string textureName = fsPath.stem().string();
     std::string fullPath = (std::filesystem::path(directory) / fsPath).lexically_normal().string();
 
-    auto it = std::find_if(app->textures_loaded.begin(), app->textures_loaded.end(),
-        [&](const std::shared_ptr<Texture>& t) { return t->path == fullPath; });
-
-    if (it != app->textures_loaded.end()) {
-        texture = *it;
-        return true;
-    }
-
-    GLuint textureID = TextureFromFile(fullPath.c_str());
-    if (textureID == 0) {
-        return false;
-    }
-
-    std::shared_ptr<Texture> new_texture = std::make_shared<Texture>();
-    new_texture->id = textureID;
-    new_texture->name = textureName;
-    new_texture->path = fullPath;
-    app->textures_loaded.push_back(new_texture);
-    texture = new_texture;
+    // The texture is decoded on a worker thread, until then it is a placeholder with id 0
+    texture = RequestTexture(app, fullPath);
+    return texture != nullptr;
 }
 
-bool Model::LoadSingleTexture(App* app, std::string fullPath) {
-    
-
-    std::filesystem::path fsPath(fullPath);
-    std::string textureName = fsPath.stem().string();
-    fullPath = fsPath.lexically_normal().string();
-
-    // Check if texture already loaded
-    auto it = std::find_if(app->textures_loaded.begin(), app->textures_loaded.end(),
-        [&](const std::shared_ptr<Texture>& t) { return t->path == fullPath; });
-
-    if (it != app->textures_loaded.end()) {
-        return true;
-    }
-
-    // Load new texture
-    GLuint textureID = TextureFromFile(fullPath.c_str());
-    if (textureID == 0) {
-        return false;
-    }
-
-    // Add to loaded textures
-    std::shared_ptr<Texture> new_texture = std::make_shared<Texture>();
-    new_texture->id = textureID;
-    new_texture->name = textureName;
-    new_texture->path = fullPath;
-    app->textures_loaded.push_back(new_texture);
-
-    return true;
+bool ModelAsset::LoadSingleTexture(App* app, std::string fullPath) {
+    fullPath = std::filesystem::path(fullPath).lexically_normal().string();
+    return RequestTexture(app, fullPath) != nullptr;
 }
 
-bool Model::LoadTexture(App* app, std::string path) {
+bool ModelAsset::LoadTexture(App* app, std::string path) {
 
     namespace fs = std::filesystem;
 
@@ -279,41 +367,7 @@ bool Model::LoadTexture(App* app, std::string path) {
     }
 }
 
-GLuint Model::TextureFromFile(const char* path) {
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-
-    if (data) {
-        GLenum format = GL_RGBA;
-        if (nrComponents == 1) format = GL_RED;
-        else if (nrComponents == 3) format = GL_RGB;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else {
-        ELOG("Failed to load texture at path: %s", path);
-        stbi_image_free(data);
-        glDeleteTextures(1, &textureID);
-        return 0;
-    }
-
-    return textureID;
-}
-
-GLuint Model::CreateSolidColorTexture(float r, float g, float b, float a) {
+GLuint ModelAsset::CreateSolidColorTexture(float r, float g, float b, float a) {
     GLuint textureID;
     glGenTextures(1, &textureID);
 
@@ -324,7 +378,7 @@ GLuint Model::CreateSolidColorTexture(float r, float g, float b, float a) {
         static_cast<unsigned char>(a * 255)
     };
 
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    GLState::BindTexture(GL_TEXTURE_2D, textureID);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -335,7 +389,7 @@ GLuint Model::CreateSolidColorTexture(float r, float g, float b, float a) {
     return textureID;
 }
 
-Texture Model::TextureFromColor(std::string textureName, glm::vec4 color) {
+Texture ModelAsset::TextureFromColor(std::string textureName, glm::vec4 color) {
     aiColor3D diffuseColor(color.x, color.y, color.z); // Default gray
 
     Texture fallbackDiffuse;
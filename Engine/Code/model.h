@@ -3,6 +3,14 @@
 
 #include "platform.h"
 #include "shader.h"
+#include "texture_registry.h"
+#include "vertex_format.h"
+#include "mesh_lod.h"
+#include "meshlet.h"
+#include "frustum_culling.h"
+#include "bvh.h"
+#include "geometry_arena.h"
+#include "material_textures.h"
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
@@ -21,6 +29,10 @@
 
 struct App;
 
+#define MODEL_IMPORT_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | \
+    aiProcess_JoinIdenticalVertices | aiProcess_PreTransformVertices | aiProcess_OptimizeMeshes | \
+    aiProcess_SortByPType)  // Triangle and vertex order are left to OptimizeMesh (mesh_optimizer.h)
+
 struct Vertex {
     glm::vec3 Position;
     glm::vec3 Normal;
@@ -30,13 +42,33 @@ struct Vertex {
 };
 
 struct Texture {
-    GLuint id;
+    GLuint id = 0;
     std::string name;
     std::string path;
 
+    // Registry bookkeeping, see texture_registry.h
+    TextureRegistry* registry = NULL;
+    TextureHandle handle = INVALID_TEXTURE_HANDLE;
+    TextureState state = TextureState_Loading;
+    u64 bytes = 0;
+    u64 lastUsedFrame = 0;
+    std::list<Texture*>::iterator lruEntry;
+
+    // Reference of the materials buffer when textures are not bound, see material_textures.h
+    MaterialTextures* materialTextures = NULL;
+    GLuint referenceId = 0;         // GL texture the reference was made from
+    GLuint64 bindlessHandle = 0;
+    u32 arrayIndex = INVALID_TEXTURE_ARRAY_INDEX;
+    u32 arrayLayer = 0;
+
+    bool translucent = false;       // Some pixel has alpha below 1, known once decoded (or read from the cache)
+
     ~Texture() {
+        if (materialTextures) {
+            ReleaseMaterialTexture(*materialTextures, *this);
+        }
         if (id != 0) {
-            glDeleteTextures(1, &id);
+            GLState::DeleteTextures(1, &id);
         }
     }
 
@@ -51,6 +83,14 @@ struct Mat_Property
     glm::vec4 color;
     bool tex_enabled = false;
     bool prop_enabled = false;
+
+    // Textures are streamed in (and reloaded after an eviction), until the upload is done the color is used.
+    // Also marks the texture as used, so it stays resident or gets reloaded.
+    bool AcquireTexture() const {
+        if (!tex_enabled || !texture) return false;
+        TouchTexture(*texture);
+        return texture->id != 0;
+    }
 };
 
 class Material {
@@ -65,90 +105,178 @@ public:
     Mat_Property height;
     Mat_Property roughness;     //roughness vs glossiness = glossines es el inverso del otro
     Mat_Property alphaMask;
+
+    std::string sourceDiffusePath;  // Diffuse texture as referenced by the source file, kept for the mesh cache
+
+    bool dirty = true;              // Set when edited, so the materials buffer gets it again (UpdateDrawBatchMaterials)
+
+    // Blended by the forward shader: its alpha comes from the mask, the diffuse texture or the diffuse color
+    bool IsTransparent() const {
+        if (alphaMask.prop_enabled) return true;
+        if (diffuse.tex_enabled && diffuse.texture) return diffuse.texture->translucent;
+        return diffuse.color.a < 1.0f;
+    }
 };
 
+#define MATERIAL_TEXTURE_COUNT 6
+
+/*
+ * Uniforms of the mesh shaders (forward, geometry pass), resolved once per shader. The material
+ * values themselves are read from the materials buffer (see GpuMaterial).
+ */
+struct MeshShaderUniforms {
+    UniformHandle<bool> compactVertex;
+    UniformHandle<int> textureUnits[MATERIAL_TEXTURE_COUNT];    // mat_textures samplers
+    UniformHandle<int> textureArrays[MATERIAL_TEXTURE_ARRAY_COUNT];
+    UniformHandle<float> parallaxScale;
+    UniformHandle<float> parallaxLayers;    // numLayers, only in the geometry pass
+};
+
+MeshShaderUniforms GetMeshShaderUniforms(Shader& shader);
+
+/**
+ * Points the material samplers of the shader to the units BindMaterialTextures uses, and the
+ * texture arrays to those of BindMaterialTextureArrays. Only one set is compiled in.
+ */
+void SetMaterialTextureUnits(const Shader& shader, const MeshShaderUniforms& uniforms);
+
+/**
+ * Binds the enabled material textures to units 0 to 5.
+ */
+void BindMaterialTextures(const Material& material);
+
 class Mesh {
 public:
     // Submesh data now directly in Mesh
     std::vector<Vertex> vertices;
     std::vector<u32> indices;
     std::shared_ptr<Material> material;
-    u32 vertexOffset;
-    u32 indexOffset;
-
-    GLuint VAO, VBO, EBO;
 
-    void SetupMesh() {
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(u32), indices.data(), GL_STATIC_DRAW);
-
-        // Vertex attributes
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    // Place in the shared geometry buffers, see geometry_arena.h
+    GeometryArenaType arena = GeometryArena_Float;
+    u32 vertexOffset = 0;   // Base vertex of the draws, the indices are relative to the mesh
+    u32 indexOffset = 0;
+    u32 vertexCount = 0;
+    u32 indexCount = 0;    // Meshes loaded from the mesh cache keep no CPU copy of the indices
+
+    VertexFormat vertexFormat = VertexFormat_Float;
+    GLenum indexType = GL_UNSIGNED_INT;
+    glm::vec3 positionOffset = glm::vec3(0.0f);     // Dequantization of compact positions
+    glm::vec3 positionScale = glm::vec3(1.0f);
+
+    // Levels of detail, ranges of the index buffer (see mesh_lod.h). Meshes without them draw everything as LOD0.
+    std::vector<MeshLod> lods;
+    glm::vec3 boundsMin = glm::vec3(0.0f);          // Bounding box and sphere, in model space
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    glm::vec3 boundsCenter = glm::vec3(0.0f);
+    f32 boundsRadius = 0.0f;
+
+    // Clusters of every level, culled each frame into indirect commands (see BuildDrawCommands)
+    std::vector<Meshlet> meshlets;
+    MeshletBounds meshletBounds;
+
+    MeshBvh pickingBvh;     // Triangles of LOD0, see PickSceneBvh
+
+    void SetupMesh(GeometryArenas& arenas) {
+        SetupMesh(arenas, vertices.data(), vertices.size(), indices.data(), indices.size());
+    }
 
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+    // Uploads the geometry straight from the given memory (e.g. a mapped mesh cache file)
+    void SetupMesh(GeometryArenas& arenas, const Vertex* vertexData, u32 numVertices, const u32* indexData, u32 numIndices) {
+        vertexCount = numVertices;
+        indexCount = numIndices;
+        if (lods.empty()) lods.push_back({ 0, numIndices, 0.0f, 0, 0 });
 
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        arena = GeometryArena_Float;
+        AllocateGeometry(arenas, arena, vertexData, numVertices, indexData, numIndices, vertexOffset, indexOffset);
+    }
 
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+    // Compact layout, see vertex_format.h. indexData is u16 or u32 as given by indexType.
+    void SetupCompactMesh(GeometryArenas& arenas, const CompactVertex* vertexData, u32 numVertices, const void* indexData, GLenum type, u32 numIndices,
+        const glm::vec3& boundsMin, const glm::vec3& boundsMax);
 
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    /**
+     * Appends the indirect commands of a LOD for the draw drawId, returns how many. With cull set, only
+     * the meshlets that pass the frustum and backface tests are drawn, merged into one command where they
+     * are contiguous. Without it, the whole LOD.
+     */
+    u32 BuildDrawCommands(u32 lodIndex, u32 drawId, const MeshletCullParams* cull, std::vector<DrawElementsIndirectCommand>& commands, MeshletCullStats& stats) const;
+};
 
-        glBindVertexArray(0);
-    }
+struct MeshImport {
+    std::vector<Vertex> vertices;       // Only filled by Assimp imports
+    std::vector<u32> indices;
+    const Vertex* vertexData = NULL;    // Points to vertices or into the mapped mesh cache, float format only
+    const u32* indexData = NULL;        // NULL when indexData16 is set
+    u32 vertexCount = 0;
+    u32 indexCount = 0;
+
+    VertexFormat format = VertexFormat_Float;
+    std::vector<CompactVertex> compactVertices;     // Compact format only
+    std::vector<u16> indices16;                     // Compact format with fewer than 65536 vertices
+    const CompactVertex* compactVertexData = NULL;  // Points to compactVertices or into the mapped mesh cache
+    const u16* indexData16 = NULL;                  // Points to indices16 or into the mapped mesh cache
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+    std::vector<MeshLod> lods;          // The index data holds every level, LOD0 first
+    glm::vec3 boundsCenter = glm::vec3(0.0f);
+    f32 boundsRadius = 0.0f;
+    std::vector<Meshlet> meshlets;
+    MeshletBounds meshletBounds;
+    MeshBvh pickingBvh;
+
+    std::string materialName;
+    std::string diffusePath;            // As referenced by the source file
+};
 
-    void Draw(const Shader& shader) const;
+// CPU side result of a model import, produced on a worker thread and uploaded on the main thread
+struct ModelImport {
+    std::string path;
+    std::vector<MeshImport> meshes;
+    MappedFile cacheFile = {};          // Kept mapped until the meshes are uploaded
+    bool valid = false;
 };
 
-class Model {
+/*
+ * What a model file loads into: the meshes in the geometry arenas and their materials. It is shared
+ * by every ModelInstance placing it in the scene, so the GPU data exists once however many there are.
+ */
+class ModelAsset {
 public:
     std::string name;
     std::vector<Mesh> meshes;
     std::vector<std::shared_ptr<Material>> materials;
     std::string directory;
 
-    u32 bufferOffset;
-    u32 bufferSize;
-
-    glm::vec3 position = glm::vec3(0.0f);
-    glm::vec3 rotation = glm::vec3(0.0f);
-    glm::vec3 scale = glm::vec3(1.0f);
+    ModelAsset() = default;
 
-    Model() = default;
-
-    Model(std::string const& path, App* app) {
-        LoadModel(path, app);
+    // Synchronous load, see LoadModelAsync in asset_loader.h to load on the worker threads
+    ModelAsset(std::string const& path, App* app, VertexFormat vertexFormat = VertexFormat_Float) {
+        ModelImport import;
+        ImportModel(path, import, vertexFormat);
+        CreateFromImport(app, import);
     }
 
-    void Draw(Shader& shader) {
-        for (auto& mesh : meshes) {
-            mesh.Draw(shader);
-        }
-    }
-
-private:
-    void LoadModel(std::string const& path, App* app);
-
-    void ProcessNode(aiNode* node, const aiScene* scene, App* app);
+    /**
+     * CPU stage of the load: maps the mesh cache, or runs Assimp, the mesh processing and the conversion
+     * to the requested vertex format and writes the cache. It makes no GL calls and touches no engine
+     * state, so it can run on any thread.
+     */
+    static bool ImportModel(std::string const& path, ModelImport& import, VertexFormat vertexFormat = VertexFormat_Float);
 
-    void ProcessMesh(App* app, aiMesh* mesh, const aiScene* scene, Mesh& new_mesh);
+    /**
+     * GL stage of the load: creates the materials and the mesh buffers. Main thread only.
+     */
+    void CreateFromImport(App* app, ModelImport& import);
 
-    void LoadMaterialTextures(App* app, aiMaterial* mat, Material& material);
+private:
+    // Assimp import, optimization, LODs and meshlets, in the float format
+    static bool ImportMeshes(std::string const& path, ModelImport& import);
 
-    static GLuint TextureFromFile(const char* path);
+    static void ProcessNode(aiNode* node, const aiScene* scene, ModelImport& import);
 
+    static void ProcessMesh(aiMesh* mesh, const aiScene* scene, MeshImport& new_mesh);
 
 public:
 
@@ -163,4 +291,31 @@ public:
     static GLuint CreateSolidColorTexture(float r, float g, float b, float a = 1.0f);
 
     static Texture TextureFromColor(std::string textureName, glm::vec4 color = glm::vec4(0.8f, 0.8f, 0.8f, 1.0f));
+};
+
+/*
+ * A placement of an asset in the scene. Instances of the same asset are drawn together, one
+ * instanced command per mesh and level of detail (see CullScene). Its position, rotation and scale
+ * are in App::transforms, at the same index.
+ */
+struct ModelInstance {
+    std::string name;
+    std::shared_ptr<ModelAsset> asset;
+
+    std::vector<u32> meshLods;      // Selected level of every mesh of the asset
+
+    /**
+     * Picks the level of detail of every mesh from the projected size of its bounding sphere.
+     * projectionScale is the projection matrix [1][1] (1 / tan(fovY / 2)). A forcedLod >= 0 skips the selection.
+     */
+    void SelectLods(const glm::mat4& modelMat, const glm::vec3& cameraPosition, f32 projectionScale, f32 bias, i32 forcedLod);
+
+    u32 GetMeshCount() const {
+        return asset ? (u32)asset->meshes.size() : 0;
+    }
+
+    // Level of a mesh, LOD0 until the first selection
+    u32 GetMeshLod(u32 mesh) const {
+        return mesh < meshLods.size() ? meshLods[mesh] : 0;
+    }
 };
\ No newline at end of file
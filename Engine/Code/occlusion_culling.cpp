@@ -0,0 +1,214 @@
+// occlusion_culling.cpp
+#include "occlusion_culling.h"
+#include "shader.h"
+#include "meshlet.h"
+#include "gl_extensions.h"
+
+static void CreatePyramid(OcclusionCuller& culler, glm::ivec2 depthSize)
+{
+    if (culler.pyramidTexture != 0) {
+        GLState::DeleteTextures(1, &culler.pyramidTexture);
+    }
+
+    culler.depthSize = depthSize;
+    culler.pyramidValid = false;
+
+    glm::ivec2 size = glm::max(depthSize / 2, glm::ivec2(1));
+    culler.levelCount = 1;
+    while ((size.x >> culler.levelCount) > 0 || (size.y >> culler.levelCount) > 0) culler.levelCount++;
+
+    glGenTextures(1, &culler.pyramidTexture);
+    GLState::BindTexture(GL_TEXTURE_2D, culler.pyramidTexture);
+    glTexStorage2D(GL_TEXTURE_2D, culler.levelCount, GL_R32F, size.x, size.y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+}
+
+static void ReserveBuffer(GLuint& buffer, u32& capacity, u32 size)
+{
+    if (size <= capacity) return;
+
+    capacity = glm::max(size, capacity * 2);
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void InitOcclusionCuller(OcclusionCuller& culler, glm::ivec2 depthSize)
+{
+    CreatePyramid(culler, depthSize);
+
+    glGenBuffers(1, &culler.instancesBuffer);
+    glGenBuffers(1, &culler.lateCommandsBuffer);
+    glGenBuffers(OCCLUSION_STATS_LATENCY, culler.statsBuffers);
+    for (u32 i = 0; i < OCCLUSION_STATS_LATENCY; ++i) {
+        OcclusionStats zero = {};
+        GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.statsBuffers[i]);
+
+        // Mapped once, only read after the fence of the slot signals
+        if (GLExt.bufferStorage) {
+            GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            GLExt.BufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(OcclusionStats), &zero, flags);
+            culler.mappedStats[i] = (const OcclusionStats*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(OcclusionStats), flags);
+        }
+        else {
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(OcclusionStats), &zero, GL_DYNAMIC_READ);
+        }
+    }
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ResizeOcclusionCuller(OcclusionCuller& culler, glm::ivec2 depthSize)
+{
+    if (depthSize == culler.depthSize) return;
+    CreatePyramid(culler, depthSize);
+}
+
+void ShutdownOcclusionCuller(OcclusionCuller& culler)
+{
+    GLState::DeleteTextures(1, &culler.pyramidTexture);
+    GLState::DeleteBuffers(1, &culler.instancesBuffer);
+    GLState::DeleteBuffers(1, &culler.lateCommandsBuffer);
+    for (GLsync fence : culler.statsFences) {
+        if (fence) glDeleteSync(fence);
+    }
+    GLState::DeleteBuffers(OCCLUSION_STATS_LATENCY, culler.statsBuffers);
+    culler = OcclusionCuller();
+}
+
+HiZUniforms GetHiZUniforms(Shader& shader)
+{
+    HiZUniforms uniforms;
+    uniforms.pyramidViewProjection = shader.GetUniform<glm::mat4>("uPyramidViewProjection");
+    uniforms.depthSize = shader.GetUniform<glm::ivec2>("uDepthSize");
+    uniforms.levelCount = shader.GetUniform<int>("uLevelCount");
+    return uniforms;
+}
+
+void SetHiZUniforms(const Shader& shader, const HiZUniforms& uniforms, const OcclusionCuller& culler, const glm::mat4& viewProjection)
+{
+    shader.Set(uniforms.pyramidViewProjection, viewProjection);
+    shader.Set(uniforms.depthSize, culler.depthSize);
+    shader.Set(uniforms.levelCount, (int)culler.levelCount);
+
+    // uPyramid has binding 0 in the shader
+    GLState::ActiveTexture(GL_TEXTURE0);
+    GLState::BindTexture(GL_TEXTURE_2D, culler.pyramidTexture);
+}
+
+OcclusionUniforms GetOcclusionUniforms(Shader& cullShader, Shader& downsampleShader)
+{
+    OcclusionUniforms uniforms;
+    uniforms.hiz = GetHiZUniforms(cullShader);
+    uniforms.instanceCount = cullShader.GetUniform<int>("uInstanceCount");
+    uniforms.phase = cullShader.GetUniform<int>("uPhase");
+    uniforms.pyramidValid = cullShader.GetUniform<bool>("uPyramidValid");
+    uniforms.sourceLevel = downsampleShader.GetUniform<int>("uSourceLevel");
+    return uniforms;
+}
+
+static void DispatchCull(OcclusionCuller& culler, const Shader& cullShader, GLuint commandsBuffer, i32 phase, const glm::mat4& viewProjection)
+{
+    const OcclusionUniforms& uniforms = culler.uniforms;
+    cullShader.Use();
+    SetHiZUniforms(cullShader, uniforms.hiz, culler, viewProjection);
+    cullShader.Set(uniforms.instanceCount, (int)culler.instances.size());
+    cullShader.Set(uniforms.phase, (int)phase);
+    cullShader.Set(uniforms.pyramidValid, culler.pyramidValid);
+
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culler.instancesBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandsBuffer);
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culler.lateCommandsBuffer);
+    u32 slot = culler.frame % OCCLUSION_STATS_LATENCY;
+    GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culler.statsBuffers[slot]);
+
+    u32 groups = ((u32)culler.instances.size() + HIZ_CULL_GROUP_SIZE - 1) / HIZ_CULL_GROUP_SIZE;
+    glDispatchCompute(groups, 1, 1);
+
+    // The commands are read by the draws and by the next dispatch, the stats through the mapping or glGetBufferSubData
+    GLbitfield statsBarrier = culler.mappedStats[slot] ? GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT : GL_BUFFER_UPDATE_BARRIER_BIT;
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | statsBarrier);
+
+    // The late dispatch writes the slot after the early one, so its fence replaces the early fence
+    if (culler.statsFences[slot]) glDeleteSync(culler.statsFences[slot]);
+    culler.statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static void ReadOcclusionStats(OcclusionCuller& culler, u32 slot)
+{
+    GLsync& fence = culler.statsFences[slot];
+    if (!fence) return;
+
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    glDeleteSync(fence);
+    fence = NULL;
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+
+    if (culler.mappedStats[slot]) {
+        culler.stats = *culler.mappedStats[slot];
+    }
+    else {
+        GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.statsBuffers[slot]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(OcclusionStats), &culler.stats);
+    }
+}
+
+void CullOcclusionEarly(OcclusionCuller& culler, const Shader& cullShader, GLuint commandsBuffer, u32 commandCount)
+{
+    culler.frame++;
+
+    // Counters written OCCLUSION_STATS_LATENCY frames ago, then reset on the GPU for this frame
+    u32 slot = culler.frame % OCCLUSION_STATS_LATENCY;
+    ReadOcclusionStats(culler, slot);
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.statsBuffers[slot]);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(OcclusionStats), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+    u32 instancesSize = (u32)(culler.instances.size() * sizeof(OcclusionInstance));
+    ReserveBuffer(culler.instancesBuffer, culler.instancesCapacity, instancesSize);
+    ReserveBuffer(culler.lateCommandsBuffer, culler.lateCommandsCapacity, commandCount * sizeof(DrawElementsIndirectCommand));
+    if (culler.instances.empty()) {
+        GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        culler.statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        return;
+    }
+
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.instancesBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, instancesSize, culler.instances.data());
+    GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    DispatchCull(culler, cullShader, commandsBuffer, 0, culler.pyramidViewProjection);
+}
+
+void BuildDepthPyramid(OcclusionCuller& culler, const Shader& downsampleShader, GLuint depthTexture, const glm::mat4& viewProjection)
+{
+    // uSource has binding 0 in the shader
+    downsampleShader.Use();
+    GLState::ActiveTexture(GL_TEXTURE0);
+
+    glm::ivec2 size = glm::max(culler.depthSize / 2, glm::ivec2(1));
+    for (u32 level = 0; level < culler.levelCount; ++level)
+    {
+        // The first level reads the depth buffer, the others the level below them
+        GLState::BindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : culler.pyramidTexture);
+        downsampleShader.Set(culler.uniforms.sourceLevel, level == 0 ? 0 : (int)level - 1);
+        glBindImageTexture(0, culler.pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        glm::ivec2 levelSize = glm::max(size >> (i32)level, glm::ivec2(1));
+        glDispatchCompute((levelSize.x + HIZ_DOWNSAMPLE_GROUP_SIZE - 1) / HIZ_DOWNSAMPLE_GROUP_SIZE,
+            (levelSize.y + HIZ_DOWNSAMPLE_GROUP_SIZE - 1) / HIZ_DOWNSAMPLE_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+    culler.pyramidViewProjection = viewProjection;
+    culler.pyramidValid = true;
+}
+
+void CullOcclusionLate(OcclusionCuller& culler, const Shader& cullShader, GLuint commandsBuffer)
+{
+    if (culler.instances.empty()) return;
+    DispatchCull(culler, cullShader, commandsBuffer, 1, culler.pyramidViewProjection);
+}
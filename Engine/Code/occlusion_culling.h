@@ -0,0 +1,112 @@
+// occlusion_culling.h
+#pragma once
+
+#include "platform.h"
+#include "shader.h"
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#define HIZ_DOWNSAMPLE_GROUP_SIZE   8       // Matches local_size in culling.glsl
+#define HIZ_CULL_GROUP_SIZE         64
+#define OCCLUSION_STATS_LATENCY     3       // Frames before the GPU counters are read back, so the read never waits
+
+/*
+ * Mesh tested against the depth pyramid, with the range of its indirect commands. 32 bytes, matches
+ * OcclusionInstance in culling.glsl (std430).
+ */
+struct OcclusionInstance {
+    glm::vec3 center;       // World space box
+    u32 firstCommand;
+    glm::vec3 extent;
+    u32 commandCount;
+};
+
+struct OcclusionStats {
+    u32 earlyVisible;       // Visible against the pyramid of the last frame, drawn first
+    u32 lateVisible;        // Hidden last frame but visible against the depth of the early draws
+    u32 occluded;           // Skipped by both phases
+};
+
+// Hi-Z test of culling.glsl, shared by the HIZ_CULL and GPU_CULL programs
+struct HiZUniforms {
+    UniformHandle<glm::mat4> pyramidViewProjection;
+    UniformHandle<glm::ivec2> depthSize;
+    UniformHandle<int> levelCount;
+};
+
+// Of the HIZ_CULL and HIZ_DOWNSAMPLE programs, resolved once
+struct OcclusionUniforms {
+    HiZUniforms hiz;
+    UniformHandle<int> instanceCount;
+    UniformHandle<int> phase;
+    UniformHandle<bool> pyramidValid;
+    UniformHandle<int> sourceLevel;     // Of the downsample
+};
+
+/*
+ * Two phase occlusion culling against a hierarchical Z pyramid (max depth per texel, the first level
+ * half the depth buffer size):
+ *  1. Early: meshes visible against the pyramid of the last frame keep their commands, the others
+ *     are moved to a second command buffer. The early ones are drawn.
+ *  2. The pyramid is built from the depth drawn so far, and the moved meshes are tested against it.
+ *     The ones that pass are drawn from the second buffer, so nothing pops in a frame late.
+ * After the late draws the pyramid is built again from the full depth, for the next frame.
+ */
+struct OcclusionCuller {
+    GLuint pyramidTexture = 0;
+    glm::ivec2 depthSize = glm::ivec2(0);
+    u32 levelCount = 0;
+    bool pyramidValid = false;                      // False until a pyramid is built, and after a resize
+    glm::mat4 pyramidViewProjection = glm::mat4(1.0f);
+
+    GLuint instancesBuffer = 0;
+    u32 instancesCapacity = 0;
+    GLuint lateCommandsBuffer = 0;
+    u32 lateCommandsCapacity = 0;
+    GLuint statsBuffers[OCCLUSION_STATS_LATENCY] = {};
+    GLsync statsFences[OCCLUSION_STATS_LATENCY] = {};                  // After the last dispatch that wrote the slot
+    const OcclusionStats* mappedStats[OCCLUSION_STATS_LATENCY] = {};    // Persistent mappings, NULL without buffer storage
+    u32 frame = 0;
+
+    OcclusionUniforms uniforms;                     // See GetOcclusionUniforms
+    std::vector<OcclusionInstance> instances;       // Filled by the culling every frame
+    OcclusionStats stats = {};                      // Of OCCLUSION_STATS_LATENCY frames ago, kept while the fence has not signaled
+};
+
+void InitOcclusionCuller(OcclusionCuller& culler, glm::ivec2 depthSize);
+
+/**
+ * Recreates the pyramid for the new depth buffer size. The next frame draws everything early.
+ */
+void ResizeOcclusionCuller(OcclusionCuller& culler, glm::ivec2 depthSize);
+
+void ShutdownOcclusionCuller(OcclusionCuller& culler);
+
+HiZUniforms GetHiZUniforms(Shader& shader);
+
+/**
+ * Points the Hi-Z test of the shader to the pyramid of the culler, bound to unit 0, built with that
+ * view projection.
+ */
+void SetHiZUniforms(const Shader& shader, const HiZUniforms& uniforms, const OcclusionCuller& culler, const glm::mat4& viewProjection);
+
+OcclusionUniforms GetOcclusionUniforms(Shader& cullShader, Shader& downsampleShader);
+
+/**
+ * Early phase over culler.instances. Splits the commands between commandsBuffer (drawn now) and
+ * culler.lateCommandsBuffer, commandCount being the size of both.
+ */
+void CullOcclusionEarly(OcclusionCuller& culler, const Shader& cullShader, GLuint commandsBuffer, u32 commandCount);
+
+/**
+ * Max depth reduction of depthTexture into every level of the pyramid. viewProjection is the one
+ * the depth was drawn with.
+ */
+void BuildDepthPyramid(OcclusionCuller& culler, const Shader& downsampleShader, GLuint depthTexture, const glm::mat4& viewProjection);
+
+/**
+ * Late phase, clears the commands of culler.lateCommandsBuffer that are still occluded.
+ */
+void CullOcclusionLate(OcclusionCuller& culler, const Shader& cullShader, GLuint commandsBuffer);
@@ -1,6 +1,8 @@
 // panel.cpp
 #include "panels.h"
 #include "engine.h"
+#include "benchmark.h"
+#include "gl_extensions.h"
 
 #include <GLFW/glfw3.h>
 #include <imgui_internal.h>
@@ -47,8 +49,25 @@ void UpdateMainMenu(App* app) {
 	if (ImGui::BeginMainMenuBar()) {
 		if (ImGui::BeginMenu("General")) {
 
-            // TODO_K: what can we put here?
-            ImGui::Text("�");
+            ImGui::MenuItem("Profiler Enabled", NULL, &app->profiler.enabled);
+            if (ImGui::MenuItem("Export Chrome Trace")) { app->profiler.ExportChromeTrace("profile_trace.json"); }
+
+            ImGui::Separator();
+
+            InputRecorder& recorder = app->inputRecorder;
+            if (recorder.state == InputRecorder_Recording) {
+                if (ImGui::MenuItem("Stop Input Recording")) { StopInputRecording(recorder); }
+            }
+            else if (ImGui::MenuItem("Record Input", NULL, false, recorder.state == InputRecorder_Idle)) {
+                StartInputRecording(recorder, app, "input_recording.bin");
+            }
+
+            if (recorder.state == InputRecorder_Replaying) {
+                if (ImGui::MenuItem("Stop Input Replay")) { StopInputReplay(recorder, app->input); }
+            }
+            else if (ImGui::MenuItem("Replay Input", NULL, false, recorder.state == InputRecorder_Idle)) {
+                StartInputReplay(recorder, app, "input_recording.bin");
+            }
 
 			ImGui::EndMenu();
 		}
@@ -69,59 +88,305 @@ void UpdateMainMenu(App* app) {
 	}
 }
 
+static const ImU32 passColors[PROFILER_MAX_TRACKED_PASSES] = {
+    IM_COL32( 66, 165, 245, 255),
+    IM_COL32(255, 167,  38, 255),
+    IM_COL32(102, 187, 106, 255),
+    IM_COL32(171,  71, 188, 255),
+    IM_COL32(239,  83,  80, 255),
+    IM_COL32( 38, 198, 218, 255),
+    IM_COL32(255, 238,  88, 255),
+    IM_COL32(141, 110,  99, 255),
+    IM_COL32(236,  64, 122, 255),
+    IM_COL32(156, 204, 101, 255),
+    IM_COL32( 92, 107, 192, 255),
+    IM_COL32(255, 112,  67, 255),
+    IM_COL32( 38, 166, 154, 255),
+    IM_COL32(189, 189, 189, 255),
+    IM_COL32(212, 225,  87, 255),
+    IM_COL32(120, 144, 156, 255),
+};
+
+void SystemDetailsPanel::FrameTimeBreakdown(App* app) {
+    const Profiler& profiler = app->profiler;
+    const u32 frameCount = profiler.GetHistoryCount();
+    const u32 passCount = profiler.GetPassCount();
+
+    if (frameCount == 0) {
+        ImGui::TextDisabled("No frames recorded yet");
+        return;
+    }
+
+    // Rolling statistics over the whole history
+    std::vector<f32> frameMs(frameCount), cpuMs(frameCount), gpuMs;
+    std::vector<f32> passMs[PROFILER_MAX_TRACKED_PASSES];
+    gpuMs.reserve(frameCount);
+    for (u32 i = 0; i < frameCount; ++i) {
+        const FrameRecord& record = profiler.GetFrameRecord(i);
+        frameMs[i] = record.frameMs;
+        cpuMs[i] = record.cpuMs;
+        if (!record.gpuResolved) continue;
+
+        f32 gpuTotal = 0.0f;
+        for (u32 p = 0; p < passCount; ++p) {
+            if (!(record.gpuPassMask & (1u << p))) continue;     // Not timed that frame, not a 0 ms sample
+            passMs[p].push_back(record.gpuPassMs[p]);
+            gpuTotal += record.gpuPassMs[p];
+        }
+        gpuMs.push_back(gpuTotal);
+    }
+
+    FrameTimeStats frameStats = ComputeFrameTimeStats(frameMs);
+    FrameTimeStats cpuStats = ComputeFrameTimeStats(cpuMs);
+    FrameTimeStats gpuStats = ComputeFrameTimeStats(gpuMs);
+
+    ImGui::TextColored(ImVec4(0.05f, 0.8f, 0.95f, 1.0f), "%.2f ms", frameMs.back());
+    ImGui::SameLine(0.0f, 10.0f);
+    ImGui::TextDisabled("| last %u frames", frameCount);
+
+    if (ImGui::BeginTable("##FrameStats", 4, ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("ms");
+        ImGui::TableSetupColumn("p50");
+        ImGui::TableSetupColumn("p99");
+        ImGui::TableSetupColumn("max");
+        ImGui::TableHeadersRow();
+
+        auto statsRow = [](const char* name, const FrameTimeStats& stats) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn(); ImGui::Text("%s", name);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", stats.p50);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", stats.p99);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", stats.max);
+        };
+        statsRow("Frame", frameStats);
+        statsRow("CPU", cpuStats);
+        statsRow("GPU", gpuStats);
+        ImGui::EndTable();
+    }
+
+    // Stacked bar chart: one bar per frame, GPU passes stacked on top of the whole frame time
+    const f32 barWidth = 2.0f;
+    const ImVec2 size(ImMax(ImGui::GetContentRegionAvail().x, 100.0f), 100.0f);
+    const f32 scaleMs = ImMax(frameStats.p99 * 1.25f, 1000.0f / 60.0f);
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    const ImVec2 origin = ImGui::GetCursorScreenPos();
+    const ImVec2 bottomRight(origin.x + size.x, origin.y + size.y);
+    drawList->AddRectFilled(origin, bottomRight, IM_COL32(25, 25, 38, 180));
+
+    const u32 visibleFrames = ImMin(frameCount, (u32)(size.x / barWidth));
+    for (u32 i = 0; i < visibleFrames; ++i) {
+        const FrameRecord& record = profiler.GetFrameRecord(frameCount - visibleFrames + i);
+        f32 x = origin.x + i * barWidth;
+
+        f32 top = bottomRight.y - ImMin(record.frameMs / scaleMs, 1.0f) * size.y;
+        drawList->AddRectFilled(ImVec2(x, top), ImVec2(x + barWidth, bottomRight.y), IM_COL32(90, 90, 110, 255));
+
+        f32 base = bottomRight.y;
+        for (u32 p = 0; p < passCount && record.gpuResolved; ++p) {
+            f32 height = record.gpuPassMs[p] / scaleMs * size.y;
+            top = ImMax(base - height, origin.y);
+            drawList->AddRectFilled(ImVec2(x, top), ImVec2(x + barWidth, base), passColors[p]);
+            base = top;
+        }
+    }
+
+    // 60 and 30 FPS budgets
+    const f32 budgetsMs[] = { 1000.0f / 60.0f, 1000.0f / 30.0f };
+    for (f32 budget : budgetsMs) {
+        if (budget > scaleMs) continue;
+        f32 y = bottomRight.y - budget / scaleMs * size.y;
+        drawList->AddLine(ImVec2(origin.x, y), ImVec2(bottomRight.x, y), IM_COL32(255, 255, 255, 90));
+    }
+    ImGui::Dummy(size);
+    ImGui::TextDisabled("Scale: %.1f ms", scaleMs);
+
+    // Legend with the rolling GPU time of every pass
+    for (u32 p = 0; p < passCount; ++p) {
+        FrameTimeStats passStats = ComputeFrameTimeStats(passMs[p]);
+
+        ImVec2 pos = ImGui::GetCursorScreenPos();
+        f32 square = ImGui::GetTextLineHeight();
+        drawList->AddRectFilled(pos, ImVec2(pos.x + square, pos.y + square), passColors[p]);
+        ImGui::Dummy(ImVec2(square, square));
+        ImGui::SameLine();
+        if (passMs[p].empty()) {
+            ImGui::TextDisabled("%-12s not timed", profiler.GetPassName(p));
+            continue;
+        }
+        ImGui::Text("%-12s p50 %.2f  p99 %.2f  max %.2f ms", profiler.GetPassName(p), passStats.p50, passStats.p99, passStats.max);
+    }
+
+    // Counters of the last frame, with their range over the history
+    for (u32 c = 0; c < profiler.GetCounterCount(); ++c) {
+        f32 minValue = FLT_MAX, maxValue = 0.0f;
+        for (u32 i = 0; i < frameCount; ++i) {
+            const FrameRecord& record = profiler.GetFrameRecord(i);
+            if (!(record.counterMask & (1u << c))) continue;
+            f32 value = record.counters[c];
+            minValue = ImMin(minValue, value);
+            maxValue = ImMax(maxValue, value);
+        }
+        if (minValue > maxValue) minValue = maxValue;     // Not set in any frame kept
+        ImGui::Text("%-16s %.0f  (min %.0f  max %.0f)", profiler.GetCounterName(c),
+            profiler.GetFrameRecord(frameCount - 1).counters[c], minValue, maxValue);
+    }
+
+    if (profiler.GetDroppedGpuSamples() > 0) {
+        ImGui::TextDisabled("%llu GPU samples dropped (not ready when read back)", (unsigned long long)profiler.GetDroppedGpuSamples());
+    }
+}
+
 void SystemDetailsPanel::Update(App* app) {
 
     if (ImGui::CollapsingHeader("System Information", ImGuiTreeNodeFlags_DefaultOpen))
     {
-        if (ImGui::CollapsingHeader("FPS Graph", ImGuiTreeNodeFlags_DefaultOpen))
+        if (ImGui::CollapsingHeader("Frame Time", ImGuiTreeNodeFlags_DefaultOpen))
+        {
+            FrameTimeBreakdown(app);
+        }
+
+        if (ImGui::CollapsingHeader("Asset Streaming"))
+        {
+            AssetLoader& loader = app->assetLoader;
+            const TextureStreamer& streamer = loader.textures;
+
+            ImGui::SliderFloat("Upload Budget (ms)", &loader.uploadBudgetMs, 0.1f, 16.0f, "%.1f");
+            ImGui::SliderFloat("Texture Budget (MB/frame)", &loader.textures.budgetMB, 0.25f, 64.0f, "%.2f");
+            ImGui::Checkbox("Compress Textures (BCn)", &loader.compressTextures);
+            ImGui::SameLine();
+            ImGui::TextDisabled("(applies to the next loads)");
+
+            u64 ringUsed = 0;
+            for (const StreamRegion& region : streamer.inFlight) ringUsed += region.size;
+
+            ImGui::Text("Pending assets: %u", GetPendingAssetCount(app));
+            ImGui::Text("Queued textures: %u", (u32)streamer.queue.size());
+            ImGui::Text("Ring in flight: %.2f / %.0f MB (%s)", ringUsed / (f32)MB(1), streamer.capacity / (f32)MB(1),
+                streamer.mappedRing ? "persistent" : "mapped per upload");
+            ImGui::Text("Uploaded last frame: %.2f MB", streamer.uploadedBytesLastFrame / (f32)MB(1));
+
+            TextureRegistry& registry = app->textureRegistry;
+            ImGui::Separator();
+            ImGui::SliderFloat("Texture VRAM Budget (MB)", &registry.budgetMB, 16.0f, 4096.0f, "%.0f");
+            ImGui::Text("Resident textures: %u / %u", (u32)registry.lru.size(), (u32)registry.byPath.size());
+            ImGui::Text("Resident memory: %.1f MB, texture arrays: %.1f MB", registry.residentBytes / (f32)MB(1),
+                app->materialTextures.arrayBytes / (f32)MB(1));
+            ImGui::Text("Failed texture array copies: %u", app->materialTextures.failedCopies);
+            ImGui::Text("Evictions: %u  Reloads: %u (last frame)", registry.evictionsLastFrame, registry.reloadsLastFrame);
+        }
+
+        if (ImGui::CollapsingHeader("Level of Detail"))
+        {
+            ImGui::SliderFloat("LOD Bias", &app->lodBias, 0.1f, 4.0f, "%.2f");
+            ImGui::SliderInt("Force LOD", &app->forcedLod, -1, MESH_LOD_MAX_COUNT - 1, app->forcedLod < 0 ? "Auto" : "LOD%d");
+
+            if (app->gpuCulling) {
+                ImGui::TextDisabled("Selected per mesh by the GPU culling, not read back");
+            }
+            else {
+                u32 drawnTriangles = 0, fullTriangles = 0;
+                for (const ModelInstance& model : app->models) {
+                    for (u32 i = 0; i < model.GetMeshCount(); ++i) {
+                        const Mesh& mesh = model.asset->meshes[i];
+                        drawnTriangles += mesh.lods[glm::min(model.GetMeshLod(i), (u32)mesh.lods.size() - 1)].indexCount / 3;
+                        fullTriangles += mesh.lods[0].indexCount / 3;
+                    }
+                }
+                ImGui::Text("Triangles: %u / %u at LOD0", drawnTriangles, fullTriangles);
+
+                if (app->selectedModel) {
+                    const ModelInstance& model = *app->selectedModel;
+                    for (u32 i = 0; i < model.GetMeshCount(); ++i) {
+                        const Mesh& mesh = model.asset->meshes[i];
+                        u32 lod = glm::min(model.GetMeshLod(i), (u32)mesh.lods.size() - 1);
+                        ImGui::Text("Mesh %u: LOD%u of %u (%u tris)", i, lod, (u32)mesh.lods.size(), mesh.lods[lod].indexCount / 3);
+                    }
+                }
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Culling"))
+        {
+            ImGui::Checkbox("Mesh Frustum Culling", &app->frustumCulling);
+            ImGui::SameLine();
+            ImGui::TextDisabled(CULLING_SIMD_WIDTH == 8 ? "(AVX2)" : "(SSE)");
+            ImGui::Checkbox("Hierarchical (BVH)", &app->bvhCulling);
+            ImGui::Checkbox("Meshlet Frustum Culling", &app->meshletCulling);
+            ImGui::Checkbox("Meshlet Backface Cone Culling (one sided meshes only)", &app->meshletConeCulling);
+            ImGui::Checkbox("Hi-Z Occlusion Culling (deferred)", &app->occlusionCulling);
+            ImGui::Checkbox("GPU-Driven Meshlet Culling", &app->gpuCulling);
+            ImGui::SameLine();
+            ImGui::TextDisabled(GLExt.drawIndirectCount ? "(indirect count)" : "(no indirect count)");
+
+            const MeshletCullStats& stats = app->meshletStats;
+            ImGui::Text("Visible meshes: %u / %u", app->visibleMeshCount, app->sceneMeshCount);
+            ImGui::Text("Visible meshlets: %u / %u", stats.visible, stats.tested);
+            ImGui::Text("Indirect commands: %u", stats.drawCommands);
+
+            if (app->gpuCulling) {
+                const GpuCuller& gpuCuller = app->gpuCuller;
+                ImGui::Text("GPU instances: %u, command slots: %u", (u32)gpuCuller.instances.size(), gpuCuller.commandCount);
+            }
+
+            const OcclusionStats& occlusion = app->occlusionCuller.stats;
+            ImGui::Text("Occlusion: %u early, %u late, %u occluded", occlusion.earlyVisible, occlusion.lateVisible, occlusion.occluded);
+
+            const SceneBvh& bvh = app->sceneBvh;
+            ImGui::Text("BVH nodes: %u, SAH cost: %.2f (built %.2f)", (u32)bvh.bvh.nodes.size(), bvh.cost, bvh.builtCost);
+            ImGui::Text("BVH rebuilds: %u, refits: %u", bvh.rebuildCount, bvh.refitCount);
+            ImGui::TextDisabled("Left click on a mesh to select its model and material");
+        }
+
+        if (ImGui::CollapsingHeader("Instancing"))
         {
-            // Circular buffer for FPS values (smoothed)
-            static float fpsValues[100] = {};
-            static int fpsOffset = 0;
-
-            // Exponential moving average for smoother FPS
-            static float smoothedFPS = 60.0f;
-            const float alpha = 0.1f; // Smoothing factor (0.0-1.0, lower = smoother)
-            float currentFPS = 1.0f / app->deltaTime;
-            smoothedFPS = smoothedFPS * (1.0f - alpha) + currentFPS * alpha;
-
-            // Store the smoothed value
-            fpsValues[fpsOffset] = smoothedFPS;
-            fpsOffset = (fpsOffset + 1) % IM_ARRAYSIZE(fpsValues);
-
-            // Auto-scaling Y-axis
-            float maxFPS = *std::max_element(fpsValues, fpsValues + IM_ARRAYSIZE(fpsValues)) * 1.1f;
-            maxFPS = ImMax(maxFPS, 60.0f); // Minimum scale
-
-            // Style setup
-            ImGui::PushStyleColor(ImGuiCol_PlotLines, ImVec4(0.05f, 0.8f, 0.95f, 1.0f));
-            ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4(0.1f, 0.1f, 0.15f, 0.7f));
-
-            // FPS graph
-            ImGui::PlotLines(
-                "##FPS",
-                fpsValues,
-                IM_ARRAYSIZE(fpsValues),
-                fpsOffset,
-                nullptr,
-                0.0f,
-                maxFPS,
-                ImVec2(300, 60)
-            );
-            ImGui::PopStyleColor(2);
-
-            // Display current FPS (smoothed)
-            //ImGui::SameLine();
-            ImGui::TextColored(
-                ImVec4(0.05f, 0.8f, 0.95f, 1.0f),
-                "%.0f FPS",
-                smoothedFPS
-            );
-
-            // Optional: Add a subtle indicator for target FPS (e.g., 60 FPS)
-            if (maxFPS > 60.0f) {
-                ImGui::SameLine(0.0f, 10.0f);
-                ImGui::TextDisabled("| Target: 60 FPS");
+            ImGui::Checkbox("Hardware Instancing", &app->instancing);
+            ImGui::Text("Assets: %u, instances: %u", (u32)app->assets.size(), (u32)app->models.size());
+            ImGui::Text("Instanced commands: %u (%u meshes)", app->instancedCommands, app->instancedMeshes);
+            if (!app->renderAll) {
+                ImGui::TextDisabled("Only with Render All, a single model is drawn without");
+            }
+
+            static int stressCount = 10000;
+            ImGui::SliderInt("Stress Instances", &stressCount, 1, 50000);
+            if (ImGui::Button("Spawn Backpacks")) {
+                SpawnStressInstances(app, (u32)stressCount);
+                app->renderAll = true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Clear")) {
+                SpawnStressInstances(app, 0);
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Render Queue"))
+        {
+            const RenderQueue& queue = app->renderQueue;
+            ImGui::Checkbox("Sort Draws", &app->sortDraws);
+            ImGui::Text("Packets: %u, batches: %u", (u32)queue.packets.size(), (u32)queue.batches.size());
+            ImGui::Text("State changes: %u in scene order, %u drawn", queue.stateChangesUnsorted, queue.stateChangesSorted);
+            if (app->gpuCulling) {
+                ImGui::TextDisabled("Only with CPU culling, the GPU culling draws the static batches");
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Material Textures"))
+        {
+            MaterialTextures& textures = app->materialTextures;
+            for (int mode = 0; mode < MaterialTextures_Count; ++mode) {
+                if (!IsMaterialTextureModeSupported((MaterialTextureMode)mode)) continue;
+                if (ImGui::RadioButton(GetMaterialTextureModeName((MaterialTextureMode)mode), textures.mode == mode)) {
+                    ChangeMaterialTextureMode(app, (MaterialTextureMode)mode);
+                }
+            }
+            ImGui::Text("Static batches: %u, materials: %u", (u32)app->drawBatches.batches.size(), (u32)app->drawBatches.materials.size());
+            ImGui::Text("Referenced textures: %u", (u32)textures.referenced.size());
+            if (textures.mode == MaterialTextures_Arrays) {
+                for (const MaterialTextureArray& array : textures.arrays) {
+                    if (array.layerCapacity == 0) continue;
+                    ImGui::BulletText("%ux%u, %u levels: %u/%u layers", array.width, array.height, array.levels,
+                        array.layerCount - (u32)array.freeLayers.size(), array.layerCapacity);
+                }
             }
         }
 
@@ -341,7 +606,8 @@ void ScenePanel::Update(App* app) {
             if (ImGui::Selectable(app->models[i].name.c_str(), is_selected))
             {
                 app->selectedModel = &app->models[i];
-                app->selectedMaterial = app->selectedModel->materials[0];
+                const ModelAsset& asset = *app->selectedModel->asset;
+                app->selectedMaterial = asset.materials.empty() ? nullptr : asset.materials[0];
             }
 
             if (is_selected)
@@ -350,13 +616,20 @@ void ScenePanel::Update(App* app) {
         ImGui::EndCombo();
     }
     ImGui::Dummy(ImVec2(0.0f, 20.0f));
-    // Rotation editor
+    // Rotation editor, the transform is only recomposed when a slider moves
+    u32 selected = app->selectedModel ? (u32)(app->selectedModel - app->models.data()) : 0;
     if (app->selectedModel) {
-        ImGui::SliderFloat3("Rotate XYZ", glm::value_ptr(app->selectedModel->rotation), -180.0f, 180.0f, "%.1f deg");
+        glm::vec3 rotation = GetTransformRotation(app->transforms, selected);
+        if (ImGui::SliderFloat3("Rotate XYZ", glm::value_ptr(rotation), -180.0f, 180.0f, "%.1f deg")) {
+            SetTransformRotation(app->transforms, selected, rotation);
+        }
     }
     ImGui::Dummy(ImVec2(0.0f, 10.0f));
     if (app->selectedModel) {
-        ImGui::SliderFloat3("Scale XYZ", glm::value_ptr(app->selectedModel->scale), 0.01f, 5.0f, "%.2f");
+        glm::vec3 scale = GetTransformScale(app->transforms, selected);
+        if (ImGui::SliderFloat3("Scale XYZ", glm::value_ptr(scale), 0.01f, 5.0f, "%.2f")) {
+            SetTransformScale(app->transforms, selected, scale);
+        }
     }
     ImGui::Dummy(ImVec2(0.0f, 20.0f));
     ImGui::Checkbox("Render All", &app->renderAll);
@@ -419,7 +692,11 @@ void DebugPanel::Update(App* app) {
 
         // Models/Lights
         ImGui::Separator();
-        ImGui::Text("Loaded Models: %zu", app->models.size());
+        ImGui::Text("Loaded Models: %zu (%zu instances)", app->assets.size(), app->models.size());
+        if (GetPendingAssetCount(app) > 0) {
+            ImGui::SameLine();
+            ImGui::TextDisabled("(%u assets streaming in)", GetPendingAssetCount(app));
+        }
         ImGui::Text("Active Lights: %zu", app->lights.size());
     }
 }
@@ -487,15 +764,19 @@ void LightingPanel::Update(App* app) {
     }
 }
 
-void MaterialsPanel::TextureSelector(App* app, std::string combo_name, Mat_Property* mat_prop) {
+bool MaterialsPanel::TextureSelector(App* app, std::string combo_name, Mat_Property* mat_prop) {
+    bool edited = false;
     if (ImGui::BeginCombo(combo_name.c_str(), mat_prop->texture ? mat_prop->texture->name.c_str() : "None"))
     {
-        for (size_t i = 0; i < app->textures_loaded.size(); ++i)
+        for (const std::shared_ptr<Texture>& texture : app->textureRegistry.textures)
         {
-            bool is_selected = (mat_prop->texture == app->textures_loaded[i]);
-            if (ImGui::Selectable(app->textures_loaded[i]->name.c_str(), is_selected))
+            if (!texture) continue;
+
+            bool is_selected = (mat_prop->texture == texture);
+            if (ImGui::Selectable(texture->name.c_str(), is_selected))
             {
-                mat_prop->texture = app->textures_loaded[i];
+                mat_prop->texture = texture;
+                edited = true;
             }
 
             if (is_selected)
@@ -505,8 +786,9 @@ void MaterialsPanel::TextureSelector(App* app, std::string combo_name, Mat_Prope
     }
     if (mat_prop->texture) {
         ImGui::SameLine();
-        ImGui::Checkbox(("Use##" + combo_name).c_str(), &mat_prop->tex_enabled);
+        edited |= ImGui::Checkbox(("Use##" + combo_name).c_str(), &mat_prop->tex_enabled);
     }
+    return edited;
 }
 
 void MaterialsPanel::Update(App* app) {
@@ -541,12 +823,13 @@ void MaterialsPanel::Update(App* app) {
     //dropdown selector to select the selected_model from the models list
     if (ImGui::BeginCombo("Selected Material", app->selectedMaterial ? app->selectedMaterial->name.c_str() : "None"))
     {
-        for (size_t i = 0; i < app->selectedModel->materials.size(); ++i)
+        const std::vector<std::shared_ptr<Material>>& materials = app->selectedModel->asset->materials;
+        for (size_t i = 0; i < materials.size(); ++i)
         {
-            bool is_selected = (app->selectedMaterial == app->selectedModel->materials[i]);
-            if (ImGui::Selectable(app->selectedModel->materials[i]->name.c_str(), is_selected))
+            bool is_selected = (app->selectedMaterial == materials[i]);
+            if (ImGui::Selectable(materials[i]->name.c_str(), is_selected))
             {
-                app->selectedMaterial = app->selectedModel->materials[i];
+                app->selectedMaterial = materials[i];
             }
 
             if (is_selected)
@@ -564,45 +847,52 @@ void MaterialsPanel::Update(App* app) {
 
     ImGui::SameLine();
     if (ImGui::Button("Load Texture")) {
-        Model::LoadTexture(app, texPath);
+        ModelAsset::LoadTexture(app, texPath);
     }
 
+    if (!app->selectedMaterial) {
+        ImGui::TextDisabled("The selected model is still loading");
+        return;
+    }
+
+    bool edited = false;
+
     ImGui::Separator();
     ImGui::Text("PBR Maps");
     ImGui::Separator();
-    ImGui::ColorEdit4("Base Color", glm::value_ptr(app->selectedMaterial->diffuse.color), ImGuiColorEditFlags_NoInputs);
-    TextureSelector(app, "D_Texture", &app->selectedMaterial->diffuse);
+    edited |= ImGui::ColorEdit4("Base Color", glm::value_ptr(app->selectedMaterial->diffuse.color), ImGuiColorEditFlags_NoInputs);
+    edited |= TextureSelector(app, "D_Texture", &app->selectedMaterial->diffuse);
 
     ImGui::Dummy(ImVec2(0.0f, 10.0f));
-    ImGui::ColorEdit4("Metallic", glm::value_ptr(app->selectedMaterial->metallic.color), ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_NoPicker);
-    TextureSelector(app, "M_Texture", &app->selectedMaterial->metallic);
+    edited |= ImGui::ColorEdit4("Metallic", glm::value_ptr(app->selectedMaterial->metallic.color), ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_NoPicker);
+    edited |= TextureSelector(app, "M_Texture", &app->selectedMaterial->metallic);
 
     ImGui::Dummy(ImVec2(0.0f, 20.0f));
     ImGui::Separator();
     ImGui::Text("Roughness/Glossiness");
     ImGui::SameLine();
-    ImGui::Checkbox("##Roughness", &app->selectedMaterial->roughness.prop_enabled);
+    edited |= ImGui::Checkbox("##Roughness", &app->selectedMaterial->roughness.prop_enabled);
     ImGui::Separator();
-    ImGui::ColorEdit4("Roughness/Glossiness", glm::value_ptr(app->selectedMaterial->roughness.color), ImGuiColorEditFlags_NoInputs);
-    TextureSelector(app, "R/G_Texture", &app->selectedMaterial->roughness);
+    edited |= ImGui::ColorEdit4("Roughness/Glossiness", glm::value_ptr(app->selectedMaterial->roughness.color), ImGuiColorEditFlags_NoInputs);
+    edited |= TextureSelector(app, "R/G_Texture", &app->selectedMaterial->roughness);
 
     ImGui::Dummy(ImVec2(0.0f, 20.0f));
     ImGui::Separator();
     ImGui::Text("Normal");
     ImGui::SameLine();
-    ImGui::Checkbox("##Normal", &app->selectedMaterial->normal.prop_enabled);
+    edited |= ImGui::Checkbox("##Normal", &app->selectedMaterial->normal.prop_enabled);
     ImGui::Separator();
-    ImGui::ColorEdit4("Normal", glm::value_ptr(app->selectedMaterial->normal.color), ImGuiColorEditFlags_NoInputs);
-    TextureSelector(app, "N_Texture", &app->selectedMaterial->normal);
+    edited |= ImGui::ColorEdit4("Normal", glm::value_ptr(app->selectedMaterial->normal.color), ImGuiColorEditFlags_NoInputs);
+    edited |= TextureSelector(app, "N_Texture", &app->selectedMaterial->normal);
 
     ImGui::Dummy(ImVec2(0.0f, 20.0f));
     ImGui::Separator();
     ImGui::Text("Displacement");
     ImGui::SameLine();
-    ImGui::Checkbox("##Height", &app->selectedMaterial->height.prop_enabled);
+    edited |= ImGui::Checkbox("##Height", &app->selectedMaterial->height.prop_enabled);
     ImGui::Separator();
-    ImGui::ColorEdit4("Height", glm::value_ptr(app->selectedMaterial->height.color), ImGuiColorEditFlags_NoInputs);
-    TextureSelector(app, "H_Texture", &app->selectedMaterial->height);
+    edited |= ImGui::ColorEdit4("Height", glm::value_ptr(app->selectedMaterial->height.color), ImGuiColorEditFlags_NoInputs);
+    edited |= TextureSelector(app, "H_Texture", &app->selectedMaterial->height);
 
     if (app->selectedMaterial->height.prop_enabled)
     {
@@ -620,6 +910,9 @@ void MaterialsPanel::Update(App* app) {
     ImGui::Separator();
     ImGui::ColorEdit4("Alpha Mask", glm::value_ptr(app->selectedMaterial->alphaMask.color), ImGuiColorEditFlags_NoInputs);
     TextureSelector(app, "AM_Texture", &app->selectedMaterial->alphaMask);*/
+
+    // Only the edited material is uploaded again
+    if (edited) app->selectedMaterial->dirty = true;
 }
 
 void PostProcessingPanel::Update(App* app) {
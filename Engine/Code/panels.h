@@ -78,6 +78,7 @@ public:
     void Update(App* app) override;
 
 private:
+    void FrameTimeBreakdown(App* app);
 
 };
 
@@ -136,7 +137,7 @@ public:
     MaterialsPanel(bool defaultOpen = true, ImGuiWindowFlags flags = ImGuiWindowFlags_None, const std::string& name = "Materials Panel") : GUI_Panel(name, defaultOpen, flags) {}
 
     void Update(App* app) override;
-    void TextureSelector(App* app, std::string combo_name, Mat_Property* mat_prop);
+    bool TextureSelector(App* app, std::string combo_name, Mat_Property* mat_prop);
 };
 
 class PostProcessingPanel : public GUI_Panel {
@@ -13,10 +13,17 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #endif
 
 #include "engine.h"
+#include "benchmark.h"
+#include "gl_extensions.h"
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
@@ -125,13 +132,262 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+#pragma region Headless
+
+// Offscreen context used by the benchmark mode. On Linux it is an EGL pbuffer context, which
+// works without any display server (e.g. Mesa llvmpipe on the render nodes). On Windows EGL
+// is not generally available, so a hidden GLFW window is used instead.
+struct HeadlessContext
+{
+#ifdef _WIN32
+    GLFWwindow* window;
+#else
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+#endif
+};
+
+#ifdef _WIN32
+
+bool CreateHeadlessContext(HeadlessContext& headless, u32 width, u32 height)
+{
+    glfwSetErrorCallback(OnGlfwError);
+    if (!glfwInit())
+    {
+        ELOG("glfwInit() failed\n");
+        return false;
+    }
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    headless.window = glfwCreateWindow(width, height, WINDOW_TITLE, NULL, NULL);
+    if (!headless.window)
+    {
+        ELOG("glfwCreateWindow() failed\n");
+        glfwTerminate();
+        return false;
+    }
+
+    glfwMakeContextCurrent(headless.window);
+    glfwSwapInterval(0);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        ELOG("Failed to initialize OpenGL context\n");
+        return false;
+    }
+
+    GLUtils::LoadExtensions((GLADloadproc)glfwGetProcAddress);
+    return true;
+}
+
+void DestroyHeadlessContext(HeadlessContext& headless)
+{
+    glfwDestroyWindow(headless.window);
+    glfwTerminate();
+}
+
+#else
+
+bool CreateHeadlessContext(HeadlessContext& headless, u32 width, u32 height)
+{
+    // Prefer the Mesa surfaceless platform, it does not need X11 or Wayland
+    headless.display = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+        headless.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (headless.display == EGL_NO_DISPLAY) {
+        headless.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint major, minor;
+    if (headless.display == EGL_NO_DISPLAY || !eglInitialize(headless.display, &major, &minor))
+    {
+        ELOG("eglInitialize() failed: 0x%04X", eglGetError());
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE,   8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE,  8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(headless.display, configAttribs, &config, 1, &configCount) || configCount == 0)
+    {
+        ELOG("eglChooseConfig() found no pbuffer config with desktop OpenGL support");
+        eglTerminate(headless.display);
+        return false;
+    }
+
+    const EGLint surfaceAttribs[] = {
+        EGL_WIDTH,  (EGLint)width,
+        EGL_HEIGHT, (EGLint)height,
+        EGL_NONE
+    };
+    headless.surface = eglCreatePbufferSurface(headless.display, config, surfaceAttribs);
+    if (headless.surface == EGL_NO_SURFACE)
+    {
+        ELOG("eglCreatePbufferSurface() failed: 0x%04X", eglGetError());
+        eglTerminate(headless.display);
+        return false;
+    }
+
+    eglBindAPI(EGL_OPENGL_API);
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    headless.context = eglCreateContext(headless.display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (headless.context == EGL_NO_CONTEXT)
+    {
+        ELOG("eglCreateContext() failed: 0x%04X", eglGetError());
+        eglDestroySurface(headless.display, headless.surface);
+        eglTerminate(headless.display);
+        return false;
+    }
+
+    eglMakeCurrent(headless.display, headless.surface, headless.surface, headless.context);
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        ELOG("Failed to initialize OpenGL context\n");
+        return false;
+    }
+
+    GLUtils::LoadExtensions((GLADloadproc)eglGetProcAddress);
+    return true;
+}
+
+void DestroyHeadlessContext(HeadlessContext& headless)
+{
+    eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(headless.display, headless.context);
+    eglDestroySurface(headless.display, headless.surface);
+    eglTerminate(headless.display);
+}
+
+#endif
+
+int RunHeadless(App& app, const BenchmarkOptions& options)
+{
+    HeadlessContext headless = {};
+    if (!CreateHeadlessContext(headless, options.width, options.height))
+    {
+        return -1;
+    }
+
+    // A fixed timestep keeps the simulated frames identical between runs
+    app.deltaTime   = 1.0f/60.0f;
+    app.displaySize = ivec2(options.width, options.height);
+
+    GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
+
+    Init(&app);
+
+    // Every asset has to be on the GPU before the first measured frame
+    WaitForAssetLoads(&app);
+
+    // The recording restores its camera first, the benchmark options still pick the scene and mode
+    BenchmarkOptions benchmarkOptions = options;
+    bool setupOk = true;
+    if (!options.replay.empty())
+    {
+        setupOk = StartInputReplay(app.inputRecorder, &app, options.replay);
+        if (setupOk && app.inputRecorder.frames.size() <= options.warmupFrames)
+        {
+            ELOG("The input recording has fewer frames than the %u warmup frames", options.warmupFrames);
+            setupOk = false;
+        }
+        benchmarkOptions.frames = (u32)app.inputRecorder.frames.size() - options.warmupFrames;
+    }
+
+    Mode mode = options.mode == "forward" ? Mode_Forward : Mode_Deferred;
+    if (!setupOk || !SetupBenchmarkScene(&app, options.scene, mode))
+    {
+        ShutdownAssetLoader(&app);
+        free(GlobalFrameArenaMemory);
+        DestroyHeadlessContext(headless);
+        return -1;
+    }
+
+    Benchmark benchmark = {};
+    InitBenchmark(benchmark, benchmarkOptions);
+
+    const u32 totalFrames = benchmarkOptions.warmupFrames + benchmarkOptions.frames;
+    for (u32 frame = 0; frame < totalFrames; ++frame)
+    {
+        f64 frameStart = GetTimeSeconds();
+        BeginBenchmarkFrame(benchmark);
+        app.profiler.BeginFrame();
+        GLState::BeginFrame();
+
+        ReplayInputFrame(app.inputRecorder, app.input, app.deltaTime);
+
+        Update(&app);
+        Render(&app);
+
+        app.profiler.EndFrame();
+        EndBenchmarkFrame(benchmark, GetTimeSeconds() - frameStart);
+        glFlush();
+
+        // Reset frame allocator
+        GlobalFrameArenaHead = 0;
+    }
+
+    FinishBenchmark(benchmark);
+    bool written = WriteBenchmarkReport(benchmark, &app);
+
+    if (!options.trace.empty())
+    {
+        written &= app.profiler.ExportChromeTrace(options.trace.c_str());
+    }
+    app.profiler.Shutdown();
+    ShutdownAssetLoader(&app);
+
+    free(GlobalFrameArenaMemory);
+    DestroyHeadlessContext(headless);
+
+    return written ? 0 : -1;
+}
+
+#pragma endregion
+
+int main(int argc, char** argv)
 {
     App app         = {};
     app.deltaTime   = 1.0f/60.0f;
     app.displaySize = ivec2(WINDOW_WIDTH, WINDOW_HEIGHT);
     app.isRunning   = true;
 
+    BenchmarkOptions options;
+    if (!ParseBenchmarkOptions(argc, argv, options))
+    {
+        return -1;
+    }
+
+    if (options.headless)
+    {
+        return RunHeadless(app, options);
+    }
+
 		glfwSetErrorCallback(OnGlfwError);
 
     if (!glfwInit())
@@ -186,6 +442,8 @@ int main()
         return -1;
     }
 
+    GLUtils::LoadExtensions((GLADloadproc)glfwGetProcAddress);
+
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
 
@@ -227,8 +485,20 @@ int main()
 
     Init(&app);
 
+    if (!options.replay.empty())
+    {
+        StartInputReplay(app.inputRecorder, &app, options.replay);
+    }
+    else if (!options.record.empty())
+    {
+        StartInputRecording(app.inputRecorder, &app, options.record);
+    }
+
     while (app.isRunning)
     {
+        app.profiler.BeginFrame();
+        GLState::BeginFrame();
+
         // Tell GLFW to call platform callbacks
         glfwPollEvents();
 
@@ -248,6 +518,10 @@ int main()
             for (u32 i = 0; i < MOUSE_BUTTON_COUNT; ++i)
                 app.input.mouseButtons[i] = BUTTON_IDLE;
 
+        // Input recording/replay, the recorded input is exactly the one consumed by Update
+        ReplayInputFrame(app.inputRecorder, app.input, app.deltaTime);
+        RecordInputFrame(app.inputRecorder, app.input, app.deltaTime);
+
         // Update
         Update(&app);
 
@@ -269,7 +543,10 @@ int main()
         Render(&app);
 
         // ImGui Render
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            PROFILE_GPU_SCOPE(&app, "GUI");
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
         if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
             GLFWwindow* backup_current_context = glfwGetCurrentContext();
             ImGui::UpdatePlatformWindows();
@@ -285,10 +562,15 @@ int main()
         app.deltaTime = (f32)(currentFrameTime - lastFrameTime);
         lastFrameTime = currentFrameTime;
 
+        app.profiler.EndFrame();
+
         // Reset frame allocator
         GlobalFrameArenaHead = 0;
     }
 
+    StopInputRecording(app.inputRecorder);
+    app.profiler.Shutdown();
+    ShutdownAssetLoader(&app);
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -429,6 +711,91 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+bool MapFile(const char* filepath, MappedFile& mappedFile)
+{
+    mappedFile = {};
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!data) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    mappedFile.data    = (const u8*)data;
+    mappedFile.size    = (u64)size.QuadPart;
+    mappedFile.handle  = file;
+    mappedFile.mapping = mapping;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat attrib;
+    if (fstat(fd, &attrib) != 0 || attrib.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, (size_t)attrib.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    mappedFile.data    = (const u8*)data;
+    mappedFile.size    = (u64)attrib.st_size;
+    mappedFile.handle  = (void*)(intptr_t)fd;
+    mappedFile.mapping = data;
+#endif
+
+    return true;
+}
+
+void UnmapFile(MappedFile& mappedFile)
+{
+    if (!mappedFile.data) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(mappedFile.data);
+    CloseHandle((HANDLE)mappedFile.mapping);
+    CloseHandle((HANDLE)mappedFile.handle);
+#else
+    munmap(mappedFile.mapping, (size_t)mappedFile.size);
+    close((int)(intptr_t)mappedFile.handle);
+#endif
+
+    mappedFile = {};
+}
+
+f64 GetTimeSeconds()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = {};
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (f64)counter.QuadPart / (f64)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (f64)now.tv_sec + (f64)now.tv_nsec / 1.0e9;
+#endif
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
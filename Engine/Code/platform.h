@@ -82,6 +82,27 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+struct MappedFile {
+    const u8* data;
+    u64       size;
+    void*     handle;   // File handle/descriptor and mapping object of the OS
+    void*     mapping;
+};
+
+/**
+ * Maps a whole file read-only in memory. The pages are loaded on demand by the OS,
+ * so nothing is copied until the data is accessed. Returns false if it can not be mapped.
+ */
+bool MapFile(const char* filepath, MappedFile& mappedFile);
+
+void UnmapFile(MappedFile& mappedFile);
+
+/**
+ * Returns a monotonic high resolution time in seconds. Unlike glfwGetTime() it does not
+ * need a window system, so it can also be used by the headless benchmark.
+ */
+f64 GetTimeSeconds();
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -0,0 +1,256 @@
+// profiler.cpp
+#include "profiler.h"
+#include "gl_error.h"
+
+#include <algorithm>
+#include <string.h>
+
+void Profiler::Init()
+{
+    events.resize(PROFILER_EVENT_CAPACITY);
+    eventHead = 0;
+
+    history.assign(PROFILER_HISTORY_FRAMES, FrameRecord{});
+    passCount = 0;
+    counterCount = 0;
+
+    for (GpuQuerySet& set : querySets) {
+        GL_CHECK(glGenQueries(PROFILER_MAX_GPU_SCOPES, set.queries));
+        set.count = 0;
+        set.frame = 0;
+    }
+
+    epoch = GetTimeSeconds();
+    frameIndex = 0;
+    initialized = true;
+}
+
+void Profiler::Shutdown()
+{
+    if (!initialized) return;
+
+    for (GpuQuerySet& set : querySets) {
+        glDeleteQueries(PROFILER_MAX_GPU_SCOPES, set.queries);
+    }
+    initialized = false;
+}
+
+f64 Profiler::NowUs() const
+{
+    return (GetTimeSeconds() - epoch) * 1.0e6;
+}
+
+void Profiler::PushEvent(const ProfileEvent& event)
+{
+    events[eventHead % PROFILER_EVENT_CAPACITY] = event;
+    eventHead++;
+}
+
+void Profiler::BeginFrame()
+{
+    if (!initialized) return;
+
+    // This set was filled PROFILER_GPU_QUERY_SETS frames ago, so its queries should be ready
+    GpuQuerySet& set = querySets[frameIndex % PROFILER_GPU_QUERY_SETS];
+    ResolveGpuQueries(set);
+    set.frame = frameIndex;
+
+    f64 nowUs = NowUs();
+    if (frameIndex > 0) {
+        history[(frameIndex - 1) % PROFILER_HISTORY_FRAMES].frameMs = (f32)((nowUs - frameStartUs) / 1000.0);
+    }
+    history[frameIndex % PROFILER_HISTORY_FRAMES] = FrameRecord{};
+    history[frameIndex % PROFILER_HISTORY_FRAMES].startUs = nowUs;
+
+    frameStartUs = nowUs;
+}
+
+void Profiler::EndFrame()
+{
+    if (!initialized) return;
+
+    ASSERT(depth == 0, "Profile scopes must be closed before the end of the frame");
+
+    f64 durationUs = NowUs() - frameStartUs;
+    history[frameIndex % PROFILER_HISTORY_FRAMES].cpuMs = (f32)(durationUs / 1000.0);
+
+    if (enabled) {
+        PushEvent({ "Frame", frameIndex, frameStartUs, durationUs, ProfileEvent_CPU, 0 });
+    }
+    frameIndex++;
+}
+
+void Profiler::BeginScope(const char* name, u32 flags)
+{
+    ASSERT(depth < PROFILER_MAX_CPU_DEPTH, "Too many nested profile scopes");
+
+    OpenScope& scope = openScopes[depth++];
+    scope.name = name;
+    scope.timed = enabled && initialized;
+    scope.debugGroup = (flags & ProfileScope_DebugGroup) && debugGroups;
+    scope.gpuQuery = -1;
+
+    if (scope.debugGroup) {
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+    }
+
+    // GL_TIME_ELAPSED queries can not be nested, an inner GPU scope is only timed on the CPU
+    GpuQuerySet& set = querySets[frameIndex % PROFILER_GPU_QUERY_SETS];
+    if (scope.timed && (flags & ProfileScope_GPU) && !gpuScopeOpen && set.count < PROFILER_MAX_GPU_SCOPES) {
+        u32 index = set.count++;
+        set.names[index] = name;
+        set.depths[index] = (u8)depth;
+        set.submitUs[index] = NowUs();
+
+        GL_CHECK(glBeginQuery(GL_TIME_ELAPSED, set.queries[index]));
+        scope.gpuQuery = (i32)index;
+        gpuScopeOpen = true;
+    }
+
+    scope.startUs = NowUs();
+}
+
+void Profiler::EndScope()
+{
+    ASSERT(depth > 0, "EndScope without a matching BeginScope");
+
+    OpenScope& scope = openScopes[--depth];
+    f64 endUs = NowUs();
+
+    if (scope.gpuQuery >= 0) {
+        GL_CHECK(glEndQuery(GL_TIME_ELAPSED));
+        gpuScopeOpen = false;
+    }
+
+    if (scope.debugGroup) {
+        glPopDebugGroup();
+    }
+
+    if (scope.timed) {
+        PushEvent({ scope.name, frameIndex, scope.startUs, endUs - scope.startUs, ProfileEvent_CPU, (u8)(depth + 1) });
+    }
+}
+
+// The names are kept sorted, so a pass is found with a binary search and the list is only reordered
+// when a pass is registered
+i32 Profiler::FindOrAddPass(const char* name)
+{
+    const char** end = passNames + passCount;
+    const char** it = std::lower_bound(passNames, end, name, [](const char* a, const char* b) { return strcmp(a, b) < 0; });
+    u32 index = (u32)(it - passNames);
+    if (it != end && strcmp(*it, name) == 0) return (i32)index;
+    if (passCount == PROFILER_MAX_TRACKED_PASSES) return -1;
+
+    // The passes after it move by one in every frame record
+    u32 moved = passCount - index;
+    u32 lowMask = (1u << index) - 1;
+    memmove(passNames + index + 1, passNames + index, moved * sizeof(const char*));
+    passNames[index] = name;
+    for (FrameRecord& record : history) {
+        memmove(record.gpuPassMs + index + 1, record.gpuPassMs + index, moved * sizeof(f32));
+        record.gpuPassMs[index] = 0.0f;
+        record.gpuPassMask = (record.gpuPassMask & lowMask) | ((record.gpuPassMask & ~lowMask) << 1);
+    }
+    passCount++;
+    return (i32)index;
+}
+
+void Profiler::SetCounter(const char* name, f32 value)
+{
+    if (!initialized) return;
+
+    for (u32 i = 0; i < counterCount; ++i) {
+        if (strcmp(counterNames[i], name) == 0) {
+            history[frameIndex % PROFILER_HISTORY_FRAMES].counters[i] = value;
+            history[frameIndex % PROFILER_HISTORY_FRAMES].counterMask |= 1u << i;
+            return;
+        }
+    }
+    if (counterCount == PROFILER_MAX_COUNTERS) return;
+
+    counterNames[counterCount] = name;
+    history[frameIndex % PROFILER_HISTORY_FRAMES].counters[counterCount] = value;
+    history[frameIndex % PROFILER_HISTORY_FRAMES].counterMask |= 1u << counterCount;
+    counterCount++;
+}
+
+void Profiler::ResolveGpuQueries(GpuQuerySet& set)
+{
+    // The record of set.frame has been overwritten if the history wrapped around since then
+    FrameRecord* record = (frameIndex - set.frame < PROFILER_HISTORY_FRAMES && set.count > 0)
+        ? &history[set.frame % PROFILER_HISTORY_FRAMES] : NULL;
+    if (record) record->gpuResolved = true;
+
+    for (u32 i = 0; i < set.count; ++i)
+    {
+        // Never wait for the GPU: a result that is not ready yet is dropped
+        GLuint available = 0;
+        GL_CHECK(glGetQueryObjectuiv(set.queries[i], GL_QUERY_RESULT_AVAILABLE, &available));
+        if (!available) {
+            if (record) record->gpuResolved = false;
+            droppedGpuSamples += set.count - i;
+            break;
+        }
+
+        GLuint64 elapsedNs = 0;
+        GL_CHECK(glGetQueryObjectui64v(set.queries[i], GL_QUERY_RESULT, &elapsedNs));
+
+        // Elapsed queries have no start time. The passes are laid out back to back on the GPU
+        // track, never earlier than the moment they were submitted on the CPU.
+        f64 durationUs = elapsedNs / 1000.0;
+        f64 startUs = glm::max(set.submitUs[i], lastGpuEndUs);
+        lastGpuEndUs = startUs + durationUs;
+
+        i32 pass = FindOrAddPass(set.names[i]);
+        if (record && pass >= 0) {
+            record->gpuPassMs[pass] += (f32)(durationUs / 1000.0);
+            record->gpuPassMask |= 1u << pass;
+        }
+
+        PushEvent({ set.names[i], set.frame, startUs, durationUs, ProfileEvent_GPU, set.depths[i] });
+    }
+    set.count = 0;
+}
+
+bool Profiler::ExportChromeTrace(const char* path) const
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        ELOG("Could not write profiler trace %s", path);
+        return false;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"Graphics Engine\"}},\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}");
+
+    u64 count = eventHead < PROFILER_EVENT_CAPACITY ? eventHead : PROFILER_EVENT_CAPACITY;
+    for (u64 i = eventHead - count; i < eventHead; ++i)
+    {
+        const ProfileEvent& event = events[i % PROFILER_EVENT_CAPACITY];
+        bool gpu = event.type == ProfileEvent_GPU;
+        fprintf(file,
+            ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu}}",
+            event.name, gpu ? "gpu" : "cpu", gpu ? 1 : 0, event.startUs, event.durationUs, (unsigned long long)event.frame);
+    }
+
+    // Counter tracks, one sample per frame kept in the history. Frames that did not set a counter have
+    // no sample rather than a 0.
+    u32 frameCount = GetHistoryCount();
+    for (u32 i = 0; i < frameCount && counterCount > 0; ++i)
+    {
+        const FrameRecord& record = GetFrameRecord(i);
+        for (u32 c = 0; c < counterCount; ++c) {
+            if (!(record.counterMask & (1u << c))) continue;
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,\"args\":{\"value\":%.0f}}",
+                counterNames[c], record.startUs, record.counters[c]);
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    ILOG("Profiler trace with %llu events written to %s", (unsigned long long)count, path);
+    return true;
+}
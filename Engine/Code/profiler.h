@@ -0,0 +1,155 @@
+// profiler.h
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+#include <vector>
+
+#define PROFILER_EVENT_CAPACITY     65536   // Ring buffer size, older events are overwritten
+#define PROFILER_MAX_CPU_DEPTH      16
+#define PROFILER_MAX_GPU_SCOPES     32      // Timed GPU scopes per frame
+#define PROFILER_GPU_QUERY_SETS     2       // Double buffered: frame N is read back on frame N+2
+#define PROFILER_HISTORY_FRAMES     4096    // Frames kept for the frame time statistics
+#define PROFILER_MAX_TRACKED_PASSES 16      // Distinct GPU scopes kept in the frame history
+#define PROFILER_MAX_COUNTERS       16      // Distinct counters kept in the frame history
+
+enum ProfileEventType {
+    ProfileEvent_CPU,
+    ProfileEvent_GPU
+};
+
+enum ProfileScopeFlags {
+    ProfileScope_CPU        = 0,
+    ProfileScope_DebugGroup = 1 << 0,   // Also opens a GL debug group (visible in RenderDoc/Nsight)
+    ProfileScope_GPU        = 1 << 1    // Also times the scope with a GL_TIME_ELAPSED query
+};
+
+struct ProfileEvent {
+    const char* name;       // Must be a string literal, only the pointer is stored
+    u64 frame;
+    f64 startUs;            // Microseconds since Profiler::Init
+    f64 durationUs;
+    u8  type;
+    u8  depth;
+};
+
+struct GpuQuerySet {
+    GLuint      queries[PROFILER_MAX_GPU_SCOPES];
+    const char* names[PROFILER_MAX_GPU_SCOPES];
+    f64         submitUs[PROFILER_MAX_GPU_SCOPES];
+    u8          depths[PROFILER_MAX_GPU_SCOPES];
+    u32         count;
+    u64         frame;
+};
+
+struct FrameRecord {
+    f64 startUs;
+    f32 frameMs;                                // BeginFrame to the next BeginFrame, includes the present
+    f32 cpuMs;                                  // BeginFrame to EndFrame
+    f32 gpuPassMs[PROFILER_MAX_TRACKED_PASSES]; // Indexed like Profiler::GetPassName
+    u32 gpuPassMask;                            // Passes timed this frame, the others have no sample
+    bool gpuResolved;                           // GPU timings arrive PROFILER_GPU_QUERY_SETS frames late
+    f32 counters[PROFILER_MAX_COUNTERS];        // Indexed like Profiler::GetCounterName
+    u32 counterMask;                            // Counters set this frame, the others have no sample
+};
+
+class Profiler {
+public:
+    bool enabled = true;
+    bool debugGroups = true;
+
+    void Init();
+    void Shutdown();
+
+    void BeginFrame();
+    void EndFrame();
+
+    void BeginScope(const char* name, u32 flags);
+    void EndScope();
+
+    u64 GetFrameIndex() const { return frameIndex; }
+    u64 GetDroppedGpuSamples() const { return droppedGpuSamples; }
+
+    // Frame history, index 0 is the oldest frame kept. The frame in progress is not included.
+    u32 GetHistoryCount() const { return (u32)glm::min<u64>(frameIndex, PROFILER_HISTORY_FRAMES); }
+    const FrameRecord& GetFrameRecord(u32 index) const {
+        return history[(frameIndex - GetHistoryCount() + index) % PROFILER_HISTORY_FRAMES];
+    }
+
+    // Sorted by name when a pass is registered, a new pass moves the indices of the ones after it
+    u32 GetPassCount() const { return passCount; }
+    const char* GetPassName(u32 index) const { return passNames[index]; }
+
+    /**
+     * Per frame value (e.g. the objects culled), kept in the frame history and exported as a counter track.
+     * The name must be a string literal, only the pointer is stored.
+     */
+    void SetCounter(const char* name, f32 value);
+
+    u32 GetCounterCount() const { return counterCount; }
+    const char* GetCounterName(u32 index) const { return counterNames[index]; }
+
+    /**
+     * Writes the events kept in the ring buffer in the chrome://tracing (Trace Event) JSON format.
+     */
+    bool ExportChromeTrace(const char* path) const;
+
+private:
+    struct OpenScope {
+        const char* name;
+        f64 startUs;
+        i32 gpuQuery;
+        bool timed;
+        bool debugGroup;
+    };
+
+    f64 NowUs() const;
+    void PushEvent(const ProfileEvent& event);
+    void ResolveGpuQueries(GpuQuerySet& set);
+    i32 FindOrAddPass(const char* name);
+
+    std::vector<ProfileEvent> events;
+    u64 eventHead = 0;
+
+    OpenScope openScopes[PROFILER_MAX_CPU_DEPTH];
+    u32 depth = 0;
+
+    GpuQuerySet querySets[PROFILER_GPU_QUERY_SETS];
+    bool gpuScopeOpen = false;
+    f64 lastGpuEndUs = 0.0;
+    u64 droppedGpuSamples = 0;
+
+    std::vector<FrameRecord> history;
+    const char* passNames[PROFILER_MAX_TRACKED_PASSES];
+    u32 passCount = 0;
+    const char* counterNames[PROFILER_MAX_COUNTERS];
+    u32 counterCount = 0;
+
+    f64 epoch = 0.0;
+    f64 frameStartUs = 0.0;
+    u64 frameIndex = 0;
+    bool initialized = false;
+};
+
+class ProfileScope {
+public:
+    ProfileScope(Profiler& profiler, const char* name, u32 flags) : profiler(profiler) {
+        profiler.BeginScope(name, flags);
+    }
+    ~ProfileScope() {
+        profiler.EndScope();
+    }
+private:
+    Profiler& profiler;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// CPU timer only (e.g. Update, Gui)
+#define PROFILE_SCOPE(app, name)     ProfileScope PROFILE_CONCAT(profileScope, __LINE__)((app)->profiler, name, ProfileScope_CPU)
+// CPU timer + GL debug group, for render scopes that contain timed GPU passes
+#define PROFILE_GL_SCOPE(app, name)  ProfileScope PROFILE_CONCAT(profileScope, __LINE__)((app)->profiler, name, ProfileScope_DebugGroup)
+// CPU timer + GL debug group + GPU timer. GL_TIME_ELAPSED queries can not nest, so use it on leaf passes only
+#define PROFILE_GPU_SCOPE(app, name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)((app)->profiler, name, ProfileScope_DebugGroup | ProfileScope_GPU)
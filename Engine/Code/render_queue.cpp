@@ -0,0 +1,127 @@
+// render_queue.cpp
+#include "render_queue.h"
+#include "model.h"
+
+u64 MakeRenderKey(RenderLayer layer, u32 arena, u32 material, f32 depth)
+{
+    u64 quantized = (u64)(glm::clamp(depth, 0.0f, 1.0f) * (f32)RENDER_KEY_DEPTH_MAX);
+    u64 materialBits = glm::min(material, (u32)RENDER_KEY_MATERIAL_MAX);
+
+    // 1 layer, 2 arena, 16 material and 24 depth bits. The low 21 are free, ties keep the push order
+    if (layer == RenderLayer_Opaque) {
+        return ((u64)layer << 63) | ((u64)arena << 61) | (materialBits << 45) | (quantized << 21);
+    }
+    return ((u64)layer << 63) | ((RENDER_KEY_DEPTH_MAX - quantized) << 39) | ((u64)arena << 37) | (materialBits << 21);
+}
+
+void ClearRenderQueue(RenderQueue& queue)
+{
+    queue.packets.clear();
+    queue.commands.clear();
+    queue.keys.clear();
+    queue.order.clear();
+    queue.batches.clear();
+}
+
+void PushRenderPacket(RenderQueue& queue, u64 key, const RenderPacket& packet)
+{
+    queue.order.push_back((u32)queue.packets.size());
+    queue.keys.push_back(key);
+    queue.packets.push_back(packet);
+}
+
+void RadixSort(std::vector<u64>& keys, std::vector<u32>& values, std::vector<u64>& scratchKeys, std::vector<u32>& scratchValues)
+{
+    u32 count = (u32)keys.size();
+    if (count < 2) return;
+    scratchKeys.resize(count);
+    scratchValues.resize(count);
+
+    // Every histogram in one read of the keys
+    u32 histograms[8][256] = {};
+    for (u32 i = 0; i < count; ++i) {
+        u64 key = keys[i];
+        for (u32 pass = 0; pass < 8; ++pass) {
+            histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+        }
+    }
+
+    for (u32 pass = 0; pass < 8; ++pass) {
+        u32 shift = pass * 8;
+        u32* histogram = histograms[pass];
+        if (histogram[(keys[0] >> shift) & 0xFF] == count) continue;
+
+        u32 offset = 0;
+        for (u32 bucket = 0; bucket < 256; ++bucket) {
+            u32 bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for (u32 i = 0; i < count; ++i) {
+            u32 destination = histogram[(keys[i] >> shift) & 0xFF]++;
+            scratchKeys[destination] = keys[i];
+            scratchValues[destination] = values[i];
+        }
+        keys.swap(scratchKeys);
+        values.swap(scratchValues);
+    }
+}
+
+// Switches of the arena, or of the material when it is bound, between consecutive packets
+static u32 CountStateChanges(const RenderQueue& queue, const std::vector<u32>& order, bool splitByMaterial)
+{
+    u32 changes = 0;
+    for (u32 i = 1; i < (u32)order.size(); ++i) {
+        const RenderPacket& previous = queue.packets[order[i - 1]];
+        const RenderPacket& packet = queue.packets[order[i]];
+        if (previous.arena != packet.arena || (splitByMaterial && previous.material != packet.material)) changes++;
+    }
+    return changes;
+}
+
+void CountSceneStateChanges(RenderQueue& queue, bool splitByMaterial)
+{
+    // Scene order, as the draws were issued before the queue
+    queue.sceneKeys.clear();
+    for (const RenderPacket& packet : queue.packets) queue.sceneKeys.push_back(packet.drawId);
+    queue.sceneOrder = queue.order;
+    RadixSort(queue.sceneKeys, queue.sceneOrder, queue.scratchKeys, queue.scratchOrder);
+    queue.stateChangesUnsorted = CountStateChanges(queue, queue.sceneOrder, splitByMaterial);
+}
+
+void FlushRenderQueue(RenderQueue& queue, bool sort, bool splitByMaterial, std::vector<DrawElementsIndirectCommand>& drawCommands,
+    std::vector<OcclusionInstance>& occlusionInstances)
+{
+    if (sort) RadixSort(queue.keys, queue.order, queue.scratchKeys, queue.scratchOrder);
+    queue.stateChangesSorted = CountStateChanges(queue, queue.order, splitByMaterial);
+
+    for (u32 index : queue.order) {
+        const RenderPacket& packet = queue.packets[index];
+
+        DrawBatch* batch = queue.batches.empty() ? NULL : &queue.batches.back();
+        if (!batch || (u32)batch->arena != packet.arena ||
+            (splitByMaterial && batch->material.get() != packet.mesh->material.get())) {
+            DrawBatch newBatch;
+            newBatch.arena = (GeometryArenaType)packet.arena;
+            newBatch.material = packet.mesh->material;
+            newBatch.firstMesh = 0;
+            newBatch.meshCount = 0;
+            newBatch.firstCommand = (u32)drawCommands.size();
+            queue.batches.push_back(newBatch);
+            batch = &queue.batches.back();
+        }
+
+        OcclusionInstance instance;
+        instance.center = packet.center;
+        instance.firstCommand = (u32)drawCommands.size();
+        instance.extent = packet.extent;
+        instance.commandCount = packet.commandCount;
+        occlusionInstances.push_back(instance);
+
+        drawCommands.insert(drawCommands.end(), queue.commands.begin() + packet.firstCommand,
+            queue.commands.begin() + packet.firstCommand + packet.commandCount);
+        batch->meshCount++;
+        batch->commandCount += packet.commandCount;
+    }
+}
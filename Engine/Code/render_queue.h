@@ -0,0 +1,91 @@
+// render_queue.h
+#pragma once
+
+#include "platform.h"
+#include "meshlet.h"
+#include "draw_batches.h"
+#include "occlusion_culling.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+class Mesh;
+
+#define RENDER_KEY_DEPTH_BITS       24
+#define RENDER_KEY_DEPTH_MAX        ((1u << RENDER_KEY_DEPTH_BITS) - 1)
+#define RENDER_KEY_MATERIAL_MAX     0xFFFF      // Materials past it share the last value, they only batch worse
+
+// Drawn in this order, the transparent draws blend over the opaque ones
+enum RenderLayer
+{
+    RenderLayer_Opaque,
+    RenderLayer_Transparent
+};
+
+/*
+ * One draw of the frame: the commands of a mesh, or the instanced command of a level of detail.
+ * Its commands are in RenderQueue::commands in the order they were built, and copied to the draw
+ * commands in the order of the keys.
+ */
+struct RenderPacket {
+    glm::vec3 center;           // World space box, for the occlusion culling
+    u32 firstCommand;
+    glm::vec3 extent;
+    u32 commandCount;
+    const Mesh* mesh;           // Asset mesh, whose material the batch binds
+    u32 arena;
+    u32 material;               // In DrawBatches::materials
+    u32 drawId;                 // First in the scene, the order before sorting
+};
+
+/*
+ * The draws of the frame, sorted by a 64 bit key. Opaque keys are, from the top bit: layer, arena
+ * (the VAO and the vertex format of the shader), material (the bound textures) and the quantized
+ * view depth, so each state is set once and the draws go front to back within it. Transparent keys
+ * put the inverted depth right after the layer, back to front over any state.
+ */
+struct RenderQueue {
+    std::vector<RenderPacket> packets;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<u64> keys;                  // Per packet, sorted with order
+    std::vector<u32> order;                 // Packet indices, in key order once sorted
+    std::vector<u64> sceneKeys;             // Draw ids, to count the state changes in scene order
+    std::vector<u32> sceneOrder;
+    std::vector<u64> scratchKeys;
+    std::vector<u32> scratchOrder;
+
+    std::vector<DrawBatch> batches;         // Runs of sorted packets sharing the arena (and material when bound), meshCount being packets
+    u32 stateChangesUnsorted = 0;           // Arena and material switches in scene order
+    u32 stateChangesSorted = 0;
+};
+
+/**
+ * depth is the view depth over the far plane, clamped to [0, 1]. material is ignored when 0 is
+ * passed for it, e.g. when the textures are not bound per batch.
+ */
+u64 MakeRenderKey(RenderLayer layer, u32 arena, u32 material, f32 depth);
+
+void ClearRenderQueue(RenderQueue& queue);
+
+// Adds a packet whose commands were just appended to queue.commands, from firstCommand on
+void PushRenderPacket(RenderQueue& queue, u64 key, const RenderPacket& packet);
+
+/**
+ * LSD radix sort of the keys, 8 bits per pass, carrying the values along. Stable, and the passes
+ * where every key has the same byte are skipped. The scratch vectors are resized as needed.
+ */
+void RadixSort(std::vector<u64>& keys, std::vector<u32>& values, std::vector<u64>& scratchKeys, std::vector<u32>& scratchValues);
+
+/**
+ * Sorts the packets by key (or keeps them in the order they were pushed), then writes their
+ * commands in that order to drawCommands with an occlusion instance each, and groups them in
+ * queue.batches. Also counts the state changes after sorting.
+ */
+void FlushRenderQueue(RenderQueue& queue, bool sort, bool splitByMaterial, std::vector<DrawElementsIndirectCommand>& drawCommands,
+    std::vector<OcclusionInstance>& occlusionInstances);
+
+/**
+ * Counts the state changes of the packets in scene order (by draw id) for the statistics. Sorts a
+ * copy of the order, so it is kept out of the timed flush.
+ */
+void CountSceneStateChanges(RenderQueue& queue, bool splitByMaterial);
@@ -3,12 +3,16 @@
 
 #include "platform.h"
 #include "gl_error.h"
+#include "gl_state.h"
 #include <glad/glad.h>
 
 #include <glm/glm.hpp>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#define INVALID_UNIFORM_SLOT 0xFFFFFFFF
+
 struct VertexShaderAttribute {
     u8 location;
     u8 componentCount;
@@ -18,6 +22,15 @@ struct VertexShaderLayout {
     std::vector<VertexShaderAttribute> attributes;
 };
 
+/*
+ * A uniform resolved once by name, see Shader::GetUniform. It is a slot of the location table of
+ * its shader, so it stays valid when the program is reloaded. T is the type of the value set.
+ */
+template <typename T>
+struct UniformHandle {
+    u32 slot = INVALID_UNIFORM_SLOT;
+};
+
 class Shader
 {
 public:
@@ -26,80 +39,197 @@ public:
     std::string programName;
     u64 lastWriteTimestamp;
     VertexShaderLayout vertexInputLayout;
+    bool compute;       // A single compute stage, compiled with COMPUTE defined
+    std::string defines;    // Prepended to every stage after the version, e.g. to pick a code path
+
+    // Location of every active uniform, enumerated after each link. Array elements are listed one by
+    // one, the first also without its index.
+    std::unordered_map<std::string, GLint> uniformLocations;
 
-    Shader(const char* filepath, const char* programName)
+    // Uniforms handed out as handles, their locations refreshed with the table
+    std::vector<std::string> uniformSlotNames;
+    std::vector<GLint> uniformSlotLocations;
+
+    Shader(const char* filepath, const char* programName, bool compute = false, const char* defines = "")
     {
         this->filepath = filepath;
         this->programName = programName;
+        this->compute = compute;
+        this->defines = defines;
         this->handle = CreateFromSource(filepath, programName);
         this->lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
         SetupVertexAttributes();
+        BuildUniformTable();
     }
 
     void Use() const
     {
-        GL_CHECK(glUseProgram(handle));
+        GL_CHECK(GLState::UseProgram(handle));
+    }
+
+    // -1 for names that are not active uniforms, which the glUniform calls ignore
+    GLint GetUniformLocation(const std::string& name) const
+    {
+        auto it = uniformLocations.find(name);
+        return it != uniformLocations.end() ? it->second : -1;
+    }
+
+    /**
+     * Handle of a uniform, to set it without the name lookup. Looked up once, e.g. at Init; asking
+     * again for the same name gives the same slot.
+     */
+    template <typename T>
+    UniformHandle<T> GetUniform(const std::string& name)
+    {
+        UniformHandle<T> uniform;
+        for (u32 i = 0; i < (u32)uniformSlotNames.size(); ++i) {
+            if (uniformSlotNames[i] == name) {
+                uniform.slot = i;
+                return uniform;
+            }
+        }
+
+        uniform.slot = (u32)uniformSlotNames.size();
+        uniformSlotNames.push_back(name);
+        uniformSlotLocations.push_back(GetUniformLocation(name));
+        return uniform;
+    }
+
+    template <typename T>
+    GLint GetLocation(UniformHandle<T> uniform) const
+    {
+        return uniform.slot < uniformSlotLocations.size() ? uniformSlotLocations[uniform.slot] : -1;
+    }
+
+    void Set(UniformHandle<bool> uniform, bool value) const
+    {
+        GL_CHECK(glUniform1i(GetLocation(uniform), (int)value));
+    }
+
+    void Set(UniformHandle<int> uniform, int value) const
+    {
+        GL_CHECK(glUniform1i(GetLocation(uniform), value));
+    }
+
+    void Set(UniformHandle<u32> uniform, u32 value) const
+    {
+        GL_CHECK(glUniform1ui(GetLocation(uniform), value));
+    }
+
+    void Set(UniformHandle<float> uniform, float value) const
+    {
+        GL_CHECK(glUniform1f(GetLocation(uniform), value));
     }
 
-    // Utility uniform functions
+    void Set(UniformHandle<glm::vec2> uniform, const glm::vec2& value) const
+    {
+        GL_CHECK(glUniform2fv(GetLocation(uniform), 1, &value[0]));
+    }
+
+    void Set(UniformHandle<glm::ivec2> uniform, const glm::ivec2& value) const
+    {
+        GL_CHECK(glUniform2iv(GetLocation(uniform), 1, &value[0]));
+    }
+
+    void Set(UniformHandle<glm::vec3> uniform, const glm::vec3& value) const
+    {
+        GL_CHECK(glUniform3fv(GetLocation(uniform), 1, &value[0]));
+    }
+
+    void Set(UniformHandle<glm::vec4> uniform, const glm::vec4& value) const
+    {
+        GL_CHECK(glUniform4fv(GetLocation(uniform), 1, &value[0]));
+    }
+
+    void Set(UniformHandle<glm::vec4> uniform, const glm::vec4* values, u32 count) const
+    {
+        GL_CHECK(glUniform4fv(GetLocation(uniform), count, &values[0][0]));
+    }
+
+    void Set(UniformHandle<glm::mat3> uniform, const glm::mat3& mat) const
+    {
+        GL_CHECK(glUniformMatrix3fv(GetLocation(uniform), 1, GL_FALSE, &mat[0][0]));
+    }
+
+    void Set(UniformHandle<glm::mat4> uniform, const glm::mat4& mat) const
+    {
+        GL_CHECK(glUniformMatrix4fv(GetLocation(uniform), 1, GL_FALSE, &mat[0][0]));
+    }
+
+    // Utility uniform functions, by name
     void SetBool(const std::string& name, bool value) const
     {
-        GL_CHECK(glUniform1i(glGetUniformLocation(handle, name.c_str()), (int)value));
+        GL_CHECK(glUniform1i(GetUniformLocation(name), (int)value));
     }
 
     void SetInt(const std::string& name, int value) const
     {
-        GL_CHECK(glUniform1i(glGetUniformLocation(handle, name.c_str()), value));
+        GL_CHECK(glUniform1i(GetUniformLocation(name), value));
+    }
+
+    void SetUInt(const std::string& name, u32 value) const
+    {
+        GL_CHECK(glUniform1ui(GetUniformLocation(name), value));
     }
 
     void SetFloat(const std::string& name, float value) const
     {
-        GL_CHECK(glUniform1f(glGetUniformLocation(handle, name.c_str()), value));
+        GL_CHECK(glUniform1f(GetUniformLocation(name), value));
     }
 
     void SetVec2(const std::string& name, const glm::vec2& value) const
     {
-        GL_CHECK(glUniform2fv(glGetUniformLocation(handle, name.c_str()), 1, &value[0]));
+        GL_CHECK(glUniform2fv(GetUniformLocation(name), 1, &value[0]));
     }
 
     void SetVec2(const std::string& name, float x, float y) const
     {
-        GL_CHECK(glUniform2f(glGetUniformLocation(handle, name.c_str()), x, y));
+        GL_CHECK(glUniform2f(GetUniformLocation(name), x, y));
+    }
+
+    void SetIVec2(const std::string& name, const glm::ivec2& value) const
+    {
+        GL_CHECK(glUniform2iv(GetUniformLocation(name), 1, &value[0]));
     }
 
     void SetVec3(const std::string& name, const glm::vec3& value) const
     {
-        GL_CHECK(glUniform3fv(glGetUniformLocation(handle, name.c_str()), 1, &value[0]));
+        GL_CHECK(glUniform3fv(GetUniformLocation(name), 1, &value[0]));
     }
 
     void SetVec3(const std::string& name, float x, float y, float z) const
     {
-        GL_CHECK(glUniform3f(glGetUniformLocation(handle, name.c_str()), x, y, z));
+        GL_CHECK(glUniform3f(GetUniformLocation(name), x, y, z));
     }
 
     void SetVec4(const std::string& name, const glm::vec4& value) const
     {
-        GL_CHECK(glUniform4fv(glGetUniformLocation(handle, name.c_str()), 1, &value[0]));
+        GL_CHECK(glUniform4fv(GetUniformLocation(name), 1, &value[0]));
     }
 
     void SetVec4(const std::string& name, float x, float y, float z, float w) const
     {
-        GL_CHECK(glUniform4f(glGetUniformLocation(handle, name.c_str()), x, y, z, w));
+        GL_CHECK(glUniform4f(GetUniformLocation(name), x, y, z, w));
+    }
+
+    void SetVec4Array(const std::string& name, const glm::vec4* values, u32 count) const
+    {
+        GL_CHECK(glUniform4fv(GetUniformLocation(name), count, &values[0][0]));
     }
 
     void SetMat2(const std::string& name, const glm::mat2& mat) const
     {
-        GL_CHECK(glUniformMatrix2fv(glGetUniformLocation(handle, name.c_str()), 1, GL_FALSE, &mat[0][0]));
+        GL_CHECK(glUniformMatrix2fv(GetUniformLocation(name), 1, GL_FALSE, &mat[0][0]));
     }
 
     void SetMat3(const std::string& name, const glm::mat3& mat) const
     {
-        GL_CHECK(glUniformMatrix3fv(glGetUniformLocation(handle, name.c_str()), 1, GL_FALSE, &mat[0][0]));
+        GL_CHECK(glUniformMatrix3fv(GetUniformLocation(name), 1, GL_FALSE, &mat[0][0]));
     }
 
     void SetMat4(const std::string& name, const glm::mat4& mat) const
     {
-        GL_CHECK(glUniformMatrix4fv(glGetUniformLocation(handle, name.c_str()), 1, GL_FALSE, &mat[0][0]));
+        GL_CHECK(glUniformMatrix4fv(GetUniformLocation(name), 1, GL_FALSE, &mat[0][0]));
     }
 
     bool ReloadIfNeeded()
@@ -110,10 +240,11 @@ public:
             GLuint newHandle = CreateFromSource(filepath.c_str(), programName.c_str());
             if (newHandle)
             {
-                glDeleteProgram(handle);
+                GLState::DeleteProgram(handle);
                 handle = newHandle;
                 lastWriteTimestamp = currentTimestamp;
                 SetupVertexAttributes();
+                BuildUniformTable();
                 return true;
 
                 ELOG("Reload shader: %s", this->filepath.c_str());
@@ -128,6 +259,28 @@ public:
         return false;
     }
 
+    /**
+     * Compiles the program again with other defines. On failure the current program and its
+     * defines are kept.
+     */
+    bool SetDefines(const char* newDefines)
+    {
+        std::string oldDefines = defines;
+        defines = newDefines;
+        GLuint newHandle = CreateFromSource(filepath.c_str(), programName.c_str());
+        if (!newHandle)
+        {
+            defines = oldDefines;
+            return false;
+        }
+
+        GLState::DeleteProgram(handle);
+        handle = newHandle;
+        SetupVertexAttributes();
+        BuildUniformTable();
+        return true;
+    }
+
 private:
     GLuint CreateFromSource(const char* filepath, const char* programName)
     {
@@ -138,6 +291,11 @@ private:
             return 0;
         }
 
+        if (compute)
+        {
+            return CreateComputeFromSource(programSource, programName);
+        }
+
         GLchar infoLogBuffer[1024] = {};
         GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
         GLsizei infoLogSize;
@@ -151,12 +309,14 @@ private:
 
         const GLchar* vertexShaderSource[] = {
             versionString,
+            defines.c_str(),
             shaderNameDefine,
             vertexShaderDefine,
             programSource.str
         };
         const GLint vertexShaderLengths[] = {
             (GLint)strlen(versionString),
+            (GLint)defines.size(),
             (GLint)strlen(shaderNameDefine),
             (GLint)strlen(vertexShaderDefine),
             (GLint)programSource.len
@@ -164,12 +324,14 @@ private:
 
         const GLchar* fragmentShaderSource[] = {
             versionString,
+            defines.c_str(),
             shaderNameDefine,
             fragmentShaderDefine,
             programSource.str
         };
         const GLint fragmentShaderLengths[] = {
             (GLint)strlen(versionString),
+            (GLint)defines.size(),
             (GLint)strlen(shaderNameDefine),
             (GLint)strlen(fragmentShaderDefine),
             (GLint)programSource.len
@@ -217,7 +379,7 @@ private:
         {
             glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
             ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", programName, infoLogBuffer);
-            glDeleteProgram(programHandle);
+            GLState::DeleteProgram(programHandle);
             programHandle = 0;
         }
 
@@ -229,9 +391,67 @@ private:
         return programHandle;
     }
 
+    GLuint CreateComputeFromSource(const String& programSource, const char* programName)
+    {
+        GLchar infoLogBuffer[1024] = {};
+        GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+        GLsizei infoLogSize;
+        GLint success;
+
+        char versionString[] = "#version 430\n";
+        char shaderNameDefine[128];
+        sprintf(shaderNameDefine, "#define %s\n", programName);
+        char computeShaderDefine[] = "#define COMPUTE\n";
+
+        const GLchar* computeShaderSource[] = {
+            versionString,
+            defines.c_str(),
+            shaderNameDefine,
+            computeShaderDefine,
+            programSource.str
+        };
+        const GLint computeShaderLengths[] = {
+            (GLint)strlen(versionString),
+            (GLint)defines.size(),
+            (GLint)strlen(shaderNameDefine),
+            (GLint)strlen(computeShaderDefine),
+            (GLint)programSource.len
+        };
+
+        GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+        GL_CHECK(glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths));
+        GL_CHECK(glCompileShader(cshader));
+        GL_CHECK(glGetShaderiv(cshader, GL_COMPILE_STATUS, &success));
+        if (!success)
+        {
+            glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", programName, infoLogBuffer);
+            glDeleteShader(cshader);
+            return 0;
+        }
+
+        GLuint programHandle = glCreateProgram();
+        GL_CHECK(glAttachShader(programHandle, cshader));
+        GL_CHECK(glLinkProgram(programHandle));
+        GL_CHECK(glGetProgramiv(programHandle, GL_LINK_STATUS, &success));
+        if (!success)
+        {
+            glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", programName, infoLogBuffer);
+            GLState::DeleteProgram(programHandle);
+            programHandle = 0;
+        }
+
+        glDetachShader(programHandle, cshader);
+        glDeleteShader(cshader);
+
+        return programHandle;
+    }
+
     void SetupVertexAttributes()
     {
         vertexInputLayout.attributes.clear();
+        if (compute) return;
 
         GLint attributeCount;
         glGetProgramiv(handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
@@ -262,4 +482,41 @@ private:
             vertexInputLayout.attributes.push_back({ (u8)attributeLocation, componentCount });
         }
     }
+    void BuildUniformTable()
+    {
+        uniformLocations.clear();
+
+        GLint uniformCount = 0;
+        if (handle) glGetProgramInterfaceiv(handle, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+
+        const GLenum properties[] = { GL_LOCATION, GL_ARRAY_SIZE };
+        for (GLint i = 0; i < uniformCount; ++i) {
+            GLint values[ARRAY_COUNT(properties)];
+            glGetProgramResourceiv(handle, GL_UNIFORM, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+
+            // Members of uniform and storage blocks have no location
+            GLint location = values[0];
+            if (location < 0) continue;
+
+            GLchar uniformName[256];
+            glGetProgramResourceName(handle, GL_UNIFORM, i, ARRAY_COUNT(uniformName), NULL, uniformName);
+            std::string name = uniformName;
+            uniformLocations[name] = location;
+
+            // Arrays come as "name[0]", their elements have consecutive locations
+            GLint arraySize = values[1];
+            size_t suffix = name.size() >= 3 ? name.size() - 3 : std::string::npos;
+            if (suffix != std::string::npos && name.compare(suffix, 3, "[0]") == 0) {
+                std::string base = name.substr(0, suffix);
+                uniformLocations[base] = location;
+                for (GLint e = 1; e < arraySize; ++e) {
+                    uniformLocations[base + "[" + std::to_string(e) + "]"] = location + e;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < uniformSlotNames.size(); ++i) {
+            uniformSlotLocations[i] = GetUniformLocation(uniformSlotNames[i]);
+        }
+    }
 };
\ No newline at end of file
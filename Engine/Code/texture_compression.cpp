@@ -0,0 +1,772 @@
+// texture_compression.cpp
+#include "texture_compression.h"
+#include "texture_streamer.h"
+#include "gl_extensions.h"
+#include "mesh_cache.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <limits.h>
+#include <memory>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define BC_USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define BC_USE_SSE2 0
+#endif
+
+#define BC_ROWS_PER_JOB     16      // Block rows encoded per chunk, 64 pixel rows
+
+CompressedImage::~CompressedImage()
+{
+    if (file.data) UnmapFile(file);
+}
+
+const char* GetTextureCodecName(TextureCodec codec)
+{
+    switch (codec) {
+    case TextureCodec_BC1: return "BC1";
+    case TextureCodec_BC4: return "BC4";
+    case TextureCodec_BC5: return "BC5";
+    case TextureCodec_BC7: return "BC7";
+    default:               return "None";
+    }
+}
+
+GLenum GetTextureCodecFormat(TextureCodec codec)
+{
+    switch (codec) {
+    case TextureCodec_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TextureCodec_BC4: return GL_COMPRESSED_RED_RGTC1;
+    case TextureCodec_BC5: return GL_COMPRESSED_RG_RGTC2;
+    case TextureCodec_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    default:               return GL_NONE;
+    }
+}
+
+static u32 GetBlockSize(TextureCodec codec)
+{
+    return (codec == TextureCodec_BC1 || codec == TextureCodec_BC4) ? 8 : 16;
+}
+
+#pragma region Codec selection
+
+bool HasTranslucentPixels(const DecodedImage& image)
+{
+    if (image.components != 2 && image.components != 4) return false;
+
+    u64 count = (u64)image.width * image.height;
+    for (u64 i = 0; i < count; ++i) {
+        if (image.pixels[i * image.components + image.components - 1] != 255) return true;
+    }
+    return false;
+}
+
+TextureCodec ChooseTextureCodec(const std::string& name, const DecodedImage& image)
+{
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return (char)tolower(c); });
+
+    auto contains = [&lower](const char* token) { return lower.find(token) != std::string::npos; };
+
+    if (contains("normal") || contains("_nrm")) {
+        return TextureCodec_BC5;
+    }
+
+    if (contains("metal") || contains("rough") || contains("gloss") || contains("height") ||
+        contains("disp") || contains("_ao") || contains("occlusion")) {
+        return TextureCodec_BC4;
+    }
+
+    if (HasTranslucentPixels(image) || !GLExt.textureCompressionS3TC) {
+        return TextureCodec_BC7;
+    }
+    return TextureCodec_BC1;
+}
+
+#pragma endregion
+
+#pragma region Block encoders
+
+static void FetchBlock(const u8* rgba, u32 width, u32 height, u32 blockX, u32 blockY, u8 block[64])
+{
+    // Blocks on the right/bottom edges repeat the last column/row
+    for (u32 y = 0; y < 4; ++y) {
+        u32 sy = glm::min(blockY * 4 + y, height - 1);
+        for (u32 x = 0; x < 4; ++x) {
+            u32 sx = glm::min(blockX * 4 + x, width - 1);
+            memcpy(block + (y * 4 + x) * 4, rgba + ((u64)sy * width + sx) * 4, 4);
+        }
+    }
+}
+
+static void BlockBounds(const u8 block[64], u8 minColor[4], u8 maxColor[4])
+{
+#if BC_USE_SSE2
+    __m128i p0 = _mm_loadu_si128((const __m128i*)block + 0);
+    __m128i p1 = _mm_loadu_si128((const __m128i*)block + 1);
+    __m128i p2 = _mm_loadu_si128((const __m128i*)block + 2);
+    __m128i p3 = _mm_loadu_si128((const __m128i*)block + 3);
+
+    __m128i lo = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+    __m128i hi = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+
+    // Fold the 4 pixels left in each register
+    lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+    hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+    hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    u32 packedMin = (u32)_mm_cvtsi128_si32(lo);
+    u32 packedMax = (u32)_mm_cvtsi128_si32(hi);
+    memcpy(minColor, &packedMin, 4);
+    memcpy(maxColor, &packedMax, 4);
+#else
+    for (u32 c = 0; c < 4; ++c) {
+        minColor[c] = 255;
+        maxColor[c] = 0;
+    }
+    for (u32 i = 0; i < 16; ++i) {
+        for (u32 c = 0; c < 4; ++c) {
+            minColor[c] = glm::min(minColor[c], block[i * 4 + c]);
+            maxColor[c] = glm::max(maxColor[c], block[i * 4 + c]);
+        }
+    }
+#endif
+}
+
+static void ChannelBounds(const u8 values[16], u8& minValue, u8& maxValue)
+{
+#if BC_USE_SSE2
+    __m128i v = _mm_loadu_si128((const __m128i*)values);
+    __m128i lo = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+    __m128i hi = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 2));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 2));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 1));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 1));
+    minValue = (u8)_mm_cvtsi128_si32(lo);
+    maxValue = (u8)_mm_cvtsi128_si32(hi);
+#else
+    minValue = 255;
+    maxValue = 0;
+    for (u32 i = 0; i < 16; ++i) {
+        minValue = glm::min(minValue, values[i]);
+        maxValue = glm::max(maxValue, values[i]);
+    }
+#endif
+}
+
+/*
+ * The bounding box diagonal goes from min to max on every channel, which is wrong for channels that
+ * decrease when the dominant one increases. Those are flipped, using the sign of their covariance.
+ */
+static void SelectDiagonal(const u8 block[64], u32 channels, int minColor[4], int maxColor[4])
+{
+    u32 reference = 0;
+    for (u32 c = 1; c < channels; ++c) {
+        if (maxColor[c] - minColor[c] > maxColor[reference] - minColor[reference]) reference = c;
+    }
+
+    int center[4];
+    for (u32 c = 0; c < channels; ++c) center[c] = (minColor[c] + maxColor[c]) / 2;
+
+    for (u32 c = 0; c < channels; ++c) {
+        if (c == reference) continue;
+
+        int covariance = 0;
+        for (u32 i = 0; i < 16; ++i) {
+            covariance += (block[i * 4 + reference] - center[reference]) * (block[i * 4 + c] - center[c]);
+        }
+        if (covariance < 0) std::swap(minColor[c], maxColor[c]);
+    }
+}
+
+static void InsetBounds(u32 channels, int minColor[4], int maxColor[4], int shift)
+{
+    // The extremes are often outliers, pulling the endpoints in lowers the error of the rest
+    for (u32 c = 0; c < channels; ++c) {
+        int inset = (maxColor[c] - minColor[c]) >> shift;
+        minColor[c] += inset;
+        maxColor[c] -= inset;
+    }
+}
+
+static int ColorDistance(const u8* a, const int* b, u32 channels)
+{
+    int distance = 0;
+    for (u32 c = 0; c < channels; ++c) {
+        int d = a[c] - b[c];
+        distance += d * d;
+    }
+    return distance;
+}
+
+// Index of the closest palette entry for every pixel, the first one on ties
+static void FindClosestIndices(const u8 block[64], const int palette[][4], u32 paletteSize, u32 channels, u32 indices[16])
+{
+#if BC_USE_SSE2
+    __m128i entries[16];
+    for (u32 p = 0; p < paletteSize; ++p) {
+        const int* e = palette[p];
+        entries[p] = _mm_set_epi16((short)e[3], (short)e[2], (short)e[1], (short)e[0], (short)e[3], (short)e[2], (short)e[1], (short)e[0]);
+    }
+
+    // Differences are 16 bit, their squares are summed in pairs by madd. Alpha is masked out for RGB.
+    __m128i zero = _mm_setzero_si128();
+    __m128i channelMask = channels == 4 ? _mm_set1_epi16(-1) : _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    for (u32 i = 0; i < 16; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(block + i * 4));
+        __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+        __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+
+        __m128i bestDistance = _mm_set1_epi32(INT_MAX);
+        __m128i bestIndex = zero;
+        for (u32 p = 0; p < paletteSize; ++p) {
+            __m128i d0 = _mm_and_si128(_mm_sub_epi16(lo, entries[p]), channelMask);
+            __m128i d1 = _mm_and_si128(_mm_sub_epi16(hi, entries[p]), channelMask);
+            d0 = _mm_madd_epi16(d0, d0);
+            d1 = _mm_madd_epi16(d1, d1);
+
+            // Add the RG and BA halves of each pixel, pixel order is kept
+            __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(d0), _mm_castsi128_ps(d1), _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(d0), _mm_castsi128_ps(d1), _MM_SHUFFLE(3, 1, 3, 1));
+            __m128i distance = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+
+            __m128i closer = _mm_cmplt_epi32(distance, bestDistance);
+            bestDistance = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, bestDistance));
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32((int)p)), _mm_andnot_si128(closer, bestIndex));
+        }
+        _mm_storeu_si128((__m128i*)(indices + i), bestIndex);
+    }
+#else
+    for (u32 i = 0; i < 16; ++i) {
+        int bestDistance = INT_MAX;
+        for (u32 p = 0; p < paletteSize; ++p) {
+            int distance = ColorDistance(block + i * 4, palette[p], channels);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                indices[i] = p;
+            }
+        }
+    }
+#endif
+}
+
+static u16 PackRGB565(const int color[3])
+{
+    int r = (glm::clamp(color[0], 0, 255) * 31 + 127) / 255;
+    int g = (glm::clamp(color[1], 0, 255) * 63 + 127) / 255;
+    int b = (glm::clamp(color[2], 0, 255) * 31 + 127) / 255;
+    return (u16)((r << 11) | (g << 5) | b);
+}
+
+static void UnpackRGB565(u16 packed, int color[3])
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+static void EncodeBC1(const u8 block[64], u8* out)
+{
+    u8 lo[4], hi[4];
+    BlockBounds(block, lo, hi);
+
+    int minColor[4] = { lo[0], lo[1], lo[2], 0 };
+    int maxColor[4] = { hi[0], hi[1], hi[2], 0 };
+    SelectDiagonal(block, 3, minColor, maxColor);
+    InsetBounds(3, minColor, maxColor, 4);
+
+    u16 color0 = PackRGB565(maxColor);
+    u16 color1 = PackRGB565(minColor);
+    if (color0 < color1) std::swap(color0, color1);     // color0 > color1 selects the 4 color mode
+
+    u32 indices = 0;
+    if (color0 != color1) {
+        int palette[4][4] = {};
+        UnpackRGB565(color0, palette[0]);
+        UnpackRGB565(color1, palette[1]);
+        for (u32 c = 0; c < 3; ++c) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        u32 closest[16];
+        FindClosestIndices(block, palette, 4, 3, closest);
+        for (u32 i = 0; i < 16; ++i) indices |= closest[i] << (2 * i);
+    }
+
+    out[0] = (u8)(color0 & 0xFF);
+    out[1] = (u8)(color0 >> 8);
+    out[2] = (u8)(color1 & 0xFF);
+    out[3] = (u8)(color1 >> 8);
+    for (u32 b = 0; b < 4; ++b) out[4 + b] = (u8)(indices >> (8 * b));
+}
+
+static void EncodeBC4(const u8 values[16], u8* out)
+{
+    u8 minValue, maxValue;
+    ChannelBounds(values, minValue, maxValue);
+
+    // maxValue > minValue selects the 8 value mode: index 0 = max, 1 = min, 2..7 in between
+    out[0] = maxValue;
+    out[1] = minValue;
+
+    u64 indices = 0;
+    if (maxValue != minValue) {
+        int range = maxValue - minValue;
+        for (u32 i = 0; i < 16; ++i) {
+            int step = ((maxValue - values[i]) * 7 + range / 2) / range;
+            u64 index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+            indices |= index << (3 * i);
+        }
+    }
+    for (u32 b = 0; b < 6; ++b) out[2 + b] = (u8)(indices >> (8 * b));
+}
+
+static void EncodeBC4Channel(const u8 block[64], u32 channel, u8* out)
+{
+    u8 values[16];
+    for (u32 i = 0; i < 16; ++i) values[i] = block[i * 4 + channel];
+    EncodeBC4(values, out);
+}
+
+struct BitWriter {
+    u64 bits[2] = {};
+    u32 position = 0;
+
+    void Write(u32 value, u32 count) {
+        for (u32 i = 0; i < count; ++i, ++position) {
+            bits[position / 64] |= (u64)((value >> i) & 1) << (position % 64);
+        }
+    }
+};
+
+static const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Mode 6 endpoints are 7 bits per channel plus a p-bit shared by the 4 channels, keep the closest p-bit
+static void QuantizeBC7Endpoint(const int color[4], u32 quantized[4], u32& pBit)
+{
+    int bestError = INT_MAX;
+    for (u32 p = 0; p < 2; ++p) {
+        u32 candidate[4];
+        int error = 0;
+        for (u32 c = 0; c < 4; ++c) {
+            int value = glm::clamp(color[c], 0, 255);
+            candidate[c] = (u32)glm::clamp((value - (int)p + 1) >> 1, 0, 127);
+            int reconstructed = (int)((candidate[c] << 1) | p);
+            error += (reconstructed - value) * (reconstructed - value);
+        }
+        if (error < bestError) {
+            bestError = error;
+            pBit = p;
+            memcpy(quantized, candidate, sizeof(candidate));
+        }
+    }
+}
+
+/*
+ * BC7 mode 6 only: one subset, RGBA endpoints and 4 bit indices. It is the mode real time encoders
+ * fall back to and gives better color than BC1 with full alpha.
+ */
+static void EncodeBC7(const u8 block[64], u8* out)
+{
+    u8 lo[4], hi[4];
+    BlockBounds(block, lo, hi);
+
+    int minColor[4] = { lo[0], lo[1], lo[2], lo[3] };
+    int maxColor[4] = { hi[0], hi[1], hi[2], hi[3] };
+    SelectDiagonal(block, 4, minColor, maxColor);
+    InsetBounds(4, minColor, maxColor, 5);
+
+    u32 endpoints[2][4], pBits[2];
+    QuantizeBC7Endpoint(maxColor, endpoints[0], pBits[0]);
+    QuantizeBC7Endpoint(minColor, endpoints[1], pBits[1]);
+
+    int palette[16][4];
+    for (u32 c = 0; c < 4; ++c) {
+        int e0 = (int)((endpoints[0][c] << 1) | pBits[0]);
+        int e1 = (int)((endpoints[1][c] << 1) | pBits[1]);
+        for (u32 p = 0; p < 16; ++p) {
+            palette[p][c] = ((64 - bc7Weights4[p]) * e0 + bc7Weights4[p] * e1 + 32) >> 6;
+        }
+    }
+
+    u32 indices[16];
+    FindClosestIndices(block, palette, 16, 4, indices);
+
+    // The anchor index is stored without its top bit, swap the endpoints if it is set
+    if (indices[0] & 8) {
+        std::swap(endpoints[0], endpoints[1]);
+        std::swap(pBits[0], pBits[1]);
+        for (u32 i = 0; i < 16; ++i) indices[i] = 15 - indices[i];
+    }
+
+    BitWriter writer;
+    writer.Write(1 << 6, 7);    // Mode 6
+    for (u32 c = 0; c < 4; ++c) {
+        writer.Write(endpoints[0][c], 7);
+        writer.Write(endpoints[1][c], 7);
+    }
+    writer.Write(pBits[0], 1);
+    writer.Write(pBits[1], 1);
+    writer.Write(indices[0], 3);
+    for (u32 i = 1; i < 16; ++i) writer.Write(indices[i], 4);
+
+    memcpy(out, writer.bits, 16);
+}
+
+// Block rows [firstRow, endRow) of one level
+static void EncodeRows(const u8* rgba, u32 width, u32 height, TextureCodec codec, u32 firstRow, u32 endRow, u8* out)
+{
+    u32 blocksX = (width + 3) / 4;
+    u32 blockSize = GetBlockSize(codec);
+
+    u8 block[64];
+    for (u32 by = firstRow; by < endRow; ++by) {
+        for (u32 bx = 0; bx < blocksX; ++bx) {
+            FetchBlock(rgba, width, height, bx, by, block);
+            u8* dst = out + ((u64)by * blocksX + bx) * blockSize;
+
+            switch (codec) {
+            case TextureCodec_BC1: EncodeBC1(block, dst); break;
+            case TextureCodec_BC4: EncodeBC4Channel(block, 0, dst); break;
+            case TextureCodec_BC5: EncodeBC4Channel(block, 0, dst); EncodeBC4Channel(block, 1, dst + 8); break;
+            case TextureCodec_BC7: EncodeBC7(block, dst); break;
+            default: break;
+            }
+        }
+    }
+}
+
+struct EncodeLevelJob {
+    const u8* rgba;
+    u32 width, height;
+    TextureCodec codec;
+    u8* out;
+    u32 chunkCount;
+    std::atomic<u32> nextChunk{0};
+    std::atomic<u32> doneChunks{0};
+
+    // Encodes chunks until none are left, false if there was none to take
+    bool Run() {
+        u32 blocksY = (height + 3) / 4;
+        bool ranAny = false;
+        for (u32 chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+            u32 firstRow = chunk * BC_ROWS_PER_JOB;
+            EncodeRows(rgba, width, height, codec, firstRow, glm::min(firstRow + BC_ROWS_PER_JOB, blocksY), out);
+            doneChunks++;
+            ranAny = true;
+        }
+        return ranAny;
+    }
+};
+
+/*
+ * The block rows are split in chunks taken by the calling worker and by helper jobs. The caller
+ * takes chunks too, so it only ever waits for chunks another worker is already encoding and a full
+ * queue cannot dead lock it. Helpers that start after the last chunk was taken return at once.
+ */
+static void EncodeLevel(const u8* rgba, u32 width, u32 height, TextureCodec codec, u8* out, JobSystem* jobs)
+{
+    u32 blocksY = (height + 3) / 4;
+    u32 chunkCount = (blocksY + BC_ROWS_PER_JOB - 1) / BC_ROWS_PER_JOB;
+    if (!jobs || chunkCount < 2 || jobs->GetWorkerCount() < 2) {
+        EncodeRows(rgba, width, height, codec, 0, blocksY, out);
+        return;
+    }
+
+    std::shared_ptr<EncodeLevelJob> job = std::make_shared<EncodeLevelJob>();
+    job->rgba = rgba;
+    job->width = width;
+    job->height = height;
+    job->codec = codec;
+    job->out = out;
+    job->chunkCount = chunkCount;
+
+    u32 helperCount = glm::min(chunkCount - 1, jobs->GetWorkerCount() - 1);
+    for (u32 i = 0; i < helperCount; ++i) {
+        jobs->Submit([job]() { job->Run(); });
+    }
+
+    job->Run();
+    while (job->doneChunks < chunkCount) {
+        std::this_thread::yield();
+    }
+}
+
+#pragma endregion
+
+#pragma region Mips
+
+static std::vector<u8> ExpandToRGBA(const DecodedImage& image)
+{
+    u64 count = (u64)image.width * image.height;
+    std::vector<u8> rgba(count * 4);
+
+    for (u64 i = 0; i < count; ++i) {
+        const u8* src = image.pixels + i * image.components;
+        u8* dst = rgba.data() + i * 4;
+        switch (image.components) {
+        case 1:  dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255;    break;
+        case 2:  dst[0] = dst[1] = dst[2] = src[0]; dst[3] = src[1]; break;
+        case 3:  memcpy(dst, src, 3); dst[3] = 255;                  break;
+        default: memcpy(dst, src, 4);                                break;
+        }
+    }
+    return rgba;
+}
+
+static void Downsample(const std::vector<u8>& src, u32 width, u32 height, std::vector<u8>& dst, u32 dstWidth, u32 dstHeight)
+{
+    dst.resize((u64)dstWidth * dstHeight * 4);
+
+    for (u32 y = 0; y < dstHeight; ++y) {
+        u32 y0 = glm::min(y * 2, height - 1);
+        u32 y1 = glm::min(y * 2 + 1, height - 1);
+        for (u32 x = 0; x < dstWidth; ++x) {
+            u32 x0 = glm::min(x * 2, width - 1);
+            u32 x1 = glm::min(x * 2 + 1, width - 1);
+
+            const u8* a = &src[((u64)y0 * width + x0) * 4];
+            const u8* b = &src[((u64)y0 * width + x1) * 4];
+            const u8* c = &src[((u64)y1 * width + x0) * 4];
+            const u8* d = &src[((u64)y1 * width + x1) * 4];
+            u8* out = &dst[((u64)y * dstWidth + x) * 4];
+            for (u32 ch = 0; ch < 4; ++ch) {
+                out[ch] = (u8)((a[ch] + b[ch] + c[ch] + d[ch] + 2) >> 2);
+            }
+        }
+    }
+}
+
+void CompressImage(const DecodedImage& image, TextureCodec codec, CompressedImage& compressed, JobSystem* jobs)
+{
+    u32 width = (u32)image.width;
+    u32 height = (u32)image.height;
+    u32 blockSize = GetBlockSize(codec);
+
+    std::vector<u8> level = ExpandToRGBA(image);
+    std::vector<u8> next;
+
+    compressed.codec = codec;
+    compressed.mips.clear();
+    compressed.storage.clear();
+
+    while (true)
+    {
+        CompressedMip mip;
+        mip.width = width;
+        mip.height = height;
+        mip.offset = compressed.storage.size();
+        mip.size = (u64)((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+
+        compressed.storage.resize(mip.offset + mip.size);
+        EncodeLevel(level.data(), width, height, codec, compressed.storage.data() + mip.offset, jobs);
+        compressed.mips.push_back(mip);
+
+        if (width == 1 && height == 1) break;
+
+        u32 nextWidth = glm::max(width / 2, 1u);
+        u32 nextHeight = glm::max(height / 2, 1u);
+        Downsample(level, width, height, next, nextWidth, nextHeight);
+        level.swap(next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+
+    compressed.data = compressed.storage.data();
+    compressed.size = compressed.storage.size();
+}
+
+#pragma endregion
+
+#pragma region DDS cache
+
+#define DDS_MAGIC               0x20534444  // "DDS "
+#define DDS_FOURCC_DX10         0x30315844  // "DX10"
+#define DDSD_REQUIRED_FLAGS     (0x1 | 0x2 | 0x4 | 0x1000)      // Caps, height, width, pixel format
+#define DDSD_MIPMAPCOUNT        0x20000
+#define DDSD_LINEARSIZE         0x80000
+#define DDPF_FOURCC             0x4
+#define DDSCAPS_TEXTURE         0x1000
+#define DDSCAPS_COMPLEX         0x8
+#define DDSCAPS_MIPMAP          0x400000
+#define DDS_DIMENSION_TEXTURE2D 3
+
+struct DDSPixelFormat {
+    u32 size;
+    u32 flags;
+    u32 fourCC;
+    u32 rgbBitCount;
+    u32 masks[4];
+};
+
+struct DDSHeader {
+    u32 size;
+    u32 flags;
+    u32 height;
+    u32 width;
+    u32 pitchOrLinearSize;
+    u32 depth;
+    u32 mipMapCount;
+    u32 reserved1[11];  // [0] cache version, [1..2] source hash
+    DDSPixelFormat pixelFormat;
+    u32 caps[4];
+    u32 reserved2;
+};
+
+struct DDSHeaderDX10 {
+    u32 dxgiFormat;
+    u32 resourceDimension;
+    u32 miscFlag;
+    u32 arraySize;
+    u32 miscFlags2;
+};
+
+static_assert(sizeof(DDSHeader) == 124, "DDS header layout");
+static_assert(sizeof(DDSHeaderDX10) == 20, "DDS DX10 header layout");
+
+#define DDS_DATA_OFFSET (sizeof(u32) + sizeof(DDSHeader) + sizeof(DDSHeaderDX10))
+
+static const u32 dxgiFormats[TextureCodec_Count] = { 0, 71, 80, 83, 98 };   // BC1, BC4, BC5, BC7 UNORM
+
+std::string GetTextureCachePath(const std::string& sourcePath, u64 sourceHash)
+{
+    u32 version = TEXTURE_CACHE_VERSION;
+    u64 key = HashBytes(sourceHash, &version, sizeof(version));
+
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s_%016llx.dds",
+        std::filesystem::path(sourcePath).stem().string().c_str(), (unsigned long long)key);
+
+    return (std::filesystem::path(MESH_CACHE_DIRECTORY) / filename).string();
+}
+
+bool ReadTextureCache(const std::string& cachePath, u64 sourceHash, CompressedImage& compressed)
+{
+    MappedFile file;
+    if (!MapFile(cachePath.c_str(), file)) {
+        return false;
+    }
+
+    const DDSHeader* header = (const DDSHeader*)(file.data + sizeof(u32));
+    const DDSHeaderDX10* header10 = (const DDSHeaderDX10*)(file.data + sizeof(u32) + sizeof(DDSHeader));
+
+    bool valid = file.size >= DDS_DATA_OFFSET &&
+        *(const u32*)file.data == DDS_MAGIC &&
+        header->size == sizeof(DDSHeader) &&
+        header->pixelFormat.fourCC == DDS_FOURCC_DX10 &&
+        header->reserved1[0] == TEXTURE_CACHE_VERSION &&
+        header->reserved1[1] == (u32)sourceHash &&
+        header->reserved1[2] == (u32)(sourceHash >> 32) &&
+        header->mipMapCount >= 1 && header->mipMapCount <= TEXTURE_CACHE_MAX_MIPS &&
+        header->width > 0 && header->height > 0;
+
+    TextureCodec codec = TextureCodec_None;
+    for (u32 i = 1; valid && i < TextureCodec_Count; ++i) {
+        if (dxgiFormats[i] == header10->dxgiFormat) codec = (TextureCodec)i;
+    }
+    // A cache written on a machine with S3TC can not be sampled without it
+    valid = valid && codec != TextureCodec_None && (codec != TextureCodec_BC1 || GLExt.textureCompressionS3TC);
+
+    if (!valid) {
+        ELOG("Ignoring invalid texture cache %s", cachePath.c_str());
+        UnmapFile(file);
+        return false;
+    }
+
+    compressed.codec = codec;
+    compressed.mips.clear();
+
+    u32 blockSize = GetBlockSize(codec);
+    u32 width = header->width;
+    u32 height = header->height;
+    u64 offset = 0;
+    for (u32 level = 0; level < header->mipMapCount; ++level) {
+        CompressedMip mip;
+        mip.width = width;
+        mip.height = height;
+        mip.offset = offset;
+        mip.size = (u64)((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+        compressed.mips.push_back(mip);
+
+        offset += mip.size;
+        width = glm::max(width / 2, 1u);
+        height = glm::max(height / 2, 1u);
+    }
+
+    if (DDS_DATA_OFFSET + offset > file.size) {
+        ELOG("Truncated texture cache %s", cachePath.c_str());
+        UnmapFile(file);
+        return false;
+    }
+
+    compressed.data = file.data + DDS_DATA_OFFSET;
+    compressed.size = offset;
+    compressed.file = file;
+    return true;
+}
+
+bool WriteTextureCache(const std::string& cachePath, const CompressedImage& compressed, u64 sourceHash)
+{
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(cachePath).parent_path(), error);
+
+    const CompressedMip& top = compressed.mips[0];
+
+    DDSHeader header = {};
+    header.size = sizeof(DDSHeader);
+    header.flags = DDSD_REQUIRED_FLAGS | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.width = top.width;
+    header.height = top.height;
+    header.pitchOrLinearSize = (u32)top.size;
+    header.mipMapCount = (u32)compressed.mips.size();
+    header.reserved1[0] = TEXTURE_CACHE_VERSION;
+    header.reserved1[1] = (u32)sourceHash;
+    header.reserved1[2] = (u32)(sourceHash >> 32);
+    header.pixelFormat.size = sizeof(DDSPixelFormat);
+    header.pixelFormat.flags = DDPF_FOURCC;
+    header.pixelFormat.fourCC = DDS_FOURCC_DX10;
+    header.caps[0] = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+
+    DDSHeaderDX10 header10 = {};
+    header10.dxgiFormat = dxgiFormats[compressed.codec];
+    header10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+    header10.arraySize = 1;
+
+    FILE* file = fopen(cachePath.c_str(), "wb");
+    if (!file) {
+        ELOG("Could not write texture cache %s", cachePath.c_str());
+        return false;
+    }
+
+    u32 magic = DDS_MAGIC;
+    fwrite(&magic, sizeof(magic), 1, file);
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(&header10, sizeof(header10), 1, file);
+    fwrite(compressed.data, 1, (size_t)compressed.size, file);
+
+    bool ok = ferror(file) == 0;
+    fclose(file);
+
+    if (!ok) {
+        ELOG("Error writing texture cache %s", cachePath.c_str());
+        std::filesystem::remove(cachePath, error);
+        return false;
+    }
+
+    ILOG("Texture cache written to %s (%s)", cachePath.c_str(), GetTextureCodecName(compressed.codec));
+    return true;
+}
+
+#pragma endregion
@@ -0,0 +1,79 @@
+// texture_compression.h
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+
+struct DecodedImage;
+class JobSystem;
+
+#define TEXTURE_CACHE_VERSION   1           // Bump when the encoders or the mip generation change
+#define TEXTURE_CACHE_MAX_MIPS  16
+
+enum TextureCodec
+{
+    TextureCodec_None,      // Uploaded as decoded, mips generated by the driver
+    TextureCodec_BC1,       // Opaque color, 4 bpp
+    TextureCodec_BC4,       // Single channel (metallic, roughness, height), 4 bpp
+    TextureCodec_BC5,       // Two channels (tangent space normal XY, Z rebuilt in the shader), 8 bpp
+    TextureCodec_BC7,       // Color with alpha, 8 bpp
+    TextureCodec_Count
+};
+
+struct CompressedMip {
+    u32 width;
+    u32 height;
+    u64 offset;     // In CompressedImage::data
+    u64 size;
+};
+
+/*
+ * Every mip of a block compressed texture, in GPU layout. The data either lives in memory (just
+ * encoded) or in the mapped cache file.
+ */
+struct CompressedImage {
+    TextureCodec codec = TextureCodec_None;
+    std::vector<CompressedMip> mips;
+
+    const u8* data = NULL;
+    u64 size = 0;
+
+    std::vector<u8> storage;
+    MappedFile file = {};
+
+    ~CompressedImage();
+};
+
+const char* GetTextureCodecName(TextureCodec codec);
+
+GLenum GetTextureCodecFormat(TextureCodec codec);
+
+/**
+ * Picks the codec from the texture role, which is guessed from the file name the same way the
+ * loaders look textures up ("_Normal", "_Roughness", "_disp"...). Color maps use BC1 unless
+ * some pixel is not opaque, or BC7 without S3TC support (BC4, BC5 and BC7 are core formats).
+ * Never returns TextureCodec_None.
+ */
+TextureCodec ChooseTextureCodec(const std::string& name, const DecodedImage& image);
+
+// Some pixel of a 2 or 4 component image has alpha below 255
+bool HasTranslucentPixels(const DecodedImage& image);
+
+/**
+ * Builds the mip chain with a box filter and encodes every level. CPU only, runs on the asset workers.
+ * With jobs, the block rows of each level are shared with the other workers.
+ */
+void CompressImage(const DecodedImage& image, TextureCodec codec, CompressedImage& compressed, JobSystem* jobs = NULL);
+
+/**
+ * The cache is a DDS file (DX10 header) so it can be inspected with the usual tools. The source hash
+ * and the cache version are stored in the reserved words of the header.
+ */
+std::string GetTextureCachePath(const std::string& sourcePath, u64 sourceHash);
+
+bool ReadTextureCache(const std::string& cachePath, u64 sourceHash, CompressedImage& compressed);
+
+bool WriteTextureCache(const std::string& cachePath, const CompressedImage& compressed, u64 sourceHash);
@@ -0,0 +1,135 @@
+// texture_registry.cpp
+#include "texture_registry.h"
+#include "engine.h"
+
+TextureHandle RegisterTexture(TextureRegistry& registry, std::shared_ptr<Texture> texture)
+{
+    TextureHandle handle = (TextureHandle)registry.textures.size();
+    registry.textures.push_back(texture);
+
+    texture->registry = &registry;
+    texture->handle = handle;
+    texture->state = TextureState_Loading;
+    texture->lastUsedFrame = registry.frame;
+
+    registry.byPath[texture->path] = handle;
+    registry.byName.emplace(texture->name, handle);
+    return handle;
+}
+
+void UnregisterTexture(TextureRegistry& registry, Texture& texture)
+{
+    ASSERT(texture.registry == &registry, "Texture belongs to another registry");
+
+    auto path = registry.byPath.find(texture.path);
+    if (path != registry.byPath.end() && path->second == texture.handle) registry.byPath.erase(path);
+
+    auto name = registry.byName.find(texture.name);
+    if (name != registry.byName.end() && name->second == texture.handle) registry.byName.erase(name);
+
+    if (texture.state == TextureState_Resident) {
+        registry.lru.erase(texture.lruEntry);
+        registry.residentBytes -= texture.bytes;
+    }
+    texture.state = TextureState_Failed;
+
+    // Materials may still hold it, they keep drawing with their color
+    registry.textures[texture.handle] = nullptr;
+}
+
+std::shared_ptr<Texture> FindTextureByPath(const TextureRegistry& registry, const std::string& path)
+{
+    auto it = registry.byPath.find(path);
+    return it != registry.byPath.end() ? registry.textures[it->second] : nullptr;
+}
+
+std::shared_ptr<Texture> FindTextureByName(const TextureRegistry& registry, const std::string& name)
+{
+    auto it = registry.byName.find(name);
+    return it != registry.byName.end() ? registry.textures[it->second] : nullptr;
+}
+
+void MarkTextureResident(TextureRegistry& registry, Texture& texture, u32 glTexture, u64 bytes)
+{
+    texture.id = glTexture;
+    texture.bytes = bytes;
+    texture.state = TextureState_Resident;
+    texture.lastUsedFrame = registry.frame;
+
+    registry.lru.push_front(&texture);
+    texture.lruEntry = registry.lru.begin();
+    registry.residentBytes += bytes;
+}
+
+void TouchTexture(Texture& texture)
+{
+    TextureRegistry* registry = texture.registry;
+    if (!registry || texture.lastUsedFrame == registry->frame) return;
+    texture.lastUsedFrame = registry->frame;
+
+    if (texture.state == TextureState_Resident) {
+        registry->lru.splice(registry->lru.begin(), registry->lru, texture.lruEntry);
+    }
+    else if (texture.state == TextureState_Evicted) {
+        texture.state = TextureState_Loading;
+        registry->reloadRequests.push_back(texture.handle);
+    }
+}
+
+static void EvictTexture(TextureRegistry& registry, Texture& texture)
+{
+    // The handle or array layer of the materials buffer goes first
+    if (texture.materialTextures) ReleaseMaterialTexture(*texture.materialTextures, texture);
+    GLState::DeleteTextures(1, &texture.id);
+    texture.id = 0;
+    texture.state = TextureState_Evicted;
+
+    registry.lru.erase(texture.lruEntry);
+    registry.residentBytes -= texture.bytes;
+}
+
+void UpdateTextureRegistry(App* app)
+{
+    TextureRegistry& registry = app->textureRegistry;
+
+    registry.reloadsLastFrame = (u32)registry.reloadRequests.size();
+    for (TextureHandle handle : registry.reloadRequests) {
+        if (registry.textures[handle]) {
+            ReloadTexture(app, registry.textures[handle]);
+        }
+    }
+    registry.reloadRequests.clear();
+
+    registry.evictionsLastFrame = 0;
+    // The texture arrays hold copies of the resident textures, and shrink as their layers are released
+    u64 budget = (u64)(registry.budgetMB * MB(1));
+    const MaterialTextures& materialTextures = app->materialTextures;
+    while (registry.residentBytes + materialTextures.arrayBytes > budget && !registry.lru.empty())
+    {
+        Texture* oldest = registry.lru.back();
+        if (oldest->lastUsedFrame >= registry.frame) break;     // Everything left was drawn last frame
+
+        EvictTexture(registry, *oldest);
+        registry.evictionsLastFrame++;
+    }
+
+    registry.frame++;
+}
+
+void ShutdownTextureRegistry(TextureRegistry& registry)
+{
+    for (std::shared_ptr<Texture>& texture : registry.textures) {
+        if (texture && texture->materialTextures) ReleaseMaterialTexture(*texture->materialTextures, *texture);
+        if (texture && texture->id != 0) {
+            GLState::DeleteTextures(1, &texture->id);
+            texture->id = 0;
+        }
+        if (texture) texture->registry = NULL;
+    }
+    registry.textures.clear();
+    registry.byPath.clear();
+    registry.byName.clear();
+    registry.lru.clear();
+    registry.reloadRequests.clear();
+    registry.residentBytes = 0;
+}
@@ -0,0 +1,79 @@
+// texture_registry.h
+#pragma once
+
+#include "platform.h"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct App;
+struct Texture;
+
+#define TEXTURE_VRAM_BUDGET_MB      1024.0f     // Resident texture memory before the least recently used ones are evicted
+#define INVALID_TEXTURE_HANDLE      0xFFFFFFFF
+
+typedef u32 TextureHandle;
+
+enum TextureState
+{
+    TextureState_Loading,       // Decoding or streaming in, id is 0
+    TextureState_Resident,
+    TextureState_Evicted,       // GL texture released, reloaded the next time a material uses it
+    TextureState_Failed
+};
+
+/*
+ * Owns every texture loaded from disk. Handles index the textures array and are never reused,
+ * so materials can keep their shared_ptr across evictions: only the GL texture is released, the
+ * Texture object stays and gets its id back when it is streamed in again.
+ */
+struct TextureRegistry {
+    std::vector<std::shared_ptr<Texture>> textures;     // Indexed by handle, NULL once unregistered
+    std::unordered_map<std::string, TextureHandle> byPath;
+    std::unordered_map<std::string, TextureHandle> byName;
+
+    std::list<Texture*> lru;                    // Resident textures, most recently used first
+    std::vector<TextureHandle> reloadRequests;  // Evicted textures used again this frame
+
+    u64 residentBytes = 0;
+    f32 budgetMB = TEXTURE_VRAM_BUDGET_MB;
+    u64 frame = 0;
+
+    u32 evictionsLastFrame = 0;
+    u32 reloadsLastFrame = 0;
+};
+
+TextureHandle RegisterTexture(TextureRegistry& registry, std::shared_ptr<Texture> texture);
+
+// Drops the path and name entries, e.g. when the file can not be decoded. The handle is not reused.
+void UnregisterTexture(TextureRegistry& registry, Texture& texture);
+
+std::shared_ptr<Texture> FindTextureByPath(const TextureRegistry& registry, const std::string& path);
+
+// Names are the file stems; if two files share one, the first registered wins
+std::shared_ptr<Texture> FindTextureByName(const TextureRegistry& registry, const std::string& name);
+
+/**
+ * Called by the streamer once the upload is resident: patches the id in and accounts its memory.
+ */
+void MarkTextureResident(TextureRegistry& registry, Texture& texture, u32 glTexture, u64 bytes);
+
+/**
+ * Marks the texture as used this frame. An evicted texture is queued to be streamed in again.
+ */
+void TouchTexture(Texture& texture);
+
+/**
+ * Once per frame: starts the reloads requested by TouchTexture, then evicts the least recently
+ * used textures until the resident memory fits the budget. Textures used in the last frame are
+ * never evicted, so a budget smaller than the visible set does not reload them every frame.
+ */
+void UpdateTextureRegistry(App* app);
+
+/**
+ * Releases every GL texture. Must run before the GL context is destroyed.
+ */
+void ShutdownTextureRegistry(TextureRegistry& registry);
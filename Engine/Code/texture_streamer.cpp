@@ -0,0 +1,287 @@
+// texture_streamer.cpp
+#include "texture_streamer.h"
+#include "engine.h"
+#include "gl_error.h"
+#include "gl_extensions.h"
+#include "texture_compression.h"
+
+DecodedImage::~DecodedImage()
+{
+    if (pixels) stbi_image_free(pixels);
+}
+
+void InitTextureStreamer(TextureStreamer& streamer)
+{
+    streamer.capacity = TEXTURE_STREAM_RING_SIZE;
+    streamer.head = 0;
+
+    GL_CHECK(glGenBuffers(1, &streamer.pbo));
+    GL_CHECK(GLState::BindBuffer(GL_PIXEL_UNPACK_BUFFER, streamer.pbo));
+
+    if (GLExt.bufferStorage) {
+        // Mapped once for the whole run, the fences keep the CPU from overwriting what the GPU still reads
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GL_CHECK(GLExt.BufferStorage(GL_PIXEL_UNPACK_BUFFER, streamer.capacity, NULL, flags));
+        streamer.mappedRing = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, streamer.capacity, flags);
+    }
+    else {
+        GL_CHECK(glBufferData(GL_PIXEL_UNPACK_BUFFER, streamer.capacity, NULL, GL_STREAM_DRAW));
+    }
+
+    GL_CHECK(GLState::BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+    streamer.initialized = true;
+
+    ILOG("Texture streaming ring: %llu MB, %s", (unsigned long long)(streamer.capacity / MB(1)),
+        streamer.mappedRing ? "persistent mapped" : "mapped per upload");
+}
+
+void ShutdownTextureStreamer(TextureStreamer& streamer)
+{
+    if (!streamer.initialized) return;
+
+    for (StreamRegion& region : streamer.inFlight) {
+        glDeleteSync(region.fence);
+        if (region.completedTexture) GLState::DeleteTextures(1, &region.completedId);
+    }
+    for (StreamingTexture& pending : streamer.queue) {
+        if (pending.glTexture) GLState::DeleteTextures(1, &pending.glTexture);
+    }
+    streamer.inFlight.clear();
+    streamer.queue.clear();
+
+    GLState::BindBuffer(GL_PIXEL_UNPACK_BUFFER, streamer.pbo);
+    if (streamer.mappedRing) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    GLState::BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    GLState::DeleteBuffers(1, &streamer.pbo);
+
+    streamer = TextureStreamer();
+}
+
+void QueueTextureUpload(TextureStreamer& streamer, std::shared_ptr<Texture> texture, std::shared_ptr<DecodedImage> image)
+{
+    StreamingTexture pending;
+    pending.texture = texture;
+    pending.image = image;
+    streamer.queue.push_back(pending);
+}
+
+void QueueTextureUpload(TextureStreamer& streamer, std::shared_ptr<Texture> texture, std::shared_ptr<CompressedImage> compressed)
+{
+    StreamingTexture pending;
+    pending.texture = texture;
+    pending.compressed = compressed;
+    streamer.queue.push_back(pending);
+}
+
+static void GetImageFormat(int components, GLenum& internalFormat, GLenum& format)
+{
+    switch (components) {
+    case 1:  internalFormat = GL_R8;    format = GL_RED;  break;
+    case 2:  internalFormat = GL_RG8;   format = GL_RG;   break;
+    case 3:  internalFormat = GL_RGB8;  format = GL_RGB;  break;
+    default: internalFormat = GL_RGBA8; format = GL_RGBA; break;
+    }
+}
+
+static void RetireFinishedRegions(App* app, TextureStreamer& streamer)
+{
+    while (!streamer.inFlight.empty())
+    {
+        StreamRegion& region = streamer.inFlight.front();
+        GLenum status = glClientWaitSync(region.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+        glDeleteSync(region.fence);
+
+        if (region.completedTexture) {
+            MarkTextureResident(app->textureRegistry, *region.completedTexture, region.completedId, region.completedBytes);
+            if (app->enableDebugGroups) {
+                glObjectLabel(GL_TEXTURE, region.completedId, -1, region.completedTexture->path.c_str());
+            }
+            app->assetLoader.pendingAssets--;
+        }
+        streamer.inFlight.pop_front();
+    }
+
+    if (streamer.inFlight.empty()) {
+        streamer.head = 0;
+    }
+}
+
+// Contiguous free bytes at the ring head, wrapping to the start when the end is too small
+static u64 AcquireRingSpace(TextureStreamer& streamer, u64 minSize)
+{
+    if (streamer.inFlight.empty()) {
+        streamer.head = 0;
+        return streamer.capacity;
+    }
+
+    u64 tail = streamer.inFlight.front().offset;
+    if (streamer.head > tail) {
+        if (streamer.capacity - streamer.head >= minSize) return streamer.capacity - streamer.head;
+        if (tail < minSize) return 0;
+        streamer.head = 0;
+        return tail;
+    }
+    if (streamer.head < tail) {
+        return tail - streamer.head;
+    }
+    return 0; // head == tail: full
+}
+
+// Mip level of a queued texture, as the rows the streamer copies: pixel rows, or rows of 4x4 blocks if compressed
+struct UploadLevel {
+    const u8* data;
+    u32 width;
+    u32 height;
+    u32 rowCount;
+    u32 rowHeight;
+    u64 rowSize;
+};
+
+static UploadLevel GetUploadLevel(const StreamingTexture& pending)
+{
+    UploadLevel level;
+    if (pending.compressed) {
+        const CompressedMip& mip = pending.compressed->mips[pending.level];
+        level.data = pending.compressed->data + mip.offset;
+        level.width = mip.width;
+        level.height = mip.height;
+        level.rowHeight = 4;
+        level.rowCount = (mip.height + 3) / 4;
+        level.rowSize = mip.size / level.rowCount;
+    }
+    else {
+        const DecodedImage& image = *pending.image;
+        level.data = image.pixels;
+        level.width = (u32)image.width;
+        level.height = (u32)image.height;
+        level.rowHeight = 1;
+        level.rowCount = (u32)image.height;
+        level.rowSize = (u64)image.width * image.components;
+    }
+    return level;
+}
+
+static void CreateStreamingTexture(StreamingTexture& pending)
+{
+    GLenum internalFormat, format;
+    GLsizei levels;
+    if (pending.compressed) {
+        internalFormat = GetTextureCodecFormat(pending.compressed->codec);
+        levels = (GLsizei)pending.compressed->mips.size();
+    }
+    else {
+        GetImageFormat(pending.image->components, internalFormat, format);
+        levels = 1 + (GLsizei)floor(log2((f32)glm::max(pending.image->width, pending.image->height)));
+    }
+
+    u32 width = pending.compressed ? pending.compressed->mips[0].width : (u32)pending.image->width;
+    u32 height = pending.compressed ? pending.compressed->mips[0].height : (u32)pending.image->height;
+
+    glGenTextures(1, &pending.glTexture);
+    GLState::BindTexture(GL_TEXTURE_2D, pending.glTexture);
+    glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+void UpdateTextureStreaming(App* app, f32 budgetMB)
+{
+    TextureStreamer& streamer = app->assetLoader.textures;
+    if (!streamer.initialized) return;
+
+    RetireFinishedRegions(app, streamer);
+
+    u64 budget = (u64)(budgetMB * MB(1));
+    u64 uploaded = 0;
+
+    GLState::BindBuffer(GL_PIXEL_UNPACK_BUFFER, streamer.pbo);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    while (!streamer.queue.empty() && uploaded < budget)
+    {
+        StreamingTexture& pending = streamer.queue.front();
+        UploadLevel level = GetUploadLevel(pending);
+
+        u64 space = AcquireRingSpace(streamer, level.rowSize);
+        if (space < level.rowSize) break;   // The GPU still reads the whole ring, continue next frame
+
+        // At least one row per frame, so a budget smaller than a row still makes progress
+        u64 bytes = glm::min(space, glm::max(budget - uploaded, level.rowSize));
+        u32 rows = glm::min((u32)(bytes / level.rowSize), level.rowCount - pending.uploadedRows);
+        u64 chunkSize = rows * level.rowSize;
+
+        if (pending.glTexture == 0) {
+            CreateStreamingTexture(pending);
+        }
+
+        const u8* src = level.data + pending.uploadedRows * level.rowSize;
+        if (streamer.mappedRing) {
+            memcpy(streamer.mappedRing + streamer.head, src, chunkSize);
+        }
+        else {
+            void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, streamer.head, chunkSize,
+                GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+            memcpy(dst, src, chunkSize);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+
+        u32 y = pending.uploadedRows * level.rowHeight;
+        u32 height = glm::min(rows * level.rowHeight, level.height - y);
+        const void* offset = (const void*)(uintptr_t)streamer.head;
+
+        GLState::BindTexture(GL_TEXTURE_2D, pending.glTexture);
+        if (pending.compressed) {
+            GLenum internalFormat = GetTextureCodecFormat(pending.compressed->codec);
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, pending.level, 0, y, level.width, height, internalFormat, (GLsizei)chunkSize, offset);
+        }
+        else {
+            GLenum internalFormat, format;
+            GetImageFormat(pending.image->components, internalFormat, format);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, level.width, height, format, GL_UNSIGNED_BYTE, offset);
+        }
+        pending.uploadedRows += rows;
+
+        StreamRegion region = {};
+        region.offset = streamer.head;
+        region.size = chunkSize;
+
+        bool finished = false;
+        if (pending.uploadedRows == level.rowCount) {
+            if (pending.compressed && pending.level + 1 < pending.compressed->mips.size()) {
+                pending.level++;
+                pending.uploadedRows = 0;
+            }
+            else {
+                finished = true;
+            }
+        }
+
+        if (finished) {
+            if (!pending.compressed) glGenerateMipmap(GL_TEXTURE_2D);
+            region.completedTexture = pending.texture;
+            region.completedId = pending.glTexture;
+            region.completedBytes = pending.compressed ? pending.compressed->size :
+                (u64)pending.image->width * pending.image->height * pending.image->components * 4 / 3;
+        }
+
+        region.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        streamer.inFlight.push_back(region);
+        streamer.head += chunkSize;
+        uploaded += chunkSize;
+
+        if (finished) {
+            streamer.queue.pop_front();
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    GLState::BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+
+    streamer.uploadedBytesLastFrame = uploaded;
+}
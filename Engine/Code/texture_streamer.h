@@ -0,0 +1,80 @@
+// texture_streamer.h
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+#include <deque>
+#include <memory>
+
+struct App;
+struct Texture;
+struct CompressedImage;
+
+#define TEXTURE_STREAM_RING_SIZE    MB(32)  // Pixel unpack buffer shared by every texture upload
+#define TEXTURE_STREAM_BUDGET_MB    16.0f   // Pixels copied to the ring per frame
+
+struct DecodedImage {
+    u8* pixels = NULL;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+
+    ~DecodedImage();
+};
+
+/*
+ * Texture waiting for (or halfway through) its upload. Big images are split in row chunks over several frames.
+ * Decoded images upload level 0 and let the driver build the mips, compressed ones upload every level
+ * in rows of 4x4 blocks.
+ */
+struct StreamingTexture {
+    std::shared_ptr<Texture> texture;
+    std::shared_ptr<DecodedImage> image;
+    std::shared_ptr<CompressedImage> compressed;
+    GLuint glTexture = 0;
+    u32 level = 0;
+    u32 uploadedRows = 0;
+};
+
+// Part of the ring read by the GPU until its fence signals
+struct StreamRegion {
+    u64 offset;
+    u64 size;
+    GLsync fence;
+    std::shared_ptr<Texture> completedTexture;  // Set on the last chunk, patched in once the fence signals
+    GLuint completedId;
+    u64 completedBytes;     // Including the mip chain, for the registry budget
+};
+
+struct TextureStreamer {
+    GLuint pbo = 0;
+    u8* mappedRing = NULL;      // Persistent mapping, NULL when glBufferStorage is not available
+    u64 capacity = 0;
+    u64 head = 0;
+
+    std::deque<StreamRegion> inFlight;
+    std::deque<StreamingTexture> queue;
+
+    f32 budgetMB = TEXTURE_STREAM_BUDGET_MB;
+    u64 uploadedBytesLastFrame = 0;
+    bool initialized = false;
+};
+
+void InitTextureStreamer(TextureStreamer& streamer);
+
+void ShutdownTextureStreamer(TextureStreamer& streamer);
+
+/**
+ * Queues a decoded image. The texture keeps id 0 (its material falls back to the color)
+ * until every mip is resident on the GPU.
+ */
+void QueueTextureUpload(TextureStreamer& streamer, std::shared_ptr<Texture> texture, std::shared_ptr<DecodedImage> image);
+
+void QueueTextureUpload(TextureStreamer& streamer, std::shared_ptr<Texture> texture, std::shared_ptr<CompressedImage> compressed);
+
+/**
+ * Patches the textures whose uploads finished on the GPU, then copies up to budgetMB of
+ * queued pixels into the ring and issues their uploads. Never waits for the GPU.
+ */
+void UpdateTextureStreaming(App* app, f32 budgetMB);
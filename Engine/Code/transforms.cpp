@@ -0,0 +1,183 @@
+// transforms.cpp
+#include "transforms.h"
+
+#include <xmmintrin.h>
+#include <algorithm>
+#include <math.h>
+
+u32 AddTransform(TransformStorage& transforms, const glm::vec3& position, const glm::vec3& rotation, const glm::vec3& scale)
+{
+    u32 index = (u32)transforms.dirty.size();
+    transforms.positionX.push_back(position.x);
+    transforms.positionY.push_back(position.y);
+    transforms.positionZ.push_back(position.z);
+    transforms.rotationX.push_back(rotation.x);
+    transforms.rotationY.push_back(rotation.y);
+    transforms.rotationZ.push_back(rotation.z);
+    transforms.scaleX.push_back(scale.x);
+    transforms.scaleY.push_back(scale.y);
+    transforms.scaleZ.push_back(scale.z);
+
+    transforms.dirty.push_back(0);
+    transforms.modelMatrices.push_back(glm::mat4(1.0f));
+    transforms.gpuTransforms.push_back(GpuTransform());
+    MarkTransformDirty(transforms, index);
+    return index;
+}
+
+void TruncateTransforms(TransformStorage& transforms, u32 count)
+{
+    if (count >= (u32)transforms.dirty.size()) return;
+
+    for (std::vector<f32>* array : { &transforms.positionX, &transforms.positionY, &transforms.positionZ,
+        &transforms.rotationX, &transforms.rotationY, &transforms.rotationZ,
+        &transforms.scaleX, &transforms.scaleY, &transforms.scaleZ }) {
+        array->resize(count);
+    }
+    transforms.dirty.resize(count);
+    transforms.modelMatrices.resize(count);
+    transforms.gpuTransforms.resize(count);
+
+    std::vector<u32>& dirtyIndices = transforms.dirtyIndices;
+    dirtyIndices.erase(std::remove_if(dirtyIndices.begin(), dirtyIndices.end(), [count](u32 index) { return index >= count; }),
+        dirtyIndices.end());
+}
+
+glm::vec3 GetTransformPosition(const TransformStorage& transforms, u32 index)
+{
+    return glm::vec3(transforms.positionX[index], transforms.positionY[index], transforms.positionZ[index]);
+}
+
+glm::vec3 GetTransformRotation(const TransformStorage& transforms, u32 index)
+{
+    return glm::vec3(transforms.rotationX[index], transforms.rotationY[index], transforms.rotationZ[index]);
+}
+
+glm::vec3 GetTransformScale(const TransformStorage& transforms, u32 index)
+{
+    return glm::vec3(transforms.scaleX[index], transforms.scaleY[index], transforms.scaleZ[index]);
+}
+
+static void SetComponents(TransformStorage& transforms, u32 index, const glm::vec3& value,
+    std::vector<f32>& x, std::vector<f32>& y, std::vector<f32>& z)
+{
+    if (x[index] == value.x && y[index] == value.y && z[index] == value.z) return;
+    x[index] = value.x;
+    y[index] = value.y;
+    z[index] = value.z;
+    MarkTransformDirty(transforms, index);
+}
+
+void SetTransformPosition(TransformStorage& transforms, u32 index, const glm::vec3& position)
+{
+    SetComponents(transforms, index, position, transforms.positionX, transforms.positionY, transforms.positionZ);
+}
+
+void SetTransformRotation(TransformStorage& transforms, u32 index, const glm::vec3& rotation)
+{
+    SetComponents(transforms, index, rotation, transforms.rotationX, transforms.rotationY, transforms.rotationZ);
+}
+
+void SetTransformScale(TransformStorage& transforms, u32 index, const glm::vec3& scale)
+{
+    SetComponents(transforms, index, scale, transforms.scaleX, transforms.scaleY, transforms.scaleZ);
+}
+
+void MarkTransformDirty(TransformStorage& transforms, u32 index)
+{
+    if (transforms.dirty[index]) return;
+    transforms.dirty[index] = 1;
+    transforms.dirtyIndices.push_back(index);
+}
+
+void MarkAllTransformsDirty(TransformStorage& transforms)
+{
+    for (u32 i = 0; i < (u32)transforms.dirty.size(); ++i) {
+        MarkTransformDirty(transforms, i);
+    }
+}
+
+#define GATHER4(array, lane) _mm_setr_ps(array[lane[0]], array[lane[1]], array[lane[2]], array[lane[3]])
+
+/*
+ * translate(position) * rotateX * rotateY * rotateZ * scale(scale), as the glm calls it replaces,
+ * and the normal matrix rotation * scale(1 / scale), of up to 4 transforms in the SSE lanes. The
+ * unused lanes repeat the last transform and are not written back.
+ */
+static void ComposeTransforms4(TransformStorage& transforms, const u32* indices, u32 count)
+{
+    u32 lane[4];
+    for (u32 l = 0; l < 4; ++l) {
+        lane[l] = indices[glm::min(l, count - 1)];
+    }
+
+    // SSE has no sine, the angles are the only scalar part
+    f32 sines[3][4], cosines[3][4];
+    for (u32 l = 0; l < 4; ++l) {
+        f32 angles[3] = { transforms.rotationX[lane[l]], transforms.rotationY[lane[l]], transforms.rotationZ[lane[l]] };
+        for (u32 axis = 0; axis < 3; ++axis) {
+            f32 radians = glm::radians(angles[axis]);
+            sines[axis][l] = sinf(radians);
+            cosines[axis][l] = cosf(radians);
+        }
+    }
+    __m128 sx = _mm_loadu_ps(sines[0]), sy = _mm_loadu_ps(sines[1]), sz = _mm_loadu_ps(sines[2]);
+    __m128 cx = _mm_loadu_ps(cosines[0]), cy = _mm_loadu_ps(cosines[1]), cz = _mm_loadu_ps(cosines[2]);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+
+    // Rotation X * Y * Z, [column][row] like glm
+    __m128 sxsy = _mm_mul_ps(sx, sy);
+    __m128 cxsy = _mm_mul_ps(cx, sy);
+    __m128 rotation[3][3];
+    rotation[0][0] = _mm_mul_ps(cy, cz);
+    rotation[0][1] = _mm_add_ps(_mm_mul_ps(sxsy, cz), _mm_mul_ps(cx, sz));
+    rotation[0][2] = _mm_sub_ps(_mm_mul_ps(sx, sz), _mm_mul_ps(cxsy, cz));
+    rotation[1][0] = _mm_sub_ps(zero, _mm_mul_ps(cy, sz));
+    rotation[1][1] = _mm_sub_ps(_mm_mul_ps(cx, cz), _mm_mul_ps(sxsy, sz));
+    rotation[1][2] = _mm_add_ps(_mm_mul_ps(cxsy, sz), _mm_mul_ps(sx, cz));
+    rotation[2][0] = sy;
+    rotation[2][1] = _mm_sub_ps(zero, _mm_mul_ps(sx, cy));
+    rotation[2][2] = _mm_mul_ps(cx, cy);
+
+    __m128 scale[3] = { GATHER4(transforms.scaleX, lane), GATHER4(transforms.scaleY, lane), GATHER4(transforms.scaleZ, lane) };
+
+    // The rotation is orthonormal, so the inverse transpose only inverts the scale
+    f32 model[3][3][4], normal[3][3][4];
+    for (u32 column = 0; column < 3; ++column) {
+        __m128 inverseScale = _mm_div_ps(one, scale[column]);
+        for (u32 row = 0; row < 3; ++row) {
+            _mm_storeu_ps(model[column][row], _mm_mul_ps(rotation[column][row], scale[column]));
+            _mm_storeu_ps(normal[column][row], _mm_mul_ps(rotation[column][row], inverseScale));
+        }
+    }
+
+    for (u32 l = 0; l < count; ++l) {
+        u32 index = lane[l];
+        glm::mat4& modelMat = transforms.modelMatrices[index];
+        GpuTransform& gpuTransform = transforms.gpuTransforms[index];
+        for (u32 column = 0; column < 3; ++column) {
+            modelMat[column] = glm::vec4(model[column][0][l], model[column][1][l], model[column][2][l], 0.0f);
+            gpuTransform.normal[column] = glm::vec4(normal[column][0][l], normal[column][1][l], normal[column][2][l], 0.0f);
+        }
+        modelMat[3] = glm::vec4(transforms.positionX[index], transforms.positionY[index], transforms.positionZ[index], 1.0f);
+        gpuTransform.model = modelMat;
+    }
+}
+
+u32 UpdateTransforms(TransformStorage& transforms)
+{
+    std::vector<u32>& updated = transforms.updated;
+    updated.swap(transforms.dirtyIndices);
+    transforms.dirtyIndices.clear();
+
+    // In order, so the upload merges the neighbours into ranges
+    std::sort(updated.begin(), updated.end());
+    for (u32 index : updated) transforms.dirty[index] = 0;
+
+    u32 count = (u32)updated.size();
+    for (u32 i = 0; i < count; i += 4) {
+        ComposeTransforms4(transforms, &updated[i], glm::min(count - i, 4u));
+    }
+    return count;
+}
@@ -0,0 +1,57 @@
+// transforms.h
+#pragma once
+
+#include "platform.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Per object data of the transforms buffer (std430), the mat3 columns of the normal matrix are vec4 aligned
+struct GpuTransform {
+    glm::mat4 model;
+    glm::vec4 normal[3];        // transpose(inverse(mat3(model)))
+};
+
+/*
+ * Position, rotation and scale of the model instances as a structure of arrays, indexed like
+ * App::models. Setting one marks the transform dirty, and only the dirty ones are composed by the
+ * next update, 4 at a time with SSE, and uploaded.
+ */
+struct TransformStorage {
+    std::vector<f32> positionX, positionY, positionZ;
+    std::vector<f32> rotationX, rotationY, rotationZ;   // Degrees, applied X then Y then Z
+    std::vector<f32> scaleX, scaleY, scaleZ;
+
+    std::vector<u8> dirty;
+    std::vector<u32> dirtyIndices;              // Marked since the last update
+
+    std::vector<glm::mat4> modelMatrices;       // Of every transform, kept between updates
+    std::vector<GpuTransform> gpuTransforms;
+    std::vector<u32> updated;                   // Composed by the last update, sorted
+};
+
+// Appends a transform, dirty so its matrices are composed by the next update
+u32 AddTransform(TransformStorage& transforms, const glm::vec3& position = glm::vec3(0.0f),
+    const glm::vec3& rotation = glm::vec3(0.0f), const glm::vec3& scale = glm::vec3(1.0f));
+
+// Drops the transforms from count on, e.g. along with the last models
+void TruncateTransforms(TransformStorage& transforms, u32 count);
+
+glm::vec3 GetTransformPosition(const TransformStorage& transforms, u32 index);
+glm::vec3 GetTransformRotation(const TransformStorage& transforms, u32 index);
+glm::vec3 GetTransformScale(const TransformStorage& transforms, u32 index);
+
+// Mark the transform dirty only when the value changes
+void SetTransformPosition(TransformStorage& transforms, u32 index, const glm::vec3& position);
+void SetTransformRotation(TransformStorage& transforms, u32 index, const glm::vec3& rotation);
+void SetTransformScale(TransformStorage& transforms, u32 index, const glm::vec3& scale);
+
+void MarkTransformDirty(TransformStorage& transforms, u32 index);
+
+void MarkAllTransformsDirty(TransformStorage& transforms);
+
+/**
+ * Composes the model and normal matrices of the dirty transforms, lists them in
+ * transforms.updated and clears their flags. Returns how many were composed.
+ */
+u32 UpdateTransforms(TransformStorage& transforms);
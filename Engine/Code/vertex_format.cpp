@@ -0,0 +1,85 @@
+// vertex_format.cpp
+#include "vertex_format.h"
+#include "model.h"
+
+#include <glm/gtc/packing.hpp>
+
+static glm::vec2 SignNotZero(glm::vec2 v)
+{
+    return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+glm::vec2 OctahedralEncode(glm::vec3 n)
+{
+    f32 length = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+    if (length == 0.0f) return glm::vec2(0.0f);
+
+    n /= length;
+    glm::vec2 encoded(n.x, n.y);
+    if (n.z < 0.0f) {
+        // Fold the lower hemisphere over the diagonals
+        encoded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * SignNotZero(encoded);
+    }
+    return encoded;
+}
+
+static i16 PackSnorm16(f32 value)
+{
+    return (i16)glm::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+static u32 PackSnorm10(f32 value)
+{
+    return (u32)(i32)glm::round(glm::clamp(value, -1.0f, 1.0f) * 511.0f) & 0x3FF;
+}
+
+static u32 PackTangent(const glm::vec3& tangent, f32 bitangentSign)
+{
+    glm::vec2 octahedral = OctahedralEncode(tangent);
+    u32 w = bitangentSign < 0.0f ? 0x3u : 0x1u;     // -1 and +1 as 2 bit signed
+    return PackSnorm10(octahedral.x) | (PackSnorm10(octahedral.y) << 10) | (w << 30);
+}
+
+void CompactMeshImport(MeshImport& mesh)
+{
+    mesh.format = VertexFormat_Compact;
+    if (mesh.vertexCount == 0) return;
+
+    const glm::vec3& boundsMin = mesh.boundsMin;
+    const glm::vec3& boundsMax = mesh.boundsMax;
+
+    // A flat axis would divide by zero, any scale decodes it back to the offset
+    glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+
+    mesh.compactVertices.resize(mesh.vertexCount);
+    for (u32 i = 0; i < mesh.vertexCount; ++i) {
+        const Vertex& src = mesh.vertexData[i];
+        CompactVertex& dst = mesh.compactVertices[i];
+
+        glm::vec3 position = glm::clamp((src.Position - boundsMin) / extent, 0.0f, 1.0f);
+        dst.position[0] = (u16)glm::round(position.x * 65535.0f);
+        dst.position[1] = (u16)glm::round(position.y * 65535.0f);
+        dst.position[2] = (u16)glm::round(position.z * 65535.0f);
+        dst.position[3] = 0;
+
+        glm::vec2 normal = OctahedralEncode(src.Normal);
+        dst.normal[0] = PackSnorm16(normal.x);
+        dst.normal[1] = PackSnorm16(normal.y);
+
+        // The shader rebuilds the bitangent as cross(normal, tangent) * sign
+        f32 sign = glm::dot(glm::cross(src.Normal, src.Tangent), src.Bitangent) < 0.0f ? -1.0f : 1.0f;
+        dst.tangent = PackTangent(src.Tangent, sign);
+
+        dst.texCoords[0] = glm::packHalf1x16(src.TexCoords.x);
+        dst.texCoords[1] = glm::packHalf1x16(src.TexCoords.y);
+    }
+    mesh.compactVertexData = mesh.compactVertices.data();
+
+    if (mesh.vertexCount < 65536) {
+        mesh.indices16.resize(mesh.indexCount);
+        for (u32 i = 0; i < mesh.indexCount; ++i) {
+            mesh.indices16[i] = (u16)mesh.indexData[i];
+        }
+        mesh.indexData16 = mesh.indices16.data();
+    }
+}
@@ -0,0 +1,39 @@
+// vertex_format.h
+#pragma once
+
+#include "platform.h"
+
+#include <glm/glm.hpp>
+
+struct MeshImport;
+
+enum VertexFormat
+{
+    VertexFormat_Float,     // Vertex, 56 bytes
+    VertexFormat_Compact    // CompactVertex, 20 bytes, 16 bit indices when they fit
+};
+
+/*
+ * Quantized vertex, decoded in the vertex shaders when the compactVertex uniform is set:
+ *   position:  unorm16 within the mesh bounds (positionOffset + position * positionScale)
+ *   normal:    octahedral, snorm16
+ *   tangent:   octahedral in xy, bitangent sign in w (GL_INT_2_10_10_10_REV, z unused)
+ *   texCoords: half floats
+ */
+struct CompactVertex {
+    u16 position[4];    // w is padding
+    i16 normal[2];
+    u32 tangent;
+    u16 texCoords[2];
+};
+
+static_assert(sizeof(CompactVertex) == 20, "CompactVertex layout");
+
+glm::vec2 OctahedralEncode(glm::vec3 n);
+
+/**
+ * Builds the compact vertices (and the 16 bit indices if the mesh has fewer than 65536 vertices)
+ * from the float vertices the import points to, quantizing the positions within mesh.boundsMin/boundsMax.
+ * CPU only, runs on the asset workers.
+ */
+void CompactMeshImport(MeshImport& mesh);
@@ -0,0 +1,365 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef HIZ_DOWNSAMPLE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Each texel keeps the farthest depth of the ones below it
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D uSource;             // The depth buffer, or the pyramid for the levels above the first
+layout(r32f, binding = 0) uniform writeonly image2D uDestination;
+
+uniform int uSourceLevel;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(uDestination);
+    if (any(greaterThanEqual(texel, size))) return;
+
+    // Sizes are rounded down, so the last row and column also take the odd texel left over
+    ivec2 sourceSize = textureSize(uSource, uSourceLevel);
+    ivec2 footprint = ivec2(2);
+    if (texel.x == size.x - 1 && (sourceSize.x & 1) != 0) footprint.x = 3;
+    if (texel.y == size.y - 1 && (sourceSize.y & 1) != 0) footprint.y = 3;
+
+    float depth = 0.0;
+    for (int y = 0; y < footprint.y; ++y) {
+        for (int x = 0; x < footprint.x; ++x) {
+            ivec2 source = min(texel * 2 + ivec2(x, y), sourceSize - 1);
+            depth = max(depth, texelFetch(uSource, source, uSourceLevel).r);
+        }
+    }
+    imageStore(uDestination, texel, vec4(depth));
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Hi-Z test, shared by the culling programs below
+#if defined(COMPUTE) && (defined(HIZ_CULL) || defined(GPU_CULL))
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(binding = 0) uniform sampler2D uPyramid;
+
+uniform mat4 uPyramidViewProjection;   // Of the depth the pyramid was built from
+uniform ivec2 uDepthSize;
+uniform int uLevelCount;
+
+bool IsVisible(vec3 center, vec3 extent)
+{
+    vec2 minUV = vec2(1.0);
+    vec2 maxUV = vec2(0.0);
+    float minDepth = 1.0;
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = center + extent * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = uPyramidViewProjection * vec4(corner, 1.0);
+
+        // Boxes crossing the near plane cannot be projected, they are kept
+        if (clip.w <= 0.0 || clip.z < -clip.w) return true;
+
+        vec3 ndc = clip.xyz / clip.w;
+        minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+        maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+        minDepth = min(minDepth, ndc.z * 0.5 + 0.5);
+    }
+
+    // Rectangle in depth buffer texels. The first level is half of it, and every level halves again.
+    ivec2 texelMin = clamp(ivec2(clamp(minUV, 0.0, 1.0) * vec2(uDepthSize)), ivec2(0), uDepthSize - 1);
+    ivec2 texelMax = clamp(ivec2(clamp(maxUV, 0.0, 1.0) * vec2(uDepthSize)), ivec2(0), uDepthSize - 1);
+    ivec2 span = texelMax - texelMin + 1;
+
+    // The level where the rectangle covers at most 2x2 texels
+    int level = clamp(int(ceil(log2(float(max(span.x, span.y))))) - 1, 0, uLevelCount - 1);
+    ivec2 levelSize = textureSize(uPyramid, level);
+    ivec2 pyramidMin = min(texelMin >> (level + 1), levelSize - 1);
+    ivec2 pyramidMax = min(texelMax >> (level + 1), levelSize - 1);
+
+    float maxDepth = max(max(texelFetch(uPyramid, pyramidMin, level).r, texelFetch(uPyramid, ivec2(pyramidMax.x, pyramidMin.y), level).r),
+        max(texelFetch(uPyramid, ivec2(pyramidMin.x, pyramidMax.y), level).r, texelFetch(uPyramid, pyramidMax, level).r));
+    return minDepth <= maxDepth;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef HIZ_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 64) in;
+
+struct OcclusionInstance {
+    vec3 center;
+    uint firstCommand;
+    vec3 extent;
+    uint commandCount;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {
+    OcclusionInstance instances[];
+};
+
+layout(std430, binding = 1) buffer EarlyCommands {
+    DrawCommand earlyCommands[];
+};
+
+layout(std430, binding = 2) buffer LateCommands {
+    DrawCommand lateCommands[];
+};
+
+layout(std430, binding = 3) buffer Stats {
+    uint earlyVisible;
+    uint lateVisible;
+    uint occluded;
+};
+
+uniform int uInstanceCount;
+uniform int uPhase;             // 0 early, 1 late
+uniform bool uPyramidValid;
+
+void main()
+{
+    int index = int(gl_GlobalInvocationID.x);
+    if (index >= uInstanceCount) return;
+
+    OcclusionInstance instance = instances[index];
+    uint first = instance.firstCommand;
+    uint last = first + instance.commandCount;
+
+    if (uPhase == 0) {
+        // Drawn now if it was visible in the last frame, otherwise left to the late phase
+        bool visible = !uPyramidValid || IsVisible(instance.center, instance.extent);
+        for (uint c = first; c < last; ++c) {
+            DrawCommand command = earlyCommands[c];
+            lateCommands[c] = command;
+            if (visible) lateCommands[c].instanceCount = 0;
+            else earlyCommands[c].instanceCount = 0;
+        }
+        if (visible) atomicAdd(earlyVisible, 1u);
+        return;
+    }
+
+    // Only the ones the early phase left out, against the depth drawn by it
+    if (lateCommands[first].instanceCount == 0) return;
+
+    if (IsVisible(instance.center, instance.extent)) {
+        atomicAdd(lateVisible, 1u);
+        return;
+    }
+    for (uint c = first; c < last; ++c) {
+        lateCommands[c].instanceCount = 0;
+    }
+    atomicAdd(occluded, 1u);
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef GPU_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One thread per meshlet of the largest LOD of every mesh, see gpu_culling.h
+layout(local_size_x = 64) in;
+
+struct GpuMeshlet {
+    vec4 sphere;        // Model space center and radius
+    vec4 cone;          // Axis and cutoff, a cutoff of 1 never culls
+    uint indexOffset;   // In the geometry arena
+    uint indexCount;
+    uint pad0;
+    uint pad1;
+};
+
+struct GpuCullInstance {
+    vec4 boundsSphere;      // Model space, for the LOD selection
+    uint firstThread;
+    uint threadCount;
+    uint firstLod;
+    uint lodCount;
+    uint commandOffset;     // First command of the draw batch
+    uint drawCountIndex;    // Draw batch
+    uint baseVertex;
+    uint drawId;
+    uint transformIndex;
+    uint materialIndex;
+    uint pad0;
+    uint pad1;
+};
+
+// See GpuTransform in transforms.h
+struct ObjectTransform {
+    mat4 model;
+    mat3 normal;
+};
+
+layout(std430, binding = 0) readonly buffer Meshlets {
+    GpuMeshlet meshlets[];
+};
+
+layout(std430, binding = 1) readonly buffer Instances {
+    GpuCullInstance instances[];
+};
+
+layout(std430, binding = 2) writeonly buffer Commands {
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 3) buffer DrawCounts {
+    uint drawCounts[];      // One per draw batch, read by glMultiDrawElementsIndirectCount
+};
+
+layout(std430, binding = 4) buffer Stats {
+    uint visibleMeshlets;
+    uint visibleMeshes;     // With at least one visible meshlet
+    uint meshes;            // Written by the CPU
+    uint testedMeshlets;    // Of the selected levels
+    uint visibleMaterials;
+    uint materialWords[];   // A flag per material, cleared before the dispatch, then the list of the visible ones
+};
+
+layout(std430, binding = 5) buffer MeshVisible {
+    uint meshVisible[];     // One per instance, cleared before the dispatch
+};
+
+layout(std430, binding = 6) readonly buffer Transforms {
+    ObjectTransform transforms[];
+};
+
+layout(std430, binding = 7) readonly buffer LodRanges {
+    uvec2 lodRanges[];      // First meshlet and meshlet count
+};
+
+layout(std430, binding = 8) readonly buffer LastLods {
+    uint lastLods[];        // Selected last frame
+};
+
+layout(std430, binding = 9) writeonly buffer Lods {
+    uint lods[];
+};
+
+uniform vec4 uFrustum[6];   // World space, normalized
+uniform int uInstanceCount;
+uniform uint uThreadCount;
+uniform bool uOcclusion;    // Against the pyramid of the last frame
+uniform vec3 uCameraPosition;
+uniform bool uBackface;
+uniform int uOnlyTransform; // Negative culls in every instance
+uniform float uProjectionScale;
+uniform float uLodThreshold;    // Size below which LOD1 is used, halved per level
+uniform float uLodHysteresis;
+uniform int uForcedLod;
+uniform uint uMaterialCount;
+
+uint LodForSize(float size, uint lodCount)
+{
+    uint lod = 0u;
+    float threshold = uLodThreshold;
+    while (lod + 1u < lodCount && size < threshold) {
+        lod++;
+        threshold *= 0.5;
+    }
+    return lod;
+}
+
+// Same as SelectMeshLod in mesh_lod.cpp
+uint SelectLod(GpuCullInstance instance, uint lastLod, vec3 center, float radius)
+{
+    if (uForcedLod >= 0) return min(uint(uForcedLod), instance.lodCount - 1u);
+    if (instance.lodCount <= 1u) return 0u;
+
+    // Diameter over the screen height, the camera inside the sphere always gets LOD0
+    float distance = length(center - uCameraPosition);
+    if (distance <= radius) return 0u;
+    float size = radius * uProjectionScale / distance;
+
+    uint finest = LodForSize(size * (1.0 + uLodHysteresis), instance.lodCount);
+    uint coarsest = LodForSize(size * (1.0 - uLodHysteresis), instance.lodCount);
+    return clamp(lastLod, finest, coarsest);
+}
+
+void main()
+{
+    uint thread = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x + gl_GlobalInvocationID.x;
+    if (thread >= uThreadCount) return;
+
+    // Last instance starting at or before the thread
+    int low = 0;
+    int high = uInstanceCount - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (instances[middle].firstThread <= thread) low = middle;
+        else high = middle - 1;
+    }
+
+    GpuCullInstance instance = instances[low];
+    uint meshletIndex = thread - instance.firstThread;
+    if (uOnlyTransform >= 0 && instance.transformIndex != uint(uOnlyTransform)) {
+        if (meshletIndex == 0u) lods[low] = lastLods[low];
+        return;
+    }
+
+    // Spheres are scaled by the largest axis, so they still contain the mesh
+    ObjectTransform transform = transforms[instance.transformIndex];
+    mat3 linear = mat3(transform.model);
+    float maxScale = max(length(linear[0]), max(length(linear[1]), length(linear[2])));
+
+    // Every thread of the instance selects the same level, the first one keeps it for the next frame
+    vec3 boundsCenter = (transform.model * vec4(instance.boundsSphere.xyz, 1.0)).xyz;
+    uint lod = SelectLod(instance, lastLods[low], boundsCenter, instance.boundsSphere.w * maxScale);
+    uvec2 range = lodRanges[instance.firstLod + lod];
+    if (meshletIndex == 0u) {
+        lods[low] = lod;
+        atomicAdd(testedMeshlets, range.y);
+    }
+    if (meshletIndex >= range.y) return;
+
+    GpuMeshlet meshlet = meshlets[range.x + meshletIndex];
+    vec3 center = (transform.model * vec4(meshlet.sphere.xyz, 1.0)).xyz;
+    float radius = meshlet.sphere.w * maxScale;
+    for (int p = 0; p < 6; ++p) {
+        if (dot(uFrustum[p].xyz, center) + uFrustum[p].w <= -radius) return;
+    }
+
+    // The cone is in model space. The inverse of the normal matrix is its transpose, and a mirrored
+    // model flips the winding, so it is never backface culled
+    if (uBackface && determinant(linear) > 0.0) {
+        vec3 cameraPosition = transpose(transform.normal) * (uCameraPosition - transform.model[3].xyz);
+        vec3 direction = meshlet.sphere.xyz - cameraPosition;
+        if (dot(direction, meshlet.cone.xyz) >= meshlet.cone.w * length(direction) + meshlet.sphere.w) return;
+    }
+
+    if (uOcclusion && !IsVisible(center, vec3(radius))) return;
+
+    uint slot = atomicAdd(drawCounts[instance.drawCountIndex], 1u);
+    commands[instance.commandOffset + slot] = DrawCommand(meshlet.indexCount, 1u, meshlet.indexOffset, int(instance.baseVertex), instance.drawId);
+    atomicAdd(visibleMeshlets, 1u);
+    if (atomicExchange(meshVisible[low], 1u) != 0u) return;
+
+    // Read back by the CPU, which keeps the textures of these materials resident
+    atomicAdd(visibleMeshes, 1u);
+    if (atomicExchange(materialWords[instance.materialIndex], 1u) == 0u) {
+        materialWords[uMaterialCount + atomicAdd(visibleMaterials, 1u)] = instance.materialIndex;
+    }
+}
+
+#endif
+#endif
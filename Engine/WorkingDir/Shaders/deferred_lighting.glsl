@@ -37,16 +37,12 @@ struct Light {      // position.w = range   ||  color.a = intensity
 };
 
 layout(std140, binding = 0) uniform GlobalParams {
+    mat4            uViewProjectionMatrix;
     vec3            uCameraPosition;
     uint            uLightCount;
     Light           uLight[16];
 };
 
-layout(std140, binding = 1) uniform TransformBlock {
-    mat4 uModelMatrix;
-    mat4 uViewProjectionMatrix;
-};
-
 const float PI = 3.14159265359;
 
 // PBR Functions
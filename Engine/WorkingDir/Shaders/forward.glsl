@@ -3,10 +3,12 @@
 ///////////////////////////////////////////////////////////////////////
 #ifdef FORWARD
 
+// Indexed by the material index of the draw data, see GpuMaterial in draw_batches.h (std430)
 struct Mat_Prop {
     vec4 color;
-    bool use_text;
+    bool use_text;      // Enabled and resident
     bool prop_enabled;
+    uvec2 texture;      // Bindless handle, or texture array and layer, see material_textures.h
 };
 
 struct Material {
@@ -35,37 +37,91 @@ struct Light {      // position.w = range   ||  color.a = intensity
     vec4 position;
 };
 
+// Per frame data, declared for both stages as the vertex stage reads the view projection
+layout(std140, binding = 0) uniform GlobalParams {
+    mat4            uViewProjectionMatrix;
+    vec3            uCameraPosition;
+    uint            uLightCount;
+    Light           uLight[16];
+};
+
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
 layout(location=0) in vec3 aPosition;
 layout(location=1) in vec3 aNormal;
 layout(location=2) in vec2 aTexCoord;
-layout(location=3) in vec3 aTangent;
-layout(location=4) in vec3 aBitangent;
+layout(location=3) in vec4 aTangent;      // w: bitangent sign, compact vertices only
+layout(location=4) in vec3 aBitangent;    // Float vertices only
+
+layout(location=5) in uint aDrawId;       // Per instance, the base instance of the command (geometry_arena.h)
+
+// Indexed by the draw id, see draw_batches.h
+struct DrawData {
+    vec3 positionOffset;
+    uint transformIndex;
+    vec3 positionScale;
+    uint materialIndex;
+};
+
+// Indexed by the transform index of the draw data, see GpuTransform in transforms.h
+struct ObjectTransform {
+    mat4 model;
+    mat3 normal;
+};
+
+layout(std430, binding = 0) readonly buffer Transforms {
+    ObjectTransform uTransforms[];
+};
 
-layout(std140, binding = 1) uniform TransformBlock {
-    mat4 uModelMatrix;
-    mat4 uViewProjectionMatrix;
+layout(std430, binding = 1) readonly buffer Draws {
+    DrawData uDraws[];
 };
 
 out vec2 vTexCoord;
 out vec3 vNormal;
 out vec3 vFragPos;
 out mat3 vTBN;
+flat out uint vMaterialIndex;
+
+// Compact vertices (see vertex_format.h): quantized positions and octahedral normal/tangent
+uniform bool compactVertex;
+
+vec3 OctahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
 
 void main()
 {
+    DrawData draw = uDraws[aDrawId];
+    ObjectTransform transform = uTransforms[draw.transformIndex];
+    mat4 modelMatrix = transform.model;
+
+    vec3 position = draw.positionOffset + aPosition * draw.positionScale;
+    vec3 normal = aNormal;
+    vec3 tangent = aTangent.xyz;
+    vec3 bitangent = aBitangent;
+    if (compactVertex) {
+        normal = OctahedralDecode(aNormal.xy);
+        tangent = OctahedralDecode(aTangent.xy);
+        bitangent = cross(normal, tangent) * aTangent.w;
+    }
+
+    vMaterialIndex = draw.materialIndex;
 	vTexCoord = aTexCoord;
-    vNormal = mat3(transpose(inverse(uModelMatrix))) * aNormal;
-    vFragPos = vec3(uModelMatrix * vec4(aPosition, 1.0));
+    vNormal = transform.normal * normal;
+    vFragPos = vec3(modelMatrix * vec4(position, 1.0));
 
     // calculate TBN matrix
-    vec3 T = normalize(vec3(uModelMatrix * vec4(aTangent, 0.0)));
-    vec3 B = normalize(vec3(uModelMatrix * vec4(aBitangent, 0.0)));
-    vec3 N = normalize(vec3(uModelMatrix * vec4(aNormal, 0.0)));
+    vec3 T = normalize(vec3(modelMatrix * vec4(tangent, 0.0)));
+    vec3 B = normalize(vec3(modelMatrix * vec4(bitangent, 0.0)));
+    vec3 N = normalize(vec3(modelMatrix * vec4(normal, 0.0)));
     vTBN = mat3(T, B, N);
 
-    gl_Position = uViewProjectionMatrix * uModelMatrix * vec4(aPosition, 1.0);
+    gl_Position = uViewProjectionMatrix * modelMatrix * vec4(position, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -74,24 +130,72 @@ in vec2 vTexCoord;
 in vec3 vNormal;
 in vec3 vFragPos;
 in mat3 vTBN;
+flat in uint vMaterialIndex;
 
-uniform Material material;
+layout(std430, binding = 2) readonly buffer Materials {
+    Material uMaterials[];
+};
+
+Material material;      // Of the draw, read at the start of main
+
+#define MAT_DIFFUSE     0
+#define MAT_METALLIC    1
+#define MAT_ROUGHNESS   2
+#define MAT_NORMAL      3
+#define MAT_HEIGHT      4
+#define MAT_ALPHA_MASK  5
+
+#if defined(TEXTURE_ARRAYS)
+uniform sampler2DArray uTextureArrays[8];
+#elif !defined(BINDLESS_TEXTURES)
 uniform Mat_Textures mat_textures;
+#endif
+
+// Texture of a material property: from its handle, from its array layer, or bound to the unit of the property.
+// The array switch keeps the sampler index constant, it is only uniform per draw.
+vec4 SampleMaterial(Mat_Prop prop, int property, vec2 texCoords)
+{
+#if defined(BINDLESS_TEXTURES)
+    return texture(sampler2D(prop.texture), texCoords);
+#elif defined(TEXTURE_ARRAYS)
+    vec3 coords = vec3(texCoords, float(prop.texture.y));
+    switch (prop.texture.x) {
+    case 0u: return texture(uTextureArrays[0], coords);
+    case 1u: return texture(uTextureArrays[1], coords);
+    case 2u: return texture(uTextureArrays[2], coords);
+    case 3u: return texture(uTextureArrays[3], coords);
+    case 4u: return texture(uTextureArrays[4], coords);
+    case 5u: return texture(uTextureArrays[5], coords);
+    case 6u: return texture(uTextureArrays[6], coords);
+    default: return texture(uTextureArrays[7], coords);
+    }
+#else
+    switch (property) {
+    case MAT_DIFFUSE: return texture(mat_textures.diffuse, texCoords);
+    case MAT_METALLIC: return texture(mat_textures.metallic, texCoords);
+    case MAT_ROUGHNESS: return texture(mat_textures.roughness, texCoords);
+    case MAT_NORMAL: return texture(mat_textures.normal, texCoords);
+    case MAT_HEIGHT: return texture(mat_textures.height, texCoords);
+    default: return texture(mat_textures.alphaMask, texCoords);
+    }
+#endif
+}
 
 // Parallax mapping settings
 uniform float parallaxScale = 0.1;
 const float numLayers = 20.0;
 
-layout(std140, binding = 0) uniform GlobalParams {
-    vec3            uCameraPosition;
-    uint            uLightCount;
-    Light           uLight[16];
-};
-
 layout(location = 0) out vec4 oColor;
 
 const float PI = 3.14159265359;
 
+// Normal maps can be BC5 compressed (XY only), so Z is rebuilt for every format
+vec3 SampleNormalMap(vec2 texCoords)
+{
+    vec2 xy = SampleMaterial(material.normal, MAT_NORMAL, texCoords).xy * 2.0 - 1.0;
+    return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
+
 // Parallax Occlusion Mapping
 ///////////////////////////////////////////////////////////////////////
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir) 
@@ -103,19 +207,19 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
     vec2 deltaTexCoords = P / numLayers;
     
     vec2 currentTexCoords = texCoords;
-    float currentDepthMapValue = texture(mat_textures.height, currentTexCoords).r;
+    float currentDepthMapValue = SampleMaterial(material.height, MAT_HEIGHT, currentTexCoords).r;
     
     while(currentLayerDepth < currentDepthMapValue)
     {
         currentTexCoords -= deltaTexCoords;
-        currentDepthMapValue = texture(mat_textures.height, currentTexCoords).r;
+        currentDepthMapValue = SampleMaterial(material.height, MAT_HEIGHT, currentTexCoords).r;
         currentLayerDepth += layerDepth;
     }
     
     vec2 prevTexCoords = currentTexCoords + deltaTexCoords;
     
     float afterDepth  = currentDepthMapValue - currentLayerDepth;
-    float beforeDepth = texture(mat_textures.height, prevTexCoords).r - currentLayerDepth + layerDepth;
+    float beforeDepth = SampleMaterial(material.height, MAT_HEIGHT, prevTexCoords).r - currentLayerDepth + layerDepth;
     
     float weight = afterDepth / (afterDepth - beforeDepth);
     vec2 finalTexCoords = prevTexCoords * weight + currentTexCoords * (1.0 - weight);
@@ -205,6 +309,7 @@ vec3 CalculatePointLight(uint index, vec3 albedo, vec3 normal, float metallic, f
 }
 
 void main() {
+    material = uMaterials[vMaterialIndex];
 
     vec2 texCoords = vTexCoord;
     if(material.height.prop_enabled && material.height.use_text) {
@@ -219,13 +324,13 @@ void main() {
     }
 
     // Albedo
-    vec4 texColor = material.diffuse.use_text ? texture(mat_textures.diffuse, texCoords) : material.diffuse.color;
+    vec4 texColor = material.diffuse.use_text ? SampleMaterial(material.diffuse, MAT_DIFFUSE, texCoords) : material.diffuse.color;
     vec3 albedo = texColor.rgb;
     float alpha = texColor.a;
 
     // Alpha Masking
     if (material.alphaMask.prop_enabled) {
-        vec3 maskRGB = material.alphaMask.use_text ? texture(mat_textures.alphaMask, texCoords).rgb : material.alphaMask.color.rgb;
+        vec3 maskRGB = material.alphaMask.use_text ? SampleMaterial(material.alphaMask, MAT_ALPHA_MASK, texCoords).rgb : material.alphaMask.color.rgb;
         float alphaMask = dot(maskRGB, vec3(0.299, 0.587, 0.114));
         alpha = alphaMask;
     }
@@ -233,17 +338,17 @@ void main() {
     // Metallic
     float metallic = 0.0;
     if (material.metallic.prop_enabled) {
-        metallic = material.metallic.use_text ? texture(mat_textures.metallic, texCoords).r : material.metallic.color.r;
+        metallic = material.metallic.use_text ? SampleMaterial(material.metallic, MAT_METALLIC, texCoords).r : material.metallic.color.r;
     }
 
     // Roughness
     float roughness = 0.0;
     if (material.roughness.prop_enabled) {
-        roughness = material.roughness.use_text ? texture(mat_textures.roughness, texCoords).r : material.roughness.color.r;
+        roughness = material.roughness.use_text ? SampleMaterial(material.roughness, MAT_ROUGHNESS, texCoords).r : material.roughness.color.r;
     }
 
     // Normal Mapping
-    vec3 textureNormal = material.normal.use_text ? texture(mat_textures.normal, texCoords).xyz * 2.0 - 1.0 : material.normal.color.xyz * 2.0 - 1.0;
+    vec3 textureNormal = material.normal.use_text ? SampleNormalMap(texCoords) : material.normal.color.xyz * 2.0 - 1.0;
     vec3 normal = normalize(vNormal);
     if (material.normal.prop_enabled) {
         normal = normalize(vTBN * textureNormal);